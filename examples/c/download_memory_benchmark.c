@@ -0,0 +1,168 @@
+/* Benchmark of the memory used by the downloader per target.
+ *
+ * Every target downloads file:///dev/null, so the transfers are cheap and
+ * the numbers show mostly the bookkeeping of the targets. Heap usage is
+ * taken from mallinfo2() (glibc 2.33+).
+ *
+ * Usage: download_memory_benchmark [number_of_targets ...]
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <librepo/librepo.h>
+
+static const int default_numbers_of_targets[] = {10000, 100000};
+
+typedef struct {
+    int fd;
+    int remaining;
+    size_t peak;
+} BenchmarkData;
+
+static size_t
+heap_in_use(void)
+{
+    return mallinfo2().uordblks;
+}
+
+static LrDownloadTarget *
+new_target(int fd)
+{
+    return lr_downloadtarget_new(NULL, "file:///dev/null", NULL, fd, NULL,
+                                 NULL, 0, FALSE, NULL, NULL, NULL, NULL, NULL,
+                                 0, 0, NULL, FALSE, FALSE);
+}
+
+static void
+update_peak(BenchmarkData *data)
+{
+    size_t in_use = heap_in_use();
+    if (in_use > data->peak)
+        data->peak = in_use;
+}
+
+static int
+end_cb(void *clientp,
+       G_GNUC_UNUSED LrTransferStatus status,
+       G_GNUC_UNUSED const char *msg)
+{
+    update_peak(clientp);
+    return LR_CB_OK;
+}
+
+static gboolean
+producer_cb(void *data, LrDownloadTarget **target, G_GNUC_UNUSED GError **err)
+{
+    BenchmarkData *bdata = data;
+    *target = NULL;
+    if (bdata->remaining-- > 0)
+        *target = new_target(bdata->fd);
+    update_peak(bdata);
+    return TRUE;
+}
+
+static gboolean
+release_cb(G_GNUC_UNUSED void *data,
+           LrDownloadTarget *target,
+           G_GNUC_UNUSED GError **err)
+{
+    lr_downloadtarget_free(target);
+    return TRUE;
+}
+
+static gboolean
+benchmark(int fd, int number_of_targets)
+{
+    GSList *targets = NULL;
+    GError *tmp_err = NULL;
+    BenchmarkData data = {fd, 0, 0};
+
+    // All targets passed at once to lr_download()
+
+    size_t base = heap_in_use();
+    for (int x = 0; x < number_of_targets; x++) {
+        LrDownloadTarget *target = new_target(fd);
+        target->cbdata = &data;
+        target->endcb = end_cb;
+        targets = g_slist_prepend(targets, target);
+    }
+    targets = g_slist_reverse(targets);
+    size_t with_targets = heap_in_use();
+    data.peak = with_targets;
+
+    GTimer *timer = g_timer_new();
+    gboolean ret = lr_download(targets, FALSE, &tmp_err);
+    g_timer_stop(timer);
+    g_slist_free_full(targets, (GDestroyNotify) lr_downloadtarget_free);
+
+    if (!ret) {
+        g_printerr("Error encountered: %s\n", tmp_err->message);
+        g_error_free(tmp_err);
+        g_timer_destroy(timer);
+        return FALSE;
+    }
+
+    g_print("Targets: %d\n", number_of_targets);
+    g_print("  LrDownloadTarget:         %6.1f B/target\n",
+            (double) (with_targets - base) / number_of_targets);
+    g_print("  lr_download() state:      %6.1f B/target  Time: %f s\n",
+            (double) (data.peak - with_targets) / number_of_targets,
+            g_timer_elapsed(timer, NULL));
+
+    // Targets pulled on demand by lr_download_lazy()
+
+    base = heap_in_use();
+    data.remaining = number_of_targets;
+    data.peak = base;
+
+    g_timer_start(timer);
+    ret = lr_download_lazy(producer_cb, release_cb, &data, 8, FALSE, &tmp_err);
+    g_timer_stop(timer);
+
+    if (!ret) {
+        g_printerr("Error encountered: %s\n", tmp_err->message);
+        g_error_free(tmp_err);
+        g_timer_destroy(timer);
+        return FALSE;
+    }
+
+    g_print("  lr_download_lazy() total: %6.1f B/target  Time: %f s\n",
+            (double) (data.peak - base) / number_of_targets,
+            g_timer_elapsed(timer, NULL));
+
+    g_timer_destroy(timer);
+    return TRUE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int rc = EXIT_SUCCESS;
+    char tmpfn[] = "/tmp/download_memory_benchmark_XXXXXX";
+
+    int fd = mkstemp(tmpfn);
+    if (fd == -1) {
+        perror("Cannot create a temporary file");
+        return EXIT_FAILURE;
+    }
+    unlink(tmpfn);
+
+    if (argc > 1) {
+        for (int x = 1; x < argc && rc == EXIT_SUCCESS; x++)
+            if (!benchmark(fd, atoi(argv[x])))
+                rc = EXIT_FAILURE;
+    } else {
+        for (size_t x = 0; x < G_N_ELEMENTS(default_numbers_of_targets)
+                           && rc == EXIT_SUCCESS; x++)
+            if (!benchmark(fd, default_numbers_of_targets[x]))
+                rc = EXIT_FAILURE;
+    }
+
+    close(fd);
+    return rc;
+}
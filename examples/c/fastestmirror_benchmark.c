@@ -0,0 +1,120 @@
+/* Benchmark of the fastest mirror detection with many local mirrors.
+ *
+ * Every synthetic mirror is a listening TCP socket on 127.0.0.1, the kernel
+ * completes the handshake from the listen backlog, so no server loop
+ * is needed.
+ *
+ * Usage: fastestmirror_benchmark [number_of_mirrors [max_parallel_probes]]
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <librepo/librepo.h>
+
+#define DEFAULT_NUMBER_OF_MIRRORS   1000
+
+static int
+open_listening_socket(int *port)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;  // Any free port
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+        || listen(fd, 16) == -1
+        || getsockname(fd, (struct sockaddr *) &addr, &addrlen) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int rc = EXIT_SUCCESS;
+    int number_of_mirrors = DEFAULT_NUMBER_OF_MIRRORS;
+    long max_probes = LRO_FASTESTMIRRORMAXPROBES_DEFAULT;
+    GSList *urls = NULL;
+    GSList *mirrors = NULL;
+    GError *tmp_err = NULL;
+
+    if (argc > 1)
+        number_of_mirrors = atoi(argv[1]);
+    if (argc > 2)
+        max_probes = atol(argv[2]);
+
+    // Each mirror needs a listening and a client socket
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    int *fds = g_new0(int, number_of_mirrors);
+    for (int x = 0; x < number_of_mirrors; x++) {
+        int port;
+        fds[x] = open_listening_socket(&port);
+        if (fds[x] == -1) {
+            g_printerr("Cannot create mirror #%d: %s\n", x, g_strerror(errno));
+            number_of_mirrors = x;
+            rc = EXIT_FAILURE;
+            goto cleanup;
+        }
+        urls = g_slist_prepend(urls, g_strdup_printf("http://127.0.0.1:%d/", port));
+    }
+
+    LrHandle *h = lr_handle_init();
+    lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORMAXPROBES, max_probes);
+
+    GTimer *timer = g_timer_new();
+    gboolean ret = lr_fastestmirror_detailed(h, urls, &mirrors, &tmp_err);
+    g_timer_stop(timer);
+
+    if (!ret) {
+        g_printerr("Error encountered: %s\n", tmp_err->message);
+        g_error_free(tmp_err);
+        rc = EXIT_FAILURE;
+    } else {
+        int measured = 0;
+        for (GSList *elem = mirrors; elem; elem = g_slist_next(elem)) {
+            LrFastestMirror *mirror = elem->data;
+            if (mirror->plain_connect_time >= 0.0)
+                measured++;
+        }
+        g_print("Mirrors: %d  Parallel probes: %ld  Measured: %d  Time: %f s\n",
+                number_of_mirrors, max_probes, measured,
+                g_timer_elapsed(timer, NULL));
+    }
+
+    g_timer_destroy(timer);
+    g_slist_free_full(mirrors, (GDestroyNotify) lr_lrfastestmirror_free);
+    lr_handle_free(h);
+
+cleanup:
+    for (int x = 0; x < number_of_mirrors; x++)
+        close(fds[x]);
+    g_free(fds);
+    g_slist_free_full(urls, g_free);
+
+    return rc;
+}
@@ -33,6 +33,7 @@
 
 #include "cleanup.h"
 #include "checksum.h"
+#include "checksum_internal.h"
 #include "rcodes.h"
 #include "util.h"
 #include "xattr_internal.h"
@@ -103,18 +104,15 @@ lr_checksum_type_to_str(LrChecksumType type)
     return NULL;
 }
 
-char *
-lr_checksum_fd(LrChecksumType type, int fd, GError **err)
-{
-    unsigned int len;
-    ssize_t readed;
-    char buf[BUFFER_SIZE];
-    unsigned char raw_checksum[EVP_MAX_MD_SIZE];
-    char *checksum;
+struct _LrChecksumCtx {
     EVP_MD_CTX *ctx;
+};
+
+LrChecksumCtx *
+lr_checksum_ctx_new(LrChecksumType type, GError **err)
+{
     const EVP_MD *ctx_type;
 
-    assert(fd > -1);
     assert(!err || *err == NULL);
 
     switch (type) {
@@ -127,58 +125,120 @@ lr_checksum_fd(LrChecksumType type, int fd, GError **err)
         case LR_CHECKSUM_UNKNOWN:
         default:
             g_debug("%s: Unknown checksum type", __func__);
-            assert(0);
             g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
                         "Unknown checksum type: %d", type);
             return NULL;
     }
 
-    ctx = EVP_MD_CTX_create();
-    if (!ctx) {
+    LrChecksumCtx *ctx = lr_malloc0(sizeof(*ctx));
+    ctx->ctx = EVP_MD_CTX_create();
+    if (!ctx->ctx) {
         g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
                     "EVP_MD_CTX_create() failed");
+        lr_free(ctx);
         return NULL;
     }
 
-    if (!EVP_DigestInit_ex(ctx, ctx_type, NULL)) {
+    if (!EVP_DigestInit_ex(ctx->ctx, ctx_type, NULL)) {
         g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
                     "EVP_DigestInit_ex() failed");
-        EVP_MD_CTX_destroy(ctx);
+        lr_checksum_ctx_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+gboolean
+lr_checksum_ctx_update(LrChecksumCtx *ctx,
+                       const void *buf,
+                       size_t len,
+                       GError **err)
+{
+    assert(ctx);
+    assert(!err || *err == NULL);
+
+    if (!EVP_DigestUpdate(ctx->ctx, buf, len)) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
+                    "EVP_DigestUpdate() failed");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+char *
+lr_checksum_ctx_final(LrChecksumCtx *ctx, GError **err)
+{
+    unsigned int len;
+    unsigned char raw_checksum[EVP_MAX_MD_SIZE];
+    char *checksum;
+
+    assert(ctx);
+    assert(!err || *err == NULL);
+
+    if (!EVP_DigestFinal_ex(ctx->ctx, raw_checksum, &len)) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
+                    "EVP_DigestFinal_ex() failed");
         return NULL;
     }
 
+    checksum = lr_malloc0(sizeof(char) * (len * 2 + 1));
+    for (size_t x = 0; x < len; x++)
+        sprintf(checksum+(x*2), "%02x", raw_checksum[x]);
+
+    return checksum;
+}
+
+void
+lr_checksum_ctx_free(LrChecksumCtx *ctx)
+{
+    if (!ctx)
+        return;
+    EVP_MD_CTX_destroy(ctx->ctx);
+    lr_free(ctx);
+}
+
+char *
+lr_checksum_fd(LrChecksumType type, int fd, GError **err)
+{
+    ssize_t readed;
+    char buf[BUFFER_SIZE];
+    char *checksum;
+    LrChecksumCtx *ctx;
+
+    assert(fd > -1);
+    assert(!err || *err == NULL);
+
+    assert(type > LR_CHECKSUM_UNKNOWN && type <= LR_CHECKSUM_SHA512);
+
+    ctx = lr_checksum_ctx_new(type, err);
+    if (!ctx)
+        return NULL;
+
     if (lseek(fd, 0, SEEK_SET) == -1) {
         g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
                     "Cannot seek to the begin of the file. "
                     "lseek(%d, 0, SEEK_SET) error: %s", fd, g_strerror(errno));
+        lr_checksum_ctx_free(ctx);
         return NULL;
     }
 
     while ((readed = read(fd, buf, BUFFER_SIZE)) > 0)
-        if (!EVP_DigestUpdate(ctx, buf, readed)) {
-            g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
-                        "EVP_DigestUpdate() failed");
+        if (!lr_checksum_ctx_update(ctx, buf, readed, err)) {
+            lr_checksum_ctx_free(ctx);
             return NULL;
         }
 
     if (readed == -1) {
-        EVP_MD_CTX_destroy(ctx);
+        lr_checksum_ctx_free(ctx);
         g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
                     "read(%d) failed: %s", fd, g_strerror(errno));
         return NULL;
     }
 
-    if (!EVP_DigestFinal_ex(ctx, raw_checksum, &len)) {
-        g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
-                    "EVP_DigestFinal_ex() failed");
-        return NULL;
-    }
-
-    EVP_MD_CTX_destroy(ctx);
-
-    checksum = lr_malloc0(sizeof(char) * (len * 2 + 1));
-    for (size_t x = 0; x < len; x++)
-        sprintf(checksum+(x*2), "%02x", raw_checksum[x]);
+    checksum = lr_checksum_ctx_final(ctx, err);
+    lr_checksum_ctx_free(ctx);
 
     return checksum;
 }
@@ -0,0 +1,70 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_CHECKSUM_INTERNAL_H__
+#define __LR_CHECKSUM_INTERNAL_H__
+
+#include <glib.h>
+
+#include "checksum.h"
+
+G_BEGIN_DECLS
+
+/** Checksum computed incrementally from data passed by parts */
+typedef struct _LrChecksumCtx LrChecksumCtx;
+
+/** Create new checksum context.
+ * @param type      Checksum type
+ * @param err       GError **
+ * @return          New context or NULL on error
+ */
+LrChecksumCtx *
+lr_checksum_ctx_new(LrChecksumType type, GError **err);
+
+/** Add data to the checksum.
+ * @param ctx       Checksum context
+ * @param buf       Data
+ * @param len       Length of the data
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set
+ */
+gboolean
+lr_checksum_ctx_update(LrChecksumCtx *ctx,
+                       const void *buf,
+                       size_t len,
+                       GError **err);
+
+/** Finish the checksum. No data could be added after this call.
+ * @param ctx       Checksum context
+ * @param err       GError **
+ * @return          Malloced checksum string or NULL on error
+ */
+char *
+lr_checksum_ctx_final(LrChecksumCtx *ctx, GError **err);
+
+/** Free the checksum context.
+ * @param ctx       Checksum context
+ */
+void
+lr_checksum_ctx_free(LrChecksumCtx *ctx);
+
+G_END_DECLS
+
+#endif
@@ -33,6 +33,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/xattr.h>
+#include <sys/file.h>
 #include <fcntl.h>
 #include <curl/curl.h>
 
@@ -49,9 +50,11 @@
 #include "handle.h"
 #include "handle_internal.h"
 #include "cleanup.h"
+#include "checksum_internal.h"
 #include "url_substitution.h"
 #include "yum_internal.h"
 #include "xattr_internal.h"
+#include "mirrorstats_internal.h"
 
 
 volatile sig_atomic_t lr_interrupt = 0;
@@ -71,6 +74,10 @@ typedef enum {
         The transfer is successfully finished. */
     LR_DS_FAILED, /*!<
         The transfer is finished without success. */
+    LR_DS_HELD, /*!<
+        The target waits for the check of its local file (see
+        ::lr_download_held) or for the lock of the file held by another
+        process (LRO_LOCKTARGETS). */
 } LrDownloadState;
 
 typedef enum {
@@ -108,9 +115,20 @@ typedef struct {
         (could be NULL) */
 } LrHandleMirrors;
 
+typedef struct {
+    gchar *host; /*!<
+        Scheme, host and port (e.g. "https://example.com:8443") */
+    int running_transfers; /*!<
+        How many transfers from all mirrors on the host (from all handles)
+        are currently in progress. */
+} LrMirrorHost;
+
 typedef struct {
     LrInternalMirror *mirror; /*!<
         Mirror */
+    LrMirrorHost *host; /*!<
+        Host of the mirror shared with other mirrors on the same host
+        or NULL for local mirrors */
     int allowed_parallel_connections; /*!<
         Maximum number of allowed parallel connections to this mirror. -1 means no limit.
         Dynamically adjusted (decreased) if no fatal (temporary) error will occur. */
@@ -126,11 +144,94 @@ typedef struct {
     int max_ranges; /*!<
         Maximum ranges supported in a single request.  This will be automatically
         adjusted when mirrors respond with 200 to a range request */
+    double previous_successful_transfers; /*!<
+        Decayed number of successful transfers from the mirror by previous
+        downloads (LRO_MIRRORSTATS) */
+    double previous_failed_transfers; /*!<
+        Decayed number of failed transfers by previous downloads */
+    double rtt_sum; /*!<
+        Sum of round-trip times measured by TCP handshakes */
+    int rtt_count; /*!<
+        Number of the measured round-trip times */
+    double downloaded_bytes; /*!<
+        Bytes received by the transfers from this mirror */
+    double download_time; /*!<
+        Total time of the transfers from this mirror */
 } LrMirror;
 
+/** State of the running transfer of a target. Allocated when the transfer
+ * is prepared and freed by end_transfer(), so waiting and finished
+ * targets don't carry it. */
+typedef struct {
+    CURL *curl_handle; /*!<
+        Used curl handle or NULL */
+
+    FILE *f; /*!<
+        fdopened file descriptor from LrDownloadTarget and used
+        in curl_handle. */
+
+    struct curl_slist *curl_rqheaders; /*!<
+        Extra headers for request. */
+
+    LrHeaderCbState headercb_state; /*!<
+        State of the header callback for current transfer */
+
+    gchar *headercb_interrupt_reason; /*!<
+        Reason why was the transfer interrupted */
+
+    gint64 writecb_recieved; /*!<
+        Total number of bytes received by the write function
+        during the current transfer. */
+
+    gboolean writecb_required_range_written; /*!<
+        If a byte range was specified to download and the
+        range was downloaded, it is TRUE. Otherwise FALSE. */
+
+    gboolean range_fail; /*!<
+        Whether range request failed. */
+
+    CURLcode curl_code; /*!<
+        Result code from the transfer */
+
+    char errorbuffer[CURL_ERROR_SIZE]; /*!<
+        Error buffer used in curl handle. */
+
+    gchar *conditional_cache; /*!<
+        Path (in the cachedir) to the cached copy of the target used for
+        conditional requests or NULL if conditional request is not used */
+
+    gboolean validators_sent; /*!<
+        If-None-Match or If-Modified-Since was sent with the request */
+
+    int conditional_fd; /*!<
+        Cached copy whose validators were sent or -1. It stays open,
+        so the copy matches the validators even if another process
+        replaces it meanwhile. */
+
+    gchar *etag; /*!<
+        ETag from the response or NULL */
+
+    gchar *last_modified; /*!<
+        Last-Modified from the response or NULL */
+} LrTransfer;
+
+/** Data passed to LrDownloadTarget.datacb. Unlike LrTransfer, it is kept
+ * between the transfers, the next one continues the stream. */
+typedef struct {
+    gint64 offset; /*!<
+        Number of bytes passed to LrDownloadTarget.datacb */
+
+    GSList *checksums; /*!<
+        Checksums (LrChecksumCtx *) of the data passed to
+        LrDownloadTarget.datacb, NULL items for unusable checksums
+        of the target */
+} LrTargetStream;
+
+/** Download of a target. Fields are ordered by size to keep the struct
+ * small, there is one for every target of the download even if it is
+ * just waiting. Data needed only while the target is transferred
+ * are in LrTransfer. */
 typedef struct {
-    LrDownloadState state; /*!<
-        State of the download (transfer). */
     LrDownloadTarget *target; /*!<
         Download target */
     LrMirror *mirror; /*!<
@@ -144,58 +245,47 @@ typedef struct {
         successfully performed.
         If state is LR_DS_FAILED then mirror from which last try
         was done. */
-    LrProtocol protocol; /*!<
-        Current protocol */
-    CURL *curl_handle; /*!<
-        Used curl handle or NULL */
-    FILE *f; /*!<
-        fdopened file descriptor from LrDownloadTarget and used
-        in curl_handle. */
-    char errorbuffer[CURL_ERROR_SIZE]; /*!<
-        Error buffer used in curl handle */
+    LrTransfer *transfer; /*!<
+        State of the running transfer or NULL */
     GSList *tried_mirrors; /*!<
         List of already tried mirrors (LrMirror *).
         This mirrors won't be tried again. */
-    gboolean resume; /*!<
-        Is resume enabled? Download target may state that resume is True
-        but Librepo can decide that resuming won't be done.
-        This variable states if the resume is enabled or not. */
-    gint64 original_offset; /*!<
-        If resume is enabled, this is the specified offset where to resume
-        the downloading. If resume is not enabled, then value is -1. */
-    gint resume_count; /*!<
-        How many resumes were done */
     GSList *lrmirrors; /*!<
         List of all available mirors (LrMirror *).
         This list is generated from LrHandle related to this target
         and is common for all targets that uses the handle. */
     LrHandle *handle; /*!<
         LrHandle associated with this target */
-    LrHeaderCbState headercb_state; /*!<
-        State of the header callback for current transfer */
-    gchar *headercb_interrupt_reason; /*!<
-        Reason why was the transfer interrupted */
-    gint64 writecb_recieved; /*!<
-        Total number of bytes received by the write function
-        during the current transfer. */
-    gboolean writecb_required_range_written; /*!<
-        If a byte range was specified to download and the
-        range was downloaded, it is TRUE. Otherwise FALSE. */
+    LrTargetStream *stream; /*!<
+        Data passed to LrDownloadTarget.datacb or NULL if no transfer
+        of a target with the callback was prepared yet */
+    gint64 original_offset; /*!<
+        If resume is enabled, this is the specified offset where to resume
+        the downloading. If resume is not enabled, then value is -1. */
+    double duration; /*!<
+        Estimated duration of the download used by LRO_SCHEDULEPOLICY,
+        <0.0 if the size is unknown */
+    LrDownloadState state; /*!<
+        State of the download (transfer). */
+    LrProtocol protocol; /*!<
+        Current protocol */
+    gboolean resume; /*!<
+        Is resume enabled? Download target may state that resume is True
+        but Librepo can decide that resuming won't be done.
+        This variable states if the resume is enabled or not. */
+    gint resume_count; /*!<
+        How many resumes were done */
     LrCbReturnCode cb_return_code; /*!<
         Last cb return code. */
-    struct curl_slist *curl_rqheaders; /*!<
-        Extra headers for request. */
+    int lock_fd; /*!<
+        Destination file locked by lock_target_file() (LRO_LOCKTARGETS)
+        or -1. The lock is kept until the target finishes, so the file
+        of a failed target is removed before another process gets it. */
 
     #ifdef WITH_ZCHUNK
     LrZckState zck_state; /*!<
         Zchunk download status */
     #endif /* WITH_ZCHUNK */
-
-    gboolean range_fail; /*!<
-        Whether range request failed. */
-
-    CURLcode curl_code; /*!<
-        Result code from the last curl transfer */
 } LrTarget;
 
 typedef struct {
@@ -211,15 +301,46 @@ typedef struct {
     int max_connection_per_host; /*!<
         Maximal number of connections per host. -1 means no limit. */
 
+    int max_connection_per_mirror_host; /*!<
+        Maximal number of connections to all mirrors on the same host
+        (LrMirrorHost). -1 means no limit. */
+
     int max_mirrors_to_try; /*!<
         Maximal number of mirrors to try. Number <= 0 means no limit. */
 
     long allowed_mirror_failures; /*!<
         See LRO_ALLOWEDMIRRORFAILURES */
 
+    long allowed_url_failures; /*!<
+        Same as allowed_mirror_failures but used for targets with
+        a complete URL or a base URL (they have only one location
+        where the download could be retried). */
+
+    long mirrorhashing; /*!<
+        See LRO_MIRRORHASHING */
+
     long adaptivemirrorsorting; /*!<
         See LRO_ADAPTIVEMIRRORSORTING */
 
+    LrSchedulePolicy schedulepolicy; /*!<
+        See LRO_SCHEDULEPOLICY */
+
+    LrTargetDoneCb donecb; /*!<
+        Called when a target reaches its final state. Could be NULL. */
+
+    void *donecbdata; /*!<
+        User data for the donecb */
+
+    gboolean release_reported; /*!<
+        Targets are removed from the download right before they are
+        reported via donecb (::lr_download_lazy) */
+
+    LrDownloadSession *session; /*!<
+        Session to add and cancel targets while running or NULL */
+
+    LrDownloadWorks *works; /*!<
+        Works started by the donecb which run in other threads or NULL */
+
     // Data
 
     CURLM *multi_handle; /*!<
@@ -228,14 +349,93 @@ typedef struct {
     GSList *handle_mirrors; /*!<
         All mirrors (list of pointers to LrHandleMirrors structures) */
 
+    GHashTable *mirror_hosts; /*!<
+        Hosts of all mirrors (host string -> LrMirrorHost) */
+
     GSList *targets; /*!<
         List of all targets (list of pointers to LrTarget stuctures) */
 
+    LrTarget *target_slab; /*!<
+        LrTargets of the targets passed to the download allocated at
+        once or NULL (targets are freed one by one when reported,
+        see release_reported). Targets added later are allocated
+        separately. */
+
+    guint target_slab_len; /*!<
+        Number of LrTargets in target_slab */
+
+    guint target_slab_used; /*!<
+        Number of LrTargets from target_slab given to targets */
+
     GSList *running_transfers; /*!<
         List of running transfers (list of pointer to LrTarget structures) */
 
+    GQueue *done_targets; /*!<
+        Targets (LrTarget *) which reached their final state and were not
+        reported via donecb yet, in the order they finished */
+
+    gboolean schedule_dirty; /*!<
+        The targets have to be sorted again (LRO_SCHEDULEPOLICY) */
+
+    gint64 totalmaxspeed; /*!<
+        Lowest nonzero LRO_TOTALMAXSPEED of the handles of the targets,
+        0 if unlimited */
+
+    gboolean speeds_dirty; /*!<
+        Max speeds of the running transfers have to be computed again */
+
+    GHashTable *held; /*!<
+        Targets in the LR_DS_HELD state (LrDownloadTarget -> LrTarget) */
+
+    GAsyncQueue *checks; /*!<
+        Results of the checks of the held targets (LrTargetCheck) */
+
+    GHashTable *dropped_checks; /*!<
+        Held targets cancelled before their checks finished, results of
+        the checks are ignored (set of LrDownloadTarget) */
+
+    GSList *lock_waiting; /*!<
+        Held targets (LrTarget *) whose files are locked by other
+        processes (LRO_LOCKTARGETS) */
+
+    gint64 lock_polled; /*!<
+        Monotonic time of the last attempt to take the locks of
+        dd->lock_waiting */
+
+    GThreadPool *lock_pool; /*!<
+        Threads checking files of held targets downloaded by other
+        processes (LRO_LOCKTARGETS). NULL if no lock was busy. */
+
+    gint lock_cancel; /*!<
+        Set (atomically) to stop the checks of the locked files */
+
 } LrDownload;
 
+struct _LrDownloadSession {
+    GMutex lock; /*!<
+        Protects the lists of requests */
+
+    GSList *added; /*!<
+        Targets to add to the download (LrDownloadTarget *),
+        the last added is the first */
+
+    GSList *cancelled; /*!<
+        Targets to cancel (LrDownloadTarget *) */
+
+    // Data of the download driven by lr_download_session_step(),
+    // used only by the thread which drives it
+
+    LrDownload *dd; /*!<
+        Download started by lr_download_session_start() or NULL */
+
+    GHashTable *sockets; /*!<
+        Sockets curl waits for (fd -> LrDownloadSessionEvents) */
+
+    gint64 deadline; /*!<
+        Monotonic time (in us) when curl wants to be called because
+        of a timeout or -1 */
+};
+
 /** Schema of structures as used in downloader module:
  *
  * +------------------------------+
@@ -292,6 +492,18 @@ typedef struct {
  *      Points to list of LrMirrors <---/           +--------------------------+
  */
 
+/** Move the target to its final state (LR_DS_FINISHED or LR_DS_FAILED)
+ * and queue it to be reported via dd->donecb.
+ */
+static void
+set_target_done(LrDownload *dd, LrTarget *target, LrDownloadState state)
+{
+    assert(state == LR_DS_FINISHED || state == LR_DS_FAILED);
+    target->state = state;
+    if (dd->donecb)
+        g_queue_push_tail(dd->done_targets, target);
+}
+
 static gboolean
 is_max_mirrors_unlimited(const LrDownload *download)
 {
@@ -313,7 +525,7 @@ can_retry_download(const LrDownload *download, int num_of_tried_mirrors,
         if (g_str_has_prefix(complete_path_or_baseurl, "file:/")) {
             return FALSE;
         }
-        return download->allowed_mirror_failures > num_of_tried_mirrors;
+        return download->allowed_url_failures > num_of_tried_mirrors;
     }
     return is_max_mirrors_unlimited(download) ||
            num_of_tried_mirrors < download->max_mirrors_to_try;
@@ -330,12 +542,20 @@ init_once_allowed_parallel_connections(LrMirror *mirror, int max_allowed_paralle
 {
     if (mirror->allowed_parallel_connections == 0) {
         mirror->allowed_parallel_connections = max_allowed_parallel_connections;
+    } else if (max_allowed_parallel_connections != -1
+               && (mirror->allowed_parallel_connections == -1
+                   || mirror->allowed_parallel_connections > max_allowed_parallel_connections)) {
+        // Limit learned by previous downloads (LRO_MIRRORSTATS) can be
+        // higher than the limit of this download
+        mirror->allowed_parallel_connections = max_allowed_parallel_connections;
     }
 }
 
 static void
 increase_running_transfers(LrMirror *mirror)
 {
+    if (mirror->host)
+        mirror->host->running_transfers++;
     mirror->running_transfers++;
     if (mirror->max_tried_parallel_connections < mirror->running_transfers)
         mirror->max_tried_parallel_connections = mirror->running_transfers;
@@ -348,37 +568,208 @@ is_parallel_connections_limited_and_reached(const LrMirror *mirror)
            mirror->running_transfers >= mirror->allowed_parallel_connections;
 }
 
+static gboolean
+is_host_connections_limited_and_reached(const LrMirror *mirror,
+                                        int max_connection_per_mirror_host)
+{
+    return mirror->host && max_connection_per_mirror_host != -1 &&
+           mirror->host->running_transfers >= max_connection_per_mirror_host;
+}
+
 static void
-mirror_update_statistics(LrMirror *mirror, gboolean transfer_success)
+decrease_running_transfers(LrMirror *mirror)
 {
+    if (mirror->host)
+        mirror->host->running_transfers--;
     mirror->running_transfers--;
+}
+
+static void
+mirror_update_statistics(LrMirror *mirror, gboolean transfer_success)
+{
+    decrease_running_transfers(mirror);
     if (transfer_success)
         mirror->successful_transfers++;
     else
         mirror->failed_transfers++;
 }
 
-/** Create GSList of LrMirrors (if it doesn't exist) for a handle.
- * If the list already exists (if more targets use the same handle)
- * then just set the list to the current target.
- * If the list doesn't exist yet, create it then create a mapping between
- * the list and the handle (LrHandleMirrors) and set the list to
- * the current target.
+/** Measure round-trip time to the mirror by the TCP handshake
+ * of the transfer (if it opened a new connection).
+ */
+static void
+mirror_update_rtt(LrMirror *mirror, CURL *curl_handle)
+{
+    double namelookup = 0.0;
+    double connect = 0.0;
+
+    if (curl_easy_getinfo(curl_handle, CURLINFO_NAMELOOKUP_TIME, &namelookup) != CURLE_OK
+        || curl_easy_getinfo(curl_handle, CURLINFO_CONNECT_TIME, &connect) != CURLE_OK)
+        return;
+
+    // Reused connections have no handshake
+    if (connect <= namelookup)
+        return;
+
+    mirror->rtt_sum += connect - namelookup;
+    mirror->rtt_count++;
+}
+
+/** Add the transfer to the throughput of the mirror (LRO_SCHEDULEPOLICY).
+ * @return          TRUE if the throughput was updated
+ */
+static gboolean
+mirror_update_throughput(LrMirror *mirror, CURL *curl_handle)
+{
+    double size = 0.0;
+    double total = 0.0;
+
+    if (curl_easy_getinfo(curl_handle, CURLINFO_SIZE_DOWNLOAD, &size) != CURLE_OK
+        || curl_easy_getinfo(curl_handle, CURLINFO_TOTAL_TIME, &total) != CURLE_OK
+        || size <= 0.0 || total <= 0.0)
+        return FALSE;
+
+    mirror->downloaded_bytes += size;
+    mirror->download_time += total;
+    return TRUE;
+}
+
+/** Seed LrMirrors with the statistics of previous downloads
+ * (LRO_MIRRORSTATS) and move the mirrors which recently failed
+ * without any success to the end of the list.
  */
 static GSList *
-lr_prepare_lrmirrors(GSList *list, LrTarget *target)
+lr_apply_mirrorstats(LrHandle *handle, GSList *lrmirrors)
 {
-    LrHandle *handle = target->handle;
+    GSList *failing = NULL;
+    GError *tmp_err = NULL;
 
-    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
-        LrHandleMirrors *handle_mirrors = elem->data;
-        if (handle_mirrors->handle == handle) {
-            // List of LrMirrors for this handle is already created
-            target->lrmirrors = handle_mirrors->lrmirrors;
-            return list;
+    if (handle->mirrorstatsfile
+        && !lr_mirrorstats_load(handle->mirrorstatsfile, &tmp_err)) {
+        g_debug("%s: %s", __func__, tmp_err->message);
+        g_clear_error(&tmp_err);
+    }
+
+    for (GSList *elem = lrmirrors; elem;) {
+        GSList *next = g_slist_next(elem);
+        LrMirror *mirror = elem->data;
+        LrMirrorStats stats;
+
+        if (lr_mirrorstats_get(mirror->mirror->url, &stats)) {
+            mirror->previous_successful_transfers = stats.successful_transfers;
+            mirror->previous_failed_transfers = stats.failed_transfers;
+            if (stats.allowed_parallel_connections > 0)
+                mirror->allowed_parallel_connections = stats.allowed_parallel_connections;
+            if (stats.max_ranges >= 0)
+                mirror->max_ranges = stats.max_ranges;
+
+            if (stats.failed_transfers >= 1.0 && stats.successful_transfers < 0.5) {
+                g_debug("%s: Mirror recently failed, trying it last: %s",
+                        __func__, mirror->mirror->url);
+                lrmirrors = g_slist_remove_link(lrmirrors, elem);
+                failing = g_slist_concat(failing, elem);
+            }
+        }
+
+        elem = next;
+    }
+
+    return g_slist_concat(lrmirrors, failing);
+}
+
+/** Store statistics of the LrMirrors to the process-wide registry
+ * (LRO_MIRRORSTATS).
+ */
+static void
+lr_store_mirrorstats(LrHandle *handle,
+                     GSList *lrmirrors,
+                     int max_connection_per_host)
+{
+    GError *tmp_err = NULL;
+
+    for (GSList *elem = lrmirrors; elem; elem = g_slist_next(elem)) {
+        LrMirror *mirror = elem->data;
+
+        // Only limits lowered by errors are worth remembering
+        int connections = mirror->allowed_parallel_connections;
+        if (connections <= 0
+            || (max_connection_per_host != -1 && connections >= max_connection_per_host))
+            connections = 0;
+        int ranges = mirror->max_ranges < 256 ? mirror->max_ranges : -1;
+        double rtt = mirror->rtt_count ? mirror->rtt_sum / mirror->rtt_count : -1.0;
+
+        if (mirror->successful_transfers == 0 && mirror->failed_transfers == 0
+            && connections == 0 && ranges < 0 && rtt < 0.0)
+            continue;
+
+        lr_mirrorstats_add(mirror->mirror->url,
+                           mirror->successful_transfers,
+                           mirror->failed_transfers,
+                           connections,
+                           ranges,
+                           rtt);
+    }
+
+    if (handle->mirrorstatsfile
+        && !lr_mirrorstats_save(handle->mirrorstatsfile, &tmp_err)) {
+        g_debug("%s: %s", __func__, tmp_err->message);
+        g_clear_error(&tmp_err);
+    }
+}
+
+static void
+lr_mirrorhost_free(LrMirrorHost *host)
+{
+    g_free(host->host);
+    lr_free(host);
+}
+
+/** Find (or create) the LrMirrorHost for the url. Host names are case
+ * insensitive and default ports are dropped, so e.g. "http://Foo:80/a/"
+ * and "http://foo/b/" share one LrMirrorHost.
+ * @param mirror_hosts  Hash table host string -> LrMirrorHost
+ * @param url           Mirror URL
+ * @return              LrMirrorHost or NULL for local mirrors
+ */
+static LrMirrorHost *
+lr_get_mirrorhost(GHashTable *mirror_hosts, const char *url)
+{
+    static const char *default_ports[][2] = {
+        { "http://", ":80" },
+        { "https://", ":443" },
+        { "ftp://", ":21" },
+    };
+
+    if (g_str_has_prefix(url, "file:"))
+        return NULL;
+
+    _cleanup_free_ gchar *without_path = lr_url_without_path(url);
+    gchar *key = g_ascii_strdown(without_path, -1);
+    for (size_t x = 0; x < G_N_ELEMENTS(default_ports); x++) {
+        if (g_str_has_prefix(key, default_ports[x][0])
+            && g_str_has_suffix(key, default_ports[x][1])) {
+            key[strlen(key) - strlen(default_ports[x][1])] = '\0';
+            break;
         }
     }
 
+    LrMirrorHost *host = g_hash_table_lookup(mirror_hosts, key);
+    if (host) {
+        g_free(key);
+        return host;
+    }
+
+    host = lr_malloc0(sizeof(*host));
+    host->host = key;
+    g_hash_table_insert(mirror_hosts, host->host, host);
+    return host;
+}
+
+/** Create GSList of LrMirrors from the internal mirrorlist of a handle.
+ */
+static GSList *
+lr_create_lrmirrors(LrHandle *handle, GHashTable *mirror_hosts)
+{
     GSList *lrmirrors = NULL;
 
     if (handle && handle->internal_mirrorlist) {
@@ -399,11 +790,48 @@ lr_prepare_lrmirrors(GSList *list, LrTarget *target)
 
             LrMirror *mirror = lr_malloc0(sizeof(*mirror));
             mirror->mirror = imirror;
+            mirror->host = lr_get_mirrorhost(mirror_hosts, imirror->url);
             mirror->max_ranges = 256;
             lrmirrors = g_slist_append(lrmirrors, mirror);
         }
+
+        if (handle->mirrorstats)
+            lrmirrors = lr_apply_mirrorstats(handle, lrmirrors);
+    }
+
+    return lrmirrors;
+}
+
+/** Create GSList of LrMirrors (if it doesn't exist) for a handle.
+ * If the list already exists (if more targets use the same handle)
+ * then just set the list to the current target.
+ * If the list doesn't exist yet, create it then create a mapping between
+ * the list and the handle (LrHandleMirrors) and set the list to
+ * the current target.
+ */
+static GSList *
+lr_prepare_lrmirrors(GSList *list, LrTarget *target, GHashTable *mirror_hosts)
+{
+    LrHandle *handle = target->handle;
+
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrHandleMirrors *handle_mirrors = elem->data;
+        if (handle_mirrors->handle == handle) {
+            // List of LrMirrors for this handle is already created
+            if (!handle_mirrors->lrmirrors) {
+                // The list could be created (empty) before the internal
+                // mirrorlist of the handle was prepared. E.g. when
+                // a target was added to a running download after
+                // the metalink of the handle was downloaded.
+                handle_mirrors->lrmirrors = lr_create_lrmirrors(handle, mirror_hosts);
+            }
+            target->lrmirrors = handle_mirrors->lrmirrors;
+            return list;
+        }
     }
 
+    GSList *lrmirrors = lr_create_lrmirrors(handle, mirror_hosts);
+
     LrHandleMirrors *handle_mirrors = lr_malloc0(sizeof(*handle_mirrors));
     handle_mirrors->handle = handle;
     handle_mirrors->lrmirrors = lrmirrors;
@@ -462,16 +890,45 @@ size_t lr_zckheadercb(char *b, size_t l, size_t c, void *dl_v) {
     assert(target && target->target);
 
     long code = -1;
-    curl_easy_getinfo(target->curl_handle, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_getinfo(target->transfer->curl_handle, CURLINFO_RESPONSE_CODE, &code);
     if(code == 200) {
         g_debug("%s: Too many ranges were attempted in one download", __func__);
-        target->range_fail = 1;
+        target->transfer->range_fail = 1;
         return 0;
     }
     return zck_header_cb(b, l, c, target->target->zck_dl);
 }
 #endif /* WITH_ZCHUNK */
 
+/** Remember validators (ETag, Last-Modified) of the response
+ * if a conditional request is used for the target.
+ */
+static void
+lr_headercb_validators(LrTarget *target, const char *ptr, size_t len)
+{
+    LrTransfer *transfer = target->transfer;
+
+    if (!transfer->conditional_cache)
+        return;
+
+    _cleanup_free_ gchar *header = g_strndup(ptr, len);
+    g_strstrip(header);
+
+    if (g_str_has_prefix(header, "HTTP/")) {
+        // Status line of a new response (e.g. after redirection)
+        g_free(transfer->etag);
+        transfer->etag = NULL;
+        g_free(transfer->last_modified);
+        transfer->last_modified = NULL;
+    } else if (!g_ascii_strncasecmp(header, "ETag:", STRLEN("ETag:"))) {
+        g_free(transfer->etag);
+        transfer->etag = g_strdup(g_strstrip(header + STRLEN("ETag:")));
+    } else if (!g_ascii_strncasecmp(header, "Last-Modified:", STRLEN("Last-Modified:"))) {
+        g_free(transfer->last_modified);
+        transfer->last_modified = g_strdup(g_strstrip(header + STRLEN("Last-Modified:")));
+    }
+}
+
 /** Header callback for CURL handles.
  * It parses HTTP and FTP headers and try to find length of the content
  * (file size of the target). If the size is different then the expected
@@ -485,7 +942,14 @@ lr_headercb(void *ptr, size_t size, size_t nmemb, void *userdata)
 
     size_t ret = size * nmemb;
     LrTarget *lrtarget = userdata;
-    LrHeaderCbState state = lrtarget->headercb_state;
+    LrHeaderCbState state = lrtarget->transfer->headercb_state;
+
+    lr_headercb_validators(lrtarget, ptr, ret);
+
+    if (lrtarget->target->expectedsize <= 0) {
+        // Header callback is used only to get the validators
+        return ret;
+    }
 
     if (state == LR_HCS_DONE || state == LR_HCS_INTERRUPTED) {
         // Nothing to do
@@ -493,7 +957,7 @@ lr_headercb(void *ptr, size_t size, size_t nmemb, void *userdata)
     }
 
     #ifdef WITH_ZCHUNK
-    if(lrtarget->target->is_zchunk && !lrtarget->range_fail && lrtarget->mirror->mirror->protocol == LR_PROTOCOL_HTTP)
+    if(lrtarget->target->is_zchunk && !lrtarget->transfer->range_fail && lrtarget->mirror->mirror->protocol == LR_PROTOCOL_HTTP)
         return lr_zckheadercb(ptr, size, nmemb, userdata);
     #endif /* WITH_ZCHUNK */
 
@@ -513,7 +977,7 @@ lr_headercb(void *ptr, size_t size, size_t nmemb, void *userdata)
                             g_strrstr(header, "Connection established") ||
                             g_strrstr(header, "Connection Established")
                         )) {
-                lrtarget->headercb_state = LR_HCS_HTTP_STATE_OK;
+                lrtarget->transfer->headercb_state = LR_HCS_HTTP_STATE_OK;
             } else {
                 // Do nothing (do not change the state)
                 // in case of redirection, 200 OK still could come
@@ -535,15 +999,15 @@ lr_headercb(void *ptr, size_t size, size_t nmemb, void *userdata)
                     g_debug("%s: Size doesn't match (%"G_GINT64_FORMAT
                             " != %"G_GINT64_FORMAT")",
                             __func__, content_length, expected);
-                    lrtarget->headercb_state = LR_HCS_INTERRUPTED;
-                    lrtarget->headercb_interrupt_reason = g_strdup_printf(
+                    lrtarget->transfer->headercb_state = LR_HCS_INTERRUPTED;
+                    lrtarget->transfer->headercb_interrupt_reason = g_strdup_printf(
                         "Inconsistent FTP server data, file Content-Length: %"G_GINT64_FORMAT " reported"
                         " via 213 code, repository metadata states file length: %"G_GINT64_FORMAT
                         " (please report to repository maintainer)",
                         content_length, expected);
                     ret++;  // Return error value
                 } else {
-                    lrtarget->headercb_state = LR_HCS_DONE;
+                    lrtarget->transfer->headercb_state = LR_HCS_DONE;
                 }
             } else if (g_str_has_prefix(header, "150")) {
                 // Code 150 should keep the file size
@@ -574,15 +1038,15 @@ lr_headercb(void *ptr, size_t size, size_t nmemb, void *userdata)
                 g_debug("%s: Size doesn't match (%"G_GINT64_FORMAT
                         " != %"G_GINT64_FORMAT")",
                         __func__, content_length, remaining_bytes);
-                lrtarget->headercb_state = LR_HCS_INTERRUPTED;
-                lrtarget->headercb_interrupt_reason = g_strdup_printf(
+                lrtarget->transfer->headercb_state = LR_HCS_INTERRUPTED;
+                lrtarget->transfer->headercb_interrupt_reason = g_strdup_printf(
                     "Inconsistent server data, reported file Content-Length: %"G_GINT64_FORMAT
                     ", repository metadata states file length: %"G_GINT64_FORMAT
                     " (please report to repository maintainer)",
                     content_length, expected);
                 ret++;  // Return error value
             } else {
-                lrtarget->headercb_state = LR_HCS_DONE;
+                lrtarget->transfer->headercb_state = LR_HCS_DONE;
             }
         }
     }
@@ -607,18 +1071,56 @@ lr_zck_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
 }
 #endif /* WITH_ZCHUNK */
 
-/** Write callback for CURL handles.
- * This callback handles situation when an user wants only specified
- * byte range of the target file.
+/** Write the received data to the file of the target and pass them
+ * to LrDownloadTarget.datacb.
+ * @return          Number of written items like fwrite()
  */
-size_t
+static size_t
+write_target_data(LrTarget *target, char *ptr, size_t size, size_t nmemb)
+{
+    LrDataCb datacb = target->target->datacb;
+
+    if (target->transfer->f && fwrite(ptr, size, nmemb, target->transfer->f) != nmemb) {
+        g_warning("Error while writing file: %s", g_strerror(errno));
+        return 0;
+    }
+
+    if (!datacb)
+        return nmemb;
+
+    size_t len = size * nmemb;
+    for (GSList *elem = target->stream->checksums; elem; elem = g_slist_next(elem)) {
+        GError *tmp_err = NULL;
+        LrChecksumCtx *ctx = elem->data;
+        if (ctx && !lr_checksum_ctx_update(ctx, ptr, len, &tmp_err)) {
+            g_warning("Error while checksumming data: %s", tmp_err->message);
+            g_error_free(tmp_err);
+            return 0;
+        }
+    }
+
+    int rc = datacb(target->target->cbdata, ptr, len);
+    if (rc != LR_CB_OK) {
+        target->cb_return_code = rc;
+        return 0; // Aborts the transfer
+    }
+
+    target->stream->offset += len;
+    return nmemb;
+}
+
+/** Write callback for CURL handles.
+ * This callback handles situation when an user wants only specified
+ * byte range of the target file.
+ */
+size_t
 lr_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
     size_t cur_written_expected = nmemb;
     size_t cur_written;
     LrTarget *target = (LrTarget *) userdata;
     #ifdef WITH_ZCHUNK
-    if(target->target->is_zchunk && !target->range_fail && target->mirror->mirror->protocol == LR_PROTOCOL_HTTP)
+    if(target->target->is_zchunk && !target->transfer->range_fail && target->mirror->mirror->protocol == LR_PROTOCOL_HTTP)
         return lr_zck_writecb(ptr, size, nmemb, userdata);
     #endif /* WITH_ZCHUNK */
 
@@ -628,18 +1130,18 @@ lr_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
 
     if (range_start <= 0 && range_end <= 0) {
         // Write everything curl give to you
-        target->writecb_recieved += all;
-        return fwrite(ptr, size, nmemb, target->f);
+        target->transfer->writecb_recieved += all;
+        return write_target_data(target, ptr, size, nmemb);
     }
 
     /* Deal with situation when user wants only specific byte range of the
      * target file, and write only the range.
      */
 
-    gint64 cur_range_start = target->writecb_recieved;
+    gint64 cur_range_start = target->transfer->writecb_recieved;
     gint64 cur_range_end = cur_range_start + all;
 
-    target->writecb_recieved += all;
+    target->transfer->writecb_recieved += all;
 
     if (target->target->byterangestart > 0) {
         // If byterangestart is specified, then CURLOPT_RESUME_FROM_LARGE
@@ -659,7 +1161,7 @@ lr_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
         // The wanted byte range is over
         // Return zero that will lead to transfer abortion
         // with error code CURLE_WRITE_ERROR
-        target->writecb_required_range_written = TRUE;
+        target->transfer->writecb_required_range_written = TRUE;
         return 0;
     }
 
@@ -694,15 +1196,81 @@ lr_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
     }
 
     assert(nmemb > 0);
-    cur_written = fwrite(ptr, size, nmemb, target->f);
-    if (cur_written != nmemb) {
-        g_warning("Error while writing file: %s", g_strerror(errno));
+    cur_written = write_target_data(target, ptr, size, nmemb);
+    if (cur_written != nmemb)
         return 0; // There was an error
-    }
 
     return cur_written_expected;
 }
 
+guint64
+lr_mirror_rendezvous_score(const char *mirror_url, const char *path)
+{
+    // FNV-1a of both strings (separated by their terminating zero)
+    guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+    for (const char *c = mirror_url; ; c++) {
+        hash ^= (guchar) *c;
+        hash *= G_GUINT64_CONSTANT(1099511628211);
+        if (!*c)
+            break;
+    }
+    for (const char *c = path; *c; c++) {
+        hash ^= (guchar) *c;
+        hash *= G_GUINT64_CONSTANT(1099511628211);
+    }
+
+    // Finalizer of splitmix64, similar inputs get unrelated scores
+    hash ^= hash >> 30;
+    hash *= G_GUINT64_CONSTANT(0xbf58476d1ce4e5b9);
+    hash ^= hash >> 27;
+    hash *= G_GUINT64_CONSTANT(0x94d049bb133111eb);
+    hash ^= hash >> 31;
+    return hash;
+}
+
+/** Select the mirror of the target by rendezvous hashing of its path
+ * over the healthy remote mirrors (LRO_MIRRORHASHING).
+ * @return      The mirror or NULL if there is no candidate
+ */
+static LrMirror *
+select_hashed_mirror(LrDownload *dd, LrTarget *target)
+{
+    LrMirror *best = NULL;
+    guint64 best_score = 0;
+
+    if (target->handle && target->handle->offline)
+        return NULL;
+
+    for (GSList *elem = target->lrmirrors; elem; elem = g_slist_next(elem)) {
+        LrMirror *c_mirror = elem->data;
+        LrProtocol protocol = c_mirror->mirror->protocol;
+
+        if (protocol != LR_PROTOCOL_HTTP && protocol != LR_PROTOCOL_FTP)
+            continue;
+        if (protocol == LR_PROTOCOL_FTP && target->target->is_zchunk)
+            continue;
+
+        // Skip mirrors failing in this or in previous downloads
+        if (c_mirror->successful_transfers == 0
+            && dd->allowed_mirror_failures > 0
+            && c_mirror->failed_transfers >= dd->allowed_mirror_failures)
+            continue;
+        if (c_mirror->previous_failed_transfers >= 1.0
+            && c_mirror->previous_successful_transfers < 0.5
+            && c_mirror->successful_transfers == 0)
+            continue;
+
+        guint64 score = lr_mirror_rendezvous_score(c_mirror->mirror->url,
+                                                   target->target->path);
+        if (!best || score > best_score) {
+            best = c_mirror;
+            best_score = score;
+        }
+    }
+
+    return best;
+}
+
 /** Select a suitable mirror
  */
 static gboolean
@@ -722,6 +1290,22 @@ select_suitable_mirror(LrDownload *dd,
     assert(!err || *err == NULL);
 
     *selected_mirror = NULL;
+
+    // The first try of the target goes to the mirror given by
+    // the rendezvous hashing (LRO_MIRRORHASHING), if it's busy
+    // the target waits for it
+    if (dd->mirrorhashing && !target->tried_mirrors) {
+        LrMirror *c_mirror = select_hashed_mirror(dd, target);
+        if (c_mirror) {
+            init_once_allowed_parallel_connections(c_mirror, dd->max_connection_per_host);
+            if (!is_parallel_connections_limited_and_reached(c_mirror)
+                && !is_host_connections_limited_and_reached(c_mirror,
+                                                            dd->max_connection_per_mirror_host))
+                *selected_mirror = c_mirror;
+            return TRUE;
+        }
+    }
+
     // mirrors_iterated is used to allow to use mirrors multiple times for a target
     unsigned mirrors_iterated = 0;
     // retry local paths have no reason
@@ -802,6 +1386,13 @@ select_suitable_mirror(LrDownload *dd,
                 continue;
             }
 
+            // Check number of connections to all mirrors on its host
+            if (is_host_connections_limited_and_reached(c_mirror,
+                                                        dd->max_connection_per_mirror_host))
+            {
+                continue;
+            }
+
             // This mirror looks suitable - use it
             *selected_mirror = c_mirror;
             return TRUE;
@@ -812,7 +1403,7 @@ select_suitable_mirror(LrDownload *dd,
     if (!at_least_one_suitable_mirror_found) {
         // No suitable mirror even exists => Set transfer as failed
         g_debug("%s: All mirrors were tried without success", __func__);
-        target->state = LR_DS_FAILED;
+        set_target_done(dd, target, LR_DS_FAILED);
 
         lr_downloadtarget_set_error(target->target, LRE_NOURL,
                     "Cannot download, all mirrors were already tried "
@@ -849,6 +1440,89 @@ select_suitable_mirror(LrDownload *dd,
 }
 
 
+/** Best measured throughput (bytes/s) of the mirrors or 0.0 if unknown */
+static double
+mirrors_throughput(GSList *lrmirrors)
+{
+    double best = 0.0;
+    for (GSList *elem = lrmirrors; elem; elem = g_slist_next(elem)) {
+        LrMirror *mirror = elem->data;
+        if (mirror->download_time > 0.0)
+            best = MAX(best, mirror->downloaded_bytes / mirror->download_time);
+    }
+    return best;
+}
+
+static gint
+schedule_cmp(gconstpointer a, gconstpointer b, gpointer data)
+{
+    const LrTarget *ta = a;
+    const LrTarget *tb = b;
+    LrSchedulePolicy policy = GPOINTER_TO_INT(data);
+
+    if (ta->target->priority != tb->target->priority)
+        return ta->target->priority > tb->target->priority ? -1 : 1;
+
+    if (policy == LR_SCHEDULE_PRIORITY)
+        return 0;
+
+    // Targets with unknown size go last
+    if ((ta->duration < 0.0) != (tb->duration < 0.0))
+        return ta->duration < 0.0 ? 1 : -1;
+
+    if (ta->duration == tb->duration)
+        return 0;
+
+    if (policy == LR_SCHEDULE_LONGESTFIRST)
+        return ta->duration > tb->duration ? -1 : 1;
+    return ta->duration < tb->duration ? -1 : 1;
+}
+
+/** Sort the targets by LRO_SCHEDULEPOLICY.
+ * The sort is stable, so ties keep the order of the targets.
+ */
+static void
+schedule_targets(LrDownload *dd)
+{
+    // Throughput of each handle's mirrors. Mirrors without measurements
+    // get the mean of the measured ones, so durations stay comparable.
+    GHashTable *throughputs = g_hash_table_new_full(g_direct_hash,
+                                                    g_direct_equal,
+                                                    NULL, g_free);
+    double sum = 0.0;
+    int measured = 0;
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
+        LrHandleMirrors *handle_mirrors = elem->data;
+        double *throughput = g_new(double, 1);
+        *throughput = mirrors_throughput(handle_mirrors->lrmirrors);
+        if (*throughput > 0.0) {
+            sum += *throughput;
+            measured++;
+        }
+        g_hash_table_insert(throughputs, handle_mirrors->lrmirrors, throughput);
+    }
+    double mean = measured ? sum / measured : 1.0;
+
+    for (GSList *elem = dd->targets; elem; elem = g_slist_next(elem)) {
+        LrTarget *target = elem->data;
+        double *throughput = g_hash_table_lookup(throughputs, target->lrmirrors);
+
+        if (target->target->expectedsize <= 0) {
+            target->duration = -1.0;
+            continue;
+        }
+
+        target->duration = (double) target->target->expectedsize
+                           / ((throughput && *throughput > 0.0) ? *throughput : mean);
+    }
+
+    g_hash_table_destroy(throughputs);
+
+    dd->targets = g_slist_sort_with_data(dd->targets, schedule_cmp,
+                                         GINT_TO_POINTER(dd->schedulepolicy));
+    dd->schedule_dirty = FALSE;
+}
+
 /** Select next target
  */
 static gboolean
@@ -865,6 +1539,9 @@ select_next_target(LrDownload *dd,
     *selected_target = NULL;
     *selected_full_url = NULL;
 
+    if (dd->schedulepolicy != LR_SCHEDULE_FIFO && dd->schedule_dirty)
+        schedule_targets(dd);
+
     for (GSList *elem = dd->targets; elem; elem = g_slist_next(elem)) {
         LrTarget *target = elem->data;
         LrMirror *mirror = NULL;
@@ -935,7 +1612,7 @@ select_next_target(LrDownload *dd,
                     __func__, full_url);
 
             // Mark the target as failed
-            target->state = LR_DS_FAILED;
+            set_target_done(dd, target, LR_DS_FAILED);
             lr_downloadtarget_set_error(target->target, LRE_NOURL,
                     "Cannot download, offline mode is specified and no "
                     "local URL is available");
@@ -1041,13 +1718,399 @@ remove_librepo_xattr(LrDownloadTarget * target)
     close(fd);
 }
 
+/** Max number of threads checking files downloaded by other processes */
+#define LOCK_CHECK_MAX_THREADS  4
+
+/** Interval (in ms) of attempts to take a lock held by another process */
+#define LOCK_WAIT_POLL_MS       100
+
+/** Check of the file of a held target, whose lock was released by
+ * another process (LRO_LOCKTARGETS). Runs in LrDownload.lock_pool. */
+typedef struct {
+    LrDownloadTarget *target;   /*!< Held target */
+    int fd;                     /*!< Locked file of the target */
+    GAsyncQueue *checks;        /*!< LrDownload.checks */
+    gint *cancel;               /*!< LrDownload.lock_cancel */
+} LrLockCheck;
+
+/** Check if the file downloaded by another process is the one the target
+ * wants. Only a matching checksum counts, targets without checksums
+ * are downloaded again.
+ */
+static gboolean
+locked_file_matches(int fd, LrDownloadTarget *target)
+{
+    for (GSList *elem = target->checksums; elem; elem = g_slist_next(elem)) {
+        LrDownloadTargetChecksum *chksum = elem->data;
+        gboolean matches = FALSE;
+
+        if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
+            continue;  // Bad checksum
+
+        lseek(fd, 0, SEEK_SET);
+        if (lr_checksum_fd_cmp(chksum->type, fd, chksum->value, 1,
+                               &matches, NULL) && matches)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+push_target_check(GAsyncQueue *checks,
+                  LrDownloadTarget *target,
+                  LrTargetCheckResult result)
+{
+    LrTargetCheck *check = g_new0(LrTargetCheck, 1);
+    check->target = target;
+    check->result = result;
+    g_async_queue_push(checks, check);
+}
+
+static void
+lock_check_run(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    LrLockCheck *job = data;
+
+    if (!g_atomic_int_get(job->cancel) && !lr_interrupt) {
+        LrTargetCheckResult result = LR_TARGETCHECK_DOWNLOAD;
+        if (locked_file_matches(job->fd, job->target))
+            result = LR_TARGETCHECK_DOWNLOADED;
+        push_target_check(job->checks, job->target, result);
+    }
+
+    close(job->fd);  // Releases the lock
+    g_free(job);
+}
+
+/** Try to take the locks of the files of dd->lock_waiting, at most once
+ * per LOCK_WAIT_POLL_MS. Files unlocked by the other processes are
+ * checked in dd->lock_pool, the results go to dd->checks.
+ */
+static void
+poll_target_locks(LrDownload *dd)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (!dd->lock_waiting || now - dd->lock_polled < LOCK_WAIT_POLL_MS * 1000)
+        return;
+    dd->lock_polled = now;
+
+    GSList *elem = dd->lock_waiting;
+    while (elem) {
+        GSList *next = g_slist_next(elem);
+        LrTarget *target = elem->data;
+        int fd = open(target->target->fn, O_RDONLY);
+
+        if (fd == -1) {
+            // Removed by the other process after a failure
+            push_target_check(dd->checks, target->target,
+                              LR_TARGETCHECK_DOWNLOAD);
+        } else if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            if (!dd->lock_pool)
+                dd->lock_pool = g_thread_pool_new(lock_check_run, NULL,
+                                                  LOCK_CHECK_MAX_THREADS,
+                                                  FALSE, NULL);
+            LrLockCheck *job = g_new0(LrLockCheck, 1);
+            job->target = target->target;
+            job->fd = fd;
+            job->checks = dd->checks;
+            job->cancel = &dd->lock_cancel;
+            g_thread_pool_push(dd->lock_pool, job, NULL);
+        } else {
+            int errsv = errno;
+            close(fd);
+            if (errsv == EWOULDBLOCK) {
+                elem = next;
+                continue;  // Still locked
+            }
+            push_target_check(dd->checks, target->target,
+                              LR_TARGETCHECK_DOWNLOAD);
+        }
+
+        dd->lock_waiting = g_slist_delete_link(dd->lock_waiting, elem);
+        elem = next;
+    }
+}
+
+/** Open and lock the destination file of the target (LRO_LOCKTARGETS).
+ * The locked file is kept in target->lock_fd. If another process holds
+ * the lock, the target is held until the lock is released (see
+ * poll_target_locks()).
+ * @param err       GError **
+ * @return          FALSE if err is set
+ */
+static gboolean
+lock_target_file(LrDownload *dd, LrTarget *target, GError **err)
+{
+    const char *fn = target->target->fn;
+
+    assert(!err || *err == NULL);
+    assert(target->lock_fd == -1);
+
+    while (1) {
+        struct stat fd_st, fn_st;
+        int locked_fd = open(fn, O_CREAT|O_RDWR, 0666);
+        if (locked_fd == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot open %s: %s", fn, g_strerror(errno));
+            return FALSE;
+        }
+
+        if (flock(locked_fd, LOCK_EX | LOCK_NB) != 0) {
+            int errsv = errno;
+            close(locked_fd);
+            if (errsv != EWOULDBLOCK) {
+                // Locks are not supported here, continue without them
+                g_debug("%s: Cannot lock %s: %s", __func__, fn,
+                        g_strerror(errsv));
+                return TRUE;
+            }
+            break;
+        }
+
+        // The file could be removed (after a failed download) by another
+        // process between the open() and the flock(), lock the new one
+        if (fstat(locked_fd, &fd_st) == 0
+            && stat(fn, &fn_st) == 0
+            && fd_st.st_dev == fn_st.st_dev
+            && fd_st.st_ino == fn_st.st_ino)
+        {
+            target->lock_fd = locked_fd;
+            return TRUE;
+        }
+
+        close(locked_fd);
+    }
+
+    g_debug("%s: %s is being downloaded by another process, waiting",
+            __func__, fn);
+
+    target->state = LR_DS_HELD;
+    g_hash_table_insert(dd->held, target->target, target);
+    dd->lock_waiting = g_slist_append(dd->lock_waiting, target);
+
+    return TRUE;
+}
+
+/** Release the lock of the destination file of the target */
+static void
+unlock_target_file(LrTarget *target)
+{
+    if (target->lock_fd != -1) {
+        close(target->lock_fd);
+        target->lock_fd = -1;
+    }
+}
+
+#define LR_CONDITIONAL_CACHE_DIR        "conditional"
+#define LR_CONDITIONAL_XATTR            "user.librepo.validators"
+#define LR_CONDITIONAL_GROUP            "validators"
+
+/** Return path to the cached copy of the url if a conditional request
+ * should be used for the target. Otherwise return NULL.
+ * Validators of the cached copy are stored (as a key file) in its
+ * LR_CONDITIONAL_XATTR extended attribute, so a single rename()
+ * replaces both of them.
+ */
+static gchar *
+conditional_cache_path(LrTarget *target, const char *url, LrProtocol protocol)
+{
+    LrHandle *handle = target->handle;
+
+    if (!target->target->conditional || target->target->datacb
+        || protocol != LR_PROTOCOL_HTTP)
+        return NULL;
+
+    // Partial downloads cannot be served from the cached copy
+    if (target->resume || target->target->is_zchunk
+        || target->target->byterangestart || target->target->range)
+        return NULL;
+
+    if (!handle || !handle->conditionalget || !handle->cachedir)
+        return NULL;
+
+    _cleanup_free_ gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256,
+                                                               url, -1);
+    return lr_pathconcat(handle->cachedir, LR_CONDITIONAL_CACHE_DIR, hash, NULL);
+}
+
+/** Append If-None-Match and If-Modified-Since headers with validators
+ * of the cached copy of the target (if there are any).
+ */
+static struct curl_slist *
+add_conditional_headers(LrTarget *target, struct curl_slist *headers)
+{
+    _cleanup_free_ gchar *data = NULL;
+    _cleanup_free_ gchar *etag = NULL;
+    _cleanup_free_ gchar *last_modified = NULL;
+    _cleanup_keyfile_unref_ GKeyFile *keyfile = NULL;
+    LrTransfer *transfer = target->transfer;
+    ssize_t len;
+    int fd;
+
+    transfer->validators_sent = FALSE;
+
+    if (!transfer->conditional_cache)
+        return headers;
+
+    fd = open(transfer->conditional_cache, O_RDONLY);
+    if (fd == -1)
+        return headers;
+
+    len = FGETXATTR(fd, LR_CONDITIONAL_XATTR, NULL, 0);
+    if (len > 0) {
+        data = g_malloc0(len + 1);
+        len = FGETXATTR(fd, LR_CONDITIONAL_XATTR, data, len);
+    }
+    keyfile = g_key_file_new();
+    if (len <= 0 || !g_key_file_load_from_data(keyfile, data, len,
+                                               G_KEY_FILE_NONE, NULL)) {
+        close(fd);
+        return headers;
+    }
+
+    etag = g_key_file_get_string(keyfile, LR_CONDITIONAL_GROUP, "etag", NULL);
+    last_modified = g_key_file_get_string(keyfile, LR_CONDITIONAL_GROUP,
+                                          "last_modified", NULL);
+
+    if (etag) {
+        _cleanup_free_ gchar *header = g_strconcat("If-None-Match: ", etag, NULL);
+        headers = curl_slist_append(headers, header);
+        transfer->validators_sent = TRUE;
+    }
+    if (last_modified) {
+        _cleanup_free_ gchar *header = g_strconcat("If-Modified-Since: ",
+                                                   last_modified, NULL);
+        headers = curl_slist_append(headers, header);
+        transfer->validators_sent = TRUE;
+    }
+    if (transfer->validators_sent && !headers)
+        lr_out_of_memory();
+
+    if (transfer->validators_sent)
+        transfer->conditional_fd = fd;
+    else
+        close(fd);
+
+    return headers;
+}
+
+/** Remove validators of the cached copy whose validators were sent,
+ * so the next request will not be conditional. A copy stored meanwhile
+ * by another process is not affected.
+ */
+static void
+remove_conditional_validators(LrTarget *target)
+{
+    int fd = target->transfer->conditional_fd;
+
+    if (fd != -1 && FREMOVEXATTR(fd, LR_CONDITIONAL_XATTR) == -1)
+        g_debug("%s: Cannot remove validators of %s: %s", __func__,
+                target->transfer->conditional_cache, g_strerror(errno));
+}
+
+/** Store a copy of the downloaded target with its validators to
+ * the cachedir. The copy is written to a temporary file, which
+ * atomically replaces the previous copy. Errors are not fatal, they only
+ * disable conditional requests for the next download.
+ */
+static void
+store_conditional_cache(LrTarget *target, int fd)
+{
+    _cleanup_free_ gchar *dir = NULL;
+    _cleanup_free_ gchar *tmp = NULL;
+    _cleanup_free_ gchar *data = NULL;
+    _cleanup_keyfile_unref_ GKeyFile *keyfile = NULL;
+    gsize len;
+    int cache_fd;
+    LrTransfer *transfer = target->transfer;
+
+    if (!transfer->conditional_cache)
+        return;
+
+    if (!transfer->etag && !transfer->last_modified) {
+        // Old validators are not valid for the new content
+        if (unlink(transfer->conditional_cache) != 0 && errno != ENOENT)
+            g_debug("%s: Cannot remove %s: %s", __func__,
+                    transfer->conditional_cache, g_strerror(errno));
+        return;
+    }
+
+    dir = g_path_get_dirname(transfer->conditional_cache);
+    if (g_mkdir_with_parents(dir, 0755) != 0) {
+        g_debug("%s: Cannot create %s: %s", __func__, dir, g_strerror(errno));
+        return;
+    }
+
+    keyfile = g_key_file_new();
+    if (transfer->etag)
+        g_key_file_set_string(keyfile, LR_CONDITIONAL_GROUP, "etag", transfer->etag);
+    if (transfer->last_modified)
+        g_key_file_set_string(keyfile, LR_CONDITIONAL_GROUP, "last_modified",
+                              transfer->last_modified);
+    data = g_key_file_to_data(keyfile, &len, NULL);
+
+    // Unique name, other processes could store the same url
+    tmp = g_strconcat(transfer->conditional_cache, ".XXXXXX", NULL);
+    cache_fd = g_mkstemp(tmp);
+    if (cache_fd == -1) {
+        g_debug("%s: Cannot create %s: %s", __func__, tmp, g_strerror(errno));
+        return;
+    }
+    if (fchmod(cache_fd, 0644) != 0
+        || lr_copy_content(fd, cache_fd) != 0
+        || FSETXATTR(cache_fd, LR_CONDITIONAL_XATTR, data, len, 0) != 0)
+    {
+        g_debug("%s: Cannot store %s: %s", __func__, tmp, g_strerror(errno));
+        close(cache_fd);
+        unlink(tmp);
+        lseek(fd, 0, SEEK_SET);
+        return;
+    }
+    close(cache_fd);
+    lseek(fd, 0, SEEK_SET);
+
+    if (rename(tmp, transfer->conditional_cache) != 0) {
+        g_debug("%s: Cannot rename %s: %s", __func__, tmp, g_strerror(errno));
+        unlink(tmp);
+    }
+}
+
+/** Fill the target with the cached copy after 304 Not Modified response.
+ */
+static gboolean
+restore_conditional_cache(LrTarget *target, int fd, GError **err)
+{
+    int cache_fd = target->transfer->conditional_fd;
+    int rc;
+
+    assert(!err || *err == NULL);
+    assert(cache_fd != -1);
+
+    rc = ftruncate(fd, 0);
+    if (rc == 0)
+        rc = lr_copy_content(cache_fd, fd);
+    lseek(fd, 0, SEEK_SET);
+
+    if (rc != 0) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot copy cached %s: %s",
+                    target->transfer->conditional_cache, g_strerror(errno));
+        remove_conditional_validators(target);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 #ifdef WITH_ZCHUNK
 gboolean
 lr_zck_clear_header(LrTarget *target, GError **err)
 {
-    assert(target && target->f && target->target && target->target->path);
+    assert(target && target->transfer->f && target->target && target->target->path);
 
-    int fd = fileno(target->f);
+    int fd = fileno(target->transfer->f);
     lseek(fd, 0, SEEK_END);
     if(ftruncate(fd, 0) < 0) {
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
@@ -1063,7 +2126,7 @@ find_local_zck_header(LrTarget *target, GError **err)
 {
     zckCtx *zck = NULL;
     gboolean found = FALSE;
-    int fd = fileno(target->f);
+    int fd = fileno(target->transfer->f);
 
     if(target->target->handle->cachedir) {
         g_debug("%s: Cache directory: %s\n", __func__,
@@ -1142,7 +2205,7 @@ static gboolean
 prep_zck_header(LrTarget *target, GError **err)
 {
     zckCtx *zck = NULL;
-    int fd = fileno(target->f);
+    int fd = fileno(target->transfer->f);
     GError *tmp_err = NULL;
 
     if(lr_zck_valid_header(target->target, target->target->path, fd,
@@ -1188,8 +2251,22 @@ prep_zck_header(LrTarget *target, GError **err)
     } else {
         target->target->zck_dl = zck_dl_init(zck);
     }
-    target->target->range = zck_get_range(0, target->target->zck_header_size-1);
-    target->target->total_to_download = target->target->zck_header_size;
+
+    /* Speculatively request the leading part of the body together with the
+     * header. Whatever arrives is written after the header and chunks which
+     * are complete get validated by zck_find_valid_chunks() in the
+     * LR_ZCK_DL_BODY_CK stage, so they are not requested again. */
+    gint64 header_end = target->target->zck_header_size - 1;
+    if (target->handle && target->handle->zckheaderprefetch > 0) {
+        header_end += target->handle->zckheaderprefetch;
+        if (target->target->origsize > 0 &&
+            header_end > target->target->origsize - 1)
+            header_end = target->target->origsize - 1;
+        g_debug("%s: Prefetching %"G_GINT64_FORMAT" bytes of %s",
+                __func__, header_end + 1, target->target->path);
+    }
+    target->target->range = zck_get_range(0, header_end);
+    target->target->total_to_download = header_end + 1;
     target->target->resume = 0;
     target->zck_state = LR_ZCK_DL_HEADER;
     return lr_zck_clear_header(target, err);
@@ -1202,7 +2279,7 @@ find_local_zck_chunks(LrTarget *target, GError **err)
     assert(target && target->target && target->target->zck_dl);
 
     zckCtx *zck = zck_dl_get_zck(target->target->zck_dl);
-    int fd = fileno(target->f);
+    int fd = fileno(target->transfer->f);
     if(zck && fd != zck_get_fd(zck) && !zck_set_fd(zck, fd)) {
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_ZCK,
                     "Unable to set zchunk file descriptor for %s: %s",
@@ -1271,7 +2348,7 @@ static gboolean
 prep_zck_body(LrTarget *target, GError **err)
 {
     zckCtx *zck = zck_dl_get_zck(target->target->zck_dl);
-    int fd = fileno(target->f);
+    int fd = fileno(target->transfer->f);
     if(zck && fd != zck_get_fd(zck) && !zck_set_fd(zck, fd)) {
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_ZCK,
                     "Unable to set zchunk file descriptor for %s: %s",
@@ -1311,7 +2388,7 @@ static gboolean
 check_zck(LrTarget *target, GError **err)
 {
     assert(!err || *err == NULL);
-    assert(target && target->f && target->target);
+    assert(target && target->transfer->f && target->target);
 
     if(target->mirror->max_ranges == 0 || target->mirror->mirror->protocol != LR_PROTOCOL_HTTP) {
         target->zck_state = LR_ZCK_DL_BODY;
@@ -1332,7 +2409,7 @@ check_zck(LrTarget *target, GError **err)
     }
 
     /* Reset range fail flag */
-    target->range_fail = FALSE;
+    target->transfer->range_fail = FALSE;
 
     /* If we've finished, then there's no point in checking any further */
     if(target->zck_state == LR_ZCK_DL_FINISHED)
@@ -1401,15 +2478,34 @@ check_zck(LrTarget *target, GError **err)
 }
 #endif /* WITH_ZCHUNK */
 
+/** Number of bytes the target already passed to LrDownloadTarget.datacb */
+static gint64
+stream_offset(LrTarget *target)
+{
+    return target->stream ? target->stream->offset : 0;
+}
+
 /** Open the file to write to
+ * @param locked_fd     Duplicate of the file locked by lock_target_file()
+ *                      or -1, it is closed on error
  */
 static FILE*
-open_target_file(LrTarget *target, GError **err)
+open_target_file(LrTarget *target, int locked_fd, GError **err)
 {
     int fd;
     FILE *f;
 
-    if (target->target->fd != -1) {
+    if (locked_fd != -1) {
+        fd = locked_fd;
+        if (!target->resume && !target->target->is_zchunk
+            && !stream_offset(target) && ftruncate(fd, 0) == -1)
+        {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "ftruncate() failed: %s", g_strerror(errno));
+            close(fd);
+            return NULL;
+        }
+    } else if (target->target->fd != -1) {
         // Use supplied filedescriptor
         fd = dup(target->target->fd);
         if (fd == -1) {
@@ -1421,7 +2517,8 @@ open_target_file(LrTarget *target, GError **err)
     } else {
         // Use supplied filename
         int open_flags = O_CREAT|O_TRUNC|O_RDWR;
-        if (target->resume || target->target->is_zchunk)
+        if (target->resume || target->target->is_zchunk
+            || stream_offset(target))
             open_flags &= ~O_TRUNC;
 
         fd = open(target->target->fn, open_flags, 0666);
@@ -1445,10 +2542,90 @@ open_target_file(LrTarget *target, GError **err)
     return f;
 }
 
-/** Prepare next transfer
+/** Prepare a target with LrDownloadTarget.datacb for the transfer.
+ * A new stream starts its checksums, an interrupted stream
+ * continues from its offset.
  */
 static gboolean
-prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
+prepare_stream(LrTarget *target, CURL *curl_handle, GError **err)
+{
+    assert(!err || *err == NULL);
+
+    if (!target->stream)
+        target->stream = g_new0(LrTargetStream, 1);
+    LrTargetStream *stream = target->stream;
+
+    if (!stream->offset) {
+        g_slist_free_full(stream->checksums,
+                          (GDestroyNotify) lr_checksum_ctx_free);
+        stream->checksums = NULL;
+        for (GSList *elem = target->target->checksums; elem; elem = g_slist_next(elem)) {
+            LrDownloadTargetChecksum *chksum = elem->data;
+            LrChecksumCtx *ctx = NULL;
+            if (chksum && chksum->value && chksum->type != LR_CHECKSUM_UNKNOWN) {
+                ctx = lr_checksum_ctx_new(chksum->type, err);
+                if (!ctx)
+                    return FALSE;
+            }
+            stream->checksums = g_slist_append(stream->checksums, ctx);
+        }
+        return TRUE;
+    }
+
+    g_debug("%s: Continuing %s from offset %"G_GINT64_FORMAT,
+            __func__, target->target->path, stream->offset);
+
+    CURLcode c_rc = curl_easy_setopt(curl_handle, CURLOPT_RESUME_FROM_LARGE,
+                                     (curl_off_t) stream->offset);
+    assert(c_rc == CURLE_OK);
+
+    // A file opened by filename has to end with the passed data
+    if (target->transfer->f && target->target->fn
+        && (ftruncate(fileno(target->transfer->f), stream->offset) == -1
+            || fseek(target->transfer->f, stream->offset, SEEK_SET) == -1))
+    {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot seek %s to %"G_GINT64_FORMAT": %s",
+                    target->target->fn, stream->offset,
+                    g_strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Free the LrTransfer of the target (with its curl handle, FILE and
+ * request headers). The curl handle has to be removed from the multi
+ * handle already.
+ */
+static void
+end_transfer(LrTarget *target)
+{
+    LrTransfer *transfer = target->transfer;
+
+    if (!transfer)
+        return;
+
+    if (transfer->curl_handle)
+        curl_easy_cleanup(transfer->curl_handle);
+    if (transfer->f)
+        fclose(transfer->f);
+    if (transfer->curl_rqheaders)
+        curl_slist_free_all(transfer->curl_rqheaders);
+    if (transfer->conditional_fd != -1)
+        close(transfer->conditional_fd);
+    g_free(transfer->headercb_interrupt_reason);
+    g_free(transfer->conditional_cache);
+    g_free(transfer->etag);
+    g_free(transfer->last_modified);
+    g_free(transfer);
+    target->transfer = NULL;
+}
+
+/** Prepare next transfer
+ */
+static gboolean
+prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
 {
     LrTarget *target;
     _cleanup_free_ char *full_url = NULL;
@@ -1460,15 +2637,46 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
 
     *candidatefound = FALSE;
 
-    ret = select_next_target(dd, &target, &full_url, err);
-    if (!ret)  // Error
-        return FALSE;
+    while (1) {
+        g_free(full_url);
+        ret = select_next_target(dd, &target, &full_url, err);
+        if (!ret)  // Error
+            return FALSE;
 
-    if (!target)  // Nothing to do
-        return TRUE;
+        if (!target)  // Nothing to do
+            return TRUE;
+
+        if (target->lock_fd == -1 && target->target->fn
+            && target->handle && target->handle->locktargets)
+        {
+            if (!lock_target_file(dd, target, err))
+                return FALSE;
+            if (target->state == LR_DS_HELD)
+                // Another process is downloading the file, try the next target
+                continue;
+        }
+
+        break;
+    }
+
+    // The lock stays with target->lock_fd when the FILE is closed
+    int locked_fd = -1;
+    if (target->lock_fd != -1 && (locked_fd = dup(target->lock_fd)) == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "dup(%d) failed: %s", target->lock_fd, g_strerror(errno));
+        return FALSE;
+    }
 
     *candidatefound = TRUE;
 
+    target->transfer = g_new0(LrTransfer, 1);
+    target->transfer->conditional_fd = -1;
+
+    // Conditional requests are keyed by URL without the one-time flag
+    target->transfer->conditional_cache = conditional_cache_path(target, full_url,
+                                                                 lr_detect_protocol(full_url));
+    target->target->not_modified = FALSE;
+
     // Append the LRO_ONETIMEFLAG if instructed to do so
     LrHandle *handle = target->handle;
     if (handle && handle->onetimeflag && handle->onetimeflag_apply) {
@@ -1501,7 +2709,18 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
                     "curl_easy_duphandle() call failed");
         goto fail;
     }
-    target->curl_handle = h;
+    target->transfer->curl_handle = h;
+
+    // Reuse connections of the fastest mirror probes done by this thread
+    if (target->handle && target->handle->fastestmirrorkeepconns) {
+        c_rc = curl_easy_setopt(h, CURLOPT_SHARE, lr_curl_thread_share());
+        if (c_rc != CURLE_OK) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                        "curl_easy_setopt(h, CURLOPT_SHARE, _) failed: %s",
+                        curl_easy_strerror(c_rc));
+            goto fail;
+        }
+    }
 
     // Set URL
     c_rc = curl_easy_setopt(h, CURLOPT_URL, full_url);
@@ -1513,8 +2732,7 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
     }
 
     // Set error buffer
-    target->errorbuffer[0] = '\0';
-    c_rc = curl_easy_setopt(h, CURLOPT_ERRORBUFFER, target->errorbuffer);
+    c_rc = curl_easy_setopt(h, CURLOPT_ERRORBUFFER, target->transfer->errorbuffer);
     if (c_rc != CURLE_OK) {
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
                     "curl_easy_setopt(h, CURLOPT_ERRORBUFFER, target->errorbuffer) failed: %s",
@@ -1522,12 +2740,15 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
         goto fail;
     }
 
-    // Prepare FILE
-    target->f = open_target_file(target, err);
-    if (!target->f)
-        goto fail;
-    target->writecb_recieved = 0;
-    target->writecb_required_range_written = FALSE;
+    // Prepare FILE (targets with datacb don't need one)
+    if (target->target->fd != -1 || target->target->fn) {
+        target->transfer->f = open_target_file(target, locked_fd, err);
+        locked_fd = -1;
+        if (!target->transfer->f)
+            goto fail;
+    }
+    target->transfer->writecb_recieved = 0;
+    target->transfer->writecb_required_range_written = FALSE;
 
     #ifdef WITH_ZCHUNK
     // If file is zchunk, prep it
@@ -1545,7 +2766,7 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
         // If zchunk is finished, we're done, so move to next target
         if(target->zck_state == LR_ZCK_DL_FINISHED) {
             g_debug("%s: Target already fully downloaded: %s", __func__, target->target->path);
-            target->state = LR_DS_FINISHED;
+            set_target_done(dd, target, LR_DS_FINISHED);
             LrEndCb end_cb =  target->target->endcb;
             if (end_cb) {
                 int rc = end_cb(target->target->cbdata,
@@ -1557,19 +2778,15 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
                     goto fail;
                 }
             }
-            curl_easy_cleanup(target->curl_handle);
-            target->curl_handle = NULL;
-            g_free(target->headercb_interrupt_reason);
-            target->headercb_interrupt_reason = NULL;
-            fclose(target->f);
-            target->f = NULL;
+            end_transfer(target);
+            unlock_target_file(target);
             lr_downloadtarget_set_error(target->target, LRE_OK, NULL);
             return prepare_next_transfer(dd, candidatefound, err);
         }
     }
     # endif /* WITH_ZCHUNK */
 
-    int fd = fileno(target->f);
+    int fd = target->transfer->f ? fileno(target->transfer->f) : -1;
 
     if (target->resume && target->resume_count >= LR_DOWNLOADER_MAXIMAL_RESUME_COUNT) {
         target->resume = FALSE;
@@ -1581,8 +2798,8 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
     if (target->resume) {
         if (target->original_offset == -1) {
             // Determine offset
-            fseek(target->f, 0L, SEEK_END);
-            gint64 determined_offset = ftell(target->f);
+            fseek(target->transfer->f, 0L, SEEK_END);
+            gint64 determined_offset = ftell(target->transfer->f);
             if (determined_offset == -1) {
                 // An error while determining offset =>
                 // Download the whole file again
@@ -1592,7 +2809,7 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
         } else if (target->original_offset > 0) {
             // Seek the file to the resume offset so that received
             // data is written at the correct position.
-            fseek(target->f, target->original_offset, SEEK_SET);
+            fseek(target->transfer->f, target->original_offset, SEEK_SET);
         }
 
         // Starting from offset 0 is a fresh download, not a resume.
@@ -1632,7 +2849,11 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
     // If librepo tries to resume a download, it checks if the xattr is present.
     // If it isn't the download is not resumed, but whole file is
     // downloaded again.
-    add_librepo_xattr(fd, target->target->fn);
+    if (fd != -1)
+        add_librepo_xattr(fd, target->target->fn);
+
+    if (target->target->datacb && !prepare_stream(target, h, err))
+        goto fail;
 
     if (target->target->byterangestart > 0) {
         assert(!target->target->resume && !target->target->range);
@@ -1660,7 +2881,7 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
     }
 
     // Prepare header callback
-    if (target->target->expectedsize > 0) {
+    if (target->target->expectedsize > 0 || target->transfer->conditional_cache) {
         c_rc = curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, lr_headercb) ||
                curl_easy_setopt(h, CURLOPT_HEADERDATA, target);
         assert(c_rc == CURLE_OK);
@@ -1688,7 +2909,8 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
         if (!headers)
             lr_out_of_memory();
     }
-    target->curl_rqheaders = headers;
+    headers = add_conditional_headers(target, headers);
+    target->transfer->curl_rqheaders = headers;
     c_rc = curl_easy_setopt(h, CURLOPT_HTTPHEADER, headers);
     assert(c_rc == CURLE_OK);
 
@@ -1705,89 +2927,447 @@ prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
     }
 
     // Set the state of header callback for this transfer
-    target->headercb_state = LR_HCS_DEFAULT;
-    g_free(target->headercb_interrupt_reason);
-    target->headercb_interrupt_reason = NULL;
+    target->transfer->headercb_state = LR_HCS_DEFAULT;
 
     // Set protocol of the target
     target->protocol = protocol;
 
     // Add the transfer to the list of running transfers
     dd->running_transfers = g_slist_append(dd->running_transfers, target);
+    dd->speeds_dirty = TRUE;
 
     return TRUE;
 
 fail:
     // Cleanup target
-    if (target->curl_handle) {
-        curl_easy_cleanup(target->curl_handle);
-        target->curl_handle = NULL;
+    if (locked_fd != -1)
+        close(locked_fd);
+    end_transfer(target);
+
+    return FALSE;
+}
+
+/** Weights of the QoS classes (see LrQosClass) */
+static const double qos_weights[LR_QOS_SENTINEL] = {
+    [LR_QOS_NORMAL]         = 2.0,
+    [LR_QOS_BACKGROUND]     = 1.0,
+    [LR_QOS_INTERACTIVE]    = 4.0,
+};
+
+static double
+qos_weight(const LrTarget *target)
+{
+    guint qosclass = target->target->qosclass;
+    if (qosclass >= LR_QOS_SENTINEL)
+        qosclass = LR_QOS_NORMAL;
+    return qos_weights[qosclass];
+}
+
+void
+lr_transfer_speeds_compute(LrTransferSpeed *transfers,
+                           guint count,
+                           gint64 totalmaxspeed)
+{
+    if (!count)
+        return;
+
+    // Sum of weights of running downloads from repos with limited speed
+    GHashTable *weights_per_repo = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    for (guint i = 0; i < count; i++) {
+        if (!transfers[i].repo || !transfers[i].repo_maxspeed) // Skip repos with unlimited speed or without handle
+            continue;
+
+        double *sum = g_hash_table_lookup(weights_per_repo, transfers[i].repo);
+        if (!sum) {
+            sum = g_new0(double, 1);
+            g_hash_table_insert(weights_per_repo, (gpointer) transfers[i].repo, sum);
+        }
+        *sum += transfers[i].weight;
     }
-    if (target->f != NULL) {
-        fclose(target->f);
-        target->f = NULL;
+
+    // Weighted share of the repo max speed (0.0 == unlimited)
+    for (guint i = 0; i < count; i++) {
+        double *sum = transfers[i].repo
+                      ? g_hash_table_lookup(weights_per_repo, transfers[i].repo)
+                      : NULL;
+        transfers[i].speed = sum
+                             ? transfers[i].repo_maxspeed * transfers[i].weight / *sum
+                             : 0.0;
     }
+    g_hash_table_destroy(weights_per_repo);
 
-    return FALSE;
+    // Weighted share of the total max speed. Transfers whose repo limit
+    // is lower than their share keep the repo limit and the bandwidth
+    // they cannot use is shared by the others (weighted max-min fairness).
+    if (!totalmaxspeed)
+        return;
+
+    gboolean *capped = g_new0(gboolean, count);
+    double remaining = (double) totalmaxspeed;
+    double level = 0.0; // Speed per unit of weight
+    gboolean changed;
+    do {
+        changed = FALSE;
+        double sum = 0.0;
+        for (guint i = 0; i < count; i++)
+            if (!capped[i])
+                sum += transfers[i].weight;
+        if (sum <= 0.0)
+            break;
+        level = remaining / sum;
+        for (guint i = 0; i < count; i++) {
+            double speed = transfers[i].speed;
+            if (capped[i] || speed <= 0.0 || speed > level * transfers[i].weight)
+                continue;
+            capped[i] = TRUE;
+            remaining -= speed;
+            changed = TRUE;
+        }
+    } while (changed);
+
+    for (guint i = 0; i < count; i++)
+        if (!capped[i])
+            transfers[i].speed = MAX(level * transfers[i].weight, 1.0);
+
+    g_free(capped);
 }
 
+/** Share LRO_MAXSPEED of each handle and LRO_TOTALMAXSPEED between
+ * the running transfers in proportion to the weights of their QoS classes
+ * (see lr_transfer_speeds_compute()).
+ * Speeds are computed again only when a transfer starts or finishes.
+ */
 static gboolean
 set_max_speeds_to_transfers(LrDownload *dd, GError **err)
 {
     assert(!err || *err == NULL);
 
-    if (!g_slist_length(dd->running_transfers)) // Nothing to do
+    if (!dd->speeds_dirty)
         return TRUE;
+    dd->speeds_dirty = FALSE;
 
-    // Compute number of running downloads from repos with limited speed
-    GHashTable *num_running_downloads_per_repo = g_hash_table_new(NULL, NULL);
-    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
-        const LrTarget *ltarget = elem->data;
-
-        if (!ltarget->handle || !ltarget->handle->maxspeed) // Skip repos with unlimited speed or without handle
-            continue;
+    guint count = g_slist_length(dd->running_transfers);
+    if (!count) // Nothing to do
+        return TRUE;
 
-        guint num_running_downloads_from_repo =
-            GPOINTER_TO_UINT(g_hash_table_lookup(num_running_downloads_per_repo, ltarget->handle));
-        if (num_running_downloads_from_repo)
-            ++num_running_downloads_from_repo;
-        else
-            num_running_downloads_from_repo = 1;
-        g_hash_table_insert(num_running_downloads_per_repo, ltarget->handle,
-                            GUINT_TO_POINTER(num_running_downloads_from_repo));
+    LrTransferSpeed *transfers = g_new(LrTransferSpeed, count);
+    guint i = 0;
+    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem), i++) {
+        const LrTarget *ltarget = elem->data;
+        transfers[i].repo = ltarget->handle;
+        transfers[i].repo_maxspeed = ltarget->handle ? ltarget->handle->maxspeed : 0;
+        transfers[i].weight = qos_weight(ltarget);
     }
+    lr_transfer_speeds_compute(transfers, count, dd->totalmaxspeed);
 
     // Set max speed to transfers
-    GHashTableIter iter;
-    gpointer key, value;
-    g_hash_table_iter_init(&iter, num_running_downloads_per_repo);
-    while (g_hash_table_iter_next(&iter, &key, &value)) {
-        const LrHandle *repo = key;
-        const guint num_running_downloads_from_repo = GPOINTER_TO_UINT(value);
+    gboolean ret = TRUE;
+    i = 0;
+    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem), i++) {
+        LrTarget *ltarget = elem->data;
+        // Rounded up, 0 == unlimited
+        curl_off_t speed = (curl_off_t) transfers[i].speed;
+        if (speed < transfers[i].speed)
+            speed++;
+        CURLcode code = curl_easy_setopt(ltarget->transfer->curl_handle,
+                                         CURLOPT_MAX_RECV_SPEED_LARGE,
+                                         speed);
+        if (code != CURLE_OK) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLSETOPT,
+                        "Cannot set CURLOPT_MAX_RECV_SPEED_LARGE option: %s",
+                        curl_easy_strerror(code));
+            ret = FALSE;
+            break;
+        }
+    }
 
-        // Calculate a max speed (rounded up) per target (for repo)
-        const gint64 single_target_speed =
-            (repo->maxspeed + (num_running_downloads_from_repo - 1)) / num_running_downloads_from_repo;
+    g_free(transfers);
 
-        for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
-            LrTarget *ltarget = elem->data;
-            if (ltarget->handle == repo) {
-                CURL *curl_handle = ltarget->curl_handle;
-                CURLcode code = curl_easy_setopt(curl_handle,
-                                                 CURLOPT_MAX_RECV_SPEED_LARGE,
-                                                 (curl_off_t)single_target_speed);
-                if (code != CURLE_OK) {
-                    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLSETOPT,
-                                "Cannot set CURLOPT_MAX_RECV_SPEED_LARGE option: %s",
-                                curl_easy_strerror(code));
-                    g_hash_table_destroy(num_running_downloads_per_repo);
-                    return FALSE;
+    return ret;
+}
+
+/** Create LrTarget for the LrDownloadTarget and append it
+ * to the list of targets of the download.
+ * @return          The new LrTarget
+ */
+static LrTarget *
+lr_download_add_target(LrDownload *dd, LrDownloadTarget *dtarget)
+{
+    // Assertions
+    assert(dtarget);
+    assert(dtarget->path);
+    assert((dtarget->fd > 0 && !dtarget->fn) || (dtarget->fd < 0 && dtarget->fn)
+           || (dtarget->fd < 0 && !dtarget->fn && dtarget->datacb));
+    assert(!dtarget->datacb || !dtarget->is_zchunk);
+    g_debug("%s: Target: %s (%s)", __func__,
+            dtarget->path,
+            (dtarget->baseurl) ? dtarget->baseurl : "-");
+
+    // Cleanup of LrDownloadTarget
+    lr_downloadtarget_reset(dtarget);
+
+    // Create and fill LrTarget
+    LrTarget *target;
+    if (dd->target_slab_used < dd->target_slab_len)
+        target = &dd->target_slab[dd->target_slab_used++];
+    else
+        target = lr_malloc0(sizeof(*target));
+    target->state           = LR_DS_WAITING;
+    target->target          = dtarget;
+    target->original_offset = -1;
+    target->lock_fd         = -1;
+    target->resume          = dtarget->resume && !dtarget->datacb;
+    target->target->rcode   = LRE_UNFINISHED;
+    target->target->err     = "Not finished";
+    target->handle          = dtarget->handle;
+    dd->targets = g_slist_append(dd->targets, target);
+    // Add list of handle internal mirrors to dd->handle_mirrors
+    // if doesn't exists yet and set the list reference
+    // to the target.
+    dd->handle_mirrors = lr_prepare_lrmirrors(dd->handle_mirrors, target,
+                                              dd->mirror_hosts);
+    dd->schedule_dirty = TRUE;
+    if (dtarget->handle && dtarget->handle->totalmaxspeed
+        && (!dd->totalmaxspeed
+            || dtarget->handle->totalmaxspeed < dd->totalmaxspeed)) {
+        dd->totalmaxspeed = dtarget->handle->totalmaxspeed;
+        dd->speeds_dirty = TRUE;
+    }
+    return target;
+}
+
+/** Free the LrTarget. Remove the file created for it if the download
+ * was unsuccessful and the file didn't exist before or its original
+ * content was overwritten. Files of held targets were not touched yet.
+ * The file is removed before its lock (LRO_LOCKTARGETS) is released.
+ */
+static void
+lr_target_free(LrDownload *dd, LrTarget *target)
+{
+    assert(target->transfer == NULL);
+
+    if (target->state != LR_DS_FINISHED && target->state != LR_DS_HELD) {
+        if (!target->resume || target->original_offset == 0) {
+            // Remove target file if the file doesn't
+            // exist before or was empty or was overwritten
+            if (target->target->fn) {
+                // We can remove only files that were specified by fn
+                if (unlink(target->target->fn) != 0) {
+                    g_warning("Error while removing: %s", g_strerror(errno));
                 }
             }
         }
     }
 
-    g_hash_table_destroy(num_running_downloads_per_repo);
+    unlock_target_file(target);
+
+    g_slist_free(target->tried_mirrors);
+    if (target->stream) {
+        g_slist_free_full(target->stream->checksums,
+                          (GDestroyNotify) lr_checksum_ctx_free);
+        g_free(target->stream);
+    }
+    if (!dd->target_slab || target < dd->target_slab
+        || target >= dd->target_slab + dd->target_slab_len)
+        lr_free(target);
+}
+
+/** Report targets which reached their final state via dd->donecb
+ * (in the order they finished) and add targets returned by the callback
+ * to the download.
+ * If dd->release_reported is set, the targets are removed from
+ * the download (and freed) before they are reported.
+ * @param added     Set to TRUE if at least one target was added.
+ */
+static gboolean
+report_done_targets(LrDownload *dd, gboolean *added, GError **err)
+{
+    assert(!err || *err == NULL);
+
+    *added = FALSE;
+
+    if (!dd->donecb)
+        return TRUE;
+
+    LrTarget *target;
+    while ((target = g_queue_pop_head(dd->done_targets))) {
+        LrDownloadTarget *dtarget = target->target;
+        GSList *new_targets = NULL;
+
+        if (dd->release_reported) {
+            dd->targets = g_slist_remove(dd->targets, target);
+            lr_target_free(dd, target);
+        }
+
+        gboolean ret = dd->donecb(dd->donecbdata, dtarget, &new_targets, err);
+
+        for (GSList *el = new_targets; el; el = g_slist_next(el)) {
+            lr_download_add_target(dd, el->data);
+            *added = TRUE;
+        }
+        g_slist_free(new_targets);
+
+        if (!ret)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Max time (in ms) between two looks at the results of the checks
+ * of held targets */
+#define HELD_TARGETS_POLL_MS    50
+
+static guint
+held_targets(LrDownload *dd)
+{
+    return g_hash_table_size(dd->held);
+}
+
+/** Finish or release held targets whose local files were already checked.
+ * @param may_wait      If no transfer is running, wait a while for
+ *                      the next result instead of busy looping.
+ * @param changed       Set to TRUE if at least one target became waiting
+ *                      or finished.
+ */
+static gboolean
+process_target_checks(LrDownload *dd,
+                      gboolean may_wait,
+                      gboolean *changed,
+                      GError **err)
+{
+    assert(!err || *err == NULL);
+
+    *changed = FALSE;
+
+    if (!held_targets(dd))
+        return TRUE;
+
+    poll_target_locks(dd);
+
+    LrTargetCheck *check;
+    if (dd->running_transfers || !may_wait)
+        check = g_async_queue_try_pop(dd->checks);
+    else
+        check = g_async_queue_timeout_pop(dd->checks,
+                                          HELD_TARGETS_POLL_MS * 1000);
+
+    for (; check; check = g_async_queue_try_pop(dd->checks)) {
+        LrTarget *target = g_hash_table_lookup(dd->held, check->target);
+        LrTargetCheckResult result = check->result;
+
+        if (!target) {
+            // The target was cancelled while held
+            if (!g_hash_table_remove(dd->dropped_checks, check->target))
+                g_warning("%s: Check result for an unknown target", __func__);
+            g_free(check);
+            continue;
+        }
+        g_free(check);
+
+        g_hash_table_remove(dd->held, target->target);
+        *changed = TRUE;
+
+        if (result == LR_TARGETCHECK_DOWNLOAD
+            || result == LR_TARGETCHECK_DOWNLOAD_NORESUME)
+        {
+            g_debug("%s: %s has to be downloaded", __func__,
+                    target->target->path);
+            if (result == LR_TARGETCHECK_DOWNLOAD_NORESUME)
+                target->resume = FALSE;
+            target->state = LR_DS_WAITING;
+            continue;
+        }
+
+        set_target_done(dd, target, LR_DS_FINISHED);
+
+        LrTransferStatus status;
+        const char *msg;
+        if (result == LR_TARGETCHECK_DOWNLOADED) {
+            // The same file was downloaded by another process
+            g_debug("%s: %s was downloaded by another process", __func__,
+                    target->target->path);
+            status = LR_TRANSFER_SUCCESSFUL;
+            msg = NULL;
+        } else {
+            g_debug("%s: %s is already downloaded", __func__,
+                    target->target->path);
+            status = LR_TRANSFER_ALREADYEXISTS;
+            msg = "Already downloaded";
+        }
+        lr_downloadtarget_set_error(target->target, LRE_OK, msg);
+
+        // Call end callback
+        LrEndCb end_cb = target->target->endcb;
+        if (end_cb) {
+            int rc = end_cb(target->target->cbdata, status, msg);
+            if (rc == LR_CB_ERROR) {
+                target->cb_return_code = LR_CB_ERROR;
+                g_debug("%s: Downloading was aborted by LR_CB_ERROR "
+                        "from end callback", __func__);
+                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                            "Interrupted by LR_CB_ERROR from end callback");
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+/** Max time (in ms) between two looks at the results of the works
+ * of dd->works */
+#define WORKS_POLL_MS           50
+
+static guint
+pending_works(LrDownload *dd)
+{
+    return dd->works ? dd->works->pending : 0;
+}
+
+/** Pass results of the finished works to their donecb and add targets
+ * returned by it to the download.
+ * @param may_wait      If no transfer is running and no target is held,
+ *                      wait a while for the next result instead of busy
+ *                      looping.
+ * @param added         Set to TRUE if at least one target was added.
+ */
+static gboolean
+process_works(LrDownload *dd,
+              gboolean may_wait,
+              gboolean *added,
+              GError **err)
+{
+    assert(!err || *err == NULL);
+
+    *added = FALSE;
+
+    if (!pending_works(dd))
+        return TRUE;
+
+    void *result;
+    if (dd->running_transfers || held_targets(dd) || !may_wait)
+        result = g_async_queue_try_pop(dd->works->results);
+    else
+        result = g_async_queue_timeout_pop(dd->works->results,
+                                           WORKS_POLL_MS * 1000);
+
+    for (; result; result = g_async_queue_try_pop(dd->works->results)) {
+        GSList *new_targets = NULL;
+
+        dd->works->pending--;
+        gboolean ret = dd->works->donecb(dd->donecbdata, result,
+                                         &new_targets, err);
+
+        for (GSList *elem = new_targets; elem; elem = g_slist_next(elem)) {
+            lr_download_add_target(dd, elem->data);
+            *added = TRUE;
+        }
+        g_slist_free(new_targets);
+
+        if (!ret)
+            return FALSE;
+    }
 
     return TRUE;
 }
@@ -1797,17 +3377,24 @@ prepare_next_transfers(LrDownload *dd, GError **err)
 {
     guint length = g_slist_length(dd->running_transfers);
     guint free_slots = dd->max_parallel_connections - length;
+    gboolean added;
 
     assert(!err || *err == NULL);
 
-    while (free_slots > 0) {
-        gboolean candidatefound;
-        if (!prepare_next_transfer(dd, &candidatefound, err))
+    do {
+        while (free_slots > 0) {
+            gboolean candidatefound;
+            if (!prepare_next_transfer(dd, &candidatefound, err))
+                return FALSE;
+            if (!candidatefound)
+                break;
+            free_slots--;
+        }
+
+        // Finished and failed targets could bring new targets
+        if (!report_done_targets(dd, &added, err))
             return FALSE;
-        if (!candidatefound)
-            break;
-        free_slots--;
-    }
+    } while (added && free_slots > 0);
 
     // Set maximal speed for each target
     if (!set_max_speeds_to_transfers(dd, err))
@@ -1847,7 +3434,7 @@ check_finished_transfer_status(CURLMsg *msg,
 
     *fatal_error = FALSE;
 
-    target->curl_code = msg->data.result;
+    target->transfer->curl_code = msg->data.result;
 
     curl_easy_getinfo(msg->easy_handle,
                       CURLINFO_EFFECTIVE_URL,
@@ -1857,7 +3444,7 @@ check_finished_transfer_status(CURLMsg *msg,
         // There was an error that is reported by CURLcode
 
         if (msg->data.result == CURLE_WRITE_ERROR &&
-            target->writecb_required_range_written)
+            target->transfer->writecb_required_range_written)
         {
             // Download was interrupted by writecb because
             // user want only specified byte range of the
@@ -1868,14 +3455,14 @@ check_finished_transfer_status(CURLMsg *msg,
                     "was downloaded.", __func__,
                     target->target->byterangestart,
                     target->target->byterangeend);
-        } else if (target->headercb_state == LR_HCS_INTERRUPTED) {
+        } else if (target->transfer->headercb_state == LR_HCS_INTERRUPTED) {
             // Download was interrupted by header callback
             g_set_error(transfer_err, LR_DOWNLOADER_ERROR, LRE_CURL,
                         "Interrupted by header callback: %s",
-                        target->headercb_interrupt_reason);
+                        target->transfer->headercb_interrupt_reason);
         }
         #ifdef WITH_ZCHUNK
-        else if (target->range_fail) {
+        else if (target->transfer->range_fail) {
             zckRange *range = zck_dl_get_range(target->target->zck_dl);
             int range_count = zck_get_range_count(range);
             if(target->mirror->max_ranges >= range_count) {
@@ -1912,7 +3499,7 @@ check_finished_transfer_status(CURLMsg *msg,
                         msg->data.result,
                         curl_easy_strerror(msg->data.result),
                         effective_url,
-                        target->errorbuffer);
+                        target->transfer->errorbuffer);
 
             switch (msg->data.result) {
             case CURLE_ABORTED_BY_CALLBACK:
@@ -1935,7 +3522,7 @@ check_finished_transfer_status(CURLMsg *msg,
                        msg->data.result,
                        curl_easy_strerror(msg->data.result),
                        effective_url,
-                       target->errorbuffer);
+                       target->transfer->errorbuffer);
                 *fatal_error = TRUE;
                 break;
             case CURLE_OPERATION_TIMEDOUT:
@@ -1944,7 +3531,7 @@ check_finished_transfer_status(CURLMsg *msg,
                        msg->data.result,
                        curl_easy_strerror(msg->data.result),
                        effective_url,
-                       target->errorbuffer);
+                       target->transfer->errorbuffer);
                 *serious_error = TRUE;
                 break;
             default:
@@ -1966,7 +3553,11 @@ check_finished_transfer_status(CURLMsg *msg,
         // Check status codes for some protocols
         if (effective_url && g_str_has_prefix(effective_url, "http")) {
             // Check HTTP(S) code
-            if (code/100 != 2) {
+            if (code == 304 && target->transfer->validators_sent) {
+                // Not Modified - the cached copy will be used
+                g_debug("%s: Not modified: %s", __func__, effective_url);
+                target->target->not_modified = TRUE;
+            } else if (code/100 != 2) {
                 g_set_error(transfer_err,
                             LR_DOWNLOADER_ERROR,
                             LRE_BADSTATUS,
@@ -2020,9 +3611,17 @@ list_of_checksums_to_str(GSList *checksums)
 }
 
 
+/** Check checksums of the downloaded target.
+ * @param fd                File of the target
+ * @param checksums         Expected checksums (LrDownloadTargetChecksum *)
+ * @param stream_checksums  If not NULL, checksums (LrChecksumCtx *) of the
+ *                          data passed to LrDownloadTarget.datacb are used
+ *                          instead of the file
+ */
 static gboolean
 check_finished_transfer_checksum(int fd,
                                  GSList *checksums,
+                                 GSList *stream_checksums,
                                  gboolean *checksum_matches,
                                  GError **transfer_err,
                                  GError **err)
@@ -2030,8 +3629,10 @@ check_finished_transfer_checksum(int fd,
     gboolean ret = TRUE;
     gboolean matches = TRUE;
     GSList *calculated_chksums = NULL;
+    GSList *stream_elem = stream_checksums;
 
-    for (GSList *elem = checksums; elem; elem = g_slist_next(elem)) {
+    for (GSList *elem = checksums; elem;
+         elem = g_slist_next(elem), stream_elem = g_slist_next(stream_elem)) {
         LrDownloadTargetChecksum *chksum = elem->data;
         LrDownloadTargetChecksum *calculated_chksum = NULL;
         gchar *calculated = NULL;
@@ -2039,16 +3640,25 @@ check_finished_transfer_checksum(int fd,
         if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
             continue;  // Bad checksum
 
-        lseek(fd, 0, SEEK_SET);
-        ret = lr_checksum_fd_compare(chksum->type,
-                                     fd,
-                                     chksum->value,
-                                     1,
-                                     &matches,
-                                     &calculated,
-                                     err);
-        if (!ret)
-            goto cleanup;
+        if (stream_checksums) {
+            calculated = lr_checksum_ctx_final(stream_elem->data, err);
+            if (!calculated) {
+                ret = FALSE;
+                goto cleanup;
+            }
+            matches = strcmp(chksum->value, calculated) == 0;
+        } else {
+            lseek(fd, 0, SEEK_SET);
+            ret = lr_checksum_fd_compare(chksum->type,
+                                         fd,
+                                         chksum->value,
+                                         1,
+                                         &matches,
+                                         &calculated,
+                                         err);
+            if (!ret)
+                goto cleanup;
+        }
 
         // Store calculated checksum
         calculated_chksum = lr_downloadtargetchecksum_new(chksum->type,
@@ -2092,6 +3702,35 @@ cleanup:
 }
 
 
+/** Return TRUE if the transfer of the target was interrupted by
+ * the header callback or by a range error, so the received data
+ * cannot be continued.
+ */
+static gboolean
+transfer_interrupted(LrTarget *target)
+{
+    return target->transfer->headercb_state == LR_HCS_INTERRUPTED
+           || target->transfer->curl_code == CURLE_RANGE_ERROR;
+}
+
+/** Return TRUE if the target passed data to LrDownloadTarget.datacb
+ * and cannot continue from another mirror after the error.
+ * Only interrupted transfers of whole files can continue.
+ * @param interrupted   See transfer_interrupted()
+ */
+static gboolean
+stream_broken(LrTarget *target, GError *transfer_err, gboolean interrupted)
+{
+    if (!stream_offset(target))
+        return FALSE;
+
+    return transfer_err->code != LRE_CURL
+           || interrupted
+           || target->target->byterangestart > 0
+           || target->target->byterangeend > 0
+           || target->target->range;
+}
+
 /** Truncate file - Used to remove downloaded garbage (error html pages, etc.)
  */
 static gboolean
@@ -2139,9 +3778,12 @@ mirror_rank(LrMirror *mirror)
 {
     gdouble rank = -1.0;
 
-    int successful = mirror->successful_transfers;
-    int failed = mirror->failed_transfers;
-    int finished_transfers = successful + failed;
+    // Previous downloads count too (LRO_MIRRORSTATS)
+    double successful = mirror->successful_transfers
+                        + mirror->previous_successful_transfers;
+    double failed = mirror->failed_transfers
+                    + mirror->previous_failed_transfers;
+    double finished_transfers = successful + failed;
 
     if (finished_transfers < 3)
         return rank; // Do not judge too early
@@ -2257,6 +3899,7 @@ check_transfer_statuses(LrDownload *dd, GError **err)
         gboolean serious_error = FALSE;
         gboolean fatal_error = FALSE;
         GError *fail_fast_error = NULL;
+        gboolean interrupted;
 
         if (msg->msg != CURLMSG_DONE) {
             // We are only interested in messages about finished transfers
@@ -2266,7 +3909,7 @@ check_transfer_statuses(LrDownload *dd, GError **err)
         // Find the target with this curl easy handle
         for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
             LrTarget *ltarget = elem->data;
-            if (ltarget->curl_handle == msg->easy_handle)
+            if (ltarget->transfer->curl_handle == msg->easy_handle)
                 target = ltarget;
         }
 
@@ -2298,14 +3941,22 @@ check_transfer_statuses(LrDownload *dd, GError **err)
         //
         // Checksum checking
         //
-        fflush(target->f);
-        fd = fileno(target->f);
+        if (target->transfer->f) {
+            fflush(target->transfer->f);
+            fd = fileno(target->transfer->f);
+        } else {
+            fd = -1;
+        }
+
+        if (target->target->not_modified
+            && !restore_conditional_cache(target, fd, &transfer_err))
+            goto transfer_error;
 
         // Preserve timestamp of downloaded file if requested
-        if (target->target->handle && target->target->handle->preservetime) {
+        if (fd != -1 && target->target->handle && target->target->handle->preservetime) {
             CURLcode c_rc;
             long remote_filetime = -1;
-            c_rc = curl_easy_getinfo(target->curl_handle, CURLINFO_FILETIME, &remote_filetime);
+            c_rc = curl_easy_getinfo(target->transfer->curl_handle, CURLINFO_FILETIME, &remote_filetime);
             if (c_rc == CURLE_OK && remote_filetime >= 0) {
                 const struct timeval tv[] = {{remote_filetime, 0}, {remote_filetime, 0}};
                 if (futimes(fd, tv) == -1)
@@ -2356,10 +4007,12 @@ check_transfer_statuses(LrDownload *dd, GError **err)
         } else {
         #endif /* WITH_ZCHUNK */
             // New file was downloaded - clear checksums cached in extended attributes
-            lr_checksum_clear_cache(fd);
+            if (fd != -1)
+                lr_checksum_clear_cache(fd);
 
             ret = check_finished_transfer_checksum(fd,
                                                   target->target->checksums,
+                                                  target->stream ? target->stream->checksums : NULL,
                                                   &matches,
                                                   &transfer_err,
                                                   &tmp_err);
@@ -2372,6 +4025,9 @@ check_transfer_statuses(LrDownload *dd, GError **err)
         #ifdef WITH_ZCHUNK
         }
         #endif /* WITH_ZCHUNK */
+        if (transfer_err && target->target->not_modified)
+            // Cached copy is broken, next request must not be conditional
+            remove_conditional_validators(target);
         if (transfer_err)  // Checksum doesn't match
             goto transfer_error;
 
@@ -2379,25 +4035,32 @@ check_transfer_statuses(LrDownload *dd, GError **err)
         // Any other checks should go here
         //
 
+        if (!target->target->not_modified)
+            store_conditional_cache(target, fd);
+        if (target->transfer->conditional_cache)
+            lr_downloadtarget_set_conditional_cache(target->target,
+                                                    target->transfer->conditional_cache);
+
 transfer_error:
 
         //
         // Cleanup
         //
-        curl_multi_remove_handle(dd->multi_handle, target->curl_handle);
-        curl_easy_cleanup(target->curl_handle);
-        target->curl_handle = NULL;
-        g_free(target->headercb_interrupt_reason);
-        target->headercb_interrupt_reason = NULL;
-        fclose(target->f);
-        target->f = NULL;
-        if (target->curl_rqheaders) {
-            curl_slist_free_all(target->curl_rqheaders);
-            target->curl_rqheaders = NULL;
+        if (target->mirror) {
+            mirror_update_rtt(target->mirror, target->transfer->curl_handle);
+            // Durations of targets from other handles' mirrors
+            // could change their order
+            if (mirror_update_throughput(target->mirror, target->transfer->curl_handle)
+                && g_slist_length(dd->handle_mirrors) > 1)
+                dd->schedule_dirty = TRUE;
         }
+        curl_multi_remove_handle(dd->multi_handle, target->transfer->curl_handle);
+        interrupted = transfer_interrupted(target);
+        end_transfer(target);
 
         dd->running_transfers = g_slist_remove(dd->running_transfers,
                                                (gconstpointer) target);
+        dd->speeds_dirty = TRUE;
         target->tried_mirrors = g_slist_append(target->tried_mirrors,
                                                target->mirror);
 
@@ -2463,7 +4126,8 @@ transfer_error:
                 // complete_url_in_path and target->baseurl doesn't have an alternatives like using
                 // mirrors, therefore they are handled differently
                 const char * complete_url_or_baseurl = complete_url_in_path ? target->target->path : target->target->baseurl;
-                if (can_retry_download(dd, num_of_tried_mirrors, complete_url_or_baseurl))
+                if (!stream_broken(target, transfer_err, interrupted)
+                    && can_retry_download(dd, num_of_tried_mirrors, complete_url_or_baseurl))
                 {
                   // Try another mirror or retry
                   if (complete_url_or_baseurl) {
@@ -2477,10 +4141,12 @@ transfer_error:
                   #ifdef WITH_ZCHUNK
                   if (!target->target->is_zchunk || target->zck_state == LR_ZCK_DL_HEADER) {
                   #endif
-                    if (target->target->resume
+                    if (target->target->datacb) {
+                        // The data passed to the callback are kept,
+                        // prepare_stream() continues after them
+                    } else if (target->target->resume
                         && transfer_err->code == LRE_CURL
-                        && target->headercb_state != LR_HCS_INTERRUPTED
-                        && target->curl_code != CURLE_RANGE_ERROR)
+                        && !interrupted)
                     {
                         // Connection error (timeout, recv error, etc.) with
                         // potentially valid partial data. Keep the data and
@@ -2508,7 +4174,7 @@ transfer_error:
                 // No more mirrors to try or baseurl used or fatal error
                 g_debug("%s: No more retries (tried: %d)",
                         __func__, num_of_tried_mirrors);
-                target->state = LR_DS_FAILED;
+                set_target_done(dd, target, LR_DS_FAILED);
 
                 // Call end callback
                 LrEndCb end_cb =  target->target->endcb;
@@ -2557,12 +4223,16 @@ transfer_error:
                 target->tried_mirrors = g_slist_remove(target->tried_mirrors, target->mirror);
             } else {
             #endif /* WITH_ZCHUNK */
-                target->state = LR_DS_FINISHED;
+                set_target_done(dd, target, LR_DS_FINISHED);
 
                 // Remove xattr that states that the file is being downloaded
                 // by librepo, because the file is now completely downloaded
                 // and the xattr is not needed (is is useful only for resuming)
-                remove_librepo_xattr(target->target);
+                if (target->target->fd != -1 || target->target->fn)
+                    remove_librepo_xattr(target->target);
+
+                // Other processes waiting for the file can use it now
+                unlock_target_file(target);
 
                 // Call end callback
                 LrEndCb end_cb = target->target->endcb;
@@ -2604,21 +4274,114 @@ transfer_error:
     return prepare_next_transfers(dd, err);
 }
 
-
+/** Stop the transfer of the waiting, held or running target and make it
+ * failed. Other targets are not affected.
+ */
 static gboolean
-lr_perform(LrDownload *dd, GError **err)
+cancel_target(LrDownload *dd, LrTarget *target, GError **err)
 {
-    CURLMcode cm_rc;    // CurlM_ReturnCode
-
-    assert(dd);
     assert(!err || *err == NULL);
 
-    int extra_sleep_trig = 0;
-    while (1) {
-
-        int still_running = 0;
+    if (target->state == LR_DS_RUNNING) {
+        curl_multi_remove_handle(dd->multi_handle, target->transfer->curl_handle);
+        end_transfer(target);
+        dd->running_transfers = g_slist_remove(dd->running_transfers, target);
+        dd->speeds_dirty = TRUE;
+        if (target->mirror)
+            decrease_running_transfers(target->mirror);
+    } else if (target->state == LR_DS_HELD) {
+        g_hash_table_remove(dd->held, target->target);
+        GSList *waiting = g_slist_find(dd->lock_waiting, target);
+        if (waiting)
+            dd->lock_waiting = g_slist_delete_link(dd->lock_waiting, waiting);
+        else  // The check of its file still runs, its result will be dropped
+            g_hash_table_add(dd->dropped_checks, target->target);
+    } else if (target->state != LR_DS_WAITING) {
+        // Finished targets are not cancelled
+        return TRUE;
+    }
 
-        cm_rc = curl_multi_perform(dd->multi_handle, &still_running);
+    g_debug("%s: Cancelled: %s", __func__, target->target->path);
+    set_target_done(dd, target, LR_DS_FAILED);
+    lr_downloadtarget_set_error(target->target, LRE_CANCELLED, "Cancelled");
+
+    // Call end callback
+    LrEndCb end_cb = target->target->endcb;
+    if (end_cb) {
+        int rc = end_cb(target->target->cbdata, LR_TRANSFER_ERROR, "Cancelled");
+        if (rc == LR_CB_ERROR) {
+            target->cb_return_code = LR_CB_ERROR;
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                        "Interrupted by LR_CB_ERROR from end callback");
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/** Add and cancel the targets requested via dd->session since
+ * the last call.
+ * @param changed       Set to TRUE if a target was added or cancelled.
+ */
+static gboolean
+process_session_requests(LrDownload *dd, gboolean *changed, GError **err)
+{
+    GSList *added, *cancelled;
+
+    assert(!err || *err == NULL);
+
+    *changed = FALSE;
+
+    if (!dd->session)
+        return TRUE;
+
+    g_mutex_lock(&dd->session->lock);
+    added = g_slist_reverse(dd->session->added);
+    cancelled = dd->session->cancelled;
+    dd->session->added = NULL;
+    dd->session->cancelled = NULL;
+    g_mutex_unlock(&dd->session->lock);
+
+    for (GSList *elem = added; elem; elem = g_slist_next(elem)) {
+        lr_download_add_target(dd, elem->data);
+        *changed = TRUE;
+    }
+    g_slist_free(added);
+
+    gboolean ret = TRUE;
+    for (GSList *elem = cancelled; elem && ret; elem = g_slist_next(elem)) {
+        for (GSList *el = dd->targets; el; el = g_slist_next(el)) {
+            LrTarget *target = el->data;
+            if (target->target != elem->data)
+                continue;
+            ret = cancel_target(dd, target, err);
+            *changed = TRUE;
+            break;
+        }
+    }
+    g_slist_free(cancelled);
+
+    return ret;
+}
+
+/** Max time (in ms) to wait before a look at the requests of the session */
+#define SESSION_POLL_MS         100
+
+static gboolean
+lr_perform(LrDownload *dd, GError **err)
+{
+    CURLMcode cm_rc;    // CurlM_ReturnCode
+
+    assert(dd);
+    assert(!err || *err == NULL);
+
+    int extra_sleep_trig = 0;
+    while (1) {
+
+        int still_running = 0;
+
+        cm_rc = curl_multi_perform(dd->multi_handle, &still_running);
 
         if (lr_interrupt) {
             // Check interrupt after each call of curl_multi_perform
@@ -2640,8 +4403,28 @@ lr_perform(LrDownload *dd, GError **err)
         if (!rc)
             return FALSE;
 
+        // Release or finish held targets whose check is done
+        gboolean changed;
+        if (!process_target_checks(dd, TRUE, &changed, err))
+            return FALSE;
+        if (changed && !prepare_next_transfers(dd, err))
+            return FALSE;
+
+        // Add and cancel targets requested via the session
+        if (!process_session_requests(dd, &changed, err))
+            return FALSE;
+        if (changed && !prepare_next_transfers(dd, err))
+            return FALSE;
+
+        // Add targets brought by the finished works
+        if (!process_works(dd, TRUE, &changed, err))
+            return FALSE;
+        if (changed && !prepare_next_transfers(dd, err))
+            return FALSE;
+
         // Leave if there's nothing to wait for
-        if (!still_running && !dd->running_transfers)
+        if (!still_running && !dd->running_transfers && !held_targets(dd)
+            && !pending_works(dd))
             break;
 
         long curl_timeout = -1;
@@ -2660,6 +4443,15 @@ lr_perform(LrDownload *dd, GError **err)
         if (curl_timeout > 500) // Wait no more than 500ms
             curl_timeout = 500;
 
+        if (held_targets(dd) && curl_timeout > HELD_TARGETS_POLL_MS)
+            curl_timeout = HELD_TARGETS_POLL_MS;
+
+        if (pending_works(dd) && curl_timeout > WORKS_POLL_MS)
+            curl_timeout = WORKS_POLL_MS;
+
+        if (dd->session && curl_timeout > SESSION_POLL_MS)
+            curl_timeout = SESSION_POLL_MS;
+
         int numfds;
         cm_rc = curl_multi_wait(dd->multi_handle, NULL, 0, curl_timeout, &numfds);
         if (cm_rc != CURLM_OK) {
@@ -2704,48 +4496,68 @@ lr_download(GSList *targets,
             gboolean failfast,
             GError **err)
 {
-    gboolean ret = FALSE;
-    LrDownload dd;             // dd stands for Download Data
-    GError *tmp_err = NULL;
+    return lr_download_pipelined(targets, failfast, 1, NULL, NULL, err);
+}
 
+/** Prepare the download data for the targets (at least one).
+ * See lr_download_internal() for the description of the arguments.
+ * @return          FALSE if err is set, dd is not prepared then
+ */
+static gboolean
+download_init(LrDownload *dd,
+              GSList *targets,
+              gboolean failfast,
+              long url_failures_factor,
+              LrTargetDoneCb donecb,
+              void *donecbdata,
+              gboolean release_reported,
+              GHashTable *held,
+              GAsyncQueue *checks,
+              LrDownloadSession *session,
+              LrDownloadWorks *works,
+              GError **err)
+{
+    assert(targets);
     assert(!err || *err == NULL);
 
-    if (lr_interrupt) {
-        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
-                    "Interrupted by signal");
-        return FALSE;
-    }
-
-    if (!targets) {
-        g_debug("%s: No targets", __func__);
-        return TRUE;
-    }
-
     // XXX: Downloader configuration (max parallel connections etc.)
     // is taken from the handle of the first target.
     LrHandle *lr_handle = ((LrDownloadTarget *) targets->data)->handle;
 
     // Prepare download data
-    dd.failfast = failfast;
+    dd->failfast = failfast;
+    dd->donecb = donecb;
+    dd->donecbdata = donecbdata;
+    dd->release_reported = release_reported;
+    dd->session = session;
+    dd->works = works;
 
     if (lr_handle) {
-        dd.max_parallel_connections = lr_handle->maxparalleldownloads;
-        dd.max_connection_per_host = lr_handle->maxdownloadspermirror;
-        dd.max_mirrors_to_try = lr_handle->maxmirrortries;
-        dd.allowed_mirror_failures = lr_handle->allowed_mirror_failures;
-        dd.adaptivemirrorsorting = lr_handle->adaptivemirrorsorting;
+        dd->max_parallel_connections = lr_handle->maxparalleldownloads;
+        dd->max_connection_per_host = lr_handle->maxdownloadspermirror;
+        dd->max_connection_per_mirror_host = lr_handle->maxdownloadsperhost > 0
+                                             ? lr_handle->maxdownloadsperhost : -1;
+        dd->max_mirrors_to_try = lr_handle->maxmirrortries;
+        dd->allowed_mirror_failures = lr_handle->allowed_mirror_failures;
+        dd->adaptivemirrorsorting = lr_handle->adaptivemirrorsorting;
+        dd->mirrorhashing = lr_handle->mirrorhashing;
+        dd->schedulepolicy = lr_handle->schedulepolicy;
     } else {
         // No handle, this is allowed when a complete URL is passed
         // via relative_url param.
-        dd.max_parallel_connections = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
-        dd.max_connection_per_host = LRO_MAXDOWNLOADSPERMIRROR_DEFAULT;
-        dd.max_mirrors_to_try = LRO_MAXMIRRORTRIES_DEFAULT;
-        dd.allowed_mirror_failures = LRO_ALLOWEDMIRRORFAILURES_DEFAULT;
-        dd.adaptivemirrorsorting = LRO_ADAPTIVEMIRRORSORTING_DEFAULT;
+        dd->max_parallel_connections = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
+        dd->max_connection_per_host = LRO_MAXDOWNLOADSPERMIRROR_DEFAULT;
+        dd->max_connection_per_mirror_host = -1;
+        dd->max_mirrors_to_try = LRO_MAXMIRRORTRIES_DEFAULT;
+        dd->allowed_mirror_failures = LRO_ALLOWEDMIRRORFAILURES_DEFAULT;
+        dd->adaptivemirrorsorting = LRO_ADAPTIVEMIRRORSORTING_DEFAULT;
+        dd->mirrorhashing = LRO_MIRRORHASHING_DEFAULT;
+        dd->schedulepolicy = LRO_SCHEDULEPOLICY_DEFAULT;
     }
+    dd->allowed_url_failures = dd->allowed_mirror_failures * url_failures_factor;
 
-    dd.multi_handle = curl_multi_init();
-    if (!dd.multi_handle) {
+    dd->multi_handle = curl_multi_init();
+    if (!dd->multi_handle) {
         // Something went wrong
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
                     "curl_multi_init() call failed");
@@ -2753,66 +4565,62 @@ lr_download(GSList *targets,
     }
 
     // Prepare list of LrTargets and LrHandleMirrors
-    dd.handle_mirrors = NULL;
-    dd.targets = NULL;
-    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
-        LrDownloadTarget *dtarget = elem->data;
-
-        // Assertions
-        assert(dtarget);
-        assert(dtarget->path);
-        assert((dtarget->fd > 0 && !dtarget->fn) || (dtarget->fd < 0 && dtarget->fn));
-        g_debug("%s: Target: %s (%s)", __func__,
-                dtarget->path,
-                (dtarget->baseurl) ? dtarget->baseurl : "-");
-
-        // Cleanup of LrDownloadTarget
-        lr_downloadtarget_reset(dtarget);
-
-        // Create and fill LrTarget
-        LrTarget *target = lr_malloc0(sizeof(*target));
-        target->state           = LR_DS_WAITING;
-        target->target          = dtarget;
-        target->original_offset = -1;
-        target->resume          = dtarget->resume;
-        target->target->rcode   = LRE_UNFINISHED;
-        target->target->err     = "Not finished";
-        target->handle          = dtarget->handle;
-        dd.targets = g_slist_append(dd.targets, target);
-        // Add list of handle internal mirrors to dd.handle_mirrors
-        // if doesn't exists yet and set the list reference
-        // to the target.
-        dd.handle_mirrors = lr_prepare_lrmirrors(dd.handle_mirrors, target);
-    }
-
-    dd.running_transfers = NULL;
-
-    // Prepare the first set of transfers
-    if (!prepare_next_transfers(&dd, &tmp_err))
-        goto lr_download_cleanup;
-
-    // Perform!
-    g_debug("%s: Downloading started", __func__);
-    ret = lr_perform(&dd, &tmp_err);
+    dd->handle_mirrors = NULL;
+    dd->mirror_hosts = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                             (GDestroyNotify) lr_mirrorhost_free);
+    dd->targets = NULL;
+    dd->running_transfers = NULL;
+    dd->done_targets = g_queue_new();
+    dd->schedule_dirty = FALSE;
+    dd->totalmaxspeed = 0;
+    dd->speeds_dirty = FALSE;
+    dd->held = g_hash_table_new(g_direct_hash, g_direct_equal);
+    dd->dropped_checks = g_hash_table_new(g_direct_hash, g_direct_equal);
+    dd->checks = checks ? g_async_queue_ref(checks)
+                        : g_async_queue_new_full(g_free);
+    dd->lock_waiting = NULL;
+    dd->lock_polled = 0;
+    dd->lock_pool = NULL;
+    dd->lock_cancel = 0;
+
+    // The targets of a plain download stay till its end, their number
+    // is known, so they are allocated at once
+    dd->target_slab = NULL;
+    dd->target_slab_len = 0;
+    dd->target_slab_used = 0;
+    if (!release_reported) {
+        dd->target_slab_len = g_slist_length(targets);
+        dd->target_slab = lr_malloc0(dd->target_slab_len * sizeof(LrTarget));
+    }
 
-    assert(ret || tmp_err);
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        LrTarget *target = lr_download_add_target(dd, elem->data);
+        if (held && g_hash_table_contains(held, elem->data)) {
+            target->state = LR_DS_HELD;
+            g_hash_table_insert(dd->held, elem->data, target);
+        }
+    }
 
-lr_download_cleanup:
+    return TRUE;
+}
 
+/** Stop the running transfers if the download was interrupted by an error
+ * and free the download data prepared by download_init().
+ * @param tmp_err   The error which interrupted the download or NULL.
+ *                  It is propagated to err.
+ */
+static void
+download_cleanup(LrDownload *dd, GError *tmp_err, GError **err)
+{
     if (tmp_err) {
         // If there was an error, stop all transfers that are in progress.
         g_info("Error while downloading: %s", tmp_err->message);
 
-        for (GSList *elem = dd.running_transfers; elem; elem = g_slist_next(elem)){
+        for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)){
             LrTarget *target = elem->data;
 
-            curl_multi_remove_handle(dd.multi_handle, target->curl_handle);
-            curl_easy_cleanup(target->curl_handle);
-            target->curl_handle = NULL;
-            fclose(target->f);
-            target->f = NULL;
-            g_free(target->headercb_interrupt_reason);
-            target->headercb_interrupt_reason = NULL;
+            curl_multi_remove_handle(dd->multi_handle, target->transfer->curl_handle);
+            end_transfer(target);
 
             // Call end callback
             LrEndCb end_cb =  target->target->endcb;
@@ -2830,19 +4638,30 @@ lr_download_cleanup:
                     tmp_err->message);
         }
 
-        g_slist_free(dd.running_transfers);
-        dd.running_transfers = NULL;
+        g_slist_free(dd->running_transfers);
+        dd->running_transfers = NULL;
 
         g_propagate_error(err, tmp_err);
     }
 
-    assert(dd.running_transfers == NULL);
+    assert(dd->running_transfers == NULL);
+
+    // Stop the checks of files of targets which are still held
+    g_slist_free(dd->lock_waiting);
+    if (dd->lock_pool) {
+        g_atomic_int_set(&dd->lock_cancel, 1);
+        g_thread_pool_free(dd->lock_pool, FALSE, TRUE);
+    }
 
-    curl_multi_cleanup(dd.multi_handle);
+    curl_multi_cleanup(dd->multi_handle);
 
-    // Clean up dd.handle_mirrors
-    for (GSList *elem = dd.handle_mirrors; elem; elem = g_slist_next(elem)) {
+    // Clean up dd->handle_mirrors
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
         LrHandleMirrors *handle_mirrors = elem->data;
+        if (handle_mirrors->handle && handle_mirrors->handle->mirrorstats)
+            lr_store_mirrorstats(handle_mirrors->handle,
+                                 handle_mirrors->lrmirrors,
+                                 dd->max_connection_per_host);
         for (GSList *el = handle_mirrors->lrmirrors; el; el = g_slist_next(el)) {
             LrMirror *mirror = el->data;
             lr_free(mirror);
@@ -2850,38 +4669,136 @@ lr_download_cleanup:
         g_slist_free(handle_mirrors->lrmirrors);
         lr_free(handle_mirrors);
     }
-    g_slist_free(dd.handle_mirrors);
+    g_slist_free(dd->handle_mirrors);
+    g_hash_table_destroy(dd->mirror_hosts);
 
     // Clean up targets
-    for (GSList *elem = dd.targets; elem; elem = g_slist_next(elem)) {
-        LrTarget *target = elem->data;
-        assert(target->curl_handle == NULL);
-        assert(target->f == NULL);
-
-        // Remove file created for the target if download was
-        // unsuccessful and the file doesn't exists before or
-        // its original content was overwritten
-        if (target->state != LR_DS_FINISHED) {
-            if (!target->resume || target->original_offset == 0) {
-                // Remove target file if the file doesn't
-                // exist before or was empty or was overwritten
-                if (target->target->fn) {
-                    // We can remove only files that were specified by fn
-                    if (unlink(target->target->fn) != 0) {
-                        g_warning("Error while removing: %s", g_strerror(errno));
-                    }
-                }
-            }
-        }
+    g_queue_free(dd->done_targets);
+    for (GSList *elem = dd->targets; elem; elem = g_slist_next(elem))
+        lr_target_free(dd, elem->data);
+    g_slist_free(dd->targets);
+    lr_free(dd->target_slab);
+    g_hash_table_destroy(dd->held);
+    g_hash_table_destroy(dd->dropped_checks);
+    g_async_queue_unref(dd->checks);
+}
 
-        g_slist_free(target->tried_mirrors);
-        lr_free(target);
+static gboolean
+lr_download_internal(GSList *targets,
+                     gboolean failfast,
+                     long url_failures_factor,
+                     LrTargetDoneCb donecb,
+                     void *donecbdata,
+                     gboolean release_reported,
+                     GHashTable *held,
+                     GAsyncQueue *checks,
+                     LrDownloadSession *session,
+                     LrDownloadWorks *works,
+                     GError **err)
+{
+    gboolean ret = FALSE;
+    LrDownload dd;             // dd stands for Download Data
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    if (lr_interrupt) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                    "Interrupted by signal");
+        return FALSE;
+    }
+
+    if (!targets) {
+        g_debug("%s: No targets", __func__);
+        return TRUE;
     }
-    g_slist_free(dd.targets);
+
+    if (!download_init(&dd, targets, failfast, url_failures_factor, donecb,
+                       donecbdata, release_reported, held, checks, session,
+                       works, err))
+        return FALSE;
+
+    // Targets could be cancelled before they are started
+    gboolean changed;
+    if (!process_session_requests(&dd, &changed, &tmp_err))
+        goto lr_download_cleanup;
+
+    // Prepare the first set of transfers
+    if (!prepare_next_transfers(&dd, &tmp_err))
+        goto lr_download_cleanup;
+
+    // Perform!
+    g_debug("%s: Downloading started", __func__);
+    ret = lr_perform(&dd, &tmp_err);
+
+    assert(ret || tmp_err);
+
+lr_download_cleanup:
+    download_cleanup(&dd, tmp_err, err);
 
     return ret;
 }
 
+gboolean
+lr_download_pipelined(GSList *targets,
+                      gboolean failfast,
+                      long url_failures_factor,
+                      LrTargetDoneCb donecb,
+                      void *donecbdata,
+                      GError **err)
+{
+    return lr_download_internal(targets, failfast, url_failures_factor,
+                                donecb, donecbdata, FALSE, NULL, NULL, NULL,
+                                NULL, err);
+}
+
+gboolean
+lr_download_pipelined_works(GSList *targets,
+                            gboolean failfast,
+                            long url_failures_factor,
+                            LrTargetDoneCb donecb,
+                            void *donecbdata,
+                            LrDownloadWorks *works,
+                            GError **err)
+{
+    GSList *all_targets = g_slist_copy(targets);
+    gboolean ret = TRUE;
+
+    assert(works);
+    assert(works->donecb);
+    assert(!err || *err == NULL);
+
+    // Nothing to download yet, wait for the works which could bring
+    // the first targets
+    while (!all_targets && works->pending && ret) {
+        void *result = g_async_queue_pop(works->results);
+        works->pending--;
+        ret = works->donecb(donecbdata, result, &all_targets, err);
+    }
+
+    if (ret)
+        ret = lr_download_internal(all_targets, failfast, url_failures_factor,
+                                   donecb, donecbdata, FALSE, NULL, NULL,
+                                   NULL, works, err);
+    g_slist_free(all_targets);
+
+    return ret;
+}
+
+gboolean
+lr_download_held(GSList *targets,
+                 GHashTable *held,
+                 GAsyncQueue *checks,
+                 gboolean failfast,
+                 LrTargetDoneCb donecb,
+                 void *donecbdata,
+                 GError **err)
+{
+    assert(!held || checks);
+    return lr_download_internal(targets, failfast, 1, donecb, donecbdata,
+                                FALSE, held, checks, NULL, NULL, err);
+}
+
 gboolean
 lr_download_target(LrDownloadTarget *target,
                    GError **err)
@@ -2906,7 +4823,7 @@ lr_download_target(LrDownloadTarget *target,
 gboolean
 lr_download_url(LrHandle *lr_handle, const char *url, int fd, GError **err)
 {
-    return lr_yum_download_url(lr_handle, url, fd, FALSE, FALSE, err);
+    return lr_yum_download_url(lr_handle, url, fd, FALSE, FALSE, FALSE, err);
 }
 
 int
@@ -2988,6 +4905,19 @@ lr_download_single_cb(GSList *targets,
                       LrProgressCb cb,
                       LrMirrorFailureCb mfcb,
                       GError **err)
+{
+    return lr_download_single_cb_pipelined(targets, failfast, cb, mfcb,
+                                           NULL, NULL, err);
+}
+
+gboolean
+lr_download_single_cb_pipelined(GSList *targets,
+                                gboolean failfast,
+                                LrProgressCb cb,
+                                LrMirrorFailureCb mfcb,
+                                LrTargetDoneCb donecb,
+                                void *donecbdata,
+                                GError **err)
 {
     gboolean ret;
     LrSharedCallbackData shared_cbdata;
@@ -3016,7 +4946,7 @@ lr_download_single_cb(GSList *targets,
                                                     lrcbdata);
     }
 
-    ret = lr_download(targets, failfast, err);
+    ret = lr_download_pipelined(targets, failfast, 1, donecb, donecbdata, err);
 
     // Remove callbacks and callback data
     for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
@@ -3031,3 +4961,461 @@ lr_download_single_cb(GSList *targets,
 
     return ret;
 }
+
+/** State of ::lr_download_lazy */
+typedef struct {
+    LrTargetProducerCb producer;
+    LrTargetReleaseCb releasecb;
+    void *cbdata;
+    GHashTable *live;   /*!< Pulled and not released targets */
+    gboolean exhausted; /*!< The producer has no more targets */
+} LrLazyDownload;
+
+/** Pull the next target from the producer of the lazy download.
+ * @param target    Set to the new target or NULL if there are no more
+ */
+static gboolean
+lazy_download_pull(LrLazyDownload *lazy, LrDownloadTarget **target, GError **err)
+{
+    *target = NULL;
+
+    if (lazy->exhausted)
+        return TRUE;
+
+    if (!lazy->producer(lazy->cbdata, target, err))
+        return FALSE;
+
+    if (*target)
+        g_hash_table_add(lazy->live, *target);
+    else
+        lazy->exhausted = TRUE;
+
+    return TRUE;
+}
+
+/** Release the target and replace it by the next one (LrTargetDoneCb) */
+static gboolean
+lazy_download_done(void *data,
+                   LrDownloadTarget *target,
+                   GSList **new_targets,
+                   GError **err)
+{
+    LrLazyDownload *lazy = data;
+    LrDownloadTarget *next;
+
+    g_hash_table_remove(lazy->live, target);
+    if (lazy->releasecb && !lazy->releasecb(lazy->cbdata, target, err))
+        return FALSE;
+
+    if (!lazy_download_pull(lazy, &next, err))
+        return FALSE;
+    if (next)
+        *new_targets = g_slist_append(*new_targets, next);
+
+    return TRUE;
+}
+
+gboolean
+lr_download_lazy(LrTargetProducerCb producer,
+                 LrTargetReleaseCb releasecb,
+                 void *cbdata,
+                 guint lookahead,
+                 gboolean failfast,
+                 GError **err)
+{
+    gboolean ret = TRUE;
+    GSList *targets = NULL;
+    GHashTableIter iter;
+    gpointer target;
+    LrLazyDownload lazy;
+
+    assert(producer);
+    assert(!err || *err == NULL);
+
+    lazy.producer = producer;
+    lazy.releasecb = releasecb;
+    lazy.cbdata = cbdata;
+    lazy.live = g_hash_table_new(g_direct_hash, g_direct_equal);
+    lazy.exhausted = FALSE;
+
+    // Pull the first targets, the rest is pulled by lazy_download_done()
+    // one by one as the targets are finished
+    for (guint x = 0; x < MAX(lookahead, 1); x++) {
+        LrDownloadTarget *first;
+        ret = lazy_download_pull(&lazy, &first, err);
+        if (!ret || !first)
+            break;
+        targets = g_slist_prepend(targets, first);
+    }
+    targets = g_slist_reverse(targets);
+
+    if (ret)
+        ret = lr_download_internal(targets, failfast, 1, lazy_download_done,
+                                   &lazy, TRUE, NULL, NULL, NULL, NULL, err);
+    g_slist_free(targets);
+
+    // Release targets which were not finished because of an error
+    g_hash_table_iter_init(&iter, lazy.live);
+    while (g_hash_table_iter_next(&iter, &target, NULL))
+        if (releasecb)
+            releasecb(cbdata, target, NULL);
+    g_hash_table_destroy(lazy.live);
+
+    return ret;
+}
+
+/** Socket callback of the curl multi handle of a started session */
+static int
+session_socket_cb(G_GNUC_UNUSED CURL *easy,
+                  curl_socket_t s,
+                  int what,
+                  void *userp,
+                  G_GNUC_UNUSED void *socketp)
+{
+    LrDownloadSession *session = userp;
+    int events = 0;
+
+    if (what == CURL_POLL_REMOVE) {
+        g_hash_table_remove(session->sockets, GINT_TO_POINTER(s));
+        return 0;
+    }
+
+    if (what == CURL_POLL_IN || what == CURL_POLL_INOUT)
+        events |= LR_DOWNLOAD_SESSION_POLLIN;
+    if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT)
+        events |= LR_DOWNLOAD_SESSION_POLLOUT;
+    g_hash_table_insert(session->sockets, GINT_TO_POINTER(s),
+                        GINT_TO_POINTER(events));
+    return 0;
+}
+
+/** Timer callback of the curl multi handle of a started session */
+static int
+session_timer_cb(G_GNUC_UNUSED CURLM *multi, long timeout_ms, void *userp)
+{
+    LrDownloadSession *session = userp;
+
+    if (timeout_ms < 0)
+        session->deadline = -1;
+    else
+        session->deadline = g_get_monotonic_time() + timeout_ms * 1000;
+    return 0;
+}
+
+/** Return a new list of the targets followed by the targets added
+ * to the session, which are removed from it. */
+static GSList *
+session_take_targets(LrDownloadSession *session, GSList *targets)
+{
+    GSList *all_targets;
+
+    g_mutex_lock(&session->lock);
+    all_targets = g_slist_concat(g_slist_copy(targets),
+                                 g_slist_reverse(session->added));
+    session->added = NULL;
+    g_mutex_unlock(&session->lock);
+
+    return all_targets;
+}
+
+/** Free the download of the session, propagate tmp_err to err */
+static void
+session_end_download(LrDownloadSession *session, GError *tmp_err, GError **err)
+{
+    download_cleanup(session->dd, tmp_err, err);
+    lr_free(session->dd);
+    session->dd = NULL;
+    g_hash_table_remove_all(session->sockets);
+    session->deadline = -1;
+}
+
+LrDownloadSession *
+lr_download_session_new(void)
+{
+    LrDownloadSession *session = lr_malloc0(sizeof(*session));
+    g_mutex_init(&session->lock);
+    session->sockets = g_hash_table_new(g_direct_hash, g_direct_equal);
+    session->deadline = -1;
+    return session;
+}
+
+void
+lr_download_session_free(LrDownloadSession *session)
+{
+    if (!session)
+        return;
+
+    lr_download_session_stop(session);
+    g_hash_table_destroy(session->sockets);
+    g_slist_free(session->added);
+    g_slist_free(session->cancelled);
+    g_mutex_clear(&session->lock);
+    lr_free(session);
+}
+
+void
+lr_download_session_add_target(LrDownloadSession *session,
+                               LrDownloadTarget *target)
+{
+    assert(session);
+    assert(target);
+
+    g_mutex_lock(&session->lock);
+    session->added = g_slist_prepend(session->added, target);
+    g_mutex_unlock(&session->lock);
+}
+
+void
+lr_download_session_cancel_target(LrDownloadSession *session,
+                                  LrDownloadTarget *target)
+{
+    assert(session);
+    assert(target);
+
+    g_mutex_lock(&session->lock);
+    GSList *elem = g_slist_find(session->added, target);
+    if (elem) {
+        // The target was not passed to the download yet
+        session->added = g_slist_delete_link(session->added, elem);
+        lr_downloadtarget_set_error(target, LRE_CANCELLED, "Cancelled");
+    } else if (!g_slist_find(session->cancelled, target)) {
+        session->cancelled = g_slist_prepend(session->cancelled, target);
+    }
+    g_mutex_unlock(&session->lock);
+}
+
+gboolean
+lr_download_session_run(LrDownloadSession *session,
+                        GSList *targets,
+                        gboolean failfast,
+                        GError **err)
+{
+    gboolean ret;
+    GSList *all_targets;
+
+    assert(session);
+    assert(!session->dd);
+    assert(!err || *err == NULL);
+
+    all_targets = session_take_targets(session, targets);
+    ret = lr_download_internal(all_targets, failfast, 1, NULL, NULL, FALSE,
+                               NULL, NULL, session, NULL, err);
+    g_slist_free(all_targets);
+
+    return ret;
+}
+
+gboolean
+lr_download_session_start(LrDownloadSession *session,
+                          GSList *targets,
+                          gboolean failfast,
+                          GError **err)
+{
+    GSList *all_targets;
+    GError *tmp_err = NULL;
+    gboolean changed;
+
+    assert(session);
+    assert(!session->dd);
+    assert(!err || *err == NULL);
+
+    if (lr_interrupt) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                    "Interrupted by signal");
+        return FALSE;
+    }
+
+    all_targets = session_take_targets(session, targets);
+    if (!all_targets) {
+        g_debug("%s: No targets", __func__);
+        return TRUE;
+    }
+
+    LrDownload *dd = lr_malloc0(sizeof(*dd));
+    gboolean ret = download_init(dd, all_targets, failfast, 1, NULL, NULL,
+                                 FALSE, NULL, NULL, session, NULL, err);
+    g_slist_free(all_targets);
+    if (!ret) {
+        lr_free(dd);
+        return FALSE;
+    }
+    session->dd = dd;
+
+    // Let curl tell which sockets and timeouts have to be watched
+    CURLMcode cm_rc;
+    if ((cm_rc = curl_multi_setopt(dd->multi_handle, CURLMOPT_SOCKETFUNCTION,
+                                   session_socket_cb)) != CURLM_OK
+        || (cm_rc = curl_multi_setopt(dd->multi_handle, CURLMOPT_SOCKETDATA,
+                                      session)) != CURLM_OK
+        || (cm_rc = curl_multi_setopt(dd->multi_handle, CURLMOPT_TIMERFUNCTION,
+                                      session_timer_cb)) != CURLM_OK
+        || (cm_rc = curl_multi_setopt(dd->multi_handle, CURLMOPT_TIMERDATA,
+                                      session)) != CURLM_OK)
+    {
+        g_set_error(&tmp_err, LR_DOWNLOADER_ERROR, LRE_CURLM,
+                    "curl_multi_setopt() error: %s",
+                    curl_multi_strerror(cm_rc));
+        session_end_download(session, tmp_err, err);
+        return FALSE;
+    }
+
+    // Targets could be cancelled before they are started
+    if (!process_session_requests(dd, &changed, &tmp_err)
+        || !prepare_next_transfers(dd, &tmp_err))
+    {
+        session_end_download(session, tmp_err, err);
+        return FALSE;
+    }
+
+    g_debug("%s: Downloading started", __func__);
+
+    if (!dd->running_transfers && !held_targets(dd))
+        session_end_download(session, NULL, NULL);
+
+    return TRUE;
+}
+
+guint
+lr_download_session_get_sockets(LrDownloadSession *session,
+                                LrDownloadSessionSocket **sockets,
+                                long *timeout)
+{
+    GHashTableIter iter;
+    gpointer fd, events;
+    guint count = 0;
+
+    assert(session);
+    assert(sockets);
+    assert(timeout);
+
+    *sockets = NULL;
+    *timeout = -1;
+
+    if (!session->dd)
+        return 0;
+
+    if (g_hash_table_size(session->sockets)) {
+        *sockets = g_new0(LrDownloadSessionSocket,
+                          g_hash_table_size(session->sockets));
+        g_hash_table_iter_init(&iter, session->sockets);
+        while (g_hash_table_iter_next(&iter, &fd, &events)) {
+            (*sockets)[count].fd = GPOINTER_TO_INT(fd);
+            (*sockets)[count].events = GPOINTER_TO_INT(events);
+            count++;
+        }
+    }
+
+    if (session->deadline >= 0) {
+        gint64 remaining = session->deadline - g_get_monotonic_time();
+        *timeout = remaining > 0 ? (remaining + 999) / 1000 : 0;
+    }
+
+    // Results of the checks of held targets are looked for by the steps
+    if (held_targets(session->dd)
+        && (*timeout < 0 || *timeout > HELD_TARGETS_POLL_MS))
+        *timeout = HELD_TARGETS_POLL_MS;
+
+    // Targets added or cancelled via the session wait for the next step
+    g_mutex_lock(&session->lock);
+    if (session->added || session->cancelled)
+        *timeout = 0;
+    g_mutex_unlock(&session->lock);
+
+    return count;
+}
+
+gboolean
+lr_download_session_step(LrDownloadSession *session,
+                         int fd,
+                         int events,
+                         GError **err)
+{
+    LrDownload *dd;
+    GError *tmp_err = NULL;
+    CURLMcode cm_rc;
+    int still_running = 0;
+    gboolean changed;
+
+    assert(session);
+    assert(!err || *err == NULL);
+
+    dd = session->dd;
+    if (!dd)
+        return TRUE;
+
+    if (fd == LR_DOWNLOAD_SESSION_TIMEOUT) {
+        session->deadline = -1;
+        cm_rc = curl_multi_socket_action(dd->multi_handle, CURL_SOCKET_TIMEOUT,
+                                         0, &still_running);
+    } else {
+        int ev_bitmask = 0;
+        if (events & LR_DOWNLOAD_SESSION_POLLIN)
+            ev_bitmask |= CURL_CSELECT_IN;
+        if (events & LR_DOWNLOAD_SESSION_POLLOUT)
+            ev_bitmask |= CURL_CSELECT_OUT;
+        cm_rc = curl_multi_socket_action(dd->multi_handle, fd, ev_bitmask,
+                                         &still_running);
+    }
+
+    if (lr_interrupt) {
+        g_set_error(&tmp_err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                    "Interrupted by signal");
+        goto fail;
+    }
+
+    if (cm_rc != CURLM_OK) {
+        g_set_error(&tmp_err, LR_DOWNLOADER_ERROR, LRE_CURLM,
+                    "curl_multi_socket_action() error: %s",
+                    curl_multi_strerror(cm_rc));
+        goto fail;
+    }
+
+    // Check if any handle finished and potentially add one or more
+    // waiting downloads to the multi_handle.
+    if (!check_transfer_statuses(dd, &tmp_err))
+        goto fail;
+
+    // Release or finish held targets whose check is done
+    if (!process_target_checks(dd, FALSE, &changed, &tmp_err))
+        goto fail;
+    if (changed && !prepare_next_transfers(dd, &tmp_err))
+        goto fail;
+
+    // Add and cancel targets requested via the session
+    if (!process_session_requests(dd, &changed, &tmp_err))
+        goto fail;
+    if (changed && !prepare_next_transfers(dd, &tmp_err))
+        goto fail;
+
+    // Nothing more to do
+    if (!still_running && !dd->running_transfers && !held_targets(dd))
+        session_end_download(session, NULL, NULL);
+
+    return TRUE;
+
+fail:
+    session_end_download(session, tmp_err, err);
+    return FALSE;
+}
+
+gboolean
+lr_download_session_is_finished(LrDownloadSession *session)
+{
+    assert(session);
+    return session->dd == NULL;
+}
+
+void
+lr_download_session_stop(LrDownloadSession *session)
+{
+    GError *tmp_err = NULL;
+
+    assert(session);
+
+    if (!session->dd)
+        return;
+
+    g_set_error(&tmp_err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                "Download session stopped");
+    session_end_download(session, tmp_err, NULL);
+}
@@ -102,6 +102,203 @@ lr_download_single_cb(GSList *targets,
                       LrMirrorFailureCb mfcb,
                       GError **err);
 
+/** Called by ::lr_download_lazy every time it needs a new target.
+ * @param data      User data passed to ::lr_download_lazy
+ * @param target    Set this to the next ::LrDownloadTarget or to NULL
+ *                  if there are no more targets.
+ * @param err       GError **
+ * @return          If FALSE then err should be set and the download
+ *                  is aborted.
+ */
+typedef gboolean (*LrTargetProducerCb)(void *data,
+                                       LrDownloadTarget **target,
+                                       GError **err);
+
+/** Called by ::lr_download_lazy when librepo doesn't need the target
+ * anymore. The target could be freed by the callback.
+ * @param data      User data passed to ::lr_download_lazy
+ * @param target    Released target. If the download was not aborted,
+ *                  its rcode, err, usedmirror... are set.
+ * @param err       GError **
+ * @return          If FALSE then err should be set and the download
+ *                  is aborted.
+ */
+typedef gboolean (*LrTargetReleaseCb)(void *data,
+                                      LrDownloadTarget *target,
+                                      GError **err);
+
+/** Variant of ::lr_download for very large numbers of targets.
+ * Targets are pulled from the producer only when they are needed,
+ * so at most lookahead of them (and of their internal data) are in
+ * memory at the same time. Every target obtained from the producer
+ * is passed to the releasecb exactly once, also when the download
+ * fails or is interrupted.
+ * Note: The downloader configuration is taken from the handle of
+ * the first target.
+ * @param producer  Callback returning the next target ::LrTargetProducerCb
+ * @param releasecb Callback taking back finished targets
+ *                  ::LrTargetReleaseCb. Could be NULL.
+ * @param cbdata    User data for the producer and the releasecb
+ * @param lookahead Max number of targets pulled from the producer and not
+ *                  released yet. It should be greater than
+ *                  LRO_MAXPARALLELDOWNLOADS, otherwise not all allowed
+ *                  transfers could run in parallel.
+ * @param failfast  See ::lr_download
+ * @param err       GError **
+ * @return          See ::lr_download
+ */
+gboolean
+lr_download_lazy(LrTargetProducerCb producer,
+                 LrTargetReleaseCb releasecb,
+                 void *cbdata,
+                 guint lookahead,
+                 gboolean failfast,
+                 GError **err);
+
+/** Download session. It allows to add targets to a running download
+ * and to cancel individual targets of it.
+ */
+typedef struct _LrDownloadSession LrDownloadSession;
+
+/** Create new download session.
+ * @return          New allocated download session
+ */
+LrDownloadSession *
+lr_download_session_new(void);
+
+/** Free the download session. It must not be used by a running
+ * ::lr_download_session_run. A download started by
+ * ::lr_download_session_start is stopped.
+ * @param session   Download session
+ */
+void
+lr_download_session_free(LrDownloadSession *session);
+
+/** Add the target to the download which runs or will run with the session.
+ * This function could be called from callbacks of the download or from
+ * another thread.
+ * @param session   Download session
+ * @param target    ::LrDownloadTarget. It must be valid until the download
+ *                  finishes.
+ */
+void
+lr_download_session_add_target(LrDownloadSession *session,
+                               LrDownloadTarget *target);
+
+/** Cancel the waiting, held or running target of the download which runs
+ * with the session. Its transfer is stopped, its end callback is called with
+ * LR_TRANSFER_ERROR and its rcode is set to LRE_CANCELLED. Targets which
+ * are already finished are not affected. This function could be called
+ * from callbacks of the download or from another thread.
+ * @param session   Download session
+ * @param target    ::LrDownloadTarget
+ */
+void
+lr_download_session_cancel_target(LrDownloadSession *session,
+                                  LrDownloadTarget *target);
+
+/** Same as ::lr_download, but targets could be added and cancelled via
+ * the session while the download is running.
+ * @param session   Download session
+ * @param targets   See ::lr_download. Targets added to the session
+ *                  before the call are downloaded too.
+ * @param failfast  See ::lr_download
+ * @param err       GError **
+ * @return          See ::lr_download
+ */
+gboolean
+lr_download_session_run(LrDownloadSession *session,
+                        GSList *targets,
+                        gboolean failfast,
+                        GError **err);
+
+/** Events of a socket of a download session */
+typedef enum {
+    LR_DOWNLOAD_SESSION_POLLIN  = 1 << 0, /*!< The socket is readable */
+    LR_DOWNLOAD_SESSION_POLLOUT = 1 << 1, /*!< The socket is writable */
+} LrDownloadSessionEvents;
+
+/** Socket of a download session which has to be watched */
+typedef struct {
+    int fd;     /*!< File descriptor of the socket */
+    int events; /*!< ::LrDownloadSessionEvents to watch for */
+} LrDownloadSessionSocket;
+
+/** Value of the fd argument of ::lr_download_session_step when
+ * the timeout returned by ::lr_download_session_get_sockets expired */
+#define LR_DOWNLOAD_SESSION_TIMEOUT     -1
+
+/** Start the download without blocking. The download is driven by
+ * ::lr_download_session_step, which is called by an external event loop
+ * every time a socket returned by ::lr_download_session_get_sockets
+ * is ready or the timeout expires.
+ * Callbacks of the targets are called from ::lr_download_session_step.
+ * @param session   Download session which is not running
+ * @param targets   See ::lr_download. Targets added to the session
+ *                  before the call are downloaded too.
+ * @param failfast  See ::lr_download
+ * @param err       GError **
+ * @return          If FALSE then err is set and the download is
+ *                  not running.
+ */
+gboolean
+lr_download_session_start(LrDownloadSession *session,
+                          GSList *targets,
+                          gboolean failfast,
+                          GError **err);
+
+/** Get the sockets and the timeout the started download waits for.
+ * The set changes after every ::lr_download_session_step.
+ * @param session   Download session
+ * @param sockets   Set to a new array of ::LrDownloadSessionSocket
+ *                  (free it by g_free) or NULL if there are no sockets.
+ * @param timeout   Set to the maximal time (in ms) to wait before
+ *                  the next step with LR_DOWNLOAD_SESSION_TIMEOUT
+ *                  or -1 if there is no timeout. While targets wait for
+ *                  files downloaded by other processes, the timeout is
+ *                  short, they are checked by the steps.
+ * @return          Number of the sockets
+ */
+guint
+lr_download_session_get_sockets(LrDownloadSession *session,
+                                LrDownloadSessionSocket **sockets,
+                                long *timeout);
+
+/** Perform the work of the started download which is possible without
+ * blocking. Finished targets are reported, new transfers are started and
+ * targets added and cancelled via the session are processed.
+ * @param session   Download session
+ * @param fd        The ready socket or LR_DOWNLOAD_SESSION_TIMEOUT
+ * @param events    ::LrDownloadSessionEvents which are ready on the fd
+ *                  (0 if unknown)
+ * @param err       GError **
+ * @return          If FALSE then err is set and the download is
+ *                  finished. Unfinished targets have rcode LRE_UNFINISHED.
+ */
+gboolean
+lr_download_session_step(LrDownloadSession *session,
+                         int fd,
+                         int events,
+                         GError **err);
+
+/** Check if the started download is finished.
+ * @param session   Download session
+ * @return          TRUE if all targets reached their final state or
+ *                  the download failed or no download is running.
+ *                  Status of the targets tells the results then.
+ */
+gboolean
+lr_download_session_is_finished(LrDownloadSession *session);
+
+/** Stop the started download before it is finished. Running transfers are
+ * interrupted and unfinished targets get rcode LRE_UNFINISHED.
+ * Nothing is done if the download is already finished. This function
+ * must not be called from callbacks of the download.
+ * @param session   Download session
+ */
+void
+lr_download_session_stop(LrDownloadSession *session);
+
 /** @} */
 
 G_END_DECLS
@@ -23,6 +23,7 @@
 
 #include "librepo/metadata_downloader.h"
 #include <librepo/handle.h>
+#include <librepo/downloadtarget.h>
 
 G_BEGIN_DECLS
 
@@ -52,6 +53,193 @@ typedef struct {
     LrSharedCallbackData *sharedcbdata; /*!< Shared cb data */
 } LrCallbackData;
 
+/** Called by ::lr_download_pipelined every time a target reaches its
+ * final state (successfully downloaded or failed).
+ * @param data          User data passed to ::lr_download_pipelined
+ * @param target        Finished target (its rcode, err, usedmirror...
+ *                      are already set)
+ * @param new_targets   Targets prepended or appended to this list are added
+ *                      to the running download. The caller owns the
+ *                      targets, the list itself is freed by the downloader.
+ * @param err           GError **
+ * @return              FALSE aborts the whole download with err set.
+ */
+typedef gboolean (*LrTargetDoneCb)(void *data,
+                                   LrDownloadTarget *target,
+                                   GSList **new_targets,
+                                   GError **err);
+
+/** Like ::lr_download but new targets may be added to the running
+ * download from the donecb, so dependent downloads (e.g. repomd.xml
+ * after a metalink) don't have to wait for unrelated transfers.
+ * @param targets               Initial list of LrDownloadTarget
+ * @param failfast              See ::lr_download
+ * @param url_failures_factor   Multiplier of the allowed mirror failures
+ *                              used for targets with a complete URL or
+ *                              a baseurl (e.g. metalinks and mirrorlists)
+ * @param donecb                Callback called for every finished target
+ *                              or NULL
+ * @param donecbdata            User data for the donecb
+ * @param err                   GError **
+ * @return                      See ::lr_download
+ */
+gboolean
+lr_download_pipelined(GSList *targets,
+                      gboolean failfast,
+                      long url_failures_factor,
+                      LrTargetDoneCb donecb,
+                      void *donecbdata,
+                      GError **err);
+
+/** Called by ::lr_download_pipelined_works (from the thread running
+ * the download) for every result of a finished work.
+ * @param data          User data passed to ::lr_download_pipelined_works
+ * @param result        Result pushed to LrDownloadWorks.results
+ * @param new_targets   See ::LrTargetDoneCb
+ * @param err           GError **
+ * @return              FALSE aborts the whole download with err set.
+ */
+typedef gboolean (*LrWorkDoneCb)(void *data,
+                                 void *result,
+                                 GSList **new_targets,
+                                 GError **err);
+
+/** Blocking work (e.g. GPG verification or sorting of mirrors) of
+ * the callbacks of ::lr_download_pipelined_works done in other threads,
+ * so the transfers of the download don't stall.
+ */
+typedef struct {
+    GAsyncQueue *results; /*!<
+        Results of the finished works, pushed from any thread */
+
+    guint pending; /*!<
+        Number of started works whose results were not passed to
+        the donecb yet. Incremented by the code starting the work
+        (in the thread running the download). */
+
+    LrWorkDoneCb donecb; /*!<
+        Called for every result */
+} LrDownloadWorks;
+
+/** Like ::lr_download_pipelined but the download doesn't end while
+ * there are pending works. Results of the works are passed to
+ * works->donecb which may add new targets to the download.
+ * If there are no targets, the results are waited for until the works
+ * bring the first targets.
+ * @param targets               Initial list of LrDownloadTarget
+ * @param failfast              See ::lr_download
+ * @param url_failures_factor   See ::lr_download_pipelined
+ * @param donecb                See ::lr_download_pipelined
+ * @param donecbdata            User data for the donecb and works->donecb
+ * @param works                 Works started by the callbacks
+ * @param err                   GError **
+ * @return                      See ::lr_download
+ */
+gboolean
+lr_download_pipelined_works(GSList *targets,
+                            gboolean failfast,
+                            long url_failures_factor,
+                            LrTargetDoneCb donecb,
+                            void *donecbdata,
+                            LrDownloadWorks *works,
+                            GError **err);
+
+/** Like ::lr_download_single_cb but with the donecb
+ * of ::lr_download_pipelined.
+ */
+gboolean
+lr_download_single_cb_pipelined(GSList *targets,
+                                gboolean failfast,
+                                LrProgressCb cb,
+                                LrMirrorFailureCb mfcb,
+                                LrTargetDoneCb donecb,
+                                void *donecbdata,
+                                GError **err);
+
+/** Verdict of the check of a local file of a held target */
+typedef enum {
+    LR_TARGETCHECK_DOWNLOAD, /*!<
+        Download the target */
+    LR_TARGETCHECK_DOWNLOAD_NORESUME, /*!<
+        Download the target, the local file cannot be resumed */
+    LR_TARGETCHECK_ALREADYEXISTS, /*!<
+        The local file is complete, the target is not downloaded */
+    LR_TARGETCHECK_DOWNLOADED, /*!<
+        The file was downloaded by another process (LRO_LOCKTARGETS),
+        the target is finished as successfully downloaded */
+} LrTargetCheckResult;
+
+/** Result of the check of a held target passed to ::lr_download_held */
+typedef struct {
+    LrDownloadTarget *target;   /*!< The held target */
+    LrTargetCheckResult result; /*!< Verdict */
+} LrTargetCheck;
+
+/** Like ::lr_download but the held targets are not transferred until
+ * the checks of their local files (usually running in other threads)
+ * are done, while the other targets are already downloading.
+ * Every held target has to get exactly one LrTargetCheck pushed to
+ * the checks queue, the downloader frees them by g_free().
+ * A target checked as LR_TARGETCHECK_ALREADYEXISTS is finished with
+ * "Already downloaded" message and its end callback gets
+ * LR_TRANSFER_ALREADYEXISTS. The files of targets which are still held
+ * when the download fails are left untouched.
+ * @param targets       List of LrDownloadTarget
+ * @param held          Set of the held targets (LrDownloadTarget) or NULL
+ * @param checks        Queue of LrTargetCheck
+ * @param failfast      See ::lr_download
+ * @param donecb        See ::lr_download_pipelined
+ * @param donecbdata    User data for the donecb
+ * @param err           GError **
+ * @return              See ::lr_download
+ */
+gboolean
+lr_download_held(GSList *targets,
+                 GHashTable *held,
+                 GAsyncQueue *checks,
+                 gboolean failfast,
+                 LrTargetDoneCb donecb,
+                 void *donecbdata,
+                 GError **err);
+
+/** Rendezvous hashing score of the mirror for the path
+ * (LRO_MIRRORHASHING). Each path is downloaded from the healthy mirror
+ * with the highest score, so removing a mirror moves only the paths
+ * it had.
+ * @param mirror_url    URL of the mirror
+ * @param path          Relative path of the target
+ * @return              Score
+ */
+guint64
+lr_mirror_rendezvous_score(const char *mirror_url, const char *path);
+
+/** Speed limit of a running transfer */
+typedef struct {
+    const void *repo; /*!<
+        Repo (LrHandle) of the transfer or NULL */
+    gint64 repo_maxspeed; /*!<
+        LRO_MAXSPEED of the repo, 0 == unlimited */
+    double weight; /*!<
+        Weight of the QoS class of the target */
+    double speed; /*!<
+        Output: max speed of the transfer in bytes/s, 0.0 == unlimited */
+} LrTransferSpeed;
+
+/** Compute max speeds of the running transfers. LRO_MAXSPEED of each repo
+ * is shared between its transfers in proportion to their weights.
+ * The totalmaxspeed (LRO_TOTALMAXSPEED) is shared the same way by all
+ * the transfers, except that transfers whose repo limit is lower than
+ * their share keep the repo limit and the rest is shared by the others
+ * (weighted max-min fairness).
+ * @param transfers     Array of the running transfers
+ * @param count         Number of the transfers
+ * @param totalmaxspeed Limit of all transfers together, 0 == unlimited
+ */
+void
+lr_transfer_speeds_compute(LrTransferSpeed *transfers,
+                           guint count,
+                           gint64 totalmaxspeed);
+
 int
 lr_multi_progress_func(void* ptr,
                        double total_to_download,
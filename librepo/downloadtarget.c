@@ -88,11 +88,15 @@ lr_downloadtarget_new(LrHandle *handle,
         final_baseurl   = g_strdup(baseurl);
     }
 
+    // Keep all the strings known now in one block of the chunk
+    gsize chunk_size = strlen(final_path) + 1
+                       + (final_baseurl ? strlen(final_baseurl) + 1 : 0)
+                       + (fn ? strlen(fn) + 1 : 0);
 
     target = lr_malloc0(sizeof(*target));
 
     target->handle          = handle;
-    target->chunk           = g_string_chunk_new(0);
+    target->chunk           = g_string_chunk_new(chunk_size);
     target->path            = g_string_chunk_insert(target->chunk, final_path);
     target->baseurl         = lr_string_chunk_insert(target->chunk, final_baseurl);
     target->fd              = fd;
@@ -126,6 +130,8 @@ lr_downloadtarget_reset(LrDownloadTarget *target)
     target->effectiveurl = NULL;
     target->rcode = LRE_OK;
     target->err = NULL;
+    target->not_modified = FALSE;
+    target->conditional_cache = NULL;
 }
 
 void
@@ -200,6 +206,14 @@ lr_downloadtarget_set_usedmirror(LrDownloadTarget *target, const char *url)
     target->usedmirror = lr_string_chunk_insert(target->chunk, url);
 }
 
+void
+lr_downloadtarget_set_conditional_cache(LrDownloadTarget *target,
+                                        const char *path)
+{
+    assert(target);
+    target->conditional_cache = lr_string_chunk_insert(target->chunk, path);
+}
+
 void
 lr_downloadtarget_set_effectiveurl(LrDownloadTarget *target, const char *url)
 {
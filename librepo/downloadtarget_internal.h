@@ -48,6 +48,13 @@ lr_downloadtarget_set_usedmirror(LrDownloadTarget *target, const char *url);
 void
 lr_downloadtarget_set_effectiveurl(LrDownloadTarget *target, const char *url);
 
+/** Helper function to comfortable setting conditional_cache attribute
+ * of ::LrDownloadTarget
+ */
+void
+lr_downloadtarget_set_conditional_cache(LrDownloadTarget *target,
+                                        const char *path);
+
 G_END_DECLS
 
 #endif
@@ -32,9 +32,10 @@
 #include "rcodes.h"
 #include "fastestmirror.h"
 #include "fastestmirror_internal.h"
+#include "fastestmirrorcache_internal.h"
 
 #define LENGTH_OF_MEASUREMENT        2.0    // Number of seconds (float point!)
-#define HALF_OF_SECOND_IN_MICROS    500000
+#define HALF_OF_SECOND_IN_MILLIS    500
 
 #define CACHE_GROUP_METADATA    ":_librepo_:"   // Group with metadata
 #define CACHE_KEY_TS            "ts"            // Timestamp
@@ -42,14 +43,25 @@
 // should obviously have been "connecttime".
 #define CACHE_KEY_CONNECTTIME   "connectime"    // Time of response
 #define CACHE_KEY_VERSION       "version"       // Version of cache format
+#define CACHE_KEY_TTFB          "ttfb"          // Time to the first byte
+#define CACHE_KEY_BANDWIDTH     "bandwidth"     // Bandwidth of a probe
 
 #define CACHE_VERSION   1   // Current version of cache format
 
 #define CACHE_RECORD_MAX_AGE    (LRO_FASTESTMIRRORMAXAGE_DEFAULT * 6)
 
+// Mirrors measured by probe downloads are ranked by the estimated
+// time of a download of this size
+#define RANK_REFERENCE_SIZE     (1024.0 * 1024.0)
+
+// Rank of the mirrors we know nothing about, after all measured ones
+#define RANK_UNKNOWN            G_MAXDOUBLE
+
 typedef struct {
     gchar *path;
     GKeyFile *keyfile;
+    LrFastestMirrorBinCache *bincache; /*!< Used instead of the keyfile
+                                            in the binary format */
 } LrFastestMirrorCache;
 
 static LrFastestMirror *
@@ -58,6 +70,9 @@ lr_lrfastestmirror_new()
     LrFastestMirror *mirror = g_new0(LrFastestMirror, 1);
     mirror->plain_connect_time = 0.0;
     mirror->cached = FALSE;
+    mirror->ttfb = -1.0;
+    mirror->bandwidth = 0.0;
+    mirror->unknown = FALSE;
     return mirror;
 }
 
@@ -74,6 +89,7 @@ lr_lrfastestmirror_free(LrFastestMirror *mirror)
 static gboolean
 lr_fastestmirrorcache_load(LrFastestMirrorCache **cache,
                            gchar *path,
+                           gboolean binary,
                            LrFastestMirrorCb cb,
                            void *cbdata,
                            GError **err)
@@ -89,6 +105,27 @@ lr_fastestmirrorcache_load(LrFastestMirrorCache **cache,
 
     cb(cbdata, LR_FMSTAGE_CACHELOADING, path);
 
+    if (binary) {
+        // Only the hash table is mapped, records are read on demand
+        GError *tmp_err = NULL;
+        *cache = lr_malloc0(sizeof(LrFastestMirrorCache));
+        (*cache)->path = g_strdup(path);
+        (*cache)->bincache = lr_fastestmirror_bincache_new(path);
+
+        if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+            cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS,
+               "Cache doesn't exist");
+        } else if (!lr_fastestmirror_bincache_load((*cache)->bincache, &tmp_err)) {
+            g_debug("%s: %s", __func__, tmp_err->message);
+            cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS, tmp_err->message);
+            g_error_free(tmp_err);
+        } else {
+            cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS, NULL);
+        }
+
+        return TRUE;
+    }
+
     GKeyFile *keyfile = g_key_file_new();
 
     *cache = lr_malloc0(sizeof(LrFastestMirrorCache));
@@ -189,9 +226,25 @@ static gboolean
 lr_fastestmirrorcache_lookup(LrFastestMirrorCache *cache,
                              gchar *url,
                              gint64 *ts,
-                             double *connecttime)
+                             double *connecttime,
+                             double *ttfb,
+                             double *bandwidth)
 {
-    if (!cache || !cache->keyfile || !url)
+    if (!cache || !url)
+        return FALSE;
+
+    if (cache->bincache) {
+        LrFastestMirrorCacheRecord record;
+        if (!lr_fastestmirror_bincache_lookup(cache->bincache, url, &record))
+            return FALSE;
+        *ts = record.ts;
+        *connecttime = record.connecttime;
+        *ttfb = record.bandwidth > 0.0 ? record.ttfb : -1.0;
+        *bandwidth = record.bandwidth > 0.0 ? record.bandwidth : 0.0;
+        return TRUE;
+    }
+
+    if (!cache->keyfile)
         return FALSE;
 
     GKeyFile *keyfile = cache->keyfile;
@@ -223,6 +276,14 @@ lr_fastestmirrorcache_lookup(LrFastestMirrorCache *cache,
     *ts = l_ts;
     *connecttime = l_connecttime;
 
+    // Metrics of probe downloads are optional
+    *ttfb = -1.0;
+    *bandwidth = 0.0;
+    if (g_key_file_has_key(keyfile, url, CACHE_KEY_BANDWIDTH, NULL)) {
+        *ttfb = g_key_file_get_double(keyfile, url, CACHE_KEY_TTFB, NULL);
+        *bandwidth = g_key_file_get_double(keyfile, url, CACHE_KEY_BANDWIDTH, NULL);
+    }
+
     return TRUE;
 }
 
@@ -230,15 +291,38 @@ static void
 lr_fastestmirrorcache_update(LrFastestMirrorCache *cache,
                              gchar *url,
                              gint64 ts,
-                             double connecttime)
+                             double connecttime,
+                             double ttfb,
+                             double bandwidth)
 {
-    if (!cache || !cache->keyfile || !url)
+    if (!cache || !url)
+        return;
+
+    if (cache->bincache) {
+        LrFastestMirrorCacheRecord record = {
+            .ts = ts,
+            .connecttime = connecttime,
+            .ttfb = bandwidth > 0.0 ? ttfb : -1.0,
+            .bandwidth = bandwidth > 0.0 ? bandwidth : 0.0,
+        };
+        lr_fastestmirror_bincache_update(cache->bincache, url, &record);
+        return;
+    }
+
+    if (!cache->keyfile)
         return;
 
     GKeyFile *keyfile = cache->keyfile;
 
     g_key_file_set_int64(keyfile, url, CACHE_KEY_TS, ts);
     g_key_file_set_double(keyfile, url, CACHE_KEY_CONNECTTIME, connecttime);
+    if (bandwidth > 0.0) {
+        g_key_file_set_double(keyfile, url, CACHE_KEY_TTFB, ttfb);
+        g_key_file_set_double(keyfile, url, CACHE_KEY_BANDWIDTH, bandwidth);
+    } else {
+        g_key_file_remove_key(keyfile, url, CACHE_KEY_TTFB, NULL);
+        g_key_file_remove_key(keyfile, url, CACHE_KEY_BANDWIDTH, NULL);
+    }
 }
 
 static gboolean
@@ -246,7 +330,15 @@ lr_fastestmirrorcache_write(LrFastestMirrorCache *cache, GError **err)
 {
     assert(!err || *err == NULL);
 
-    if (!cache || !cache->keyfile)
+    if (!cache)
+        return TRUE;
+
+    if (cache->bincache)
+        return lr_fastestmirror_bincache_write(cache->bincache,
+                                               CACHE_RECORD_MAX_AGE,
+                                               err);
+
+    if (!cache->keyfile)
         return TRUE;
 
     // Gen cache content
@@ -279,24 +371,202 @@ lr_fastestmirrorcache_free(LrFastestMirrorCache *cache)
         return;
 
     g_free(cache->path);
-    g_key_file_free(cache->keyfile);
+    if (cache->keyfile)
+        g_key_file_free(cache->keyfile);
+    lr_fastestmirror_bincache_free(cache->bincache);
     g_free(cache);
 }
 
+/** Progress callback of the probe downloads. Stops the probe
+ * once it has enough data (in case the server ignored the Range).
+ */
+static int
+lr_fastestmirror_probe_progresscb(void *clientp,
+                                  curl_off_t dltotal G_GNUC_UNUSED,
+                                  curl_off_t dlnow,
+                                  curl_off_t ultotal G_GNUC_UNUSED,
+                                  curl_off_t ulnow G_GNUC_UNUSED)
+{
+    long *probe_size = clientp;
+    return dlnow >= *probe_size ? 1 : 0;
+}
+
+/** Write callback of the probe downloads. The data are not needed,
+ * only the transfer rate matters.
+ */
+static size_t
+lr_fastestmirror_probe_writecb(char *ptr G_GNUC_UNUSED,
+                               size_t size,
+                               size_t nmemb,
+                               void *userdata G_GNUC_UNUSED)
+{
+    return size * nmemb;
+}
+
+/** Configure the curl handle to download the first probe_size bytes
+ * of the probe_path from the mirror.
+ */
+static gboolean
+lr_fastestmirror_setup_probe(CURL *curlh,
+                             const char *url,
+                             const char *probe_path,
+                             long *probe_size,
+                             GError **err)
+{
+    CURLcode curlcode;
+    _cleanup_free_ gchar *probe_url = lr_pathconcat(url, probe_path, NULL);
+    _cleanup_free_ gchar *range = g_strdup_printf("0-%ld", *probe_size - 1);
+
+    if ((curlcode = curl_easy_setopt(curlh, CURLOPT_URL, probe_url)) != CURLE_OK
+        || (curlcode = curl_easy_setopt(curlh, CURLOPT_RANGE, range)) != CURLE_OK
+        || (curlcode = curl_easy_setopt(curlh, CURLOPT_WRITEFUNCTION,
+                                        lr_fastestmirror_probe_writecb)) != CURLE_OK
+        || (curlcode = curl_easy_setopt(curlh, CURLOPT_XFERINFOFUNCTION,
+                                        lr_fastestmirror_probe_progresscb)) != CURLE_OK
+        || (curlcode = curl_easy_setopt(curlh, CURLOPT_XFERINFODATA,
+                                        probe_size)) != CURLE_OK
+        || (curlcode = curl_easy_setopt(curlh, CURLOPT_NOPROGRESS, 0L)) != CURLE_OK) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
+                    "Cannot set up probe download of %s: %s",
+                    probe_url, curl_easy_strerror(curlcode));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Create LrFastestMirror with a curl handle ready to probe the url.
+ * Probes done in the background (in another thread) never keep their
+ * connections, the share of the calling thread cannot be used there.
+ */
+static LrFastestMirror *
+lr_fastestmirror_probe_new(LrHandle *handle,
+                           gchar *url,
+                           gboolean background,
+                           GError **err)
+{
+    CURLcode curlcode;
+    CURL *curlh;
+
+    assert(!err || *err == NULL);
+
+    if (handle)
+        curlh = curl_easy_duphandle(handle->curl_handle);
+    else
+        curlh = lr_get_curl_handle();
+
+    if (!curlh) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
+                    "Cannot create curl handle");
+        return NULL;
+    }
+
+    curlcode = curl_easy_setopt(curlh, CURLOPT_URL, url);
+    if (curlcode != CURLE_OK) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
+                    "curl_easy_setopt(_, CURLOPT_URL, %s) failed: %s",
+                    url, curl_easy_strerror(curlcode));
+        curl_easy_cleanup(curlh);
+        return NULL;
+    }
+
+    // The handle may share the connection cache of the downloads, a reused
+    // connection would be measured as a near-zero connect time
+    curlcode = curl_easy_setopt(curlh, CURLOPT_FRESH_CONNECT, 1L);
+    if (curlcode != CURLE_OK) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
+                    "curl_easy_setopt(_, CURLOPT_FRESH_CONNECT, 1) failed: %s",
+                    curl_easy_strerror(curlcode));
+        curl_easy_cleanup(curlh);
+        return NULL;
+    }
+
+    if (handle && handle->fastestmirrorkeepconns && !background) {
+        curlcode = curl_easy_setopt(curlh, CURLOPT_SHARE, lr_curl_thread_share());
+        if (curlcode != CURLE_OK) {
+            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
+                        "curl_easy_setopt(_, CURLOPT_SHARE, _) failed: %s",
+                        curl_easy_strerror(curlcode));
+            curl_easy_cleanup(curlh);
+            return NULL;
+        }
+    }
+
+    if (handle && handle->fastestmirrorprobesize > 0) {
+        if (!lr_fastestmirror_setup_probe(curlh, url,
+                                          handle->fastestmirrorprobepath,
+                                          &handle->fastestmirrorprobesize,
+                                          err)) {
+            curl_easy_cleanup(curlh);
+            return NULL;
+        }
+    } else if (handle && handle->fastestmirrorkeepconns && !background) {
+        // Connections of CONNECT_ONLY handles cannot be reused,
+        // a HEAD request leaves the connection in the shared cache
+        if ((curlcode = curl_easy_setopt(curlh, CURLOPT_NOBODY, 1L)) != CURLE_OK) {
+            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
+                    "curl_easy_setopt(_, CURLOPT_NOBODY, 1) failed: %s",
+                    curl_easy_strerror(curlcode));
+            curl_easy_cleanup(curlh);
+            return NULL;
+        }
+    } else if ((curlcode = curl_easy_setopt(curlh, CURLOPT_CONNECT_ONLY, 1))
+               != CURLE_OK) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
+                "curl_easy_setopt(_, CURLOPT_CONNECT_ONLY, 1) failed: %s",
+                curl_easy_strerror(curlcode));
+        curl_easy_cleanup(curlh);
+        return NULL;
+    }
+
+    LrFastestMirror *mirror = lr_lrfastestmirror_new();
+    mirror->url = url;
+    mirror->curl = curlh;
+    return mirror;
+}
+
+/** Mirror waiting for a background probe */
+typedef struct {
+    gchar *url;
+    gint64 ts;      /*!< Timestamp of its cached record (0 if unknown) */
+} LrStaleMirror;
+
+static gint
+cmp_stale_mirrors(gconstpointer a, gconstpointer b)
+{
+    const LrStaleMirror *a_mirror = a;
+    const LrStaleMirror *b_mirror = b;
+    if (a_mirror->ts < b_mirror->ts)
+        return -1;
+    return a_mirror->ts > b_mirror->ts;
+}
+
 /** Create list of LrFastestMirror based on input list of URLs.
+ * In the background mode, stale and unknown mirrors are not probed,
+ * they keep their cached values and at most budget of them (the oldest
+ * first) are prepared for probing in the refresh_list. Urls of these are
+ * copies. Mirrors not found in the cache, and with probe downloads also
+ * the ones cached without bandwidth, are unknown (ranked after all
+ * measured mirrors).
  */
 static gboolean
 lr_fastestmirror_prepare(LrHandle *handle,
                          GSList *in_list,
                          GSList **out_list,
                          LrFastestMirrorCache *cache,
+                         gboolean background,
+                         long budget,
+                         GSList **refresh_list,
                          GError **err)
 {
     gboolean ret = TRUE;
     GSList *list = NULL;
+    GSList *refresh = NULL;
 
     assert(!err || *err == NULL);
 
+    *refresh_list = NULL;
+
     if (!in_list) {
         *out_list = NULL;
         return TRUE;
@@ -304,20 +574,28 @@ lr_fastestmirror_prepare(LrHandle *handle,
 
     gint64 maxage = LRO_FASTESTMIRRORMAXAGE_DEFAULT;
     gint64 current_time = g_get_real_time() / 1000000;
+    gboolean probe_download = FALSE;
+    _cleanup_array_unref_ GArray *stale = g_array_new(FALSE, FALSE,
+                                                      sizeof(LrStaleMirror));
 
-    if (handle)
+    if (handle) {
         maxage = (gint64) handle->fastestmirrormaxage;
+        probe_download = handle->fastestmirrorprobesize > 0;
+    }
 
     for (GSList *elem = in_list; elem; elem = g_slist_next(elem)) {
         gchar *url = elem->data;
-        CURLcode curlcode;
-        CURL *curlh;
 
         // Try to find item in the cache
-        gint64 ts;
-        double connecttime;
-        if (lr_fastestmirrorcache_lookup(cache, url, &ts, &connecttime)) {
-            if (ts >= (current_time - maxage)) {
+        gint64 ts = 0;
+        double connecttime = -1.0, ttfb = -1.0, bandwidth = 0.0;
+        gboolean found = lr_fastestmirrorcache_lookup(cache, url, &ts,
+                                                      &connecttime,
+                                                      &ttfb, &bandwidth);
+        if (found) {
+            if (probe_download && bandwidth <= 0.0 && connecttime >= 0.0) {
+                g_debug("%s: Cached record without bandwidth: %s", __func__, url);
+            } else if (ts >= (current_time - maxage)) {
                 // Use cached entry
                 g_debug("%s: Using cached connect time for: %s (%f)",
                         __func__, url, connecttime);
@@ -325,6 +603,8 @@ lr_fastestmirror_prepare(LrHandle *handle,
                 mirror->url = url;
                 mirror->curl = NULL;
                 mirror->plain_connect_time = connecttime;
+                mirror->ttfb = ttfb;
+                mirror->bandwidth = bandwidth;
                 mirror->cached = TRUE;
                 list = g_slist_append(list, mirror);
                 continue;
@@ -335,59 +615,163 @@ lr_fastestmirror_prepare(LrHandle *handle,
             g_debug("%s: Not found in cache: %s", __func__, url);
         }
 
-        if (handle)
-            curlh = curl_easy_duphandle(handle->curl_handle);
-        else
-            curlh = lr_get_curl_handle();
-
-        if (!curlh) {
-            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
-                        "Cannot create curl handle");
-            ret = FALSE;
-            break;
+        if (background) {
+            // Use whatever we know now, the mirror is probed later
+            LrFastestMirror *mirror = lr_lrfastestmirror_new();
+            mirror->url = url;
+            mirror->curl = NULL;
+            mirror->plain_connect_time = connecttime;
+            mirror->ttfb = ttfb;
+            mirror->bandwidth = bandwidth;
+            mirror->cached = TRUE;
+            // A connect time cannot be compared with the estimated
+            // download time of the probed mirrors
+            mirror->unknown = !found || (probe_download && bandwidth <= 0.0
+                                         && connecttime >= 0.0);
+            list = g_slist_append(list, mirror);
+
+            LrStaleMirror stale_mirror = { url, found ? ts : 0 };
+            g_array_append_val(stale, stale_mirror);
+            continue;
         }
 
-        curlcode = curl_easy_setopt(curlh, CURLOPT_URL, url);
-        if (curlcode != CURLE_OK) {
-            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
-                        "curl_easy_setopt(_, CURLOPT_URL, %s) failed: %s",
-                        url, curl_easy_strerror(curlcode));
-            curl_easy_cleanup(curlh);
+        LrFastestMirror *mirror = lr_fastestmirror_probe_new(handle, url,
+                                                             FALSE, err);
+        if (!mirror) {
             ret = FALSE;
             break;
         }
 
-        curlcode = curl_easy_setopt(curlh, CURLOPT_CONNECT_ONLY, 1);
-        if (curlcode != CURLE_OK) {
-            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
-                    "curl_easy_setopt(_, CURLOPT_CONNECT_ONLY, 1) failed: %s",
-                    curl_easy_strerror(curlcode));
-            curl_easy_cleanup(curlh);
+        list = g_slist_append(list, mirror);
+    }
+
+    // Probe budget goes to the mirrors we know the least about
+    g_array_sort(stale, cmp_stale_mirrors);
+    for (guint x = 0; ret && x < stale->len && (long) x < budget; x++) {
+        LrStaleMirror *stale_mirror = &g_array_index(stale, LrStaleMirror, x);
+        gchar *url = g_strdup(stale_mirror->url);
+        LrFastestMirror *mirror = lr_fastestmirror_probe_new(handle, url,
+                                                             TRUE, err);
+        if (!mirror) {
+            g_free(url);
             ret = FALSE;
             break;
         }
-
-        LrFastestMirror *mirror = lr_lrfastestmirror_new();
-        mirror->url = url;
-        mirror->curl = curlh;
-
-        list = g_slist_append(list, mirror);
+        refresh = g_slist_prepend(refresh, mirror);
     }
 
     if (ret) {
         *out_list = list;
+        *refresh_list = refresh;
     } else {
         assert(!err || *err);
         g_slist_free_full(list, (GDestroyNotify)lr_lrfastestmirror_free);
+        for (GSList *elem = refresh; elem; elem = g_slist_next(elem)) {
+            LrFastestMirror *mirror = elem->data;
+            g_free(mirror->url);
+            lr_lrfastestmirror_free(mirror);
+        }
+        g_slist_free(refresh);
         *out_list = NULL;
     }
 
     return ret;
 }
 
+/** Fill plain_connect_time of the mirror from its finished probe.
+ * For probe downloads also the time to the first byte and the bandwidth.
+ */
+static void
+lr_fastestmirror_measure(LrFastestMirror *mirror,
+                         CURLcode result,
+                         gboolean probe_download)
+{
+    CURL *curl = mirror->curl;
+
+    // Calculate plain_connect_time
+    char *effective_url;
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+
+    if (!effective_url) {
+        // No effective url is most likely an error
+        mirror->plain_connect_time = -1.0;
+    } else if (g_str_has_prefix(effective_url, "file:")) {
+        // Local directories are considered to be the best mirrors
+        mirror->plain_connect_time = 0.0;
+    } else {
+        // Get connect time
+        double namelookup_time;
+        double connect_time;
+        double plain_connect_time;
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &namelookup_time);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect_time);
+
+        if (connect_time == 0.0) {
+            // Zero connect time is most likely an error
+            plain_connect_time = -1.0;
+        } else {
+            plain_connect_time = connect_time - namelookup_time;
+        }
+
+        mirror->plain_connect_time = plain_connect_time;
+    }
+
+    if (!probe_download || mirror->plain_connect_time < 0.0)
+        return;
+
+    // Aborted by the progress callback means all needed data arrived
+    long code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    if ((result != CURLE_OK && result != CURLE_ABORTED_BY_CALLBACK)
+        || (code != 0 && code/100 != 2)) {
+        g_debug("%s: Probe download failed: %s (%s, code %ld)", __func__,
+                mirror->url, curl_easy_strerror(result), code);
+        mirror->plain_connect_time = -1.0;
+        return;
+    }
+
+    double starttransfer_time, total_time, downloaded;
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &starttransfer_time);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total_time);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &downloaded);
+
+    mirror->ttfb = starttransfer_time;
+    if (total_time > starttransfer_time)
+        mirror->bandwidth = downloaded / (total_time - starttransfer_time);
+    else if (total_time > 0.0)
+        mirror->bandwidth = downloaded / total_time;
+    else
+        mirror->bandwidth = G_MAXDOUBLE;  // Local or really fast mirror
+}
+
+/** Value used for ranking of the mirror (lower is better, <0.0 is
+ * an unusable mirror). Mirrors measured by a probe download are ranked
+ * by the estimated time of a download of RANK_REFERENCE_SIZE,
+ * unknown mirrors get RANK_UNKNOWN.
+ */
+static double
+lr_fastestmirror_rank(const LrFastestMirror *mirror)
+{
+    if (mirror->unknown)
+        return RANK_UNKNOWN;
+    if (mirror->plain_connect_time < 0.0)
+        return -1.0;
+    if (mirror->bandwidth > 0.0)
+        return MAX(mirror->ttfb, 0.0) + RANK_REFERENCE_SIZE / mirror->bandwidth;
+    return mirror->plain_connect_time;
+}
+
+/** Probe the mirrors. At most max_probes of them are probed at once,
+ * a new probe is started as soon as a running one finishes.
+ * Probes which don't finish in length_of_measurement seconds get -1.0
+ * connect time. Mirrors which were not probed at all become unknown,
+ * they are neither considered unreachable nor stored to the cache.
+ */
 static gboolean
 lr_fastestmirror_perform(GSList *list,
                          gdouble length_of_measurement,
+                         long max_probes,
+                         gboolean probe_download,
                          LrFastestMirrorCb cb,
                          void *cbdata,
                          GError **err)
@@ -397,148 +781,138 @@ lr_fastestmirror_perform(GSList *list,
     if (!list)
         return TRUE;
 
-    CURLM *multihandle = curl_multi_init();
-    if (!multihandle) {
-        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
-                    "curl_multi_init() error");
-        return FALSE;
-    }
-
-    // Add curl easy handles to multi handle
-    long handles_added = 0;
+    // Mirrors to probe
+    long handles_to_probe = 0;
+    GQueue pending = G_QUEUE_INIT;
     for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
         LrFastestMirror *mirror = elem->data;
         if (mirror->curl) {
-            curl_multi_add_handle(multihandle, mirror->curl);
-            handles_added++;
+            g_queue_push_tail(&pending, mirror);
+            handles_to_probe++;
         }
     }
 
-    if (handles_added == 0) {
-        curl_multi_cleanup(multihandle);
+    if (handles_to_probe == 0)
         return TRUE;
+
+    CURLM *multihandle = curl_multi_init();
+    if (!multihandle) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
+                    "curl_multi_init() error");
+        g_queue_clear(&pending);
+        return FALSE;
     }
 
-    cb(cbdata, LR_FMSTAGE_DETECTION, (void *) &handles_added);
+    cb(cbdata, LR_FMSTAGE_DETECTION, (void *) &handles_to_probe);
 
-    int still_running;
+    gboolean ret = TRUE;
+    GHashTable *running = g_hash_table_new(g_direct_hash, g_direct_equal);
     gdouble elapsed_time = 0.0;
     _cleanup_timer_destroy_ GTimer *timer = g_timer_new();
     g_timer_start(timer);
 
-    do {
-        struct timeval timeout;
-        int rc, cm_rc;
-        int maxfd = -1;
+    while (TRUE) {
+        int still_running, numfds, msgs_in_queue;
         long curl_timeout = -1;
-        fd_set fdread, fdwrite, fdexcep;
+        CURLMcode cm_rc;
+        CURLMsg *msg;
 
-        FD_ZERO(&fdread);
-        FD_ZERO(&fdwrite);
-        FD_ZERO(&fdexcep);
+        // Start new probes up to the limit
+        while (!g_queue_is_empty(&pending)
+               && (long) g_hash_table_size(running) < max_probes) {
+            LrFastestMirror *mirror = g_queue_pop_head(&pending);
+            curl_multi_add_handle(multihandle, mirror->curl);
+            g_hash_table_insert(running, mirror->curl, mirror);
+        }
+
+        curl_multi_perform(multihandle, &still_running);
 
-        // Set suitable timeout to play around with
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = HALF_OF_SECOND_IN_MICROS;
+        // Evaluate finished probes right away to free their slots
+        while ((msg = curl_multi_info_read(multihandle, &msgs_in_queue))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            LrFastestMirror *mirror = g_hash_table_lookup(running,
+                                                          msg->easy_handle);
+            assert(mirror);
+            curl_multi_remove_handle(multihandle, mirror->curl);
+            g_hash_table_remove(running, mirror->curl);
+            lr_fastestmirror_measure(mirror, msg->data.result, probe_download);
+        }
+
+        if (g_queue_is_empty(&pending) && g_hash_table_size(running) == 0)
+            break;
+
+        // Break loop after some reasonable amount of time
+        elapsed_time = g_timer_elapsed(timer, NULL);
+        if (elapsed_time >= length_of_measurement)
+            break;
+
+        if (!g_queue_is_empty(&pending)
+            && (long) g_hash_table_size(running) < max_probes)
+            continue;  // Free slots - start new probes first
 
         cm_rc = curl_multi_timeout(multihandle, &curl_timeout);
         if (cm_rc != CURLM_OK) {
             g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURLM,
                         "curl_multi_timeout() error: %s",
                         curl_multi_strerror(cm_rc));
-            curl_multi_cleanup(multihandle);
-            return FALSE;
-        }
-
-        // Set timeout to a reasonable value
-        if (curl_timeout >= 0) {
-            timeout.tv_sec = curl_timeout / 1000;
-            if (timeout.tv_sec >= 1) {
-                timeout.tv_sec = 0;
-                timeout.tv_usec = HALF_OF_SECOND_IN_MICROS;
-            } else {
-                timeout.tv_usec = (curl_timeout % 1000) * 1000;
-                if (timeout.tv_usec > HALF_OF_SECOND_IN_MICROS)
-                    timeout.tv_usec = HALF_OF_SECOND_IN_MICROS;
-            }
+            ret = FALSE;
+            break;
         }
 
-        // Get file descriptors from the transfers
-        cm_rc = curl_multi_fdset(multihandle, &fdread, &fdwrite,
-                                 &fdexcep, &maxfd);
+        // Wait no more than half of a second and never behind the deadline
+        long remaining_ms = (long) ((length_of_measurement - elapsed_time) * 1000) + 1;
+        if (curl_timeout < 0 || curl_timeout > HALF_OF_SECOND_IN_MILLIS)
+            curl_timeout = HALF_OF_SECOND_IN_MILLIS;
+        if (curl_timeout > remaining_ms)
+            curl_timeout = remaining_ms;
+
+        // Unlike select(), poll based waiting has no limit of the
+        // file descriptor numbers (FD_SETSIZE)
+#if LIBCURL_VERSION_NUM >= 0x074200  // curl_multi_poll() since 7.66.0
+        const char *wait_func = "curl_multi_poll()";
+        cm_rc = curl_multi_poll(multihandle, NULL, 0, (int) curl_timeout, &numfds);
+#else
+        const char *wait_func = "curl_multi_wait()";
+        cm_rc = curl_multi_wait(multihandle, NULL, 0, (int) curl_timeout, &numfds);
+#endif
         if (cm_rc != CURLM_OK) {
             g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURLM,
-                        "curl_multi_fdset() error: %s",
+                        "%s error: %s", wait_func,
                         curl_multi_strerror(cm_rc));
-            curl_multi_cleanup(multihandle);
-            return FALSE;
-        }
-
-        rc = select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
-        if (rc < 0) {
-            if (errno == EINTR) {
-                g_debug("%s: select() interrupted by signal", __func__);
-            } else {
-                g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_SELECT,
-                            "select() error: %s", g_strerror(errno));
-                curl_multi_cleanup(multihandle);
-                return FALSE;
-            }
+            ret = FALSE;
+            break;
         }
+#if LIBCURL_VERSION_NUM < 0x074200
+        // Older curl_multi_wait() returns immediately if there are
+        // no file descriptors to wait for, avoid busy-looping
+        if (numfds == 0)
+            g_usleep(curl_timeout * 1000);
+#endif
+    }
 
-        curl_multi_perform(multihandle, &still_running);
-
-        // Break loop after some reasonable amount of time
-        elapsed_time = g_timer_elapsed(timer, NULL);
-
-    } while(still_running && elapsed_time < length_of_measurement);
+    // Stragglers
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, running);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        LrFastestMirror *mirror = value;
+        curl_multi_remove_handle(multihandle, mirror->curl);
+        g_debug("%s: Probe timed out: %s", __func__, mirror->url);
+        mirror->plain_connect_time = -1.0;
+    }
 
-    // Remove curl easy handles from multi handle
-    // and calculate plain_connect_time
-    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+    // Mirrors which didn't get their turn
+    for (GList *elem = pending.head; elem; elem = g_list_next(elem)) {
         LrFastestMirror *mirror = elem->data;
-        CURL *curl = mirror->curl;
-
-        if (!curl)
-            continue;
-
-        // Remove handle
-        curl_multi_remove_handle(multihandle, curl);
-
-        // Calculate plain_connect_time
-        char *effective_url;
-        curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
-
-        if (!effective_url) {
-            // No effective url is most likely an error
-            mirror->plain_connect_time = -1.0;
-        } else if (g_str_has_prefix(effective_url, "file:")) {
-            // Local directories are considered to be the best mirrors
-            mirror->plain_connect_time = 0.0;
-        } else {
-            // Get connect time
-            double namelookup_time;
-            double connect_time;
-            double plain_connect_time;
-            curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &namelookup_time);
-            curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect_time);
-
-            if (connect_time == 0.0) {
-                // Zero connect time is most likely an error
-                plain_connect_time = -1.0;
-            } else {
-                plain_connect_time = connect_time - namelookup_time;
-            }
-
-            mirror->plain_connect_time = plain_connect_time;
-            //g_debug("%s: name_lookup: %3.6f connect_time:  %3.6f (%3.6f) | %s",
-            //        __func__, namelookup_time, connect_time,
-            //        mirror->plain_connect_time, mirror->url);
-        }
+        g_debug("%s: Not probed in time: %s", __func__, mirror->url);
+        mirror->unknown = TRUE;
     }
 
+    g_queue_clear(&pending);
+    g_hash_table_destroy(running);
     curl_multi_cleanup(multihandle);
-    return TRUE;
+    return ret;
 }
 
 static void
@@ -556,8 +930,8 @@ cmp_fastestmirrors(gconstpointer a,
 {
     const LrFastestMirror *a_mirror = a;
     const LrFastestMirror *b_mirror = b;
-    double a_ct = a_mirror->plain_connect_time;
-    double b_ct = b_mirror->plain_connect_time;
+    double a_ct = lr_fastestmirror_rank(a_mirror);
+    double b_ct = lr_fastestmirror_rank(b_mirror);
 
     if (a_ct < 0.0 && b_ct < 0.0)
         return 0;
@@ -574,6 +948,97 @@ cmp_fastestmirrors(gconstpointer a,
         return 1;
 }
 
+struct _LrFastestMirrorRefresh {
+    GThread *thread;            /*!< Thread running the probes */
+    GSList *mirrors;            /*!< LrFastestMirror* (with own urls) */
+    LrFastestMirrorCache *cache;/*!< Cache updated by the results */
+    gdouble length_of_measurement;
+    long max_probes;
+    gboolean probe_download;
+    volatile gint finished;     /*!< Set when the cache is written */
+};
+
+static gpointer
+lr_fastestmirror_refresh_run(gpointer data)
+{
+    LrFastestMirrorRefresh *refresh = data;
+    GError *tmp_err = NULL;
+
+    // User callbacks are not called from the helper thread
+    if (lr_fastestmirror_perform(refresh->mirrors,
+                                 refresh->length_of_measurement,
+                                 refresh->max_probes,
+                                 refresh->probe_download,
+                                 null_cb,
+                                 NULL,
+                                 &tmp_err)) {
+        gint64 ts = g_get_real_time() / 1000000;
+        for (GSList *elem = refresh->mirrors; elem; elem = g_slist_next(elem)) {
+            LrFastestMirror *mirror = elem->data;
+            if (mirror->unknown)
+                continue;  // Keep the old record till the next refresh
+            g_debug("%s: Refreshed %s (%f)", __func__, mirror->url,
+                    mirror->plain_connect_time);
+            lr_fastestmirrorcache_update(refresh->cache,
+                                         mirror->url,
+                                         ts,
+                                         mirror->plain_connect_time,
+                                         mirror->ttfb,
+                                         mirror->bandwidth);
+        }
+
+        if (!lr_fastestmirrorcache_write(refresh->cache, &tmp_err)) {
+            g_debug("%s: Cannot write cache: %s", __func__, tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+    } else {
+        g_debug("%s: Background probes failed: %s", __func__, tmp_err->message);
+        g_clear_error(&tmp_err);
+    }
+
+    g_atomic_int_set(&refresh->finished, 1);
+    return NULL;
+}
+
+/** Start the background probes. The refresh takes the mirrors and
+ * the cache.
+ */
+static void
+lr_fastestmirror_refresh_start(LrHandle *handle,
+                               GSList *mirrors,
+                               LrFastestMirrorCache *cache)
+{
+    LrFastestMirrorRefresh *refresh = lr_malloc0(sizeof(*refresh));
+    refresh->mirrors = mirrors;
+    refresh->cache = cache;
+    refresh->length_of_measurement = handle->fastestmirrortimeout;
+    refresh->max_probes = handle->fastestmirrormaxprobes;
+    refresh->probe_download = handle->fastestmirrorprobesize > 0;
+    refresh->thread = g_thread_new("lr-fastestmirror",
+                                   lr_fastestmirror_refresh_run,
+                                   refresh);
+    handle->fastestmirrorrefresh = refresh;
+}
+
+void
+lr_fastestmirror_refresh_wait(LrHandle *handle)
+{
+    LrFastestMirrorRefresh *refresh = handle->fastestmirrorrefresh;
+
+    if (!refresh)
+        return;
+
+    g_thread_join(refresh->thread);
+    for (GSList *elem = refresh->mirrors; elem; elem = g_slist_next(elem)) {
+        LrFastestMirror *mirror = elem->data;
+        g_free(mirror->url);
+        lr_lrfastestmirror_free(mirror);
+    }
+    g_slist_free(refresh->mirrors);
+    lr_fastestmirrorcache_free(refresh->cache);
+    lr_free(refresh);
+    handle->fastestmirrorrefresh = NULL;
+}
 
 gboolean
 lr_fastestmirror_detailed(LrHandle *handle,
@@ -584,22 +1049,41 @@ lr_fastestmirror_detailed(LrHandle *handle,
     assert(!err || *err == NULL);
 
     char *fastestmirrorcache = NULL;
+    gboolean binarycache = FALSE;
     gdouble length_of_measurement = LENGTH_OF_MEASUREMENT;
+    long max_probes = LRO_FASTESTMIRRORMAXPROBES_DEFAULT;
+    gboolean background = FALSE;
+    long budget = 0;
     LrFastestMirrorCb cb = null_cb;
     void *cbdata = NULL;
 
     if (handle) {
         fastestmirrorcache = handle->fastestmirrorcache;
+        binarycache = handle->fastestmirrorbinarycache;
         if (handle->fastestmirrorcb)
             cb = handle->fastestmirrorcb;
         cbdata = handle->fastestmirrordata;
         length_of_measurement = handle->fastestmirrortimeout;
+        max_probes = handle->fastestmirrormaxprobes;
+        background = fastestmirrorcache && handle->fastestmirrorbackground > 0;
+        budget = handle->fastestmirrorbackground;
 
         if (handle->offline) {
             g_debug("%s: Fastest mirror determination "
                     "skipped... LRO_OFFLINE enabled", __func__);
             return TRUE;
         }
+
+        if (background && handle->fastestmirrorrefresh) {
+            if (g_atomic_int_get(&handle->fastestmirrorrefresh->finished)) {
+                lr_fastestmirror_refresh_wait(handle);
+            } else {
+                // Never wait, the running probes refresh the cache later
+                g_debug("%s: Previous background probes still running",
+                        __func__);
+                budget = 0;
+            }
+        }
     }
 
     g_debug("%s: Fastest mirror determination in progress...", __func__);
@@ -615,6 +1099,7 @@ lr_fastestmirror_detailed(LrHandle *handle,
     LrFastestMirrorCache *cache = NULL;
     ret = lr_fastestmirrorcache_load(&cache,
                                      fastestmirrorcache,
+                                     binarycache,
                                      cb,
                                      cbdata,
                                      err);
@@ -624,8 +1109,9 @@ lr_fastestmirror_detailed(LrHandle *handle,
     }
 
     // Prepare list of LrFastestMirror elements
-    GSList *lrfastestmirrors;
-    ret = lr_fastestmirror_prepare(handle, inlist, &lrfastestmirrors, cache, err);
+    GSList *lrfastestmirrors, *refresh;
+    ret = lr_fastestmirror_prepare(handle, inlist, &lrfastestmirrors, cache,
+                                   background, budget, &refresh, err);
     if (!ret) {
         cb(cbdata, LR_FMSTAGE_STATUS, "Error while lr_fastestmirror_prepare()");
         g_debug("%s: Error while lr_fastestmirror_prepare()", __func__);
@@ -633,8 +1119,11 @@ lr_fastestmirror_detailed(LrHandle *handle,
         return FALSE;
     }
 
+    // In the background mode there is nothing to probe here
     ret = lr_fastestmirror_perform(lrfastestmirrors,
                                    length_of_measurement,
+                                   max_probes,
+                                   handle && handle->fastestmirrorprobesize > 0,
                                    cb,
                                    cbdata,
                                    err);
@@ -656,16 +1145,25 @@ lr_fastestmirror_detailed(LrHandle *handle,
     gint64 ts = g_get_real_time() / 1000000; // TimeStamp
     for (GSList *elem = lrfastestmirrors; elem; elem = g_slist_next(elem)) {
         LrFastestMirror *mirror = elem->data;
-        if (mirror->cached == FALSE) {
+        if (mirror->cached == FALSE && mirror->unknown == FALSE) {
             lr_fastestmirrorcache_update(cache,
                                          mirror->url,
                                          ts,
-                                         mirror->plain_connect_time);
+                                         mirror->plain_connect_time,
+                                         mirror->ttfb,
+                                         mirror->bandwidth);
         }
     }
 
-    lr_fastestmirrorcache_write(cache, NULL);
-    lr_fastestmirrorcache_free(cache);
+    if (refresh) {
+        // The cache is written once the background probes finish
+        g_debug("%s: Probing %d mirrors in the background", __func__,
+                g_slist_length(refresh));
+        lr_fastestmirror_refresh_start(handle, refresh, cache);
+    } else {
+        lr_fastestmirrorcache_write(cache, NULL);
+        lr_fastestmirrorcache_free(cache);
+    }
 
     *outlist = lrfastestmirrors;
 
@@ -704,14 +1202,15 @@ lr_fastestmirror(LrHandle *handle,
     // the best mirror, to introduce enough entropy to spread the load across nearby mirrors.
     double bestMirrorLatency = 0;
     if (lrfastestmirrors != NULL) {
-        bestMirrorLatency = ((LrFastestMirror *)lrfastestmirrors->data)->plain_connect_time;
+        bestMirrorLatency = lr_fastestmirror_rank(lrfastestmirrors->data);
     }
 
     for (GSList *elem = lrfastestmirrors; elem; elem = g_slist_next(elem)) {
         LrFastestMirror *mirror = elem->data;
-        g_debug("%s: %3.6f : %s", __func__, mirror->plain_connect_time, mirror->url);
-        if (mirror->plain_connect_time >= 0 &&
-            mirror->plain_connect_time < (2.0 * bestMirrorLatency)) { // Shuffle nearby mirrors
+        double rank = lr_fastestmirror_rank(mirror);
+        g_debug("%s: %3.6f : %s", __func__, rank, mirror->url);
+        if (rank >= 0 &&
+            rank < (2.0 * bestMirrorLatency)) { // Shuffle nearby mirrors
             new_list = g_slist_insert(new_list, mirror->url, g_random_int_range(0, g_slist_length(new_list)+1));
         } else { // Far away mirrors appended as backup options
             new_list = g_slist_append(new_list, mirror->url);
@@ -759,7 +1258,10 @@ lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
                                           g_hash_table_new_full(g_str_hash,
                                                                 g_str_equal,
                                                                 g_free,
-                                                                NULL);
+                                                                g_free);
+    // Probe downloads need a full URL of a mirror, the first mirror
+    // of the host is used
+    gboolean probe_download = main_handle->fastestmirrorprobesize > 0;
 
     for (GSList *ehandle = handles; ehandle; ehandle = g_slist_next(ehandle)) {
         LrHandle *handle = ehandle->data;
@@ -767,7 +1269,10 @@ lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
         for (GSList *elem = mirrors; elem; elem = g_slist_next(elem)) {
             LrInternalMirror *imirror = elem->data;
             gchar *host = lr_url_without_path(imirror->url);
-            g_hash_table_insert(hosts_ht, host, NULL);
+            if (g_hash_table_contains(hosts_ht, host))
+                g_free(host);
+            else
+                g_hash_table_insert(hosts_ht, host, g_strdup(imirror->url));
         }
 
         // Cache related warning
@@ -785,7 +1290,9 @@ lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
         }
     }
 
-    _cleanup_list_free_ GList *tmp_list_of_urls = g_hash_table_get_keys(hosts_ht);
+    _cleanup_list_free_ GList *tmp_list_of_urls = probe_download
+                                                  ? g_hash_table_get_values(hosts_ht)
+                                                  : g_hash_table_get_keys(hosts_ht);
     _cleanup_slist_free_ GSList *list_of_urls = NULL;
     int number_of_mirrors = 0;
     for (GList *elem = tmp_list_of_urls; elem; elem = g_list_next(elem)) {
@@ -813,7 +1320,7 @@ lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
         GSList *mirrors = handle->internal_mirrorlist;
         GSList *new_list = NULL;
         for (GSList *elem = list_of_urls; elem; elem = g_slist_next(elem)) {
-            gchar *host = elem->data;
+            _cleanup_free_ gchar *host = lr_url_without_path(elem->data);
             for (GSList *ime = mirrors; ime; ime = g_slist_next(ime)) {
                 LrInternalMirror *im = ime->data;
                 _cleanup_free_ gchar *im_host = lr_url_without_path(im->url);
@@ -36,6 +36,13 @@ typedef struct {
     CURL *curl;                 // Curl handle or NULL
     double plain_connect_time;  // Mirror connect time (<0.0 if connection was unsuccessful)
     gboolean cached;            // Was connect time load from cache?
+    double ttfb;                // Time to the first byte of a probe download
+                                // (<0.0 if not measured)
+    double bandwidth;           // Bandwidth of a probe download in bytes/s
+                                // (<=0.0 if not measured)
+    gboolean unknown;           // Nothing usable is known about the mirror
+                                // (e.g. its probe didn't get its turn),
+                                // it is ranked after the measured ones
 } LrFastestMirror;
 
 
@@ -45,7 +52,9 @@ void
 lr_lrfastestmirror_free(LrFastestMirror *mirror);
 
 
-/** Sorts list or mirror URLs by their connections times.
+/** Sorts list or mirror URLs by their connections times
+ * (or by the time to the first byte and the bandwidth
+ * if LRO_FASTESTMIRRORPROBESIZE is set).
  * @param handle        LrHandle or NULL
  * @param list          Pointer to the GSList of urls (char* or gchar*)
  *                      that will be sorted.
@@ -38,6 +38,18 @@ gboolean
 lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
                                           GError **err);
 
+/** Background probes of the fastest mirror detection
+ * (see LRO_FASTESTMIRRORBACKGROUND).
+ */
+typedef struct _LrFastestMirrorRefresh LrFastestMirrorRefresh;
+
+/** Wait for the background probes started by the handle (if any),
+ * store their results to the cache and free them.
+ * @param handle    LrHandle
+ */
+void
+lr_fastestmirror_refresh_wait(LrHandle *handle);
+
 G_END_DECLS
 
 #endif
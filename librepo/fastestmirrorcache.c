@@ -0,0 +1,466 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _DEFAULT_SOURCE     // Because of flock() and fchmod()
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "cleanup.h"
+#include "rcodes.h"
+#include "fastestmirrorcache_internal.h"
+
+#define BINCACHE_MAGIC          "LRFMBC\0\0"    // 8 bytes with the trailing \0
+#define BINCACHE_BYTEORDER      0x01020304      // Detects foreign endianness
+#define BINCACHE_VERSION        1               // Current version of the format
+#define BINCACHE_MIN_BUCKETS    16
+
+/* File layout:
+ *   LrBinCacheHeader
+ *   LrBinCacheBucket[n_buckets]    Open addressing, linear probing
+ *   char strings[strings_size]     URLs (not \0 terminated)
+ */
+
+typedef struct {
+    char magic[8];
+    guint32 byteorder;
+    guint32 version;
+    guint32 n_buckets;      // Power of two
+    guint32 n_records;
+    guint64 strings_size;
+} LrBinCacheHeader;
+
+typedef struct {
+    guint64 hash;           // 0 == empty bucket
+    gint64 ts;
+    double connecttime;
+    double ttfb;
+    double bandwidth;
+    guint32 url_offset;
+    guint32 url_len;
+} LrBinCacheBucket;
+
+struct _LrFastestMirrorBinCache {
+    gchar *path;
+    void *map;                      // Mapped file or NULL
+    gsize map_size;
+    GHashTable *updates;            // url -> LrFastestMirrorCacheRecord*
+};
+
+/** FNV-1a, never returns 0 (reserved for empty buckets)
+ */
+static guint64
+bincache_hash(const char *str, gsize len)
+{
+    guint64 hash = 14695981039346656037ULL;
+    for (gsize x = 0; x < len; x++) {
+        hash ^= (guchar) str[x];
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+static LrFastestMirrorCacheRecord *
+bincache_record_dup(const LrFastestMirrorCacheRecord *record)
+{
+    LrFastestMirrorCacheRecord *dup = g_new(LrFastestMirrorCacheRecord, 1);
+    *dup = *record;
+    return dup;
+}
+
+/** Check the mapped file is a valid cache in the current format.
+ */
+static gboolean
+bincache_validate(const void *map, gsize size, GError **err)
+{
+    const LrBinCacheHeader *hdr = map;
+
+    if (size < sizeof(*hdr)
+        || memcmp(hdr->magic, BINCACHE_MAGIC, sizeof(hdr->magic))) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_FILE,
+                    "Not a binary fastestmirror cache");
+        return FALSE;
+    }
+
+    if (hdr->byteorder != BINCACHE_BYTEORDER || hdr->version != BINCACHE_VERSION) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_FILE,
+                    "Unsupported version of the binary fastestmirror cache");
+        return FALSE;
+    }
+
+    if (hdr->n_buckets == 0 || (hdr->n_buckets & (hdr->n_buckets - 1))
+        || size != sizeof(*hdr)
+                   + (guint64) hdr->n_buckets * sizeof(LrBinCacheBucket)
+                   + hdr->strings_size) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_FILE,
+                    "Corrupted binary fastestmirror cache");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Find bucket of the url in the mapped file.
+ */
+static const LrBinCacheBucket *
+bincache_find(const void *map, const char *url)
+{
+    const LrBinCacheHeader *hdr = map;
+    const LrBinCacheBucket *buckets = (const void *) (hdr + 1);
+    const char *strings = (const char *) (buckets + hdr->n_buckets);
+    gsize len = strlen(url);
+    guint64 hash = bincache_hash(url, len);
+    guint32 mask = hdr->n_buckets - 1;
+
+    for (guint32 x = 0; x < hdr->n_buckets; x++) {
+        const LrBinCacheBucket *bucket = &buckets[(hash + x) & mask];
+        if (bucket->hash == 0)
+            return NULL;
+        if (bucket->hash != hash || bucket->url_len != len)
+            continue;
+        if ((guint64) bucket->url_offset + bucket->url_len > hdr->strings_size)
+            return NULL;  // Corrupted
+        if (!memcmp(strings + bucket->url_offset, url, len))
+            return bucket;
+    }
+
+    return NULL;
+}
+
+static gboolean
+bincache_map(const char *path, void **map, gsize *size, GError **err)
+{
+    struct stat st;
+
+    *map = NULL;
+    *size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT)
+            return TRUE;
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot open %s: %s", path, g_strerror(errno));
+        return FALSE;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot stat %s: %s", path, g_strerror(errno));
+        close(fd);
+        return FALSE;
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        return bincache_validate(NULL, 0, err);
+    }
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot mmap %s: %s", path, g_strerror(errno));
+        return FALSE;
+    }
+
+    if (!bincache_validate(addr, st.st_size, err)) {
+        munmap(addr, st.st_size);
+        return FALSE;
+    }
+
+    *map = addr;
+    *size = st.st_size;
+    return TRUE;
+}
+
+LrFastestMirrorBinCache *
+lr_fastestmirror_bincache_new(const char *path)
+{
+    LrFastestMirrorBinCache *cache = g_new0(LrFastestMirrorBinCache, 1);
+    cache->path = g_strdup(path);
+    cache->updates = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                           g_free, g_free);
+    return cache;
+}
+
+gboolean
+lr_fastestmirror_bincache_load(LrFastestMirrorBinCache *cache, GError **err)
+{
+    assert(cache);
+    assert(!err || *err == NULL);
+
+    if (cache->map) {
+        munmap(cache->map, cache->map_size);
+        cache->map = NULL;
+        cache->map_size = 0;
+    }
+
+    return bincache_map(cache->path, &cache->map, &cache->map_size, err);
+}
+
+gboolean
+lr_fastestmirror_bincache_lookup(LrFastestMirrorBinCache *cache,
+                                 const char *url,
+                                 LrFastestMirrorCacheRecord *record)
+{
+    if (!cache || !url)
+        return FALSE;
+
+    LrFastestMirrorCacheRecord *updated = g_hash_table_lookup(cache->updates, url);
+    if (updated) {
+        *record = *updated;
+        return TRUE;
+    }
+
+    if (!cache->map)
+        return FALSE;
+
+    const LrBinCacheBucket *bucket = bincache_find(cache->map, url);
+    if (!bucket)
+        return FALSE;
+
+    record->ts = bucket->ts;
+    record->connecttime = bucket->connecttime;
+    record->ttfb = bucket->ttfb;
+    record->bandwidth = bucket->bandwidth;
+    return TRUE;
+}
+
+void
+lr_fastestmirror_bincache_update(LrFastestMirrorBinCache *cache,
+                                 const char *url,
+                                 const LrFastestMirrorCacheRecord *record)
+{
+    if (!cache || !url)
+        return;
+
+    g_hash_table_replace(cache->updates, g_strdup(url),
+                         bincache_record_dup(record));
+}
+
+/** Add records from the mapped file to the table (newer records win).
+ */
+static void
+bincache_collect(const void *map,
+                 GHashTable *records,
+                 gint64 min_ts)
+{
+    const LrBinCacheHeader *hdr = map;
+    const LrBinCacheBucket *buckets = (const void *) (hdr + 1);
+    const char *strings = (const char *) (buckets + hdr->n_buckets);
+
+    for (guint32 x = 0; x < hdr->n_buckets; x++) {
+        const LrBinCacheBucket *bucket = &buckets[x];
+        if (bucket->hash == 0 || bucket->ts < min_ts)
+            continue;
+        if ((guint64) bucket->url_offset + bucket->url_len > hdr->strings_size)
+            continue;
+
+        gchar *url = g_strndup(strings + bucket->url_offset, bucket->url_len);
+        LrFastestMirrorCacheRecord *old = g_hash_table_lookup(records, url);
+        if (old && old->ts >= bucket->ts) {
+            g_free(url);
+            continue;
+        }
+
+        LrFastestMirrorCacheRecord *record = g_new(LrFastestMirrorCacheRecord, 1);
+        record->ts = bucket->ts;
+        record->connecttime = bucket->connecttime;
+        record->ttfb = bucket->ttfb;
+        record->bandwidth = bucket->bandwidth;
+        g_hash_table_replace(records, url, record);
+    }
+}
+
+/** Write the records in the binary format to the fd.
+ */
+static gboolean
+bincache_dump(int fd, GHashTable *records, GError **err)
+{
+    guint32 n_records = g_hash_table_size(records);
+    guint32 n_buckets = BINCACHE_MIN_BUCKETS;
+    while (n_buckets < n_records * 2)  // Load factor <= 0.5
+        n_buckets <<= 1;
+    guint32 mask = n_buckets - 1;
+
+    LrBinCacheBucket *buckets = g_new0(LrBinCacheBucket, n_buckets);
+    GString *strings = g_string_new(NULL);
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, records);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        const char *url = key;
+        const LrFastestMirrorCacheRecord *record = value;
+        gsize len = strlen(url);
+        guint64 hash = bincache_hash(url, len);
+
+        guint32 idx = hash & mask;
+        while (buckets[idx].hash != 0)
+            idx = (idx + 1) & mask;
+
+        buckets[idx].hash = hash;
+        buckets[idx].ts = record->ts;
+        buckets[idx].connecttime = record->connecttime;
+        buckets[idx].ttfb = record->ttfb;
+        buckets[idx].bandwidth = record->bandwidth;
+        buckets[idx].url_offset = strings->len;
+        buckets[idx].url_len = len;
+        g_string_append_len(strings, url, len);
+    }
+
+    LrBinCacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BINCACHE_MAGIC, sizeof(hdr.magic));
+    hdr.byteorder = BINCACHE_BYTEORDER;
+    hdr.version = BINCACHE_VERSION;
+    hdr.n_buckets = n_buckets;
+    hdr.n_records = n_records;
+    hdr.strings_size = strings->len;
+
+    FILE *f = fdopen(dup(fd), "w");
+    gboolean ret = f != NULL;
+    if (ret) {
+        ret = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+              && fwrite(buckets, sizeof(*buckets), n_buckets, f) == n_buckets
+              && fwrite(strings->str, 1, strings->len, f) == strings->len;
+        ret = (fclose(f) == 0) && ret;
+    }
+
+    if (!ret)
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot write binary fastestmirror cache: %s",
+                    g_strerror(errno));
+
+    g_free(buckets);
+    g_string_free(strings, TRUE);
+    return ret;
+}
+
+gboolean
+lr_fastestmirror_bincache_write(LrFastestMirrorBinCache *cache,
+                                gint64 max_age,
+                                GError **err)
+{
+    assert(!err || *err == NULL);
+
+    if (!cache || g_hash_table_size(cache->updates) == 0)
+        return TRUE;
+
+    // Serialize writers, readers don't care - they keep the old file
+    // mapped and the new one appears atomically by rename()
+    _cleanup_free_ gchar *lock_path = g_strconcat(cache->path, ".lock", NULL);
+    int lock_fd = open(lock_path, O_CREAT | O_RDWR, 0644);
+    if (lock_fd == -1) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot open %s: %s", lock_path, g_strerror(errno));
+        return FALSE;
+    }
+
+    while (flock(lock_fd, LOCK_EX) == -1) {
+        if (errno != EINTR) {
+            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                        "Cannot lock %s: %s", lock_path, g_strerror(errno));
+            close(lock_fd);
+            return FALSE;
+        }
+    }
+
+    gint64 min_ts = g_get_real_time() / 1000000 - max_age;
+    _cleanup_hashtable_unref_ GHashTable *records =
+            g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    // Records written by others since we loaded the cache must not be lost
+    void *map = NULL;
+    gsize map_size = 0;
+    GError *tmp_err = NULL;
+    if (bincache_map(cache->path, &map, &map_size, &tmp_err)) {
+        if (map) {
+            bincache_collect(map, records, min_ts);
+            munmap(map, map_size);
+        }
+    } else {
+        g_debug("%s: Current cache is ignored: %s", __func__, tmp_err->message);
+        g_clear_error(&tmp_err);
+    }
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, cache->updates);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        LrFastestMirrorCacheRecord *record = value;
+        LrFastestMirrorCacheRecord *old = g_hash_table_lookup(records, key);
+        if ((old && old->ts > record->ts) || record->ts < min_ts)
+            continue;
+        g_hash_table_replace(records, g_strdup(key),
+                             bincache_record_dup(record));
+    }
+
+    gboolean ret;
+    _cleanup_free_ gchar *tmp_path = g_strconcat(cache->path, ".XXXXXX", NULL);
+    int fd = g_mkstemp(tmp_path);
+    if (fd == -1) {
+        g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                    "Cannot create %s: %s", tmp_path, g_strerror(errno));
+        ret = FALSE;
+    } else {
+        ret = bincache_dump(fd, records, err);
+        fchmod(fd, 0644);
+        close(fd);
+        if (ret && rename(tmp_path, cache->path) == -1) {
+            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                        "Cannot rename %s to %s: %s", tmp_path, cache->path,
+                        g_strerror(errno));
+            ret = FALSE;
+        }
+        if (!ret)
+            unlink(tmp_path);
+    }
+
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+
+    if (ret)
+        g_hash_table_remove_all(cache->updates);
+
+    return ret;
+}
+
+void
+lr_fastestmirror_bincache_free(LrFastestMirrorBinCache *cache)
+{
+    if (!cache)
+        return;
+
+    if (cache->map)
+        munmap(cache->map, cache->map_size);
+    g_hash_table_destroy(cache->updates);
+    g_free(cache->path);
+    g_free(cache);
+}
@@ -0,0 +1,104 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_FASTESTMIRRORCACHE_INTERNAL_H__
+#define __LR_FASTESTMIRRORCACHE_INTERNAL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Binary fastestmirror cache.
+ *
+ * The file is a hash table of fixed size records followed by a pool
+ * of URL strings, so it is used directly via mmap() and a lookup doesn't
+ * depend on the number of cached mirrors. Readers don't lock, writers
+ * hold a lock (<path>.lock), merge their updates with the current
+ * content of the file and atomically replace it by rename().
+ */
+typedef struct _LrFastestMirrorBinCache LrFastestMirrorBinCache;
+
+/** Measurement of a mirror stored in the cache */
+typedef struct {
+    gint64 ts;              /*!< Timestamp of the measurement */
+    double connecttime;     /*!< Plain connect time (<0.0 if unsuccessful) */
+    double ttfb;            /*!< Time to the first byte (<0.0 if unknown) */
+    double bandwidth;       /*!< Bandwidth in bytes/s (<=0.0 if unknown) */
+} LrFastestMirrorCacheRecord;
+
+/** Create new empty cache for the file.
+ * @param path      Path to the cache file
+ * @return          New cache
+ */
+LrFastestMirrorBinCache *
+lr_fastestmirror_bincache_new(const char *path);
+
+/** Map the cache file. Nonexistent file is not an error (the cache stays
+ * empty). Invalid file is an error, the cache stays empty and usable
+ * and the file is replaced by the next write.
+ * @param cache     Cache
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set
+ */
+gboolean
+lr_fastestmirror_bincache_load(LrFastestMirrorBinCache *cache, GError **err);
+
+/** Find record of the url.
+ * @param cache     Cache
+ * @param url       URL
+ * @param record    Record is filled if found
+ * @return          TRUE if found
+ */
+gboolean
+lr_fastestmirror_bincache_lookup(LrFastestMirrorBinCache *cache,
+                                 const char *url,
+                                 LrFastestMirrorCacheRecord *record);
+
+/** Set record of the url. It is stored by ::lr_fastestmirror_bincache_write.
+ * @param cache     Cache
+ * @param url       URL
+ * @param record    New record
+ */
+void
+lr_fastestmirror_bincache_update(LrFastestMirrorBinCache *cache,
+                                 const char *url,
+                                 const LrFastestMirrorCacheRecord *record);
+
+/** Merge updated records with the current content of the cache file
+ * and replace the file. Records older than max_age seconds are dropped.
+ * @param cache     Cache
+ * @param max_age   Max age of records in seconds
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set
+ */
+gboolean
+lr_fastestmirror_bincache_write(LrFastestMirrorBinCache *cache,
+                                gint64 max_age,
+                                GError **err);
+
+/** Free the cache.
+ * @param cache     Cache
+ */
+void
+lr_fastestmirror_bincache_free(LrFastestMirrorBinCache *cache);
+
+G_END_DECLS
+
+#endif
@@ -49,6 +49,8 @@
 #include "url_substitution.h"
 #include "downloader.h"
 #include "fastestmirror_internal.h"
+#include "resolver_internal.h"
+#include "mirrorstats_internal.h"
 #include "cleanup.h"
 
 CURL *
@@ -90,6 +92,36 @@ err:
     return NULL;
 }
 
+static void
+lr_curl_share_free(CURLSH *share)
+{
+    if (curl_share_cleanup(share) != CURLSHE_OK)
+        g_warning("%s: The curl share is still in use", __func__);
+}
+
+// The connection cache of a share must not be used from more threads,
+// every thread gets its own share
+static GPrivate curl_thread_share = G_PRIVATE_INIT((GDestroyNotify) lr_curl_share_free);
+
+CURLSH *
+lr_curl_thread_share(void)
+{
+    CURLSH *share = g_private_get(&curl_thread_share);
+    if (share)
+        return share;
+
+    share = curl_share_init();
+    if (!share)
+        return NULL;
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900  // Shared connection cache since 7.57.0
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    g_private_set(&curl_thread_share, share);
+    return share;
+}
+
 void
 lr_handle_free_list(char ***list)
 {
@@ -137,6 +169,26 @@ lr_handle_init(void)
     handle->ftpuseepsv = LRO_FTPUSEEPSV_DEFAULT;
     handle->cachedir = NULL;
     handle->preservetime = 0;
+    handle->zckheaderprefetch = LRO_ZCKHEADERPREFETCH_DEFAULT;
+    handle->conditionalget = LRO_CONDITIONALGET_DEFAULT;
+    handle->previousdestdir = NULL;
+    handle->fastestmirrormaxprobes = LRO_FASTESTMIRRORMAXPROBES_DEFAULT;
+    handle->fastestmirrorprobesize = LRO_FASTESTMIRRORPROBESIZE_DEFAULT;
+    handle->fastestmirrorprobepath = g_strdup(LRO_FASTESTMIRRORPROBEPATH_DEFAULT);
+    handle->fastestmirrorkeepconns = LRO_FASTESTMIRRORKEEPCONNS_DEFAULT;
+    handle->fastestmirrorbinarycache = LRO_FASTESTMIRRORBINARYCACHE_DEFAULT;
+    handle->fastestmirrorbackground = LRO_FASTESTMIRRORBACKGROUND_DEFAULT;
+    handle->mirrorstats = LRO_MIRRORSTATS_DEFAULT;
+    handle->mirrorstatsfile = NULL;
+    handle->maxdownloadsperhost = LRO_MAXDOWNLOADSPERHOST_DEFAULT;
+    handle->preresolve = LRO_PRERESOLVE_DEFAULT;
+    handle->preresolvecache = NULL;
+    handle->preresolvecachettl = LRO_PRERESOLVECACHETTL_DEFAULT;
+    handle->rankmirrors = LRO_RANKMIRRORS_DEFAULT;
+    handle->mirrorhashing = LRO_MIRRORHASHING_DEFAULT;
+    handle->locktargets = LRO_LOCKTARGETS_DEFAULT;
+    handle->schedulepolicy = LRO_SCHEDULEPOLICY_DEFAULT;
+    handle->totalmaxspeed = LRO_TOTALMAXSPEED_DEFAULT;
 
     return handle;
 }
@@ -146,8 +198,11 @@ lr_handle_free(LrHandle *handle)
 {
     if (!handle)
         return;
+    // Background probes use the curl handles of the handle
+    lr_fastestmirror_refresh_wait(handle);
     if (handle->curl_handle)
         curl_easy_cleanup(handle->curl_handle);
+    curl_slist_free_all(handle->resolve);
     if (handle->mirrorlist_fd != -1)
         close(handle->mirrorlist_fd);
     if (handle->metalink_fd != -1)
@@ -179,6 +234,11 @@ lr_handle_free(LrHandle *handle)
     lr_urlvars_free(handle->urlvars);
     lr_free(handle->gnupghomedir);
     lr_free(handle->cachedir);
+    lr_free(handle->previousdestdir);
+    lr_free(handle->fastestmirrorprobepath);
+    lr_free(handle->mirrorstatsfile);
+    lr_free(handle->preresolvecache);
+    lr_handle_free_list(&handle->mirrorlocations);
     lr_handle_free_list(&handle->httpheader);
     lr_free(handle);
 }
@@ -415,9 +475,12 @@ lr_handle_setopt(LrHandle *handle,
         c_rc = curl_easy_setopt(c_h, CURLOPT_PASSWORD, va_arg(arg, char *));
         break;
 
-    case LRO_PROXY:
-        c_rc = curl_easy_setopt(c_h, CURLOPT_PROXY, va_arg(arg, char *));
+    case LRO_PROXY: {
+        char *proxy = va_arg(arg, char *);
+        handle->proxy_set = proxy && *proxy;
+        c_rc = curl_easy_setopt(c_h, CURLOPT_PROXY, proxy);
         break;
+    }
 
     case LRO_PROXYPORT: {
         c_rc = curl_easy_setopt(c_h, CURLOPT_PROXYPORT,va_arg(arg, long));
@@ -868,6 +931,170 @@ lr_handle_setopt(LrHandle *handle,
         c_rc = curl_easy_setopt(c_h, CURLOPT_FILETIME, handle->preservetime);
         break;
 
+    case LRO_ZCKHEADERPREFETCH:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_ZCKHEADERPREFETCH_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_ZCKHEADERPREFETCH is too low.");
+            ret = FALSE;
+        } else {
+            handle->zckheaderprefetch = val_long;
+        }
+
+        break;
+
+    case LRO_CONDITIONALGET:
+        handle->conditionalget = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_PREVIOUSDESTDIR:
+        if (handle->previousdestdir) lr_free(handle->previousdestdir);
+        handle->previousdestdir = g_strdup(va_arg(arg, char *));
+        break;
+
+    case LRO_FASTESTMIRRORMAXPROBES:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_FASTESTMIRRORMAXPROBES_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_FASTESTMIRRORMAXPROBES is too low.");
+            ret = FALSE;
+        } else {
+            handle->fastestmirrormaxprobes = val_long;
+        }
+
+        break;
+
+    case LRO_FASTESTMIRRORPROBESIZE:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_FASTESTMIRRORPROBESIZE_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_FASTESTMIRRORPROBESIZE is too low.");
+            ret = FALSE;
+        } else {
+            handle->fastestmirrorprobesize = val_long;
+        }
+
+        break;
+
+    case LRO_FASTESTMIRRORPROBEPATH: {
+        char *path = va_arg(arg, char *);
+        lr_free(handle->fastestmirrorprobepath);
+        handle->fastestmirrorprobepath = g_strdup(path ? path
+                                                  : LRO_FASTESTMIRRORPROBEPATH_DEFAULT);
+        break;
+    }
+
+    case LRO_FASTESTMIRRORKEEPCONNS:
+        handle->fastestmirrorkeepconns = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_FASTESTMIRRORBINARYCACHE:
+        handle->fastestmirrorbinarycache = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_FASTESTMIRRORBACKGROUND:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_FASTESTMIRRORBACKGROUND_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_FASTESTMIRRORBACKGROUND is too low.");
+            ret = FALSE;
+        } else {
+            handle->fastestmirrorbackground = val_long;
+        }
+
+        break;
+
+    case LRO_MIRRORSTATS:
+        handle->mirrorstats = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_MIRRORSTATSFILE:
+        if (handle->mirrorstatsfile) lr_free(handle->mirrorstatsfile);
+        handle->mirrorstatsfile = g_strdup(va_arg(arg, char *));
+        break;
+
+    case LRO_MAXDOWNLOADSPERHOST:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_MAXDOWNLOADSPERHOST_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_MAXDOWNLOADSPERHOST is too low.");
+            ret = FALSE;
+        } else {
+            handle->maxdownloadsperhost = val_long;
+        }
+
+        break;
+
+    case LRO_PRERESOLVE:
+        handle->preresolve = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_PRERESOLVECACHE:
+        if (handle->preresolvecache) lr_free(handle->preresolvecache);
+        handle->preresolvecache = g_strdup(va_arg(arg, char *));
+        break;
+
+    case LRO_PRERESOLVECACHETTL:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_PRERESOLVECACHETTL_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_PRERESOLVECACHETTL is too low.");
+            ret = FALSE;
+        } else {
+            handle->preresolvecachettl = val_long;
+        }
+
+        break;
+
+    case LRO_RANKMIRRORS:
+        handle->rankmirrors = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_MIRRORLOCATIONS:
+    {
+        char **list = va_arg(arg, char **);
+        lr_handle_free_list(&handle->mirrorlocations);
+        handle->mirrorlocations = lr_strv_dup(list);
+        break;
+    }
+
+    case LRO_MIRRORHASHING:
+        handle->mirrorhashing = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_LOCKTARGETS:
+        handle->locktargets = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_SCHEDULEPOLICY: {
+        long policy = va_arg(arg, long);
+        if (policy < LR_SCHEDULE_FIFO || policy >= LR_SCHEDULE_SENTINEL) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad LRO_SCHEDULEPOLICY value");
+            ret = FALSE;
+        } else {
+            handle->schedulepolicy = policy;
+        }
+        break;
+    }
+
+    case LRO_TOTALMAXSPEED:
+        val_gint64 = va_arg(arg, gint64);
+        if (val_gint64 < 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad value of LRO_TOTALMAXSPEED");
+            ret = FALSE;
+            break;
+        }
+        handle->totalmaxspeed = val_gint64;
+        break;
+
     default:
         g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
                     "Unknown option");
@@ -986,7 +1213,8 @@ lr_yum_download_url_retry(int attempts, LrHandle *lr_handle, const char *url,
     gboolean ret = FALSE;
 
     for (int i = 1;; i++) {
-        ret = lr_yum_download_url(lr_handle, url, fd, no_cache, is_zchunk, err);
+        ret = lr_yum_download_url(lr_handle, url, fd, no_cache, is_zchunk,
+                                  TRUE, err);
         if (ret)
             return ret;
 
@@ -1251,6 +1479,53 @@ lr_handle_prepare_metalink(LrHandle *handle, gchar *localpath, GError **err)
     return TRUE;
 }
 
+/** Resolve hosts of all mirrors of the internal mirrorlist and pass
+ * the addresses to the curl handle, its duplicates (probes, downloads)
+ * use them as well.
+ */
+static void
+lr_handle_preresolve(LrHandle *handle)
+{
+#if LIBCURL_VERSION_NUM < 0x074B00
+    // Entries without the '+' prefix (7.75.0) never expire, they would
+    // pin the addresses for the whole life of the handle
+    g_debug("%s: Not supported by this curl version", __func__);
+    return;
+#endif
+
+    // Names are resolved by the proxy, addresses would not be used
+    if (handle->proxy_set) {
+        g_debug("%s: Skipped, a proxy is used", __func__);
+        return;
+    }
+
+    GSList *urls = NULL;
+    for (GSList *elem = handle->internal_mirrorlist; elem; elem = g_slist_next(elem)) {
+        LrInternalMirror *mirror = elem->data;
+        urls = g_slist_prepend(urls, mirror->url);
+    }
+
+    struct curl_slist *resolve = lr_resolver_prepare(urls,
+                                                     handle->ipresolve,
+                                                     handle->preresolvecache,
+                                                     handle->preresolvecachettl);
+    g_slist_free(urls);
+
+    if (!resolve)
+        return;
+
+    CURLcode c_rc = curl_easy_setopt(handle->curl_handle, CURLOPT_RESOLVE, resolve);
+    if (c_rc != CURLE_OK) {
+        g_warning("%s: Cannot set CURLOPT_RESOLVE: %s",
+                  __func__, curl_easy_strerror(c_rc));
+        curl_slist_free_all(resolve);
+        return;
+    }
+
+    curl_slist_free_all(handle->resolve);
+    handle->resolve = resolve;
+}
+
 gboolean
 lr_handle_prepare_internal_mirrorlist(LrHandle *handle,
                                       gboolean usefastestmirror,
@@ -1353,6 +1628,24 @@ lr_handle_prepare_internal_mirrorlist(LrHandle *handle,
                                             handle->internal_mirrorlist,
                                             handle->urls_mirrors);
 
+    // If enabled, resolve hosts of all mirrors in advance
+    // (the LRO_PRERESOLVE option)
+    if (handle->preresolve)
+        lr_handle_preresolve(handle);
+
+    // If enabled, sort internal mirrorlist by the location, preference
+    // and measured round-trip times (the LRO_RANKMIRRORS option)
+    if (handle->rankmirrors && !usefastestmirror) {
+        GError *stats_err = NULL;
+        if (handle->mirrorstatsfile
+            && !lr_mirrorstats_load(handle->mirrorstatsfile, &stats_err)) {
+            g_debug("%s: %s", __func__, stats_err->message);
+            g_clear_error(&stats_err);
+        }
+        handle->internal_mirrorlist = lr_lrmirrorlist_rank(handle->internal_mirrorlist,
+                                                           handle->mirrorlocations);
+    }
+
     // If enabled, sort internal mirrorlist by the connection
     // speed (the LRO_FASTESTMIRROR option)
     if (usefastestmirror) {
@@ -1576,7 +1869,8 @@ lr_handle_getinfo(LrHandle *handle,
     case LRI_URLS:
     case LRI_YUMDLIST:
     case LRI_YUMBLIST:
-    case LRI_HTTPHEADER: {
+    case LRI_HTTPHEADER:
+    case LRI_MIRRORLOCATIONS: {
         char **source_list = NULL;
         char ***strlist = va_arg(arg, char ***);
 
@@ -1588,6 +1882,8 @@ lr_handle_getinfo(LrHandle *handle,
             source_list = handle->yumblist;
         else if (option == LRI_HTTPHEADER)
             source_list = handle->httpheader;
+        else if (option == LRI_MIRRORLOCATIONS)
+            source_list = handle->mirrorlocations;
 
         if (!source_list) {
             *strlist = NULL;
@@ -1788,6 +2084,101 @@ lr_handle_getinfo(LrHandle *handle,
         *str = handle->cachedir;
         break;
 
+    case LRI_ZCKHEADERPREFETCH:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->zckheaderprefetch;
+        break;
+
+    case LRI_CONDITIONALGET:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->conditionalget;
+        break;
+
+    case LRI_PREVIOUSDESTDIR:
+        str = va_arg(arg, char **);
+        *str = handle->previousdestdir;
+        break;
+
+    case LRI_FASTESTMIRRORMAXPROBES:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->fastestmirrormaxprobes;
+        break;
+
+    case LRI_FASTESTMIRRORPROBESIZE:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->fastestmirrorprobesize;
+        break;
+
+    case LRI_FASTESTMIRRORPROBEPATH:
+        str = va_arg(arg, char **);
+        *str = handle->fastestmirrorprobepath;
+        break;
+
+    case LRI_FASTESTMIRRORKEEPCONNS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->fastestmirrorkeepconns;
+        break;
+
+    case LRI_FASTESTMIRRORBINARYCACHE:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->fastestmirrorbinarycache;
+        break;
+
+    case LRI_FASTESTMIRRORBACKGROUND:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->fastestmirrorbackground;
+        break;
+
+    case LRI_MIRRORSTATS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->mirrorstats;
+        break;
+
+    case LRI_MIRRORSTATSFILE:
+        str = va_arg(arg, char **);
+        *str = handle->mirrorstatsfile;
+        break;
+
+    case LRI_MAXDOWNLOADSPERHOST:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->maxdownloadsperhost;
+        break;
+
+    case LRI_PRERESOLVE:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->preresolve;
+        break;
+
+    case LRI_PRERESOLVECACHE:
+        str = va_arg(arg, char **);
+        *str = handle->preresolvecache;
+        break;
+
+    case LRI_PRERESOLVECACHETTL:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->preresolvecachettl;
+        break;
+
+    case LRI_RANKMIRRORS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->rankmirrors;
+        break;
+
+    case LRI_MIRRORHASHING:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->mirrorhashing;
+        break;
+
+    case LRI_LOCKTARGETS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->locktargets;
+        break;
+
+    case LRI_SCHEDULEPOLICY:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->schedulepolicy;
+        break;
+
     default:
         rc = FALSE;
         g_set_error(err, LR_HANDLE_ERROR, LRE_UNKNOWNOPT,
@@ -249,6 +249,79 @@ struct _LrHandle {
         Preserve timestamps of downloaded files */
 
     LrUrlVars *yumslist;
+
+    long zckheaderprefetch; /*!<
+        See: LRO_ZCKHEADERPREFETCH */
+
+    long conditionalget; /*!<
+        Use conditional requests for repomd.xml, metalink and mirrorlist */
+
+    char *previousdestdir; /*!<
+        Destdir of a previous download of the repository */
+
+    long fastestmirrormaxprobes; /*!<
+        Max number of parallel fastest mirror probes */
+
+    long fastestmirrorprobesize; /*!<
+        Number of bytes downloaded by a fastest mirror probe */
+
+    char *fastestmirrorprobepath; /*!<
+        Path of a file downloaded by a fastest mirror probe */
+
+    long fastestmirrorkeepconns; /*!<
+        Reuse connections of fastest mirror probes */
+
+    long fastestmirrorbinarycache; /*!<
+        Use the binary format of the fastestmirror cache */
+
+    long fastestmirrorbackground; /*!<
+        Max number of mirrors probed in the background */
+
+    struct _LrFastestMirrorRefresh *fastestmirrorrefresh; /*!<
+        Background probes of the fastest mirror detection or NULL */
+
+    long mirrorstats; /*!<
+        Use the process-wide mirror statistics */
+
+    char *mirrorstatsfile; /*!<
+        File with the mirror statistics or NULL */
+
+    long maxdownloadsperhost; /*!<
+        Max number of parallel downloads per host (0 == no limit) */
+
+    gboolean proxy_set; /*!<
+        LRO_PROXY is set */
+
+    long preresolve; /*!<
+        Resolve hosts of all mirrors in advance */
+
+    struct curl_slist *resolve; /*!<
+        CURLOPT_RESOLVE entries of the pre-resolved hosts or NULL.
+        Curl doesn't copy the list, it is shared by duplicated handles. */
+
+    char *preresolvecache; /*!<
+        File with the pre-resolved addresses or NULL */
+
+    long preresolvecachettl; /*!<
+        Max age of addresses in the preresolvecache */
+
+    long rankmirrors; /*!<
+        Sort mirrors by locality, preference and measured RTT */
+
+    char **mirrorlocations; /*!<
+        Preferred mirror locations (country codes) or NULL */
+
+    long mirrorhashing; /*!<
+        Assign targets to mirrors by rendezvous hashing */
+
+    long locktargets; /*!<
+        Lock destination files while downloading */
+
+    LrSchedulePolicy schedulepolicy; /*!<
+        Order in which waiting targets are started */
+
+    gint64 totalmaxspeed; /*!<
+        Max total speed of all targets of a download in bytes/s */
 };
 
 /** Return new CURL easy handle with some default options setted.
@@ -256,6 +329,15 @@ struct _LrHandle {
 CURL *
 lr_get_curl_handle();
 
+/** Return CURL share handle of the calling thread (created on the first
+ * call and freed when the thread exits) or NULL. It shares connections,
+ * DNS cache and TLS sessions of the probes and the downloads of all
+ * handles with LRO_FASTESTMIRRORKEEPCONNS enabled. It has no locking,
+ * only CURL handles used by the calling thread may use it.
+ */
+CURLSH *
+lr_curl_thread_share(void);
+
 /**
  * Create (if do not exists) internal mirrorlist. Insert baseurl (if
  * specified) and download, parse and insert mirrors from mirrorlist url.
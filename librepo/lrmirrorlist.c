@@ -24,6 +24,7 @@
 
 #include "util.h"
 #include "lrmirrorlist.h"
+#include "mirrorstats_internal.h"
 
 LrProtocol
 lr_detect_protocol(const char *url)
@@ -60,6 +61,7 @@ lr_lrmirror_free(void *data)
 {
     LrInternalMirror *mirror = data;
     lr_free(mirror->url);
+    lr_free(mirror->location);
     lr_free(mirror);
 }
 
@@ -156,6 +158,7 @@ lr_lrmirrorlist_append_metalink(LrInternalMirrorlist *list,
         LrInternalMirror *mirror = lr_lrmirror_new(url_copy, urlvars);
         mirror->preference = metalinkurl->preference;
         mirror->protocol = lr_detect_protocol(mirror->url);
+        mirror->location = g_strdup(metalinkurl->location);
         g_free(url_copy);
         list = g_slist_append(list, mirror);
 
@@ -179,6 +182,7 @@ lr_lrmirrorlist_append_lrmirrorlist(LrInternalMirrorlist *list,
         LrInternalMirror *mirror = lr_lrmirror_new(oth->url, NULL);
         mirror->preference = oth->preference;
         mirror->protocol = oth->protocol;
+        mirror->location = g_strdup(oth->location);
         list = g_slist_append(list, mirror);
         //g_debug("%s: Appending URL: %s", __func__, mirror->url);
     }
@@ -200,3 +204,89 @@ lr_lrmirrorlist_nth_url(LrInternalMirrorlist *list,
     LrInternalMirror *mirror = g_slist_nth_data(list, nth);
     return (mirror) ? mirror->url : NULL;
 }
+
+typedef struct {
+    LrInternalMirror *mirror;
+    guint position;     /*!< Position in the original list */
+    guint tier;         /*!< Position of the location in the preferred ones */
+    double cost;        /*!< RTT weighted by the preference */
+} LrRankedMirror;
+
+static int
+lr_rankedmirror_cmp(const void *a, const void *b)
+{
+    const LrRankedMirror *ma = a;
+    const LrRankedMirror *mb = b;
+
+    if (ma->tier != mb->tier)
+        return ma->tier < mb->tier ? -1 : 1;
+    if (ma->cost != mb->cost)
+        return ma->cost < mb->cost ? -1 : 1;
+    return ma->position < mb->position ? -1 : ma->position > mb->position;
+}
+
+static int
+lr_double_cmp(const void *a, const void *b)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+    return da < db ? -1 : da > db;
+}
+
+LrInternalMirrorlist *
+lr_lrmirrorlist_rank(LrInternalMirrorlist *list, char **locations)
+{
+    guint len = g_slist_length(list);
+    if (len < 2)
+        return list;
+
+    guint n_locations = locations ? g_strv_length(locations) : 0;
+    LrRankedMirror *ranked = g_new0(LrRankedMirror, len);
+    double *rtts = g_new(double, len);
+    guint n_rtts = 0;
+
+    guint x = 0;
+    for (LrInternalMirrorlist *elem = list; elem; elem = g_slist_next(elem), x++) {
+        LrInternalMirror *mirror = elem->data;
+        LrMirrorStats stats;
+
+        ranked[x].mirror = mirror;
+        ranked[x].position = x;
+        ranked[x].tier = n_locations;
+        for (guint l = 0; mirror->location && l < n_locations; l++) {
+            if (!g_ascii_strcasecmp(mirror->location, locations[l])) {
+                ranked[x].tier = l;
+                break;
+            }
+        }
+
+        ranked[x].cost = -1.0;
+        if (lr_mirrorstats_get(mirror->url, &stats) && stats.rtt >= 0.0) {
+            ranked[x].cost = stats.rtt;
+            rtts[n_rtts++] = stats.rtt;
+        }
+    }
+
+    double median = 1.0;
+    if (n_rtts) {
+        qsort(rtts, n_rtts, sizeof(double), lr_double_cmp);
+        median = rtts[n_rtts / 2];
+    }
+
+    for (x = 0; x < len; x++) {
+        int preference = CLAMP(ranked[x].mirror->preference, 1, 100);
+        double rtt = ranked[x].cost >= 0.0 ? ranked[x].cost : median;
+        // Preference 100 keeps the RTT, preference 1 almost doubles it
+        ranked[x].cost = rtt * (200 - preference) / 100.0;
+    }
+
+    qsort(ranked, len, sizeof(*ranked), lr_rankedmirror_cmp);
+
+    x = 0;
+    for (LrInternalMirrorlist *elem = list; elem; elem = g_slist_next(elem), x++)
+        elem->data = ranked[x].mirror;
+
+    g_free(ranked);
+    g_free(rtts);
+    return list;
+}
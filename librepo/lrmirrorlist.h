@@ -42,6 +42,7 @@ typedef struct {
     char *url;           /*!< URL of the mirror */
     int preference;      /*!< Integer number 1-100 - higher is better */
     LrProtocol protocol; /*!< Protocol of this mirror */
+    char *location;      /*!< ISO 3166-1 alpha-2 code or NULL */
 } LrInternalMirror;
 
 typedef GSList LrInternalMirrorlist;
@@ -115,6 +116,20 @@ char *
 lr_lrmirrorlist_nth_url(LrInternalMirrorlist *list,
                         unsigned int nth);
 
+/** Sort mirrors without probing them. Mirrors are ordered by
+ * the position of their location in the locations (mirrors located
+ * elsewhere go last), then by the round-trip time known from previous
+ * downloads (LRO_MIRRORSTATS) weighted by the preference. Mirrors without
+ * a measured RTT are expected to be as fast as the median one. Mirrors
+ * which rank equally keep their order.
+ * @param list          a LrInternalMirrorlist
+ * @param locations     NULL terminated list of preferred locations
+ *                      (the best first) or NULL
+ * @return              the new start of the LrInternalMirrorlist
+ */
+LrInternalMirrorlist *
+lr_lrmirrorlist_rank(LrInternalMirrorlist *list, char **locations);
+
 /** Free LrInternalMirrorlist.
  * @param list          Internal mirrorlist
  */
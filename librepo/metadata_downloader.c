@@ -25,12 +25,15 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include "cleanup.h"
 
 #include "librepo/librepo.h"
 
 #include "handle_internal.h"
+#include "downloader_internal.h"
+#include "yum_internal.h"
 #include "librepo.h"
 
 LrMetadataTarget *
@@ -152,225 +155,336 @@ lr_restore_sigaction(struct sigaction *old_sigact,
     return TRUE;
 }
 
-GSList *
-appendFdValue(GSList *fd_list, int fd)
+/** Stage of the metadata download of a single repository */
+typedef enum {
+    LR_MDS_MIRRORS,     /*!< Downloading metalink and/or mirrorlist */
+    LR_MDS_REPOMD,      /*!< Preparing mirrors, downloading repomd.xml */
+    LR_MDS_SIGNATURE,   /*!< Downloading and verifying repomd.xml.asc */
+    LR_MDS_RECORDS,     /*!< Downloading repomd records */
+} LrMetadataStage;
+
+/** Download state of a single LrMetadataTarget */
+typedef struct {
+    LrMetadataTarget *target; /*!<
+        Metadata target */
+
+    LrMetadataStage stage; /*!<
+        Current stage */
+
+    gboolean shared_handle; /*!<
+        The handle is used by another metadata target too, so its mirrors
+        are not prepared in another thread */
+
+    LrDownloadTarget *metalink_target; /*!<
+        Metalink download target or NULL */
+
+    LrDownloadTarget *mirrorlist_target; /*!<
+        Mirrorlist download target or NULL */
+
+    int pending_lists; /*!<
+        Number of metalink/mirrorlist targets not finished yet */
+
+    int repomd_fd; /*!<
+        File descriptor of the downloaded repomd.xml or -1 */
+
+    char *repomd_path; /*!<
+        Path of the downloaded repomd.xml or NULL */
+
+    int signature_fd; /*!<
+        File descriptor of the repomd.xml.asc being downloaded or -1 */
+
+    char *signature_path; /*!<
+        Path of the downloaded repomd.xml.asc or NULL */
+} LrMetadataRepoState;
+
+/** Blocking work of a repository done in LrMetadataPipeline.pool */
+typedef enum {
+    LR_MDW_MIRRORS,     /*!< Preparation of the internal mirrorlist
+                             sorted by LRO_FASTESTMIRROR */
+    LR_MDW_GPG,         /*!< GPG verification of repomd.xml */
+} LrMetadataWorkKind;
+
+typedef struct {
+    LrMetadataWorkKind kind; /*!<
+        What to do */
+
+    LrMetadataRepoState *state; /*!<
+        Repository of the work */
+
+    GError *err; /*!<
+        Error of the work or NULL */
+} LrMetadataWork;
+
+/** Data shared by all repositories of a single ::lr_download_metadata call */
+typedef struct {
+    GHashTable *states; /*!<
+        LrDownloadTarget (metalink, mirrorlist, repomd.xml, repomd.xml.asc)
+        -> LrMetadataRepoState */
+
+    GSList *repo_states; /*!<
+        List of all LrMetadataRepoState */
+
+    GSList *list_targets; /*!<
+        Metalink and mirrorlist LrDownloadTargets */
+
+    GSList *repomd_targets; /*!<
+        Repomd.xml LrDownloadTargets */
+
+    GSList *signature_targets; /*!<
+        Repomd.xml.asc LrDownloadTargets */
+
+    GSList *record_targets; /*!<
+        LrDownloadTargets of repomd records */
+
+    GSList *cbdata_list; /*!<
+        Callback data of the record targets */
+
+    GSList *shared_cbdata_list; /*!<
+        Shared callback data of the record targets */
+
+    GError *records_error; /*!<
+        Error from preparation of record targets */
+
+    GThreadPool *pool; /*!<
+        Threads doing the blocking work (LrMetadataWork), so it doesn't
+        stall the transfers of the other repositories. NULL if no work
+        was started. */
+
+    GSList *work_list; /*!<
+        All started LrMetadataWork */
+
+    LrDownloadWorks works; /*!<
+        Works passed to the downloader */
+} LrMetadataPipeline;
+
+/** Max number of threads doing the blocking work of the repositories */
+#define METADATA_WORK_MAX_THREADS   4
+
+static void
+lr_metadata_repo_state_free(LrMetadataRepoState *state)
 {
-    int *fd_allocated = malloc(sizeof(int));
-    *fd_allocated = fd;
-    fd_list = g_slist_append(fd_list, fd_allocated);
-    return fd_list;
+    if (!state)
+        return;
+    if (state->repomd_fd != -1)
+        close(state->repomd_fd);
+    if (state->signature_fd != -1)
+        close(state->signature_fd);
+    lr_free(state->repomd_path);
+    lr_free(state->signature_path);
+    lr_free(state);
 }
 
-GSList *
-appendPath(GSList *paths, const char *path)
+static void
+lr_metadata_work_free(LrMetadataWork *work)
 {
-    paths = g_slist_append(paths, g_strdup(path));
-    return paths;
+    if (!work)
+        return;
+    g_clear_error(&work->err);
+    g_free(work);
 }
 
-void
-fillInvalidationValues(GSList **fd_list, GSList **paths)
+/** Run in a thread of pipeline->pool. No user callbacks are called here.
+ */
+static void
+metadata_work_run(gpointer data, gpointer user_data)
 {
-    (*fd_list) = appendFdValue((*fd_list), -1);
-    (*paths) = appendPath((*paths), "");
+    LrMetadataWork *work = data;
+    LrMetadataPipeline *pipeline = user_data;
+    LrMetadataRepoState *state = work->state;
+    LrHandle *handle = state->target->handle;
+
+    switch (work->kind) {
+    case LR_MDW_MIRRORS:
+        lr_handle_prepare_internal_mirrorlist(handle, TRUE, &work->err);
+        break;
+    case LR_MDW_GPG:
+        lr_gpg_check_signature(state->signature_path,
+                               state->repomd_path,
+                               handle->gnupghomedir,
+                               &work->err);
+        break;
+    }
+
+    g_async_queue_push(pipeline->works.results, work);
 }
 
-void
-handle_failure(LrMetadataTarget *target,
-               GSList **fd_list,
-               GSList **paths,
-               GError *err)
+/** Start the work of the repository in pipeline->pool. The repository
+ * continues when the result comes to metadata_work_done().
+ */
+static void
+start_work(LrMetadataRepoState *state,
+           LrMetadataWorkKind kind,
+           LrMetadataPipeline *pipeline)
 {
-    lr_metadatatarget_append_error(target, err->message);
-    fillInvalidationValues(fd_list, paths);
-    g_error_free(err);
+    LrMetadataWork *work = g_new0(LrMetadataWork, 1);
+    work->kind = kind;
+    work->state = state;
+
+    if (!pipeline->pool)
+        pipeline->pool = g_thread_pool_new(metadata_work_run, pipeline,
+                                           METADATA_WORK_MAX_THREADS,
+                                           FALSE, NULL);
+
+    pipeline->work_list = g_slist_prepend(pipeline->work_list, work);
+    pipeline->works.pending++;
+    g_thread_pool_push(pipeline->pool, work, NULL);
 }
 
-void
-create_repomd_xml_download_targets(GSList *targets,
-                                   GSList **download_targets,
-                                   GSList **fd_list,
-                                   GSList **paths)
+/** Prepare the download target of repomd.xml. The internal mirrorlist
+ * of the handle has to be already prepared.
+ * @return      The target or NULL if there is nothing to download
+ *              (fetchmirrors, update or an error)
+ */
+static LrDownloadTarget *
+prepare_repomd_xml_download_target(LrMetadataRepoState *state)
 {
-    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
-        LrMetadataTarget *target = elem->data;
-        LrDownloadTarget *download_target;
-        GSList *checksums = NULL;
-        GError *err = NULL;
-        LrHandle *handle;
-        char *path = NULL;
-        int fd = -1;
-
-        if (!target->handle) {
-            /* every target must have fd and path, even invalid */
-            fillInvalidationValues(fd_list, paths);
-            continue;
-        }
+    LrMetadataTarget *target = state->target;
+    LrDownloadTarget *download_target;
+    GSList *checksums = NULL;
+    GError *err = NULL;
+    LrHandle *handle = target->handle;
+    char *path = NULL;
+    int fd = -1;
+
+    if (handle->fetchmirrors)
+        return NULL;
 
-        handle = target->handle;
+    if (mkdir(handle->destdir, S_IRWXU) == -1 && errno != EEXIST) {
+        lr_metadatatarget_append_error(target, "Cannot create tmpdir: %s %s", handle->destdir, g_strerror(errno));
+        return NULL;
+    }
 
-        if (!handle->urls && !handle->mirrorlisturl && !handle->metalinkurl) {
-            lr_metadatatarget_append_error(target, "No LRO_URLS, LRO_MIRRORLISTURL nor LRO_METALINKURL specified");
-            fillInvalidationValues(fd_list, paths);
-            continue;
-        }
+    if (!lr_prepare_repodata_dir(handle, &err))
+        goto fail;
 
-        if (handle->repotype != LR_YUMREPO) {
-            lr_metadatatarget_append_error(target, "Bad LRO_REPOTYPE specified");
-            fillInvalidationValues(fd_list, paths);
-            continue;
-        }
+    // For an update we use repomd from the previous (first) run
+    if (handle->update)
+        return NULL;
 
-        if (target->repo == NULL) {
-            target->repo = lr_yum_repo_init();
-        }
-        if (target->repomd == NULL) {
-            target->repomd = lr_yum_repomd_init();
-        }
+    if (!lr_store_mirrorlist_files(handle, target->repo, &err))
+        goto fail;
 
-        if (!lr_handle_prepare_internal_mirrorlist(handle,
-                                                   handle->fastestmirror,
-                                                   &err)) {
-            lr_metadatatarget_append_error(target, "Cannot prepare internal mirrorlist: %s", err->message);
-            fillInvalidationValues(fd_list, paths);
-            g_error_free(err);
-            continue;
-        }
+    if (!lr_copy_metalink_content(handle, target->repo, &err))
+        goto fail;
 
-        if (handle->fetchmirrors) {
-            fillInvalidationValues(fd_list, paths);
-            continue;
-        }
+    if ((fd = lr_prepare_repomd_xml_file(handle, &path, &err)) == -1)
+        goto fail;
 
-        if (mkdir(handle->destdir, S_IRWXU) == -1 && errno != EEXIST) {
-            lr_metadatatarget_append_error(target, "Cannot create tmpdir: %s %s", handle->destdir, g_strerror(errno));
-            fillInvalidationValues(fd_list, paths);
-            g_error_free(err);
-            continue;
-        }
+    if (handle->metalink && (handle->checks & LR_CHECK_CHECKSUM)) {
+        lr_get_best_checksum(handle->metalink, &checksums);
+    }
 
-        if (!lr_prepare_repodata_dir(handle, &err)) {
-            handle_failure(target, fd_list, paths, err);
-            continue;
-        }
+    download_target = lr_downloadtarget_new(target->handle,
+                                            "repodata/repomd.xml",
+                                            NULL,
+                                            fd,
+                                            NULL,
+                                            checksums,
+                                            0,
+                                            0,
+                                            target->progresscb,
+                                            target->cbdata,
+                                            NULL,
+                                            target->mirrorfailurecb,
+                                            target,
+                                            0,
+                                            0,
+                                            NULL,
+                                            TRUE,
+                                            FALSE);
 
-        if (!handle->update) {
-            if (!lr_store_mirrorlist_files(handle, target->repo, &err)) {
-                handle_failure(target, fd_list, paths, err);
-                continue;
-            }
-
-            if (!lr_copy_metalink_content(handle, target->repo, &err)) {
-                handle_failure(target, fd_list, paths, err);
-                continue;
-            }
-
-            if ((fd = lr_prepare_repomd_xml_file(handle, &path, &err)) == -1) {
-                handle_failure(target, fd_list, paths, err);
-                continue;
-            }
-
-            if (handle->metalink && (handle->checks & LR_CHECK_CHECKSUM)) {
-                lr_get_best_checksum(handle->metalink, &checksums);
-            }
-
-            download_target = lr_downloadtarget_new(target->handle,
-                                                    "repodata/repomd.xml",
-                                                    NULL,
-                                                    fd,
-                                                    NULL,
-                                                    checksums,
-                                                    0,
-                                                    0,
-                                                    target->progresscb,
-                                                    target->cbdata,
-                                                    NULL,
-                                                    target->mirrorfailurecb,
-                                                    target,
-                                                    0,
-                                                    0,
-                                                    NULL,
-                                                    TRUE,
-                                                    FALSE);
-
-            target->download_target = download_target;
-            (*download_targets) = g_slist_append((*download_targets), download_target);
-            (*fd_list) = appendFdValue((*fd_list), fd);
-            (*paths) = appendPath((*paths), path);
-        } else {
-            fillInvalidationValues(fd_list, paths);
-        }
+    target->download_target = download_target;
+    state->repomd_fd = fd;
+    state->repomd_path = path;
+    return download_target;
 
-        lr_free(path);
-    }
+fail:
+    lr_metadatatarget_append_error(target, err->message);
+    g_error_free(err);
+    return NULL;
 }
 
-// If it returns FALSE then err is set
-void
-process_repomd_xml(GSList *targets,
-                   GSList *fd_list,
-                   GSList *paths)
+/** Prepare the download target of repomd.xml.asc. Like in
+ * lr_download_repomd_xml_asc(), it is downloaded only from the mirror
+ * where repomd.xml was downloaded.
+ * @return      The target or NULL on error
+ */
+static LrDownloadTarget *
+prepare_signature_download_target(LrMetadataRepoState *state)
 {
-    GError *error = NULL;
-
-    for (GSList *elem = targets, *fd = fd_list, *path = paths; elem;
-         elem = g_slist_next(elem), fd = g_slist_next(fd), path = g_slist_next(path)) {
-
-        LrMetadataTarget *target = elem->data;
-        LrHandle *handle = target->handle;
-
-        // No repomd should be present
-        if (handle->fetchmirrors) {
-            continue;
-        }
-
-        // For an update we use repomd from the previous (first) run
-        if (handle->update) {
-            continue;
-        }
-
-        gboolean ret;
-        int fd_value = *((int *) fd->data);
-
-        if (!target->handle || fd_value == -1) {
-            goto fail;
-        }
-
-        handle->used_mirror =  g_strdup(target->download_target->usedmirror);
-        handle->gnupghomedir = g_strdup(target->gnupghomedir);
+    LrMetadataTarget *target = state->target;
+    LrHandle *handle = target->handle;
+    char *path;
+    int fd;
+
+    path = lr_pathconcat(handle->destdir, "repodata/repomd.xml.asc", NULL);
+    fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd == -1) {
+        g_debug("%s: Cannot open: %s", __func__, path);
+        lr_metadatatarget_append_error(target, "Cannot open %s: %s", path, g_strerror(errno));
+        lr_free(path);
+        return NULL;
+    }
 
-        if (target->download_target->rcode != LRE_OK) {
-            lr_metadatatarget_append_error(target, (char *) lr_strerror(target->download_target->rcode));
-            goto fail;
-        }
+    _cleanup_free_ gchar *url = lr_pathconcat(handle->used_mirror,
+                                              "repodata/repomd.xml.asc",
+                                              NULL);
+    LrDownloadTarget *download_target = lr_downloadtarget_new(handle,
+                                            url,
+                                            NULL,
+                                            fd,
+                                            NULL,
+                                            NULL,
+                                            0,
+                                            0,
+                                            target->progresscb,
+                                            target->cbdata,
+                                            NULL,
+                                            target->mirrorfailurecb,
+                                            target,
+                                            0,
+                                            0,
+                                            NULL,
+                                            FALSE,
+                                            FALSE);
 
-        if (!lr_check_repomd_xml_asc_availability(handle, target->repo, fd_value, path->data, &error)) {
-            lr_metadatatarget_append_error(target, error->message);
-            g_clear_error(&error);
-            goto fail;
-        }
+    state->signature_fd = fd;
+    state->signature_path = path;
+    return download_target;
+}
 
-        lseek(fd_value, SEEK_SET, 0);
-        ret = lr_yum_repomd_parse_file(target->repomd, fd_value, lr_xml_parser_warning_logger,
-                                       "Repomd xml parser", &error);
-        if (!ret) {
-            lr_metadatatarget_append_error(target, "Parsing unsuccessful: %s", error->message);
-            g_clear_error(&error);
-            goto fail;
-        }
+/** Drop the downloaded repomd.xml of a repository which failed */
+static void
+repomd_xml_failed(LrMetadataRepoState *state)
+{
+    close(state->repomd_fd);
+    state->repomd_fd = -1;
+    lr_free(state->repomd_path);
+    state->repomd_path = NULL;
+}
 
-        close(fd_value);
-        lr_free(fd->data);
-        target->repo->destdir = g_strdup(handle->destdir);
-        target->repo->repomd = path->data;
-        continue;
-    fail:
-        if (fd_value != -1) {
-            close(fd_value);
-        }
-        lr_free(path->data);
-        lr_free(fd->data);
+static void
+parse_repomd_xml(LrMetadataRepoState *state)
+{
+    LrMetadataTarget *target = state->target;
+    LrHandle *handle = target->handle;
+    GError *error = NULL;
+    int fd = state->repomd_fd;
+
+    lseek(fd, 0, SEEK_SET);
+    if (!lr_yum_repomd_parse_file(target->repomd, fd, lr_xml_parser_warning_logger,
+                                  "Repomd xml parser", &error)) {
+        lr_metadatatarget_append_error(target, "Parsing unsuccessful: %s", error->message);
+        g_clear_error(&error);
+        repomd_xml_failed(state);
+        return;
     }
+
+    close(fd);
+    state->repomd_fd = -1;
+    target->repo->destdir = g_strdup(handle->destdir);
+    target->repo->repomd = state->repomd_path;
+    state->repomd_path = NULL;
 }
 
 static gboolean
@@ -462,12 +576,17 @@ restore_handle_callbacks(GSList *targets, GSList *handle_callbacks_backups)
     g_slist_free(handle_callbacks_backups);
 }
 
-static void
-append_url_target(const char *url, LrMetadataTarget *target, GSList **download_targets) {
+static LrDownloadTarget *
+append_url_target(const char *url,
+                  LrMetadataRepoState *state,
+                  LrMetadataPipeline *pipeline,
+                  GSList **new_targets)
+{
+    LrMetadataTarget *target = state->target;
     int fd = lr_gettmpfile();
     if (fd < 0) {
         lr_metadatatarget_append_error(target, "Cannot create a temporary file for: %s", url);
-        return;
+        return NULL;
     }
     target->handle->onetimeflag_apply = TRUE;
     LrDownloadTarget *download_target = lr_downloadtarget_new(target->handle,
@@ -489,63 +608,316 @@ append_url_target(const char *url, LrMetadataTarget *target, GSList **download_t
                                             TRUE,
                                             FALSE);
 
-    *download_targets = g_slist_append(*download_targets, download_target);
+    g_hash_table_insert(pipeline->states, download_target, state);
+    pipeline->list_targets = g_slist_append(pipeline->list_targets, download_target);
+    *new_targets = g_slist_append(*new_targets, download_target);
+    state->pending_lists++;
+    return download_target;
 }
 
-static void
-create_metalink_and_mirrorlist_download_targets(GSList *targets, GSList **download_targets)
+/** Move the repository to the records stage. Targets of its repomd
+ * records are appended to the new_targets.
+ */
+static gboolean
+start_records_stage(LrMetadataRepoState *state,
+                    LrMetadataPipeline *pipeline,
+                    GSList **new_targets,
+                    GError **err)
 {
-    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
-        LrMetadataTarget *target = elem->data;
-        LrHandle *handle;
-        // handle is required
-        assert(target->handle);
-        handle = target->handle;
+    GSList *record_targets = NULL;
 
-        if (handle->offline || handle->local) {
-            // Handle is configured not to download
-            continue;
-        }
+    state->stage = LR_MDS_RECORDS;
+
+    if (!lr_yum_prepare_repo_records(state->target,
+                                     &record_targets,
+                                     &pipeline->cbdata_list,
+                                     &pipeline->shared_cbdata_list,
+                                     &pipeline->records_error,
+                                     err))
+        return FALSE;
+
+    pipeline->record_targets = g_slist_concat(pipeline->record_targets,
+                                              g_slist_copy(record_targets));
+    *new_targets = g_slist_concat(*new_targets, record_targets);
+    return TRUE;
+}
+
+/** Add the repomd.xml target once the internal mirrorlist of the handle
+ * is prepared. If there is no repomd.xml to download, continue directly
+ * with the records stage.
+ */
+static gboolean
+download_repomd_xml(LrMetadataRepoState *state,
+                    LrMetadataPipeline *pipeline,
+                    GSList **new_targets,
+                    GError **err)
+{
+    LrDownloadTarget *download_target;
 
+    download_target = prepare_repomd_xml_download_target(state);
+    if (!download_target)
+        return start_records_stage(state, pipeline, new_targets, err);
+
+    g_hash_table_insert(pipeline->states, download_target, state);
+    pipeline->repomd_targets = g_slist_append(pipeline->repomd_targets, download_target);
+    *new_targets = g_slist_append(*new_targets, download_target);
+    return TRUE;
+}
+
+/** Move the repository to the repomd stage. The internal mirrorlist
+ * is prepared first, in pipeline->pool if LRO_FASTESTMIRROR has to
+ * measure the mirrors.
+ */
+static gboolean
+start_repomd_stage(LrMetadataRepoState *state,
+                   LrMetadataPipeline *pipeline,
+                   GSList **new_targets,
+                   GError **err)
+{
+    LrMetadataTarget *target = state->target;
+    LrHandle *handle = target->handle;
+    GError *tmp_err = NULL;
+
+    state->stage = LR_MDS_REPOMD;
+
+    if (!handle->urls && !handle->mirrorlisturl && !handle->metalinkurl) {
+        lr_metadatatarget_append_error(target, "No LRO_URLS, LRO_MIRRORLISTURL nor LRO_METALINKURL specified");
+        return start_records_stage(state, pipeline, new_targets, err);
+    }
+
+    if (handle->repotype != LR_YUMREPO) {
+        lr_metadatatarget_append_error(target, "Bad LRO_REPOTYPE specified");
+        return start_records_stage(state, pipeline, new_targets, err);
+    }
+
+    if (target->repo == NULL) {
+        target->repo = lr_yum_repo_init();
+    }
+    if (target->repomd == NULL) {
+        target->repomd = lr_yum_repomd_init();
+    }
+
+    // The fastestmirror callback is a user callback, it is called only
+    // from the thread running the download
+    if (handle->fastestmirror && !handle->internal_mirrorlist
+        && !handle->fastestmirrorcb && !state->shared_handle) {
+        start_work(state, LR_MDW_MIRRORS, pipeline);
+        return TRUE;
+    }
+
+    if (!lr_handle_prepare_internal_mirrorlist(handle,
+                                               handle->fastestmirror,
+                                               &tmp_err)) {
+        lr_metadatatarget_append_error(target, "Cannot prepare internal mirrorlist: %s", tmp_err->message);
+        g_error_free(tmp_err);
+        return start_records_stage(state, pipeline, new_targets, err);
+    }
+
+    return download_repomd_xml(state, pipeline, new_targets, err);
+}
+
+/** Start download of a repository. Metalink and mirrorlist are
+ * downloaded first if needed.
+ */
+static gboolean
+start_mirrors_stage(LrMetadataRepoState *state,
+                    LrMetadataPipeline *pipeline,
+                    GSList **new_targets,
+                    GError **err)
+{
+    LrHandle *handle = state->target->handle;
+
+    state->stage = LR_MDS_MIRRORS;
+
+    if (!handle->offline && !handle->local) {
         // If metalink is configured but mirrors are not populated yet
         // we need to download it.
         if (handle->metalinkurl && !handle->metalink_mirrors) {
             _cleanup_free_ gchar *url = lr_prepend_url_protocol(handle->metalinkurl);
-            append_url_target(url, target, download_targets);
+            state->metalink_target = append_url_target(url, state, pipeline, new_targets);
         }
         // If mirrorlist is configured but mirrors are not populated yet
         // we need to download it.
         if (handle->mirrorlisturl && !handle->mirrorlist_mirrors) {
             _cleanup_free_ gchar *url = lr_prepend_url_protocol(handle->mirrorlisturl);
-            append_url_target(url, target, download_targets);
+            state->mirrorlist_target = append_url_target(url, state, pipeline, new_targets);
         }
     }
+
+    if (state->pending_lists > 0)
+        return TRUE;
+
+    return start_repomd_stage(state, pipeline, new_targets, err);
 }
 
+/** Errors of the metalink and mirrorlist targets are appended to their
+ * metadata targets once, when the targets are freed by
+ * lr_metadata_download_cleanup().
+ */
 static gboolean
-propagate_metalink_or_mirrorlist_download_targets(GSList *download_targets, GError **err)
+metalink_or_mirrorlist_done(LrMetadataRepoState *state,
+                            LrDownloadTarget *download_target,
+                            LrMetadataPipeline *pipeline,
+                            GSList **new_targets,
+                            GError **err)
 {
-    for (GSList *elem = download_targets; elem; elem = g_slist_next(elem)) {
-        LrDownloadTarget *download_target = elem->data;
-        LrMetadataTarget *target = download_target->userdata;
+    LrHandle *handle = state->target->handle;
+
+    if (lseek(download_target->fd, 0, SEEK_SET) != 0) {
+        g_debug("%s: Seek error: %s", __func__, g_strerror(errno));
+        g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                    "lseek(%d, 0, SEEK_SET) error: %s",
+                    download_target->fd, g_strerror(errno));
+        close(download_target->fd);
+        return FALSE;
+    }
 
-        if (target->handle->metalinkurl) {
-            target->handle->metalink_fd = download_target->fd;
-        } else if (target->handle->mirrorlisturl) {
-            target->handle->mirrorlist_fd = download_target->fd;
-        } else {
-            // The targets should download only metalinks or mirrorlists
-            assert(0);
+    if (download_target == state->metalink_target) {
+        handle->metalink_fd = download_target->fd;
+    } else {
+        assert(download_target == state->mirrorlist_target);
+        handle->mirrorlist_fd = download_target->fd;
+    }
+
+    if (--state->pending_lists > 0)
+        return TRUE;
+
+    return start_repomd_stage(state, pipeline, new_targets, err);
+}
+
+/** Continue with repomd.xml.asc (LR_CHECK_GPG) or with the records */
+static gboolean
+repomd_xml_done(LrMetadataRepoState *state,
+                LrMetadataPipeline *pipeline,
+                GSList **new_targets,
+                GError **err)
+{
+    LrMetadataTarget *target = state->target;
+    LrHandle *handle = target->handle;
+
+    handle->used_mirror =  g_strdup(target->download_target->usedmirror);
+    handle->gnupghomedir = g_strdup(target->gnupghomedir);
+
+    if (target->download_target->rcode != LRE_OK) {
+        lr_metadatatarget_append_error(target, (char *) lr_strerror(target->download_target->rcode));
+        repomd_xml_failed(state);
+    } else if (handle->checks & LR_CHECK_GPG) {
+        LrDownloadTarget *signature_target;
+
+        signature_target = prepare_signature_download_target(state);
+        if (signature_target) {
+            state->stage = LR_MDS_SIGNATURE;
+            g_hash_table_insert(pipeline->states, signature_target, state);
+            pipeline->signature_targets = g_slist_append(pipeline->signature_targets,
+                                                         signature_target);
+            *new_targets = g_slist_append(*new_targets, signature_target);
+            return TRUE;
         }
+        repomd_xml_failed(state);
+    } else {
+        parse_repomd_xml(state);
+    }
 
-        if (lseek(download_target->fd, 0, SEEK_SET) != 0) {
-            g_debug("%s: Seek error: %s", __func__, g_strerror(errno));
-            g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
-                        "lseek(%d, 0, SEEK_SET) error: %s",
-                        download_target->fd, g_strerror(errno));
-            close(download_target->fd);
-            return FALSE;
+    return start_records_stage(state, pipeline, new_targets, err);
+}
+
+/** Verify the downloaded repomd.xml.asc in pipeline->pool */
+static gboolean
+signature_done(LrMetadataRepoState *state,
+               LrDownloadTarget *download_target,
+               LrMetadataPipeline *pipeline,
+               GSList **new_targets,
+               GError **err)
+{
+    LrMetadataTarget *target = state->target;
+
+    close(state->signature_fd);
+    state->signature_fd = -1;
+
+    if (download_target->rcode != LRE_OK) {
+        lr_metadatatarget_append_error(target,
+                    "GPG verification is enabled, but GPG signature "
+                    "is not available. This may be an error or the "
+                    "repository does not support GPG verification: %s",
+                    download_target->err);
+        unlink(state->signature_path);
+        lr_free(state->signature_path);
+        state->signature_path = NULL;
+        repomd_xml_failed(state);
+        return start_records_stage(state, pipeline, new_targets, err);
+    }
+
+    target->repo->signature = g_strdup(state->signature_path);
+    start_work(state, LR_MDW_GPG, pipeline);
+    return TRUE;
+}
+
+/** LrTargetDoneCb which moves the repository of the finished target
+ * to its next stage as soon as the target is downloaded, regardless
+ * of the state of the other repositories.
+ */
+static gboolean
+metadata_target_done(void *data,
+                     LrDownloadTarget *download_target,
+                     GSList **new_targets,
+                     GError **err)
+{
+    LrMetadataPipeline *pipeline = data;
+    LrMetadataRepoState *state;
+
+    state = g_hash_table_lookup(pipeline->states, download_target);
+    if (!state) {
+        // Target of a repomd record, nothing to do
+        return TRUE;
+    }
+
+    switch (state->stage) {
+    case LR_MDS_MIRRORS:
+        return metalink_or_mirrorlist_done(state, download_target, pipeline,
+                                           new_targets, err);
+    case LR_MDS_REPOMD:
+        return repomd_xml_done(state, pipeline, new_targets, err);
+    case LR_MDS_SIGNATURE:
+        return signature_done(state, download_target, pipeline,
+                              new_targets, err);
+    case LR_MDS_RECORDS:
+        break;
+    }
+
+    return TRUE;
+}
+
+/** LrWorkDoneCb which moves the repository of the finished work
+ * to its next stage.
+ */
+static gboolean
+metadata_work_done(void *data,
+                   void *result,
+                   GSList **new_targets,
+                   GError **err)
+{
+    LrMetadataPipeline *pipeline = data;
+    LrMetadataWork *work = result;
+    LrMetadataRepoState *state = work->state;
+
+    switch (work->kind) {
+    case LR_MDW_MIRRORS:
+        if (work->err) {
+            lr_metadatatarget_append_error(state->target, "Cannot prepare internal mirrorlist: %s", work->err->message);
+            return start_records_stage(state, pipeline, new_targets, err);
+        }
+        return download_repomd_xml(state, pipeline, new_targets, err);
+    case LR_MDW_GPG:
+        if (work->err) {
+            g_debug("%s: GPG signature verification failed: %s",
+                    __func__, work->err->message);
+            lr_metadatatarget_append_error(state->target, "repomd.xml GPG signature verification error: %s", work->err->message);
+            repomd_xml_failed(state);
+        } else {
+            g_debug("%s: GPG signature successfully verified", __func__);
+            parse_repomd_xml(state);
         }
+        return start_records_stage(state, pipeline, new_targets, err);
     }
 
     return TRUE;
@@ -556,9 +928,10 @@ lr_download_metadata(GSList *targets,
                      GError **err)
 {
     struct sigaction old_sigact;
+    LrMetadataPipeline pipeline;
     GSList *download_targets = NULL;
-    GSList *fd_list = NULL;
-    GSList *paths = NULL;
+    GError *tmp_err = NULL;
+    gboolean ret = TRUE;
 
     assert(!err || *err == NULL);
 
@@ -595,46 +968,90 @@ lr_download_metadata(GSList *targets,
         }
     }
 
-    create_metalink_and_mirrorlist_download_targets(targets, &download_targets);
-
-    // To match commit 12d0b4 (retry the metalink/mirrorlist download 3x times)
-    // multiply allowed_mirror_failures by 3. Since each metalink/mirrorlist has
-    // exactly one url (mirror) it has the same effect.
-    // Modify the first handle becasue that is where lr_download takes the config from.
-    LrHandle *first_lr_handle = ((LrDownloadTarget *) targets->data)->handle;
-    first_lr_handle->allowed_mirror_failures *= 3;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.states = g_hash_table_new(g_direct_hash, g_direct_equal);
+    pipeline.works.results = g_async_queue_new();
+    pipeline.works.donecb = metadata_work_done;
 
-    if (!lr_download(download_targets, FALSE, err)) {
-        first_lr_handle->allowed_mirror_failures /= 3;
-        restore_handle_callbacks(targets, handle_callbacks_backups);
-        return cleanup(download_targets, err);
+    // Handles used by more metadata targets
+    GHashTable *handles = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GHashTable *shared_handles = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        LrMetadataTarget *target = elem->data;
+        if (target->handle && !g_hash_table_add(handles, target->handle))
+            g_hash_table_add(shared_handles, target->handle);
     }
-    // Restore previous value.
-    first_lr_handle->allowed_mirror_failures /= 3;
 
-    if (!propagate_metalink_or_mirrorlist_download_targets(download_targets, err)) {
-        restore_handle_callbacks(targets, handle_callbacks_backups);
-        return cleanup(download_targets, err);
-    }
-    lr_metadata_download_cleanup(download_targets);
-    download_targets = NULL;
+    // Every repository goes through its stages (metalink/mirrorlist,
+    // repomd.xml, repomd.xml.asc, records) independently. The next stage
+    // of a repository is started right when the previous one finishes,
+    // so a slow mirror of one repository doesn't hold back the others.
+    // Sorting of mirrors by LRO_FASTESTMIRROR and GPG verification run
+    // in other threads, the transfers don't stall meanwhile.
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        LrMetadataTarget *target = elem->data;
+
+        if (!target->handle)
+            continue;
 
-    create_repomd_xml_download_targets(targets, &download_targets, &fd_list, &paths);
+        LrMetadataRepoState *state = lr_malloc0(sizeof(*state));
+        state->target = target;
+        state->shared_handle = g_hash_table_contains(shared_handles,
+                                                     target->handle);
+        state->repomd_fd = -1;
+        state->signature_fd = -1;
+        pipeline.repo_states = g_slist_append(pipeline.repo_states, state);
 
-    if (!lr_download(download_targets, FALSE, err)) {
-        restore_handle_callbacks(targets, handle_callbacks_backups);
-        return cleanup(download_targets, err);
+        if (!start_mirrors_stage(state, &pipeline, &download_targets, &tmp_err)) {
+            ret = FALSE;
+            break;
+        }
     }
 
-    process_repomd_xml(targets, fd_list, paths);
+    g_hash_table_destroy(handles);
+    g_hash_table_destroy(shared_handles);
+
+    // To match commit 12d0b4 (retry the metalink/mirrorlist download 3x times)
+    // allow 3x more failures for targets with a complete URL. Since each
+    // metalink/mirrorlist has exactly one url (mirror) it has the same effect.
+    if (ret)
+        ret = lr_download_pipelined_works(download_targets, FALSE, 3,
+                                          metadata_target_done, &pipeline,
+                                          &pipeline.works, &tmp_err);
+    g_slist_free(download_targets);
 
-    g_slist_free(fd_list);
-    g_slist_free(paths);
+    // Works are still running if the download failed, the ones
+    // not started yet are dropped
+    if (pipeline.pool)
+        g_thread_pool_free(pipeline.pool, !ret, TRUE);
+    g_async_queue_unref(pipeline.works.results);
+    g_slist_free_full(pipeline.work_list,
+                      (GDestroyNotify) lr_metadata_work_free);
+
+    if (ret) {
+        if (!pipeline.record_targets && pipeline.records_error)
+            g_propagate_error(&tmp_err, pipeline.records_error);
+        else
+            g_clear_error(&pipeline.records_error);
+    } else {
+        g_clear_error(&pipeline.records_error);
+    }
 
-    lr_yum_download_repos(targets, err);
+    lr_yum_propagate_records_errors(pipeline.record_targets);
+    lr_yum_free_records_cbdata(pipeline.cbdata_list,
+                               pipeline.shared_cbdata_list);
+    g_slist_free_full(pipeline.record_targets,
+                      (GDestroyNotify) lr_downloadtarget_free);
+    lr_metadata_download_cleanup(pipeline.list_targets);
+    g_slist_free_full(pipeline.signature_targets,
+                      (GDestroyNotify) lr_downloadtarget_free);
+    g_slist_free_full(pipeline.repo_states,
+                      (GDestroyNotify) lr_metadata_repo_state_free);
+    g_hash_table_destroy(pipeline.states);
+
+    if (tmp_err)
+        g_propagate_error(err, tmp_err);
 
     restore_handle_callbacks(targets, handle_callbacks_backups);
-    return cleanup(download_targets, err);
+    return cleanup(pipeline.repomd_targets, err);
 }
-
-
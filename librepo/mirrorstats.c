@@ -0,0 +1,352 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <assert.h>
+
+#include "util.h"
+#include "cleanup.h"
+#include "rcodes.h"
+#include "mirrorstats_internal.h"
+
+#define MIRRORSTATS_HALF_LIFE       3600    // Seconds
+#define MIRRORSTATS_LIMITS_MAX_AGE  (4 * MIRRORSTATS_HALF_LIFE)
+#define MIRRORSTATS_MIN_TRANSFERS   0.05    // Less is forgotten
+#define MIRRORSTATS_RTT_WEIGHT      0.25    // Weight of a new RTT sample
+
+#define MIRRORSTATS_KEY_TS          "ts"
+#define MIRRORSTATS_KEY_LIMITS_TS   "limits_ts"
+#define MIRRORSTATS_KEY_SUCCESSFUL  "successful_transfers"
+#define MIRRORSTATS_KEY_FAILED      "failed_transfers"
+#define MIRRORSTATS_KEY_CONNECTIONS "allowed_parallel_connections"
+#define MIRRORSTATS_KEY_RANGES      "max_ranges"
+#define MIRRORSTATS_KEY_RTT_TS      "rtt_ts"
+#define MIRRORSTATS_KEY_RTT         "rtt"
+
+typedef struct {
+    LrMirrorStats stats;
+    gint64 ts;          /*!< Time the counters were decayed to */
+    gint64 limits_ts;   /*!< Time the limits were learned */
+    gint64 rtt_ts;      /*!< Time of the last RTT sample */
+} LrMirrorStatsRecord;
+
+G_LOCK_DEFINE_STATIC(mirrorstats);
+static GHashTable *mirrorstats_records = NULL;  // url -> LrMirrorStatsRecord*
+static GHashTable *mirrorstats_files = NULL;    // Already loaded files
+
+static gint64
+lr_mirrorstats_now(void)
+{
+    return g_get_real_time() / 1000000;
+}
+
+/** 2^(-age/MIRRORSTATS_HALF_LIFE). Whole half-lives are exact,
+ * the rest is approximated linearly (no need for libm).
+ */
+static double
+lr_mirrorstats_decay_factor(gint64 age)
+{
+    if (age <= 0)
+        return 1.0;
+
+    gint64 halvings = age / MIRRORSTATS_HALF_LIFE;
+    if (halvings >= 63)
+        return 0.0;
+
+    double rest = (age % MIRRORSTATS_HALF_LIFE) / (double) MIRRORSTATS_HALF_LIFE;
+    return (1.0 - rest / 2.0) / (double) ((guint64) 1 << halvings);
+}
+
+/** Decay the record to the time now. The lock must be held.
+ */
+static void
+lr_mirrorstats_record_decay(LrMirrorStatsRecord *record, gint64 now)
+{
+    double factor = lr_mirrorstats_decay_factor(now - record->ts);
+    record->stats.successful_transfers *= factor;
+    record->stats.failed_transfers *= factor;
+    if (now > record->ts)
+        record->ts = now;
+
+    if (now - record->limits_ts > MIRRORSTATS_LIMITS_MAX_AGE) {
+        record->stats.allowed_parallel_connections = 0;
+        record->stats.max_ranges = -1;
+    }
+
+    if (now - record->rtt_ts > MIRRORSTATS_LIMITS_MAX_AGE)
+        record->stats.rtt = -1.0;
+}
+
+static gboolean
+lr_mirrorstats_record_is_empty(const LrMirrorStatsRecord *record)
+{
+    return record->stats.successful_transfers < MIRRORSTATS_MIN_TRANSFERS
+           && record->stats.failed_transfers < MIRRORSTATS_MIN_TRANSFERS
+           && record->stats.allowed_parallel_connections <= 0
+           && record->stats.max_ranges < 0
+           && record->stats.rtt < 0.0;
+}
+
+/** Find (or create) the record of the url. The lock must be held.
+ */
+static LrMirrorStatsRecord *
+lr_mirrorstats_lookup(const char *url, gboolean create, gint64 now)
+{
+    if (!mirrorstats_records) {
+        if (!create)
+            return NULL;
+        mirrorstats_records = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                    g_free, g_free);
+    }
+
+    LrMirrorStatsRecord *record = g_hash_table_lookup(mirrorstats_records, url);
+    if (!record && create) {
+        record = g_new0(LrMirrorStatsRecord, 1);
+        record->stats.max_ranges = -1;
+        record->stats.rtt = -1.0;
+        record->ts = now;
+        record->limits_ts = now;
+        record->rtt_ts = now;
+        g_hash_table_insert(mirrorstats_records, g_strdup(url), record);
+    }
+
+    return record;
+}
+
+gboolean
+lr_mirrorstats_get(const char *url, LrMirrorStats *stats)
+{
+    gint64 now = lr_mirrorstats_now();
+    gboolean found = FALSE;
+
+    G_LOCK(mirrorstats);
+    LrMirrorStatsRecord *record = lr_mirrorstats_lookup(url, FALSE, now);
+    if (record) {
+        lr_mirrorstats_record_decay(record, now);
+        *stats = record->stats;
+        found = TRUE;
+    }
+    G_UNLOCK(mirrorstats);
+
+    return found;
+}
+
+void
+lr_mirrorstats_add(const char *url,
+                   int successful,
+                   int failed,
+                   int allowed_parallel_connections,
+                   int max_ranges,
+                   double rtt)
+{
+    gint64 now = lr_mirrorstats_now();
+
+    G_LOCK(mirrorstats);
+    LrMirrorStatsRecord *record = lr_mirrorstats_lookup(url, TRUE, now);
+    lr_mirrorstats_record_decay(record, now);
+    record->stats.successful_transfers += successful;
+    record->stats.failed_transfers += failed;
+    if (allowed_parallel_connections > 0 || max_ranges >= 0) {
+        record->stats.allowed_parallel_connections = allowed_parallel_connections;
+        record->stats.max_ranges = max_ranges;
+        record->limits_ts = now;
+    }
+    if (rtt >= 0.0) {
+        if (record->stats.rtt < 0.0)
+            record->stats.rtt = rtt;
+        else
+            record->stats.rtt += MIRRORSTATS_RTT_WEIGHT * (rtt - record->stats.rtt);
+        record->rtt_ts = now;
+    }
+    G_UNLOCK(mirrorstats);
+}
+
+/** Remember the file was loaded. The lock must be held.
+ * @return      FALSE if it was already loaded
+ */
+static gboolean
+lr_mirrorstats_mark_file(const char *path)
+{
+    if (!mirrorstats_files)
+        mirrorstats_files = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                  g_free, NULL);
+    if (g_hash_table_contains(mirrorstats_files, path))
+        return FALSE;
+    g_hash_table_add(mirrorstats_files, g_strdup(path));
+    return TRUE;
+}
+
+/** Merge the file into the registry. The lock must be held.
+ */
+static gboolean
+lr_mirrorstats_load_file(const char *path, gint64 now, GError **err)
+{
+    GError *tmp_err = NULL;
+    _cleanup_keyfile_free_ GKeyFile *keyfile = g_key_file_new();
+
+    if (!g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, &tmp_err)) {
+        if (g_error_matches(tmp_err, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_error_free(tmp_err);
+            return TRUE;
+        }
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_KEYFILE,
+                    "Cannot load mirror statistics %s: %s",
+                    path, tmp_err->message);
+        g_error_free(tmp_err);
+        return FALSE;
+    }
+
+    _cleanup_strv_free_ gchar **groups = g_key_file_get_groups(keyfile, NULL);
+    for (gchar **group = groups; *group; group++) {
+        LrMirrorStatsRecord loaded;
+        loaded.ts = g_key_file_get_int64(keyfile, *group, MIRRORSTATS_KEY_TS, NULL);
+        loaded.limits_ts = g_key_file_get_int64(keyfile, *group,
+                                                MIRRORSTATS_KEY_LIMITS_TS, NULL);
+        loaded.stats.successful_transfers = g_key_file_get_double(keyfile, *group,
+                                                MIRRORSTATS_KEY_SUCCESSFUL, NULL);
+        loaded.stats.failed_transfers = g_key_file_get_double(keyfile, *group,
+                                                MIRRORSTATS_KEY_FAILED, NULL);
+        loaded.stats.allowed_parallel_connections = g_key_file_get_integer(keyfile,
+                                                *group, MIRRORSTATS_KEY_CONNECTIONS, NULL);
+        loaded.stats.max_ranges = -1;
+        if (g_key_file_has_key(keyfile, *group, MIRRORSTATS_KEY_RANGES, NULL))
+            loaded.stats.max_ranges = g_key_file_get_integer(keyfile, *group,
+                                                MIRRORSTATS_KEY_RANGES, NULL);
+        loaded.rtt_ts = g_key_file_get_int64(keyfile, *group,
+                                             MIRRORSTATS_KEY_RTT_TS, NULL);
+        loaded.stats.rtt = -1.0;
+        if (g_key_file_has_key(keyfile, *group, MIRRORSTATS_KEY_RTT, NULL))
+            loaded.stats.rtt = g_key_file_get_double(keyfile, *group,
+                                                MIRRORSTATS_KEY_RTT, NULL);
+        lr_mirrorstats_record_decay(&loaded, now);
+        if (lr_mirrorstats_record_is_empty(&loaded))
+            continue;
+
+        // Knowledge from the file is added to what this process learned
+        LrMirrorStatsRecord *record = lr_mirrorstats_lookup(*group, TRUE, now);
+        lr_mirrorstats_record_decay(record, now);
+        record->stats.successful_transfers += loaded.stats.successful_transfers;
+        record->stats.failed_transfers += loaded.stats.failed_transfers;
+        if (record->stats.allowed_parallel_connections <= 0
+            && record->stats.max_ranges < 0) {
+            record->stats.allowed_parallel_connections = loaded.stats.allowed_parallel_connections;
+            record->stats.max_ranges = loaded.stats.max_ranges;
+            record->limits_ts = loaded.limits_ts;
+        }
+        if (record->stats.rtt < 0.0) {
+            record->stats.rtt = loaded.stats.rtt;
+            record->rtt_ts = loaded.rtt_ts;
+        }
+    }
+
+    g_debug("%s: Loaded mirror statistics from %s", __func__, path);
+    return TRUE;
+}
+
+gboolean
+lr_mirrorstats_load(const char *path, GError **err)
+{
+    gboolean ret = TRUE;
+
+    assert(!err || *err == NULL);
+
+    G_LOCK(mirrorstats);
+    if (lr_mirrorstats_mark_file(path))
+        ret = lr_mirrorstats_load_file(path, lr_mirrorstats_now(), err);
+    G_UNLOCK(mirrorstats);
+
+    return ret;
+}
+
+gboolean
+lr_mirrorstats_save(const char *path, GError **err)
+{
+    gint64 now = lr_mirrorstats_now();
+    _cleanup_keyfile_free_ GKeyFile *keyfile = g_key_file_new();
+
+    assert(!err || *err == NULL);
+
+    G_LOCK(mirrorstats);
+
+    // The content of the file is a part of the registry now
+    lr_mirrorstats_mark_file(path);
+
+    if (mirrorstats_records) {
+        GHashTableIter iter;
+        gpointer key, value;
+        g_hash_table_iter_init(&iter, mirrorstats_records);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            const char *url = key;
+            LrMirrorStatsRecord *record = value;
+
+            lr_mirrorstats_record_decay(record, now);
+            if (lr_mirrorstats_record_is_empty(record)) {
+                g_hash_table_iter_remove(&iter);
+                continue;
+            }
+
+            g_key_file_set_int64(keyfile, url, MIRRORSTATS_KEY_TS, record->ts);
+            g_key_file_set_double(keyfile, url, MIRRORSTATS_KEY_SUCCESSFUL,
+                                  record->stats.successful_transfers);
+            g_key_file_set_double(keyfile, url, MIRRORSTATS_KEY_FAILED,
+                                  record->stats.failed_transfers);
+            if (record->stats.allowed_parallel_connections > 0
+                || record->stats.max_ranges >= 0) {
+                g_key_file_set_int64(keyfile, url, MIRRORSTATS_KEY_LIMITS_TS,
+                                     record->limits_ts);
+                g_key_file_set_integer(keyfile, url, MIRRORSTATS_KEY_CONNECTIONS,
+                                       record->stats.allowed_parallel_connections);
+                g_key_file_set_integer(keyfile, url, MIRRORSTATS_KEY_RANGES,
+                                       record->stats.max_ranges);
+            }
+            if (record->stats.rtt >= 0.0) {
+                g_key_file_set_int64(keyfile, url, MIRRORSTATS_KEY_RTT_TS,
+                                     record->rtt_ts);
+                g_key_file_set_double(keyfile, url, MIRRORSTATS_KEY_RTT,
+                                      record->stats.rtt);
+            }
+        }
+    }
+
+    G_UNLOCK(mirrorstats);
+
+    GError *tmp_err = NULL;
+    if (!lr_key_file_save_to_file(keyfile, path, &tmp_err)) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_FILE,
+                    "Cannot save mirror statistics to %s: %s",
+                    path, tmp_err->message);
+        g_error_free(tmp_err);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+lr_mirrorstats_clear(void)
+{
+    G_LOCK(mirrorstats);
+    if (mirrorstats_records)
+        g_hash_table_destroy(mirrorstats_records);
+    mirrorstats_records = NULL;
+    if (mirrorstats_files)
+        g_hash_table_destroy(mirrorstats_files);
+    mirrorstats_files = NULL;
+    G_UNLOCK(mirrorstats);
+}
@@ -0,0 +1,98 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_MIRRORSTATS_INTERNAL_H__
+#define __LR_MIRRORSTATS_INTERNAL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Process-wide registry of mirror statistics (see LRO_MIRRORSTATS).
+ *
+ * Statistics collected by lr_download() calls are kept by the mirror
+ * URL and shared by all handles of the process. Transfer counters decay
+ * exponentially (half-life MIRRORSTATS_HALF_LIFE seconds), learned limits
+ * and round-trip times are forgotten when they get too old. All functions are thread-safe.
+ */
+
+/** Statistics of a mirror */
+typedef struct {
+    double successful_transfers; /*!<
+        Decayed number of successful transfers */
+    double failed_transfers; /*!<
+        Decayed number of failed transfers */
+    int allowed_parallel_connections; /*!<
+        Learned maximum of parallel connections (0 if unknown) */
+    int max_ranges; /*!<
+        Learned maximum of ranges in a single request (-1 if unknown) */
+    double rtt; /*!<
+        Smoothed round-trip time in seconds (<0.0 if unknown) */
+} LrMirrorStats;
+
+/** Get statistics of the mirror, decayed to the current time.
+ * @param url       Mirror URL
+ * @param stats     Filled with the statistics if found
+ * @return          TRUE if the mirror is known
+ */
+gboolean
+lr_mirrorstats_get(const char *url, LrMirrorStats *stats);
+
+/** Add results of a download to the statistics of the mirror.
+ * @param url       Mirror URL
+ * @param successful    Number of successful transfers
+ * @param failed        Number of failed transfers
+ * @param allowed_parallel_connections  Learned limit or 0
+ * @param max_ranges    Learned limit or -1
+ * @param rtt           Measured round-trip time or <0.0
+ */
+void
+lr_mirrorstats_add(const char *url,
+                   int successful,
+                   int failed,
+                   int allowed_parallel_connections,
+                   int max_ranges,
+                   double rtt);
+
+/** Merge statistics stored in the file into the registry. Every file
+ * is loaded only once per process, nonexistent file is not an error.
+ * @param path      Path to the file
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set
+ */
+gboolean
+lr_mirrorstats_load(const char *path, GError **err);
+
+/** Store the whole registry to the file.
+ * @param path      Path to the file
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set
+ */
+gboolean
+lr_mirrorstats_save(const char *path, GError **err);
+
+/** Forget all statistics and loaded files.
+ */
+void
+lr_mirrorstats_clear(void);
+
+G_END_DECLS
+
+#endif
@@ -35,7 +35,10 @@
 #include "package_downloader.h"
 #include "handle_internal.h"
 #include "downloader.h"
+#include "downloader_internal.h"
+#include "downloadtarget_internal.h"
 #include "fastestmirror_internal.h"
+#include "yum_internal.h"
 
 /* Do NOT use resume on successfully downloaded files - download will fail */
 
@@ -165,6 +168,7 @@ lr_packagetarget_reset(LrPackageTarget *target)
 {
     target->local_path = NULL;
     target->err = NULL;
+    target->usedmirror = NULL;
 }
 
 void
@@ -176,6 +180,151 @@ lr_packagetarget_free(LrPackageTarget *target)
     lr_free(target);
 }
 
+/** Check of an existing local file of a package, runs in a thread pool
+ * while other packages are downloading. */
+typedef struct {
+    LrDownloadTarget *downloadtarget;   /*!< Held download target */
+    LrPackageTarget *packagetarget;     /*!< Package target */
+    gboolean size_matches;  /*!< Size of the file is the expected one */
+    gboolean size_enough;   /*!< Resume is enabled and size matches,
+                                 used if the checksum cannot be computed */
+    GAsyncQueue *checks;    /*!< Queue for the LrTargetCheck */
+} LrPackageCheckJob;
+
+static void
+lr_package_check_job_run(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    LrPackageCheckJob *job = data;
+    LrPackageTarget *packagetarget = job->packagetarget;
+    LrTargetCheck *check = g_new0(LrTargetCheck, 1);
+    gboolean ret = FALSE;
+    gboolean matches = FALSE;
+
+    check->target = job->downloadtarget;
+    check->result = LR_TARGETCHECK_DOWNLOAD;
+
+    /* If the file exists and checksum is ok, then is pointless to
+     * download the file again.
+     * Moreover, if the resume is enabled and the file is already
+     * completely downloaded, then the download is going to fail.
+     */
+    int fd_r = open(packagetarget->local_path, O_RDONLY);
+    if (fd_r != -1) {
+        ret = lr_checksum_fd_cmp(packagetarget->checksum_type,
+                                 fd_r,
+                                 packagetarget->checksum,
+                                 1,
+                                 &matches,
+                                 NULL);
+        close(fd_r);
+    }
+
+    if (ret && matches) {
+        // Checksum calculation was ok and checksum matches
+        g_debug("%s: Package %s is already downloaded (checksum matches)",
+                __func__, packagetarget->local_path);
+        check->result = LR_TARGETCHECK_ALREADYEXISTS;
+    } else if (ret) {
+        // Checksum calculation was ok but checksum doesn't match,
+        // if the file size is the same as the expected one
+        // don't try to resume
+        if (job->size_matches)
+            check->result = LR_TARGETCHECK_DOWNLOAD_NORESUME;
+    } else if (job->size_enough) {
+        // See the size check in lr_download_packages()
+        g_debug("%s: Package %s is already downloaded (size matches)",
+                __func__, packagetarget->local_path);
+        check->result = LR_TARGETCHECK_ALREADYEXISTS;
+    }
+
+    g_async_queue_push(job->checks, check);
+}
+
+/** Packages with the same content (see lr_package_dedup_key()) are
+ * downloaded only once, the file is linked or copied to the other
+ * destinations when the download is done. */
+typedef struct {
+    GHashTable *groups; /*!<
+        Key -> GQueue of LrDownloadTarget waiting for the content
+        of the target of the group passed to the downloader. */
+    GHashTable *downloading; /*!<
+        LrDownloadTarget being downloaded -> key of its group */
+} LrPackageDedup;
+
+/** Key of the package content or NULL if the package cannot be shared */
+static gchar *
+lr_package_dedup_key(LrPackageTarget *packagetarget)
+{
+    if (!packagetarget->checksum
+        || packagetarget->checksum_type == LR_CHECKSUM_UNKNOWN
+        || packagetarget->byterangestart
+        || packagetarget->byterangeend)
+        return NULL;
+
+    _cleanup_free_ gchar *checksum = g_ascii_strdown(packagetarget->checksum, -1);
+    return g_strdup_printf("%d:%s", packagetarget->checksum_type, checksum);
+}
+
+/** LrTargetDoneCb of lr_download_packages() */
+static gboolean
+lr_package_dedup_done(void *data,
+                      LrDownloadTarget *target,
+                      GSList **new_targets,
+                      GError **err)
+{
+    LrPackageDedup *dedup = data;
+    const char *key = g_hash_table_lookup(dedup->downloading, target);
+
+    if (!key)
+        return TRUE;
+
+    g_hash_table_remove(dedup->downloading, target);
+    GQueue *waiting = g_hash_table_lookup(dedup->groups, key);
+
+    if (target->rcode != LRE_OK) {
+        // Another target with the same content may be downloadable
+        // (e.g. from mirrors of another repo)
+        LrDownloadTarget *next = g_queue_pop_head(waiting);
+        if (next) {
+            g_hash_table_insert(dedup->downloading, next, (gpointer) key);
+            *new_targets = g_slist_append(*new_targets, next);
+        }
+        return TRUE;
+    }
+
+    LrDownloadTarget *dup;
+    while ((dup = g_queue_pop_head(waiting))) {
+
+        if (!lr_yum_link_or_copy(target->fn, dup->fn)) {
+            // Download it on its own
+            *new_targets = g_slist_append(*new_targets, dup);
+            continue;
+        }
+
+        g_debug("%s: %s has the same content as %s", __func__,
+                dup->fn, target->fn);
+
+        lr_downloadtarget_set_error(dup, LRE_OK, NULL);
+        if (target->usedmirror)
+            lr_downloadtarget_set_usedmirror(dup, target->usedmirror);
+        if (target->effectiveurl)
+            lr_downloadtarget_set_effectiveurl(dup, target->effectiveurl);
+
+        // Call end callback
+        if (dup->endcb
+            && dup->endcb(dup->cbdata, LR_TRANSFER_SUCCESSFUL, NULL) == LR_CB_ERROR)
+        {
+            g_debug("%s: Downloading was aborted by LR_CB_ERROR "
+                    "from end callback", __func__);
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                        "Interrupted by LR_CB_ERROR from end callback");
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
 gboolean
 lr_download_packages(GSList *targets,
                      LrPackageDownloadFlag flags,
@@ -186,6 +335,14 @@ lr_download_packages(GSList *targets,
     struct sigaction old_sigact;
     GSList *downloadtargets = NULL;
     gboolean interruptible = FALSE;
+    // Checks of existing files run while the other packages are downloading
+    GThreadPool *check_pool = NULL;
+    GPtrArray *check_jobs = NULL;
+    GHashTable *held = NULL;
+    GAsyncQueue *checks = NULL;
+    // Targets passed to the downloader, the rest waits in the dedup groups
+    GSList *initialtargets = NULL;
+    LrPackageDedup dedup = { NULL, NULL };
 
     assert(!err || *err == NULL);
 
@@ -240,6 +397,13 @@ lr_download_packages(GSList *targets,
     // List of handles for fastest mirror resolving
     GSList *fmr_handles = NULL;
 
+    check_jobs = g_ptr_array_new_with_free_func(g_free);
+    held = g_hash_table_new(g_direct_hash, g_direct_equal);
+    checks = g_async_queue_new_full(g_free);
+    dedup.groups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify) g_queue_free);
+    dedup.downloading = g_hash_table_new(g_direct_hash, g_direct_equal);
+
     // Prepare targets
     for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
         _cleanup_free_ gchar *local_path = NULL;
@@ -247,6 +411,7 @@ lr_download_packages(GSList *targets,
         LrDownloadTarget *downloadtarget;
         gint64 realsize = -1;
         gboolean doresume = packagetarget->resume;
+        gboolean check_checksum = FALSE;
 
         // Reset output attributes of the handle
         lr_packagetarget_reset(packagetarget);
@@ -287,7 +452,8 @@ lr_download_packages(GSList *targets,
                 g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
                         "Cannot stat %s: %s", packagetarget->local_path,
                         g_strerror(errno));
-                return FALSE;
+                ret = FALSE;
+                goto cleanup;
             }
 
             realsize = buf.st_size;
@@ -302,49 +468,16 @@ lr_download_packages(GSList *targets,
             && packagetarget->checksum
             && packagetarget->checksum_type != LR_CHECKSUM_UNKNOWN)
         {
-            /* If the file exists and checksum is ok, then is pointless to
-             * download the file again.
-             * Moreover, if the resume is enabled and the file is already
-             * completely downloaded, then the download is going to fail.
-             */
-            int fd_r = open(packagetarget->local_path, O_RDONLY);
-            if (fd_r != -1) {
-                gboolean matches;
-                ret = lr_checksum_fd_cmp(packagetarget->checksum_type,
-                                         fd_r,
-                                         packagetarget->checksum,
-                                         1,
-                                         &matches,
-                                         NULL);
-                close(fd_r);
-                if (ret && matches) {
-                    // Checksum calculation was ok and checksum matches
-                    g_debug("%s: Package %s is already downloaded (checksum matches)",
-                            __func__, packagetarget->local_path);
-
-                    packagetarget->err = g_string_chunk_insert(
-                                                packagetarget->chunk,
-                                                "Already downloaded");
-
-                    // Call end callback
-                    LrEndCb end_cb = packagetarget->endcb;
-                    if (end_cb)
-                        end_cb(packagetarget->cbdata,
-                               LR_TRANSFER_ALREADYEXISTS,
-                               "Already downloaded");
-
-                    continue;
-                } else if (ret) {
-                    // Checksum calculation was ok but checksum doesn't match
-                    if (realsize != -1 && realsize == packagetarget->expectedsize)
-                        // File size is the same as the expected one
-                        // Don't try to resume
-                        doresume = FALSE;
-                }
-            }
+            // The checksum of the existing file is checked
+            // by lr_package_check_job_run() in the check_pool
+            check_checksum = TRUE;
         }
 
-        if (doresume && realsize != -1 && realsize == packagetarget->expectedsize) {
+        if (!check_checksum
+            && doresume
+            && realsize != -1
+            && realsize == packagetarget->expectedsize)
+        {
             // File's size matches the expected one, the resume is enabled and
             // no checksum is known => expect that the file is
             // the one the user wants
@@ -404,13 +537,56 @@ lr_download_packages(GSList *targets,
                                                FALSE,
                                                FALSE);
 
+        downloadtarget->priority = packagetarget->priority;
+        downloadtarget->qosclass = packagetarget->qosclass;
         downloadtargets = g_slist_prepend(downloadtargets, downloadtarget);
+
+        // A held target (with an existing local file) is never shared,
+        // only the content of the first target of a group is downloaded
+        gchar *key = lr_package_dedup_key(packagetarget);
+        GQueue *waiting = key ? g_hash_table_lookup(dedup.groups, key) : NULL;
+        if (waiting && !check_checksum) {
+            g_debug("%s: %s waits for the same content", __func__,
+                    packagetarget->local_path);
+            g_queue_push_tail(waiting, downloadtarget);
+            g_free(key);
+            continue;
+        }
+
+        initialtargets = g_slist_prepend(initialtargets, downloadtarget);
+        if (key && !waiting) {
+            g_hash_table_insert(dedup.downloading, downloadtarget, key);
+            g_hash_table_insert(dedup.groups, key, g_queue_new());
+        } else {
+            g_free(key);
+        }
+
+        if (check_checksum) {
+            LrPackageCheckJob *job = g_new0(LrPackageCheckJob, 1);
+            job->downloadtarget = downloadtarget;
+            job->packagetarget = packagetarget;
+            job->size_matches = realsize != -1
+                                && realsize == packagetarget->expectedsize;
+            job->size_enough = doresume && job->size_matches;
+            job->checks = checks;
+            g_ptr_array_add(check_jobs, job);
+            g_hash_table_add(held, downloadtarget);
+
+            if (!check_pool)
+                check_pool = g_thread_pool_new(lr_package_check_job_run,
+                                               NULL,
+                                               g_get_num_processors(),
+                                               FALSE,
+                                               NULL);
+            g_thread_pool_push(check_pool, job, NULL);
+        }
     }
     /*
      * Since g_slist_append() has to traverse the list to the end, we use
      * g_slist_prepend() above, and reverse the lists now.
      */
     downloadtargets = g_slist_reverse(downloadtargets);
+    initialtargets = g_slist_reverse(initialtargets);
 
     // Do Fastest Mirror resolving for all handles in one shot
     if (fmr_handles) {
@@ -418,16 +594,36 @@ lr_download_packages(GSList *targets,
         ret = lr_fastestmirror_sort_internalmirrorlists(fmr_handles, err);
         g_slist_free(fmr_handles);
 
-        if (!ret) {
-            return FALSE;
-        }
+        if (!ret)
+            goto cleanup;
     }
 
-    // Start downloading
-    ret = lr_download(downloadtargets, failfast, err);
+    // Start downloading, targets with a pending check are held
+    ret = lr_download_held(initialtargets, held, checks, failfast,
+                           lr_package_dedup_done, &dedup, err);
 
 cleanup:
 
+    // Drop checks which didn't start yet and wait for the running ones
+    if (check_pool)
+        g_thread_pool_free(check_pool, TRUE, TRUE);
+    g_ptr_array_free(check_jobs, TRUE);
+    g_hash_table_destroy(held);
+    g_async_queue_unref(checks);
+    g_slist_free(initialtargets);
+
+    // Targets still waiting for the content of another target
+    // were not processed at all
+    GHashTableIter iter;
+    gpointer waiting;
+    g_hash_table_iter_init(&iter, dedup.groups);
+    while (g_hash_table_iter_next(&iter, NULL, &waiting))
+        for (GList *elem = ((GQueue *) waiting)->head; elem; elem = elem->next)
+            lr_downloadtarget_set_error(elem->data, LRE_UNFINISHED,
+                                        "Not finished");
+    g_hash_table_destroy(dedup.groups);
+    g_hash_table_destroy(dedup.downloading);
+
     // Copy download statuses from downloadtargets to targets
     for (GSList *elem = downloadtargets; elem; elem = g_slist_next(elem)) {
         LrDownloadTarget *downloadtarget = elem->data;
@@ -435,6 +631,10 @@ cleanup:
         if (downloadtarget->err)
             packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
                                                        downloadtarget->err);
+        if (downloadtarget->usedmirror)
+            packagetarget->usedmirror = g_string_chunk_insert(
+                                                packagetarget->chunk,
+                                                downloadtarget->usedmirror);
     }
 
     // Free downloadtargets list
@@ -26,6 +26,7 @@
 #include <librepo/rcodes.h>
 #include <librepo/handle.h>
 #include <librepo/checksum.h>
+#include <librepo/types.h>
 
 G_BEGIN_DECLS
 
@@ -131,6 +132,18 @@ typedef struct {
     GStringChunk *chunk; /*!<
         String chunk */
 
+    char *usedmirror; /*!<
+        URL of the mirror the package was downloaded from or NULL.
+        Filled by ::lr_download_packages(). */
+
+    long priority; /*!<
+        Packages with a higher priority are downloaded first unless
+        LRO_SCHEDULEPOLICY is LR_SCHEDULE_FIFO. 0 is default. */
+
+    LrQosClass qosclass; /*!<
+        Class of the package for sharing of the limited download speed,
+        see ::LrQosClass. LR_QOS_NORMAL is default. */
+
 } LrPackageTarget;
 
 /** Create new LrPackageTarget object.
@@ -264,6 +277,9 @@ typedef enum {
 } LrPackageDownloadFlag;
 
 /** Download all LrPackageTargets at the targets GSList.
+ * Packages with the same checksum (e.g. the same package offered by
+ * several repos) are downloaded only once, the file is hardlinked
+ * or copied to the other destinations.
  * @param targets           GSList where each element is a ::LrPackageTarget
  *                          object
  * @param flags             Bitfield with flags to download
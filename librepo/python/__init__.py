@@ -431,6 +431,159 @@ Version contants
     *Boolean* If enabled, librepo will try to keep timestamps of the downloaded files
     in sync with that on the remote side.
 
+.. data:: LRO_ZCKHEADERPREFETCH
+
+    *Integer or None* Number of bytes past the end of a zchunk header
+    which are requested together with the header. Chunks which completely
+    fit into this extra range don't have to be downloaded again.
+    None sets the default value 0 (download only the header).
+
+.. data:: LRO_CONDITIONALGET
+
+    *Boolean* If enabled and :data:`.LRO_CACHEDIR` is set, ETag and
+    Last-Modified of downloaded repomd.xml, metalink and mirrorlist are
+    stored in the cachedir and sent with the next request. When the server
+    replies 304 Not Modified, the cached copy is used and an unchanged
+    repomd.xml is reported via :data:`.LRR_RPMMD_REPOMD_UNCHANGED`
+    (the rest of the repository is not downloaded then). The validators
+    are stored in an extended attribute of the cached copy. Only
+    :meth:`~.Handle.perform` sends conditional requests, downloads of
+    metadata targets ignore this option.
+
+.. data:: LRO_PREVIOUSDESTDIR
+
+    *String or None* Destination directory of a previous download of the
+    same repository. Repomd records with unchanged checksum are reflinked
+    (or copied) from there instead of being downloaded again. Files of
+    the previous destination directory are never hardlinked, so they
+    stay untouched.
+
+.. data:: LRO_FASTESTMIRRORMAXPROBES
+
+    *Integer or None* Maximal number of mirrors probed in parallel
+    during the fastest mirror detection. Mirrors which don't get their
+    turn within :data:`.LRO_FASTESTMIRRORTIMEOUT` are ranked after
+    the measured ones and are not stored to the cache.
+    None sets the default value 64.
+
+.. data:: LRO_FASTESTMIRRORPROBESIZE
+
+    *Integer or None* If greater than 0, the fastest mirror detection
+    downloads the first *N* bytes of :data:`.LRO_FASTESTMIRRORPROBEPATH`
+    from every mirror and ranks them by the time to the first byte and
+    the measured bandwidth instead of the connect time only.
+    None sets the default value 0 (measure the connect time only).
+
+.. data:: LRO_FASTESTMIRRORPROBEPATH
+
+    *String or None* Path (relative to the mirror URL) of a file
+    downloaded by the fastest mirror probes if
+    :data:`.LRO_FASTESTMIRRORPROBESIZE` is set.
+    None sets the default "repodata/repomd.xml".
+
+.. data:: LRO_FASTESTMIRRORKEEPCONNS
+
+    *Boolean* Keep connections opened by the fastest mirror probes alive
+    and reuse them for the following downloads by all handles with this
+    option enabled, so the first transfers from the best mirrors skip
+    the TCP (and TLS) handshakes. Connections are shared only within
+    the thread which did the probes, background probes don't keep them.
+
+.. data:: LRO_FASTESTMIRRORBINARYCACHE
+
+    *Boolean* Store the fastestmirror cache in a compact binary format
+    which is mmap()ed, so loading doesn't depend on the number of cached
+    mirrors and concurrent updates are merged.
+
+.. data:: LRO_FASTESTMIRRORBACKGROUND
+
+    *Integer or None* If greater than 0, mirrors are sorted right away
+    by the (even too old) values from :data:`.LRO_FASTESTMIRRORCACHE`
+    (unknown mirrors and, with :data:`.LRO_FASTESTMIRRORPROBESIZE`,
+    mirrors cached without a measured bandwidth go after the measured ones)
+    and at most *N* stale or unknown mirrors are probed in the background
+    while the download runs. None sets the default value 0 (probe
+    synchronously).
+
+.. data:: LRO_MIRRORSTATS
+
+    *Boolean* Share mirror statistics (failures, learned limits)
+    among all downloads and handles of the process, so mirrors which
+    failed recently are tried last. The statistics decay over time.
+
+.. data:: LRO_MIRRORSTATSFILE
+
+    *String or None* Path to a file where the :data:`.LRO_MIRRORSTATS`
+    statistics are kept between processes.
+
+.. data:: LRO_MAXDOWNLOADSPERHOST
+
+    *Integer or None*. Maximum number of parallel downloads per host
+    (scheme, host and port), shared by all mirrors on the host, even by
+    mirrors of different handles. ``None`` sets default value 0
+    (no limit).
+
+.. data:: LRO_PRERESOLVE
+
+    *Boolean* Resolve host names of all mirrors concurrently before
+    the downloads start, so the DNS latency is not paid mirror after
+    mirror. Nothing is resolved if :data:`.LRO_PROXY` is set or with
+    curl older than 7.75.0, mirrors covered by proxy environment
+    variables are skipped.
+
+.. data:: LRO_PRERESOLVECACHE
+
+    *String or None* Path to a file where the :data:`.LRO_PRERESOLVE`
+    addresses are kept between processes.
+
+.. data:: LRO_PRERESOLVECACHETTL
+
+    *Integer or None* Max age in seconds of addresses in
+    :data:`.LRO_PRERESOLVECACHE`. None sets the default value 300.
+
+.. data:: LRO_RANKMIRRORS
+
+    *Boolean* Sort mirrors without probing them: mirrors located in
+    :data:`.LRO_MIRRORLOCATIONS` go first, then mirrors are ordered by
+    the round-trip time measured by previous downloads
+    (:data:`.LRO_MIRRORSTATS`) weighted by the metalink preference.
+
+.. data:: LRO_MIRRORLOCATIONS
+
+    *List of strings or None* Country codes (e.g. ``["CZ", "SK"]``)
+    of preferred mirror locations, the closest first. Used by
+    :data:`.LRO_RANKMIRRORS`.
+
+.. data:: LRO_MIRRORHASHING
+
+    *Boolean* Download every target from the mirror given by
+    rendezvous hashing of its path, so hosts behind a caching proxy
+    fetch the same file from the same mirror. Other mirrors are tried
+    only if the download fails.
+
+.. data:: LRO_LOCKTARGETS
+
+    *Boolean* Lock destination files while downloading them, so
+    processes sharing a cache directory don't download the same file
+    twice. A process finding a file locked waits for it and uses it
+    if its checksum matches. Only targets with a file name are locked,
+    targets writing to a file descriptor are not coordinated.
+
+.. data:: LRO_SCHEDULEPOLICY
+
+    *Integer or None* Order in which waiting targets are started,
+    see :ref:`schedule-policy-label`. None sets the default value
+    :data:`.SCHEDULE_FIFO`.
+
+.. data:: LRO_TOTALMAXSPEED
+
+    *Long or None*. Set maximal allowed total speed in bytes per second
+    of all targets downloaded together, e.g. by one
+    :func:`~librepo.download_packages` call, regardless of their handles.
+    The bandwidth is shared by the running downloads according to the
+    weights of their QoS classes, see :ref:`qos-class-label`.
+    0 = unlimited speed - the default value.
+
 .. _handle-info-options-label:
 
 :class:`~.Handle` info options
@@ -485,6 +638,26 @@ Version contants
 .. data:: LRI_HTTPAUTHMETHODS
 .. data:: LRI_PROXYAUTHMETHODS
 .. data:: LRI_FTPUSEEPSV
+.. data:: LRI_ZCKHEADERPREFETCH
+.. data:: LRI_CONDITIONALGET
+.. data:: LRI_PREVIOUSDESTDIR
+.. data:: LRI_FASTESTMIRRORMAXPROBES
+.. data:: LRI_FASTESTMIRRORPROBESIZE
+.. data:: LRI_FASTESTMIRRORPROBEPATH
+.. data:: LRI_FASTESTMIRRORKEEPCONNS
+.. data:: LRI_FASTESTMIRRORBINARYCACHE
+.. data:: LRI_FASTESTMIRRORBACKGROUND
+.. data:: LRI_MIRRORSTATS
+.. data:: LRI_MIRRORSTATSFILE
+.. data:: LRI_MAXDOWNLOADSPERHOST
+.. data:: LRI_PRERESOLVE
+.. data:: LRI_PRERESOLVECACHE
+.. data:: LRI_PRERESOLVECACHETTL
+.. data:: LRI_RANKMIRRORS
+.. data:: LRI_MIRRORLOCATIONS
+.. data:: LRI_MIRRORHASHING
+.. data:: LRI_LOCKTARGETS
+.. data:: LRI_SCHEDULEPOLICY
 
 .. _proxy-type-label:
 
@@ -516,6 +689,54 @@ Supported IP resolving
 
     Resolve to IPv6 addresses.
 
+.. _schedule-policy-label:
+
+Schedule policies
+-----------------
+
+Except for :data:`.SCHEDULE_FIFO`, targets with a higher priority
+are always started first.
+
+.. data:: SCHEDULE_FIFO
+
+    Default value, targets are started in the order they were passed.
+
+.. data:: SCHEDULE_PRIORITY
+
+    Targets with a higher priority first, the order of targets otherwise.
+
+.. data:: SCHEDULE_LONGESTFIRST
+
+    Targets with the longest estimated download time (expected size
+    and measured mirror throughput) first. Minimizes the total time.
+
+.. data:: SCHEDULE_SHORTESTFIRST
+
+    Targets with the shortest estimated download time first, so the first
+    packages are available sooner.
+
+.. _qos-class-label:
+
+QoS classes
+-----------
+
+Speed limits (:data:`.LRO_MAXSPEED`, :data:`.LRO_TOTALMAXSPEED`) are shared
+by the running downloads in proportion to the weights of their classes.
+Bandwidth a download cannot use because of a tighter limit goes to
+the others.
+
+.. data:: QOS_NORMAL
+
+    Default class, weight 2.
+
+.. data:: QOS_BACKGROUND
+
+    Weight 1, e.g. for prefetching of packages.
+
+.. data:: QOS_INTERACTIVE
+
+    Weight 4, e.g. for metadata a user is waiting for.
+
 .. _repotype-constants-label:
 
 Repo type constants
@@ -812,6 +1033,10 @@ LibRepo Error codes.
 
     (35) Interrupted by user cb.
 
+.. data:: LRE_CANCELLED
+
+    (42) Download of the target was cancelled.
+
 .. data:: LRE_UNKNOWNERROR
 
     An unknown error.
@@ -996,6 +1221,14 @@ LibRepo Result options for use in :meth:`~.Result.getinfo` method.
     Returns the highest timestamp from all records in the repomd.
     See: http://yum.baseurl.org/gitweb?p=yum.git;a=commitdiff;h=59d3d67f
 
+.. data:: LRR_RPMMD_REPOMD_UNCHANGED
+
+    Returns *True* if the server replied that repomd.xml was not modified
+    since the previous download (see :data:`.LRO_CONDITIONALGET`).
+    The repomd.xml is not parsed and the rest of the repository is not
+    downloaded in that case, the previously downloaded repository
+    should be used.
+
 .. _endcb-statuses-label:
 
 Transfer statuses for endcb of :class:`~.PackageTarget`
@@ -1504,6 +1737,90 @@ class Handle(_librepo.Handle):
 
         See :data:`.LRO_PRESERVETIME`
 
+    .. attribute:: zckheaderprefetch
+
+        See :data:`.LRO_ZCKHEADERPREFETCH`
+
+    .. attribute:: conditionalget
+
+        See :data:`.LRO_CONDITIONALGET`
+
+    .. attribute:: previousdestdir
+
+        See :data:`.LRO_PREVIOUSDESTDIR`
+
+    .. attribute:: fastestmirrormaxprobes
+
+        See :data:`.LRO_FASTESTMIRRORMAXPROBES`
+
+    .. attribute:: fastestmirrorprobesize
+
+        See :data:`.LRO_FASTESTMIRRORPROBESIZE`
+
+    .. attribute:: fastestmirrorprobepath
+
+        See :data:`.LRO_FASTESTMIRRORPROBEPATH`
+
+    .. attribute:: fastestmirrorkeepconns
+
+        See :data:`.LRO_FASTESTMIRRORKEEPCONNS`
+
+    .. attribute:: fastestmirrorbinarycache
+
+        See :data:`.LRO_FASTESTMIRRORBINARYCACHE`
+
+    .. attribute:: fastestmirrorbackground
+
+        See :data:`.LRO_FASTESTMIRRORBACKGROUND`
+
+    .. attribute:: mirrorstats
+
+        See :data:`.LRO_MIRRORSTATS`
+
+    .. attribute:: mirrorstatsfile
+
+        See :data:`.LRO_MIRRORSTATSFILE`
+
+    .. attribute:: maxdownloadsperhost
+
+        See :data:`.LRO_MAXDOWNLOADSPERHOST`
+
+    .. attribute:: preresolve
+
+        See :data:`.LRO_PRERESOLVE`
+
+    .. attribute:: preresolvecache
+
+        See :data:`.LRO_PRERESOLVECACHE`
+
+    .. attribute:: preresolvecachettl
+
+        See :data:`.LRO_PRERESOLVECACHETTL`
+
+    .. attribute:: rankmirrors
+
+        See :data:`.LRO_RANKMIRRORS`
+
+    .. attribute:: mirrorlocations
+
+        See :data:`.LRO_MIRRORLOCATIONS`
+
+    .. attribute:: mirrorhashing
+
+        See :data:`.LRO_MIRRORHASHING`
+
+    .. attribute:: locktargets
+
+        See :data:`.LRO_LOCKTARGETS`
+
+    .. attribute:: schedulepolicy
+
+        See :data:`.LRO_SCHEDULEPOLICY`
+
+    .. attribute:: totalmaxspeed
+
+        See :data:`.LRO_TOTALMAXSPEED`
+
     """
 
     def setopt(self, option, val):
@@ -1657,6 +1974,10 @@ class Result(_librepo.Result):
     .. attribute:: yum_timestamp
 
         See: :data:`.LRR_YUM_TIMESTAMP`
+
+    .. attribute:: rpmmd_repomd_unchanged
+
+        See: :data:`.LRR_RPMMD_REPOMD_UNCHANGED`
     """
 
     def getinfo(self, option):
@@ -307,6 +307,10 @@ py_setopt(_HandleObject *self, PyObject *args)
     case LRO_PROXY_SSLCLIENTCERT:
     case LRO_PROXY_SSLCLIENTKEY:
     case LRO_PROXY_SSLCACERT:
+    case LRO_PREVIOUSDESTDIR:
+    case LRO_FASTESTMIRRORPROBEPATH:
+    case LRO_MIRRORSTATSFILE:
+    case LRO_PRERESOLVECACHE:
     case LRO_CACHEDIR:
     {
         char *str = NULL, *alloced = NULL;
@@ -377,6 +381,14 @@ py_setopt(_HandleObject *self, PyObject *args)
     case LRO_ADAPTIVEMIRRORSORTING:
     case LRO_FTPUSEEPSV:
     case LRO_PRESERVETIME:
+    case LRO_CONDITIONALGET:
+    case LRO_FASTESTMIRRORKEEPCONNS:
+    case LRO_FASTESTMIRRORBINARYCACHE:
+    case LRO_MIRRORSTATS:
+    case LRO_PRERESOLVE:
+    case LRO_RANKMIRRORS:
+    case LRO_MIRRORHASHING:
+    case LRO_LOCKTARGETS:
     case LRO_OFFLINE:
     {
         long d;
@@ -472,6 +484,13 @@ py_setopt(_HandleObject *self, PyObject *args)
     case LRO_MAXDOWNLOADSPERMIRROR:
     case LRO_HTTPAUTHMETHODS:
     case LRO_PROXYAUTHMETHODS:
+    case LRO_ZCKHEADERPREFETCH:
+    case LRO_FASTESTMIRRORMAXPROBES:
+    case LRO_FASTESTMIRRORPROBESIZE:
+    case LRO_FASTESTMIRRORBACKGROUND:
+    case LRO_MAXDOWNLOADSPERHOST:
+    case LRO_PRERESOLVECACHETTL:
+    case LRO_SCHEDULEPOLICY:
     {
         long d;
 
@@ -493,6 +512,20 @@ py_setopt(_HandleObject *self, PyObject *args)
                 d = LRO_HTTPAUTHMETHODS_DEFAULT;
             else if (option == LRO_PROXYAUTHMETHODS)
                 d = LRO_PROXYAUTHMETHODS_DEFAULT;
+            else if (option == LRO_ZCKHEADERPREFETCH)
+                d = LRO_ZCKHEADERPREFETCH_DEFAULT;
+            else if (option == LRO_FASTESTMIRRORMAXPROBES)
+                d = LRO_FASTESTMIRRORMAXPROBES_DEFAULT;
+            else if (option == LRO_FASTESTMIRRORPROBESIZE)
+                d = LRO_FASTESTMIRRORPROBESIZE_DEFAULT;
+            else if (option == LRO_FASTESTMIRRORBACKGROUND)
+                d = LRO_FASTESTMIRRORBACKGROUND_DEFAULT;
+            else if (option == LRO_MAXDOWNLOADSPERHOST)
+                d = LRO_MAXDOWNLOADSPERHOST_DEFAULT;
+            else if (option == LRO_PRERESOLVECACHETTL)
+                d = LRO_PRERESOLVECACHETTL_DEFAULT;
+            else if (option == LRO_SCHEDULEPOLICY)
+                d = LRO_SCHEDULEPOLICY_DEFAULT;
             else
                 assert(0);
         } else {
@@ -511,6 +544,7 @@ py_setopt(_HandleObject *self, PyObject *args)
      * Options with gint64/None arguments
      */
     case LRO_MAXSPEED:
+    case LRO_TOTALMAXSPEED:
     {
         gint64 d;
 
@@ -520,6 +554,8 @@ py_setopt(_HandleObject *self, PyObject *args)
             /* Default options */
             if (option == LRO_MAXSPEED)
                 d = (gint64) LRO_MAXSPEED_DEFAULT;
+            else if (option == LRO_TOTALMAXSPEED)
+                d = (gint64) LRO_TOTALMAXSPEED_DEFAULT;
             else
                 assert(0);
         } else {
@@ -541,6 +577,7 @@ py_setopt(_HandleObject *self, PyObject *args)
     case LRO_YUMDLIST:
     case LRO_YUMBLIST:
     case LRO_HTTPHEADER:
+    case LRO_MIRRORLOCATIONS:
     {
         Py_ssize_t len = 0;
 
@@ -869,6 +906,10 @@ py_getinfo(_HandleObject *self, PyObject *args)
     case LRI_PROXY_SSLCLIENTCERT:
     case LRI_PROXY_SSLCLIENTKEY:
     case LRI_PROXY_SSLCACERT:
+    case LRI_PREVIOUSDESTDIR:
+    case LRI_FASTESTMIRRORPROBEPATH:
+    case LRI_MIRRORSTATSFILE:
+    case LRI_PRERESOLVECACHE:
     case LRI_CACHEDIR:
         res = lr_handle_getinfo(self->handle,
                                 &tmp_err,
@@ -907,6 +948,21 @@ py_getinfo(_HandleObject *self, PyObject *args)
     case LRI_LOWSPEEDTIME:
     case LRI_LOWSPEEDLIMIT:
     case LRI_FTPUSEEPSV:
+    case LRI_SCHEDULEPOLICY:
+    case LRI_LOCKTARGETS:
+    case LRI_MIRRORHASHING:
+    case LRI_RANKMIRRORS:
+    case LRI_PRERESOLVECACHETTL:
+    case LRI_PRERESOLVE:
+    case LRI_MAXDOWNLOADSPERHOST:
+    case LRI_MIRRORSTATS:
+    case LRI_FASTESTMIRRORBACKGROUND:
+    case LRI_FASTESTMIRRORBINARYCACHE:
+    case LRI_FASTESTMIRRORKEEPCONNS:
+    case LRI_FASTESTMIRRORPROBESIZE:
+    case LRI_FASTESTMIRRORMAXPROBES:
+    case LRI_CONDITIONALGET:
+    case LRI_ZCKHEADERPREFETCH:
         res = lr_handle_getinfo(self->handle,
                                 &tmp_err,
                                 (LrHandleInfoOption)option,
@@ -985,6 +1041,7 @@ py_getinfo(_HandleObject *self, PyObject *args)
     case LRI_YUMBLIST:
     case LRI_MIRRORS:
     case LRI_HTTPHEADER:
+    case LRI_MIRRORLOCATIONS:
     {
         PyObject *list;
         char **strlist;
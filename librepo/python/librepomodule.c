@@ -56,6 +56,11 @@ py_debug_cb(G_GNUC_UNUSED const gchar *log_domain,
     if (!debug_cb)
         return;
 
+    // Messages from threads unknown to the interpreter (e.g. the helper
+    // thread verifying repomd.xml signature) cannot be passed to Python
+    if (!PyGILState_GetThisThreadState())
+        return;
+
     // XXX: GIL Hack
     if (global_state)
         EndAllowThreads((PyThreadState **) global_state);
@@ -297,6 +302,27 @@ PyInit__librepo(void)
     PYMODULE_ADDINTCONSTANT(LRO_FTPUSEEPSV);
     PYMODULE_ADDINTCONSTANT(LRO_CACHEDIR);
     PYMODULE_ADDINTCONSTANT(LRO_PRESERVETIME);
+    PYMODULE_ADDINTCONSTANT(LRO_ZCKHEADERPREFETCH);
+    PYMODULE_ADDINTCONSTANT(LRO_CONDITIONALGET);
+    PYMODULE_ADDINTCONSTANT(LRO_PREVIOUSDESTDIR);
+    PYMODULE_ADDINTCONSTANT(LRO_FASTESTMIRRORMAXPROBES);
+    PYMODULE_ADDINTCONSTANT(LRO_FASTESTMIRRORPROBESIZE);
+    PYMODULE_ADDINTCONSTANT(LRO_FASTESTMIRRORPROBEPATH);
+    PYMODULE_ADDINTCONSTANT(LRO_FASTESTMIRRORKEEPCONNS);
+    PYMODULE_ADDINTCONSTANT(LRO_FASTESTMIRRORBINARYCACHE);
+    PYMODULE_ADDINTCONSTANT(LRO_FASTESTMIRRORBACKGROUND);
+    PYMODULE_ADDINTCONSTANT(LRO_MIRRORSTATS);
+    PYMODULE_ADDINTCONSTANT(LRO_MIRRORSTATSFILE);
+    PYMODULE_ADDINTCONSTANT(LRO_MAXDOWNLOADSPERHOST);
+    PYMODULE_ADDINTCONSTANT(LRO_PRERESOLVE);
+    PYMODULE_ADDINTCONSTANT(LRO_PRERESOLVECACHE);
+    PYMODULE_ADDINTCONSTANT(LRO_PRERESOLVECACHETTL);
+    PYMODULE_ADDINTCONSTANT(LRO_RANKMIRRORS);
+    PYMODULE_ADDINTCONSTANT(LRO_MIRRORLOCATIONS);
+    PYMODULE_ADDINTCONSTANT(LRO_MIRRORHASHING);
+    PYMODULE_ADDINTCONSTANT(LRO_LOCKTARGETS);
+    PYMODULE_ADDINTCONSTANT(LRO_SCHEDULEPOLICY);
+    PYMODULE_ADDINTCONSTANT(LRO_TOTALMAXSPEED);
     PYMODULE_ADDINTCONSTANT(LRO_SENTINEL);
 
     // Handle info options
@@ -349,6 +375,26 @@ PyInit__librepo(void)
     PYMODULE_ADDINTCONSTANT(LRI_PROXYAUTHMETHODS);
     PYMODULE_ADDINTCONSTANT(LRI_FTPUSEEPSV);
     PYMODULE_ADDINTCONSTANT(LRI_CACHEDIR);
+    PYMODULE_ADDINTCONSTANT(LRI_ZCKHEADERPREFETCH);
+    PYMODULE_ADDINTCONSTANT(LRI_CONDITIONALGET);
+    PYMODULE_ADDINTCONSTANT(LRI_PREVIOUSDESTDIR);
+    PYMODULE_ADDINTCONSTANT(LRI_FASTESTMIRRORMAXPROBES);
+    PYMODULE_ADDINTCONSTANT(LRI_FASTESTMIRRORPROBESIZE);
+    PYMODULE_ADDINTCONSTANT(LRI_FASTESTMIRRORPROBEPATH);
+    PYMODULE_ADDINTCONSTANT(LRI_FASTESTMIRRORKEEPCONNS);
+    PYMODULE_ADDINTCONSTANT(LRI_FASTESTMIRRORBINARYCACHE);
+    PYMODULE_ADDINTCONSTANT(LRI_FASTESTMIRRORBACKGROUND);
+    PYMODULE_ADDINTCONSTANT(LRI_MIRRORSTATS);
+    PYMODULE_ADDINTCONSTANT(LRI_MIRRORSTATSFILE);
+    PYMODULE_ADDINTCONSTANT(LRI_MAXDOWNLOADSPERHOST);
+    PYMODULE_ADDINTCONSTANT(LRI_PRERESOLVE);
+    PYMODULE_ADDINTCONSTANT(LRI_PRERESOLVECACHE);
+    PYMODULE_ADDINTCONSTANT(LRI_PRERESOLVECACHETTL);
+    PYMODULE_ADDINTCONSTANT(LRI_RANKMIRRORS);
+    PYMODULE_ADDINTCONSTANT(LRI_MIRRORLOCATIONS);
+    PYMODULE_ADDINTCONSTANT(LRI_MIRRORHASHING);
+    PYMODULE_ADDINTCONSTANT(LRI_LOCKTARGETS);
+    PYMODULE_ADDINTCONSTANT(LRI_SCHEDULEPOLICY);
     PYMODULE_ADDINTCONSTANT(LRI_SENTINEL);
 
     // Check options
@@ -374,6 +420,17 @@ PyInit__librepo(void)
     PYMODULE_ADDINTCONSTANT(LR_IPRESOLVE_V4);
     PYMODULE_ADDINTCONSTANT(LR_IPRESOLVE_V6);
 
+    // Schedule policies
+    PYMODULE_ADDINTCONSTANT(LR_SCHEDULE_FIFO);
+    PYMODULE_ADDINTCONSTANT(LR_SCHEDULE_PRIORITY);
+    PYMODULE_ADDINTCONSTANT(LR_SCHEDULE_LONGESTFIRST);
+    PYMODULE_ADDINTCONSTANT(LR_SCHEDULE_SHORTESTFIRST);
+
+    // QoS classes
+    PYMODULE_ADDINTCONSTANT(LR_QOS_NORMAL);
+    PYMODULE_ADDINTCONSTANT(LR_QOS_BACKGROUND);
+    PYMODULE_ADDINTCONSTANT(LR_QOS_INTERACTIVE);
+
     // Return codes
     PYMODULE_ADDINTCONSTANT(LRE_OK);
     PYMODULE_ADDINTCONSTANT(LRE_BADFUNCARG);
@@ -416,6 +473,7 @@ PyInit__librepo(void)
     PYMODULE_ADDINTCONSTANT(LRE_NOTSET);
     PYMODULE_ADDINTCONSTANT(LRE_FILE);
     PYMODULE_ADDINTCONSTANT(LRE_KEYFILE);
+    PYMODULE_ADDINTCONSTANT(LRE_CANCELLED);
     PYMODULE_ADDINTCONSTANT(LRE_UNKNOWNERROR);
 
     // Result option
@@ -425,6 +483,7 @@ PyInit__librepo(void)
     PYMODULE_ADDINTCONSTANT(LRR_RPMMD_REPO);
     PYMODULE_ADDINTCONSTANT(LRR_YUM_REPOMD);
     PYMODULE_ADDINTCONSTANT(LRR_RPMMD_TIMESTAMP);
+    PYMODULE_ADDINTCONSTANT(LRR_RPMMD_REPOMD_UNCHANGED);
     PYMODULE_ADDINTCONSTANT(LRR_SENTINEL);
 
     // Checksums
@@ -390,6 +390,54 @@ get_int(_PackageTargetObject *self, void *member_offset)
     return PyLong_FromLong((long) val);
 }
 
+static int
+set_int(_PackageTargetObject *self, PyObject *value, void *member_offset)
+{
+    if (check_PackageTargetStatus(self))
+        return -1;
+    if (!value || !PyLong_Check(value)) {
+        PyErr_SetString(PyExc_TypeError, "Only Int/Long is supported with this attribute");
+        return -1;
+    }
+    long val = PyLong_AsLong(value);
+    if (val == -1 && PyErr_Occurred())
+        return -1;
+    if (val < INT_MIN || val > INT_MAX) {
+        PyErr_SetString(PyExc_OverflowError, "Value is out of range");
+        return -1;
+    }
+    LrPackageTarget *target = self->target;
+    *((int *) ((size_t)target + (size_t) member_offset)) = (int) val;
+    return 0;
+}
+
+static PyObject *
+get_long(_PackageTargetObject *self, void *member_offset)
+{
+    if (check_PackageTargetStatus(self))
+        return NULL;
+    LrPackageTarget *target = self->target;
+    long val = *((long *) ((size_t)target + (size_t) member_offset));
+    return PyLong_FromLong(val);
+}
+
+static int
+set_long(_PackageTargetObject *self, PyObject *value, void *member_offset)
+{
+    if (check_PackageTargetStatus(self))
+        return -1;
+    if (!value || !PyLong_Check(value)) {
+        PyErr_SetString(PyExc_TypeError, "Only Int/Long is supported with this attribute");
+        return -1;
+    }
+    long val = PyLong_AsLong(value);
+    if (val == -1 && PyErr_Occurred())
+        return -1;
+    LrPackageTarget *target = self->target;
+    *((long *) ((size_t)target + (size_t) member_offset)) = val;
+    return 0;
+}
+
 static PyObject *
 get_str(_PackageTargetObject *self, void *member_offset)
 {
@@ -461,6 +509,9 @@ static PyGetSetDef packagetarget_getsetters[] = {
     {"mirrorfailurecb",(getter)get_pythonobj,NULL, NULL, OFFSET(mirrorfailurecb)},
     {"local_path",    (getter)get_str,       NULL, NULL, OFFSET(local_path)},
     {"err",           (getter)get_str,       NULL, NULL, OFFSET(err)},
+    {"usedmirror",    (getter)get_str,       NULL, NULL, OFFSET(usedmirror)},
+    {"priority",      (getter)get_long,      (setter)set_long, NULL, OFFSET(priority)},
+    {"qosclass",      (getter)get_int,       (setter)set_int,  NULL, OFFSET(qosclass)},
     {NULL, NULL, NULL, NULL, NULL} /* sentinel */
 };
 
@@ -183,6 +183,18 @@ getinfo(_ResultObject *self, PyObject *args)
         return obj;
     }
 
+    case LRR_RPMMD_REPOMD_UNCHANGED: {
+        gboolean unchanged;
+        GError *tmp_err = NULL;
+        res = lr_result_getinfo(self->result,
+                                &tmp_err,
+                                (LrResultInfoOption)option,
+                                &unchanged);
+        if (!res)
+            RETURN_ERROR(&tmp_err, -1, NULL);
+        return PyBool_FromLong(unchanged);
+    }
+
     /*
      * Unknown options
      */
@@ -0,0 +1,462 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "util.h"
+#include "cleanup.h"
+#include "resolver_internal.h"
+
+#define RESOLVER_TIMEOUT        10  // Seconds
+#define RESOLVER_MAX_THREADS    16
+
+#define RESOLVER_KEY_TS         "ts"
+#define RESOLVER_KEY_ADDRESSES  "addresses"
+
+/** State shared by the caller and the resolving threads. A resolution
+ * may outlive lr_resolver_prepare() (getaddrinfo() cannot be cancelled),
+ * so the state is freed by the one who drops the last reference.
+ */
+typedef struct {
+    GMutex mutex;
+    GCond cond;
+    int refs;           /*!< Protected by the mutex */
+    int pending;        /*!< Number of unfinished jobs */
+    GPtrArray *jobs;    /*!< All jobs (LrResolverJob *) */
+} LrResolverState;
+
+typedef struct {
+    LrResolverState *state;
+    gchar *host;
+    gboolean done;
+    gchar **addresses;  /*!< Result or NULL if the host wasn't resolved */
+} LrResolverJob;
+
+static void
+lr_resolver_job_free(LrResolverJob *job)
+{
+    g_free(job->host);
+    g_strfreev(job->addresses);
+    g_free(job);
+}
+
+static void
+lr_resolver_state_unref(LrResolverState *state)
+{
+    g_mutex_lock(&state->mutex);
+    gboolean last = --state->refs == 0;
+    g_mutex_unlock(&state->mutex);
+
+    if (!last)
+        return;
+
+    g_ptr_array_free(state->jobs, TRUE);
+    g_mutex_clear(&state->mutex);
+    g_cond_clear(&state->cond);
+    g_free(state);
+}
+
+/** Resolve the host to a NULL terminated list of unique addresses.
+ */
+static gchar **
+lr_resolver_getaddrinfo(const char *host)
+{
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int rc = getaddrinfo(host, NULL, &hints, &result);
+    if (rc != 0) {
+        g_debug("%s: Cannot resolve %s: %s", __func__, host, gai_strerror(rc));
+        return NULL;
+    }
+
+    GPtrArray *addresses = g_ptr_array_new();
+    for (struct addrinfo *ai = result; ai; ai = ai->ai_next) {
+        char buf[INET6_ADDRSTRLEN];
+        const void *addr;
+
+        if (ai->ai_family == AF_INET)
+            addr = &((struct sockaddr_in *) ai->ai_addr)->sin_addr;
+        else if (ai->ai_family == AF_INET6)
+            addr = &((struct sockaddr_in6 *) ai->ai_addr)->sin6_addr;
+        else
+            continue;
+
+        if (!inet_ntop(ai->ai_family, addr, buf, sizeof(buf)))
+            continue;
+
+        gboolean duplicate = FALSE;
+        for (guint x = 0; x < addresses->len && !duplicate; x++)
+            duplicate = !strcmp(g_ptr_array_index(addresses, x), buf);
+        if (!duplicate)
+            g_ptr_array_add(addresses, g_strdup(buf));
+    }
+    freeaddrinfo(result);
+
+    if (addresses->len == 0) {
+        g_ptr_array_free(addresses, TRUE);
+        return NULL;
+    }
+
+    g_ptr_array_add(addresses, NULL);
+    return (gchar **) g_ptr_array_free(addresses, FALSE);
+}
+
+static void
+lr_resolver_job_run(gpointer data, gpointer user_data G_GNUC_UNUSED)
+{
+    LrResolverJob *job = data;
+    LrResolverState *state = job->state;
+    gchar **addresses = lr_resolver_getaddrinfo(job->host);
+
+    g_mutex_lock(&state->mutex);
+    job->addresses = addresses;
+    job->done = TRUE;
+    state->pending--;
+    g_cond_signal(&state->cond);
+    g_mutex_unlock(&state->mutex);
+
+    lr_resolver_state_unref(state);
+}
+
+/** Resolve all hosts (keys of the table) which don't have addresses yet.
+ * Resolved ones get their addresses and are added to the list.
+ */
+static void
+lr_resolver_resolve(GHashTable *hosts, GSList **resolved)
+{
+    LrResolverState *state = g_new0(LrResolverState, 1);
+    g_mutex_init(&state->mutex);
+    g_cond_init(&state->cond);
+    state->refs = 1;
+    state->jobs = g_ptr_array_new_with_free_func((GDestroyNotify) lr_resolver_job_free);
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, hosts);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        if (value)
+            continue;  // Already known
+        LrResolverJob *job = g_new0(LrResolverJob, 1);
+        job->state = state;
+        job->host = g_strdup(key);
+        g_ptr_array_add(state->jobs, job);
+    }
+
+    if (state->jobs->len == 0) {
+        lr_resolver_state_unref(state);
+        return;
+    }
+
+    g_debug("%s: Resolving %u hosts", __func__, state->jobs->len);
+
+    state->refs += state->jobs->len;
+    state->pending = state->jobs->len;
+    GThreadPool *pool = g_thread_pool_new(lr_resolver_job_run,
+                                          NULL,
+                                          MIN(state->jobs->len, RESOLVER_MAX_THREADS),
+                                          FALSE,
+                                          NULL);
+    for (guint x = 0; x < state->jobs->len; x++)
+        g_thread_pool_push(pool, g_ptr_array_index(state->jobs, x), NULL);
+
+    gint64 deadline = g_get_monotonic_time() + RESOLVER_TIMEOUT * G_TIME_SPAN_SECOND;
+    g_mutex_lock(&state->mutex);
+    while (state->pending > 0)
+        if (!g_cond_wait_until(&state->cond, &state->mutex, deadline))
+            break;
+
+    if (state->pending > 0)
+        g_debug("%s: %d hosts were not resolved in time", __func__, state->pending);
+
+    // Jobs which are done are not touched by the threads anymore
+    for (guint x = 0; x < state->jobs->len; x++) {
+        LrResolverJob *job = g_ptr_array_index(state->jobs, x);
+        if (!job->done || !job->addresses)
+            continue;
+        g_hash_table_insert(hosts, g_strdup(job->host), job->addresses);
+        *resolved = g_slist_prepend(*resolved, job->host);
+        job->host = NULL;
+        job->addresses = NULL;
+    }
+    g_mutex_unlock(&state->mutex);
+
+    // Unfinished jobs are left to the pool, it is freed after them
+    g_thread_pool_free(pool, FALSE, FALSE);
+    lr_resolver_state_unref(state);
+}
+
+/** Use fresh addresses from the cache for the hosts.
+ */
+static void
+lr_resolver_cache_lookup(GKeyFile *cache, GHashTable *hosts, gint64 now, gint64 ttl)
+{
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, hosts);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        const char *host = key;
+        if (!g_key_file_has_group(cache, host))
+            continue;
+        gint64 ts = g_key_file_get_int64(cache, host, RESOLVER_KEY_TS, NULL);
+        if (now - ts >= ttl || ts > now)
+            continue;
+        gchar **addresses = g_key_file_get_string_list(cache, host,
+                                                       RESOLVER_KEY_ADDRESSES,
+                                                       NULL, NULL);
+        if (!addresses || !addresses[0]) {
+            g_strfreev(addresses);
+            continue;
+        }
+        g_hash_table_iter_replace(&iter, addresses);
+    }
+}
+
+/** Store the newly resolved hosts to the cache and drop expired records.
+ */
+static void
+lr_resolver_cache_save(GKeyFile *cache,
+                       const char *path,
+                       GHashTable *hosts,
+                       GSList *resolved,
+                       gint64 now,
+                       gint64 ttl)
+{
+    for (GSList *elem = resolved; elem; elem = g_slist_next(elem)) {
+        const char *host = elem->data;
+        gchar **addresses = g_hash_table_lookup(hosts, host);
+        g_key_file_set_int64(cache, host, RESOLVER_KEY_TS, now);
+        g_key_file_set_string_list(cache, host, RESOLVER_KEY_ADDRESSES,
+                                   (const gchar * const *) addresses,
+                                   g_strv_length(addresses));
+    }
+
+    _cleanup_strv_free_ gchar **groups = g_key_file_get_groups(cache, NULL);
+    for (gchar **group = groups; *group; group++) {
+        gint64 ts = g_key_file_get_int64(cache, *group, RESOLVER_KEY_TS, NULL);
+        if (now - ts >= ttl || ts > now)
+            g_key_file_remove_group(cache, *group, NULL);
+    }
+
+    GError *tmp_err = NULL;
+    if (!lr_key_file_save_to_file(cache, path, &tmp_err)) {
+        g_warning("Cannot save resolved addresses to %s: %s",
+                  path, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+}
+
+/** Build a CURLOPT_RESOLVE entry or return NULL if there
+ * is no address of the wanted family.
+ */
+static gchar *
+lr_resolver_entry(const char *hostport,
+                  gchar **addresses,
+                  LrIpResolveType ipresolve)
+{
+    GString *entry = g_string_new(NULL);
+#if LIBCURL_VERSION_NUM >= 0x074B00  // Entries which time out since 7.75.0
+    g_string_append_c(entry, '+');
+#endif
+    g_string_append_printf(entry, "%s:", hostport);
+
+    gboolean empty = TRUE;
+    for (gchar **address = addresses; *address; address++) {
+        gboolean ipv6 = strchr(*address, ':') != NULL;
+        if ((ipv6 && ipresolve == LR_IPRESOLVE_V4)
+            || (!ipv6 && ipresolve == LR_IPRESOLVE_V6))
+            continue;
+#if LIBCURL_VERSION_NUM >= 0x073B00  // More addresses and IPv6 since 7.59.0
+        if (!empty)
+            g_string_append_c(entry, ',');
+        if (ipv6)
+            g_string_append_printf(entry, "[%s]", *address);
+        else
+            g_string_append(entry, *address);
+        empty = FALSE;
+#else
+        if (ipv6)
+            continue;
+        g_string_append(entry, *address);
+        empty = FALSE;
+        break;
+#endif
+    }
+
+    return g_string_free(entry, empty);
+}
+
+gboolean
+lr_resolver_url_host(const char *url, gchar **host, int *port)
+{
+    static const struct {
+        const char *scheme;
+        int port;
+    } default_ports[] = {
+        { "http", 80 },
+        { "https", 443 },
+        { "ftp", 21 },
+    };
+
+    _cleanup_free_ gchar *scheme = NULL;
+    _cleanup_free_ gchar *uri_host = NULL;
+    gint uri_port = -1;
+
+    if (!g_uri_split_network(url, G_URI_FLAGS_NONE, &scheme, &uri_host,
+                             &uri_port, NULL))
+        return FALSE;
+
+    if (!uri_host || !*uri_host)
+        return FALSE;
+
+    for (size_t x = 0; x < G_N_ELEMENTS(default_ports); x++) {
+        if (!g_ascii_strcasecmp(scheme, default_ports[x].scheme)) {
+            *host = g_ascii_strdown(uri_host, -1);
+            *port = uri_port != -1 ? uri_port : default_ports[x].port;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+gboolean
+lr_resolver_url_proxied(const char *url)
+{
+    // Variables read by curl (only the lowercase http_proxy)
+    static const struct {
+        const char *prefix;
+        const char *vars[2];
+    } proxy_vars[] = {
+        { "http://", { "http_proxy", NULL } },
+        { "https://", { "https_proxy", "HTTPS_PROXY" } },
+        { "ftp://", { "ftp_proxy", "FTP_PROXY" } },
+    };
+    static const char *all_vars[] = { "all_proxy", "ALL_PROXY" };
+
+    for (size_t x = 0; x < G_N_ELEMENTS(proxy_vars); x++) {
+        if (g_ascii_strncasecmp(url, proxy_vars[x].prefix,
+                                strlen(proxy_vars[x].prefix)))
+            continue;
+        for (size_t y = 0; y < G_N_ELEMENTS(proxy_vars[x].vars); y++) {
+            const char *value = proxy_vars[x].vars[y]
+                                ? g_getenv(proxy_vars[x].vars[y]) : NULL;
+            if (value && *value)
+                return TRUE;
+        }
+        for (size_t y = 0; y < G_N_ELEMENTS(all_vars); y++) {
+            const char *value = g_getenv(all_vars[y]);
+            if (value && *value)
+                return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+struct curl_slist *
+lr_resolver_prepare(GSList *urls,
+                    LrIpResolveType ipresolve,
+                    const char *cache_path,
+                    gint64 ttl)
+{
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    struct curl_slist *resolve = NULL;
+
+    // host -> addresses (NULL until known)
+    _cleanup_hashtable_unref_ GHashTable *hosts =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                              (GDestroyNotify) g_strfreev);
+    // "host:port" -> host
+    _cleanup_hashtable_unref_ GHashTable *hostports =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    for (GSList *elem = urls; elem; elem = g_slist_next(elem)) {
+        gchar *host = NULL;
+        int port;
+
+        if (lr_resolver_url_proxied(elem->data))
+            continue;  // The proxy resolves the name
+
+        if (!lr_resolver_url_host(elem->data, &host, &port))
+            continue;
+
+        if (g_hostname_is_ip_address(host)) {
+            g_free(host);
+            continue;
+        }
+
+        gchar *hostport = g_strdup_printf("%s:%d", host, port);
+        if (!g_hash_table_contains(hosts, host))
+            g_hash_table_insert(hosts, g_strdup(host), NULL);
+        g_hash_table_insert(hostports, hostport, host);
+    }
+
+    if (g_hash_table_size(hosts) == 0)
+        return NULL;
+
+    _cleanup_keyfile_free_ GKeyFile *cache = NULL;
+    if (cache_path) {
+        GError *tmp_err = NULL;
+        cache = g_key_file_new();
+        if (!g_key_file_load_from_file(cache, cache_path, G_KEY_FILE_NONE, &tmp_err)) {
+            if (!g_error_matches(tmp_err, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                g_debug("%s: Cannot load %s: %s", __func__, cache_path,
+                        tmp_err->message);
+            g_error_free(tmp_err);
+        }
+        lr_resolver_cache_lookup(cache, hosts, now, ttl);
+    }
+
+    GSList *resolved = NULL;
+    lr_resolver_resolve(hosts, &resolved);
+
+    if (cache && resolved)
+        lr_resolver_cache_save(cache, cache_path, hosts, resolved, now, ttl);
+    g_slist_free_full(resolved, g_free);
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, hostports);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        gchar **addresses = g_hash_table_lookup(hosts, value);
+        if (!addresses)
+            continue;
+        _cleanup_free_ gchar *entry = lr_resolver_entry(key, addresses, ipresolve);
+        if (!entry)
+            continue;
+        g_debug("%s: Resolved in advance: %s", __func__, entry);
+        resolve = curl_slist_append(resolve, entry);
+    }
+
+    return resolve;
+}
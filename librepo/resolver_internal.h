@@ -0,0 +1,79 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2013  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_RESOLVER_INTERNAL_H__
+#define __LR_RESOLVER_INTERNAL_H__
+
+#include <glib.h>
+#include <curl/curl.h>
+
+#include "types.h"
+
+G_BEGIN_DECLS
+
+/** Up-front resolution of mirror hosts (see LRO_PRERESOLVE).
+ *
+ * Hosts of all mirrors are resolved concurrently before the first
+ * transfer starts and the results are handed over to curl as
+ * CURLOPT_RESOLVE entries, so the DNS latency of a mirror is not paid
+ * serially when the downloader walks down the mirror list.
+ */
+
+/** Get host and port of the url.
+ * @param url       URL
+ * @param host      Host (without brackets for IPv6 addresses)
+ * @param port      Port (default port of the scheme if not specified)
+ * @return          FALSE if the url doesn't point to a network host
+ *                  (local paths, unknown schemes, ...)
+ */
+gboolean
+lr_resolver_url_host(const char *url, gchar **host, int *port);
+
+/** Check if curl would use a proxy from the environment (http_proxy,
+ * https_proxy, all_proxy, ...) for the url. The no_proxy variable is not
+ * taken into account.
+ * @param url       URL
+ * @return          TRUE if a proxy variable applies to the url
+ */
+gboolean
+lr_resolver_url_proxied(const char *url);
+
+/** Resolve hosts of all the urls concurrently. URLs which go through
+ * a proxy from the environment are skipped. Hosts which cannot be
+ * resolved (in RESOLVER_TIMEOUT seconds) are skipped, curl resolves them
+ * on its own. If cache_path is specified, addresses from the cache younger
+ * than ttl seconds are used instead of resolving and the new results are
+ * stored to the cache. Problems with the cache are only logged.
+ * @param urls          List of URLs (char *)
+ * @param ipresolve     Family of returned addresses
+ * @param cache_path    Path to the cache file or NULL
+ * @param ttl           Max age of cached addresses in seconds
+ * @return              List of "host:port:address[,address...]" entries
+ *                      for CURLOPT_RESOLVE or NULL
+ */
+struct curl_slist *
+lr_resolver_prepare(GSList *urls,
+                    LrIpResolveType ipresolve,
+                    const char *cache_path,
+                    gint64 ttl);
+
+G_END_DECLS
+
+#endif
@@ -111,6 +111,12 @@ lr_result_getinfo(LrResult *result,
         break;
     }
 
+    case LRR_RPMMD_REPOMD_UNCHANGED: {
+        gboolean *unchanged = va_arg(arg, gboolean *);
+        *unchanged = result->repomd_unchanged;
+        break;
+    }
+
     default:
         rc = FALSE;
         g_set_error(err, LR_RESULT_ERROR, LRE_UNKNOWNOPT,
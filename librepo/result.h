@@ -53,6 +53,13 @@ typedef enum {
     LRR_RPMMD_REPO,      /*!< In C same as LRR_YUM_REPO */
     LRR_RPMMD_REPOMD,    /*!< In C same as LRR_YUM_REPOMD */
     LRR_RPMMD_TIMESTAMP, /*!< In C same as LRR_YUM_TIMESTAMP */
+
+    LRR_RPMMD_REPOMD_UNCHANGED, /*!< (gboolean *)
+        TRUE if server replied that repomd.xml was not modified since
+        the previous download (see LRO_CONDITIONALGET). In that case
+        repomd.xml was neither parsed nor were the rest of the repository
+        downloaded, so the repository from the previous download should
+        be used. */
     LRR_SENTINEL,
 } LrResultInfoOption;
 
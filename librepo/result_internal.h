@@ -37,6 +37,9 @@ struct _LrResult {
 
     LrYumRepo      *yum_repo; /*!<
         Pointer to struct with info about yum repo */
+
+    gboolean        repomd_unchanged; /*!<
+        Server replied 304 Not Modified for repomd.xml */
 };
 
 G_END_DECLS
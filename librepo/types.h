@@ -65,6 +65,35 @@ typedef enum {
     LR_IPRESOLVE_V6,        /*!< Resolve to IPv6 addresses */
 } LrIpResolveType;
 
+/** Order in which waiting download targets are started (LRO_SCHEDULEPOLICY).
+ * Except for LR_SCHEDULE_FIFO, targets with a higher priority
+ * (LrDownloadTarget.priority) are always started first. Durations are
+ * estimated from the expected sizes and the throughput measured on
+ * the mirrors of the targets, targets with unknown size are started
+ * after the others. Ties keep the order of the targets. */
+typedef enum {
+    LR_SCHEDULE_FIFO,           /*!< Default - order of the targets */
+    LR_SCHEDULE_PRIORITY,       /*!< Priority, then order of the targets */
+    LR_SCHEDULE_LONGESTFIRST,   /*!< Longest download first, minimizes
+                                     the total time of the batch */
+    LR_SCHEDULE_SHORTESTFIRST,  /*!< Shortest download first, first
+                                     targets are available sooner */
+    LR_SCHEDULE_SENTINEL,       /*!< Sentinel */
+} LrSchedulePolicy;
+
+/** QoS class of a download target (LrDownloadTarget.qosclass).
+ * Download speed limits (LRO_MAXSPEED, LRO_TOTALMAXSPEED) are shared
+ * by the running transfers in proportion to the weights of their classes,
+ * bandwidth a transfer cannot use because of a tighter limit is
+ * redistributed to the others. The weights are 1 (background),
+ * 2 (normal) and 4 (interactive). */
+typedef enum {
+    LR_QOS_NORMAL,          /*!< Default class */
+    LR_QOS_BACKGROUND,      /*!< E.g. prefetching of packages */
+    LR_QOS_INTERACTIVE,     /*!< E.g. metadata a user is waiting for */
+    LR_QOS_SENTINEL,        /*!< Sentinel */
+} LrQosClass;
+
 /** LrAuth methods */
 typedef enum {
     LR_AUTH_NONE        = 0,       /*!< None auth method */
@@ -155,6 +184,16 @@ typedef int (*LrMirrorFailureCb)(void *clientp,
                                  const char *msg,
                                  const char *url);
 
+/** Data callback prototype
+ * @param clientp           Pointer to user data.
+ * @param buf               Received data of the target
+ * @param len               Length of the data
+ * @return                  See LrCbReturnCode codes
+ */
+typedef int (*LrDataCb)(void *clientp,
+                        const char *buf,
+                        size_t len);
+
 /** MirrorFailure callback
  * @param clientp           Pointer to user data.
  * @param msg               Error message.
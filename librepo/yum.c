@@ -20,6 +20,7 @@
 
 #define _POSIX_SOURCE
 #define _DEFAULT_SOURCE
+#define _GNU_SOURCE
 #define  BITS_IN_BYTE 8
 
 #include <stdio.h>
@@ -31,6 +32,10 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 
 #ifdef WITH_ZCHUNK
 #include <zck.h>
@@ -430,19 +435,66 @@ lr_prepare_repomd_xml_file(LrHandle *handle,
     return fd;
 }
 
-/** Check repomd.xml.asc if available.
- * Try to download and verify GPG signature (repomd.xml.asc).
+/** Download repomd.xml.asc.
  * Try to download only from the mirror where repomd.xml itself was
  * downloaded. It is because most of yum repositories are not signed
  * and try every mirror for signature is non effective.
  * Every mirror would be tried because mirrored_download function have
  * no clue if 404 for repomd.xml.asc means that no signature exists or
  * it is just error on the mirror and should try the next one.
+ * @param signature     Path of the downloaded signature
+ **/
+static gboolean
+lr_download_repomd_xml_asc(LrHandle *handle,
+                           LrYumRepo *repo,
+                           char **signature,
+                           GError **err)
+{
+    GError *tmp_err = NULL;
+    gboolean ret;
+    int fd_sig;
+    char *url, *path;
+
+    path = lr_pathconcat(handle->destdir, "repodata/repomd.xml.asc", NULL);
+    fd_sig = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd_sig == -1) {
+        g_debug("%s: Cannot open: %s", __func__, path);
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot open %s: %s", path, g_strerror(errno));
+        g_free(path);
+        return FALSE;
+    }
+
+    url = lr_pathconcat(handle->used_mirror, "repodata/repomd.xml.asc", NULL);
+    ret = lr_download_url(handle, url, fd_sig, &tmp_err);
+    g_free(url);
+    close(fd_sig);
+    if (!ret) {
+        // Error downloading signature
+        g_set_error(err, LR_YUM_ERROR, LRE_BADGPG,
+                    "GPG verification is enabled, but GPG signature "
+                    "is not available. This may be an error or the "
+                    "repository does not support GPG verification: %s", tmp_err->message);
+        g_clear_error(&tmp_err);
+        unlink(path);
+        g_free(path);
+        return FALSE;
+    }
+
+    // Signature downloaded
+    repo->signature = g_strdup(path);
+    *signature = path;
+    return TRUE;
+}
+
+/** Check repomd.xml.asc if available.
+ * Try to download and verify GPG signature (repomd.xml.asc).
+ * See lr_download_repomd_xml_asc() for details about the download.
  **/
 gboolean
 lr_check_repomd_xml_asc_availability(LrHandle *handle,
                                      LrYumRepo *repo,
-                                     int fd,
+                                     G_GNUC_UNUSED int fd,
                                      char *path,
                                      GError **err)
 {
@@ -450,50 +502,111 @@ lr_check_repomd_xml_asc_availability(LrHandle *handle,
     gboolean ret;
 
     if (handle->checks & LR_CHECK_GPG) {
-        int fd_sig;
-        char *url, *signature;
+        char *signature;
 
-        signature = lr_pathconcat(handle->destdir, "repodata/repomd.xml.asc", NULL);
-        fd_sig = open(signature, O_CREAT | O_TRUNC | O_RDWR, 0666);
-        if (fd_sig == -1) {
-            g_debug("%s: Cannot open: %s", __func__, signature);
-            g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                        "Cannot open %s: %s", signature, g_strerror(errno));
-            g_free(signature);
+        if (!lr_download_repomd_xml_asc(handle, repo, &signature, err))
             return FALSE;
-        }
 
-        url = lr_pathconcat(handle->used_mirror, "repodata/repomd.xml.asc", NULL);
-        ret = lr_download_url(handle, url, fd_sig, &tmp_err);
-        g_free(url);
-        close(fd_sig);
+        ret = lr_gpg_check_signature(signature,
+                                     path,
+                                     handle->gnupghomedir,
+                                     &tmp_err);
+        g_free(signature);
         if (!ret) {
-            // Error downloading signature
-            g_set_error(err, LR_YUM_ERROR, LRE_BADGPG,
-                        "GPG verification is enabled, but GPG signature "
-                        "is not available. This may be an error or the "
-                        "repository does not support GPG verification: %s", tmp_err->message);
-            g_clear_error(&tmp_err);
-            unlink(signature);
-            g_free(signature);
+            g_debug("%s: GPG signature verification failed: %s",
+                    __func__, tmp_err->message);
+            g_propagate_prefixed_error(err, tmp_err,
+                                       "repomd.xml GPG signature verification error: ");
             return FALSE;
-        } else {
-            // Signature downloaded
-            repo->signature = g_strdup(signature);
-            ret = lr_gpg_check_signature(signature,
-                                         path,
-                                         handle->gnupghomedir,
-                                         &tmp_err);
-            g_free(signature);
-            if (!ret) {
-                g_debug("%s: GPG signature verification failed: %s",
-                        __func__, tmp_err->message);
-                g_propagate_prefixed_error(err, tmp_err,
-                                           "repomd.xml GPG signature verification error: ");
-                return FALSE;
-            }
-            g_debug("%s: GPG signature successfully verified", __func__);
         }
+        g_debug("%s: GPG signature successfully verified", __func__);
+    }
+
+    return TRUE;
+}
+
+/** GPG verification of repomd.xml running in a helper thread while
+ * the repomd records are already being downloaded.
+ */
+typedef struct {
+    GThread *thread;        /*!< Thread running the verification */
+    gchar *signature;       /*!< Path to repomd.xml.asc */
+    gchar *data;            /*!< Path to repomd.xml */
+    gchar *home_dir;        /*!< GnuPG home dir */
+    volatile gint finished; /*!< Set when the verification is done */
+    gboolean verified;      /*!< Result of the verification */
+    GError *err;            /*!< Verification error */
+} LrGpgCheckJob;
+
+static gpointer
+lr_gpg_check_job_run(gpointer data)
+{
+    LrGpgCheckJob *job = data;
+
+    job->verified = lr_gpg_check_signature(job->signature,
+                                           job->data,
+                                           job->home_dir,
+                                           &job->err);
+    g_atomic_int_set(&job->finished, 1);
+    return NULL;
+}
+
+static LrGpgCheckJob *
+lr_gpg_check_job_start(gchar *signature,
+                       const char *data,
+                       const char *home_dir)
+{
+    LrGpgCheckJob *job = lr_malloc0(sizeof(*job));
+    job->signature = signature;
+    job->data = g_strdup(data);
+    job->home_dir = g_strdup(home_dir);
+    job->thread = g_thread_new("lr-gpg-check", lr_gpg_check_job_run, job);
+    return job;
+}
+
+/** Wait for the verification and free the job.
+ * @return      TRUE if the signature was successfully verified
+ */
+static gboolean
+lr_gpg_check_job_finish(LrGpgCheckJob *job, GError **err)
+{
+    gboolean ret;
+
+    assert(!err || *err == NULL);
+
+    g_thread_join(job->thread);
+    ret = job->verified;
+    if (!ret) {
+        g_debug("%s: GPG signature verification failed: %s",
+                __func__, job->err->message);
+        g_propagate_prefixed_error(err, job->err,
+                                   "repomd.xml GPG signature verification error: ");
+    } else {
+        g_debug("%s: GPG signature successfully verified", __func__);
+    }
+
+    g_free(job->signature);
+    g_free(job->data);
+    g_free(job->home_dir);
+    lr_free(job);
+    return ret;
+}
+
+/** LrTargetDoneCb that aborts the download of repomd records as soon
+ * as the GPG verification of repomd.xml fails.
+ */
+static gboolean
+lr_gpg_check_job_donecb(void *data,
+                        G_GNUC_UNUSED LrDownloadTarget *target,
+                        G_GNUC_UNUSED GSList **new_targets,
+                        GError **err)
+{
+    LrGpgCheckJob *job = data;
+
+    if (g_atomic_int_get(&job->finished) && !job->verified) {
+        g_set_error(err, LR_YUM_ERROR, LRE_BADGPG,
+                    "repomd.xml GPG signature verification failed");
+        return FALSE;
     }
 
     return TRUE;
@@ -549,7 +662,8 @@ lr_get_metadata_failure_callback(const LrHandle *handle)
 
 gboolean
 lr_yum_download_url(LrHandle *lr_handle, const char *url, int fd,
-                    gboolean no_cache, gboolean is_zchunk, GError **err)
+                    gboolean no_cache, gboolean is_zchunk,
+                    gboolean conditional, GError **err)
 {
     gboolean ret;
     LrDownloadTarget *target;
@@ -572,6 +686,7 @@ lr_yum_download_url(LrHandle *lr_handle, const char *url, int fd,
                                    NULL, 0, 0,(lr_handle && lr_handle->user_cb) ? progresscb : NULL, cbdata,
                                    NULL, (lr_handle && lr_handle->hmfcb) ? hmfcb : NULL, NULL, 0, 0,
                                    NULL, no_cache, is_zchunk);
+    target->conditional = conditional;
 
     // Download the target
     ret = lr_download_target(target, &tmp_err);
@@ -595,6 +710,8 @@ static gboolean
 lr_yum_download_repomd(LrHandle *handle,
                        LrMetalink *metalink,
                        int fd,
+                       gboolean *not_modified,
+                       char **conditional_cache,
                        GError **err)
 {
     int ret = TRUE;
@@ -633,6 +750,7 @@ lr_yum_download_repomd(LrHandle *handle,
                                                      NULL,
                                                      TRUE,
                                                      FALSE);
+    target->conditional = TRUE;
 
     ret = lr_download_target(target, &tmp_err);
     assert((ret && !tmp_err) || (!ret && tmp_err));
@@ -653,6 +771,8 @@ lr_yum_download_repomd(LrHandle *handle,
         // TODO: Get rid of use_mirror attr
         lr_free(handle->used_mirror);
         handle->used_mirror = g_strdup(target->usedmirror);
+        *not_modified = target->not_modified;
+        *conditional_cache = g_strdup(target->conditional_cache);
     }
 
     lr_downloadtarget_free(target);
@@ -684,6 +804,145 @@ prepare_repo_download_std_target(LrHandle *handle,
     return TRUE;
 }
 
+gboolean
+lr_yum_copy_file_content(int src_fd, int dst_fd)
+{
+#ifdef FICLONE
+    // Copy-on-write filesystems just share the extents
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0)
+        return TRUE;
+#endif /* FICLONE */
+#ifdef HAVE_COPY_FILE_RANGE
+    struct stat st;
+    if (fstat(src_fd, &st) == 0) {
+        // Explicit offsets, the file offsets of the fds are not moved
+        loff_t src_off = 0;
+        loff_t dst_off = 0;
+        while (src_off < st.st_size) {
+            ssize_t copied = copy_file_range(src_fd, &src_off, dst_fd, &dst_off,
+                                             st.st_size - src_off, 0);
+            if (copied <= 0)
+                break;
+        }
+        if (src_off == st.st_size)
+            return TRUE;
+        // Fall back to the read/write loop from the beginning
+        if (ftruncate(dst_fd, 0) != 0
+            || lseek(src_fd, 0, SEEK_SET) == -1
+            || lseek(dst_fd, 0, SEEK_SET) == -1)
+            return FALSE;
+    }
+#endif /* HAVE_COPY_FILE_RANGE */
+    return lr_copy_content(src_fd, dst_fd) == 0;
+}
+
+gboolean
+lr_yum_link_or_copy(const char *src, const char *dst)
+{
+    if (g_strcmp0(src, dst) == 0)
+        return TRUE;
+
+    unlink(dst);
+    if (link(src, dst) == 0) {
+        g_debug("%s: Hardlinked %s to %s", __func__, src, dst);
+        return TRUE;
+    }
+
+    return lr_yum_copy(src, dst);
+}
+
+gboolean
+lr_yum_copy(const char *src, const char *dst)
+{
+    int src_fd, dst_fd;
+    gboolean ret;
+
+    if (g_strcmp0(src, dst) == 0)
+        return TRUE;
+
+    // The dst may be a hardlink, it must not be truncated in place
+    unlink(dst);
+
+    src_fd = open(src, O_RDONLY);
+    if (src_fd == -1) {
+        g_debug("%s: Cannot open %s: %s", __func__, src, g_strerror(errno));
+        return FALSE;
+    }
+
+    dst_fd = open(dst, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    if (dst_fd == -1) {
+        g_debug("%s: Cannot open %s: %s", __func__, dst, g_strerror(errno));
+        close(src_fd);
+        return FALSE;
+    }
+
+    ret = lr_yum_copy_file_content(src_fd, dst_fd);
+    close(src_fd);
+    close(dst_fd);
+
+    if (!ret) {
+        g_debug("%s: Cannot copy %s: %s", __func__, src, g_strerror(errno));
+        unlink(dst);
+        return FALSE;
+    }
+
+    g_debug("%s: Copied %s to %s", __func__, src, dst);
+    return TRUE;
+}
+
+/** If the record is available with the same checksum in the
+ * LRO_PREVIOUSDESTDIR, put it to the path (reflink or copy)
+ * and return TRUE. Otherwise (or on any error) return FALSE
+ * and the record has to be downloaded.
+ */
+static gboolean
+lr_yum_reuse_previous_record(LrHandle *handle,
+                             LrYumRepoMdRecord *record,
+                             const char *path)
+{
+    gboolean matches = FALSE;
+    GError *tmp_err = NULL;
+    int src_fd;
+
+    if (!handle->previousdestdir || !record->checksum || !record->checksum_type)
+        return FALSE;
+
+    LrChecksumType type = lr_checksum_type(record->checksum_type);
+    if (type == LR_CHECKSUM_UNKNOWN)
+        return FALSE;
+
+    _cleanup_free_ gchar *prev = lr_pathconcat(handle->previousdestdir,
+                                               record->location_href, NULL);
+
+    src_fd = open(prev, O_RDONLY);
+    if (src_fd == -1)
+        return FALSE;
+
+    if (!lr_checksum_fd_cmp(type, src_fd, record->checksum, TRUE,
+                            &matches, &tmp_err)) {
+        g_debug("%s: Cannot checksum %s: %s", __func__, prev, tmp_err->message);
+        g_error_free(tmp_err);
+        close(src_fd);
+        return FALSE;
+    }
+
+    if (!matches) {
+        close(src_fd);
+        return FALSE;
+    }
+
+    close(src_fd);
+
+    // A hardlink would share the inode with the previous destdir and
+    // a later download into the destdir could overwrite it in place.
+    // When updating the same destdir, the file is already in place.
+    if (!lr_yum_copy(prev, path))
+        return FALSE;
+
+    g_debug("%s: Reused %s from %s", __func__, record->type, prev);
+    return TRUE;
+}
+
 #ifdef WITH_ZCHUNK
 gboolean
 prepare_repo_download_zck_target(LrHandle *handle,
@@ -781,6 +1040,15 @@ prepare_repo_download_targets(LrHandle *handle,
             if(!prepare_repo_download_std_target(handle, record, &path,
                                                  &checksums))
                 return FALSE;
+
+            if (lr_yum_reuse_previous_record(handle, record, path)) {
+                // Unchanged record from the previous download
+                g_slist_free_full(checksums,
+                                  (GDestroyNotify) lr_downloadtargetchecksum_free);
+                lr_yum_repo_update(repo, record->type, path);
+                g_free(path);
+                continue;
+            }
         }
 
         if (handle->user_cb || handle->hmfcb) {
@@ -892,6 +1160,112 @@ gchar* join_glist_strings(GList *list, const gchar *separator) {
     return g_string_free(result, FALSE); // FALSE = return the string, not free it
 }
 
+gboolean
+lr_yum_prepare_repo_records(LrMetadataTarget *repo_target,
+                            GSList **download_targets,
+                            GSList **cbdata_list,
+                            GSList **shared_cbdata_list,
+                            GError **prepare_err,
+                            GError **err)
+{
+    GSList *repo_download_targets = NULL;
+
+    assert(!err || *err == NULL);
+
+    prepare_repo_download_targets(repo_target->handle,
+                                  repo_target->repo,
+                                  repo_target->repomd,
+                                  repo_target,
+                                  &repo_download_targets,
+                                  cbdata_list,
+                                  prepare_err);
+
+
+    // Shared data for all targets from a single repository
+    LrSharedCallbackData *shared_cbdata = lr_malloc0(sizeof(*shared_cbdata));
+    shared_cbdata->cb           = repo_target->progresscb;
+    shared_cbdata->mfcb         = repo_target->mirrorfailurecb;
+    shared_cbdata->endcb        = repo_target->endcb;
+    shared_cbdata->singlecbdata = NULL;
+    shared_cbdata->target       = repo_target;
+    *shared_cbdata_list = g_slist_append(*shared_cbdata_list, shared_cbdata);
+
+    for (GSList *elem = repo_download_targets; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *download_target = elem->data;
+        LrCallbackData *lrcbdata = lr_malloc0(sizeof(*lrcbdata));
+        lrcbdata->downloaded     = 0.0;
+        lrcbdata->total          = 0.0;
+        lrcbdata->userdata       = repo_target->cbdata;
+        lrcbdata->sharedcbdata   = shared_cbdata;
+
+        download_target->progresscb      = (repo_target->progresscb) ? lr_multi_progress_func : NULL;
+        download_target->mirrorfailurecb = (repo_target->mirrorfailurecb) ? lr_multi_mf_func : NULL;
+        download_target->endcb           = (repo_target->endcb) ? lr_metadata_target_end_func : NULL;
+        download_target->cbdata          = lrcbdata;
+
+        shared_cbdata->singlecbdata = g_slist_append(shared_cbdata->singlecbdata,
+                                                    lrcbdata);
+    }
+
+    if ((g_slist_length(repo_download_targets) == 0) && (repo_target->endcb)) {
+        LrTransferStatus status;
+        const char *msg;
+        gchar *err_msg = NULL;
+        if (g_list_length(repo_target->err) == 0) {
+            // If there is nothing to download for this repo_target and
+            // there were no erors it is finished.
+            // This can happen when downloading just metalink/repomd.xml
+            status = LR_TRANSFER_SUCCESSFUL;
+            msg = "Successfully downloaded";
+        } else {
+            // If there were errors (we failed to download/verify/parse repomd)
+            // for this repo_target it cannot continue and is finished.
+            status = LR_TRANSFER_ERROR;
+            err_msg = join_glist_strings(repo_target->err, ",");
+            msg = err_msg ? err_msg : "Unknown error.";
+        }
+        int ret = repo_target->endcb(repo_target->cbdata, status, msg);
+        g_free(err_msg);
+        if (ret == LR_CB_ERROR) {
+            g_debug("%s: Downloading was aborted by LR_CB_ERROR from end callback", __func__);
+            g_set_error(err, LR_DOWNLOADER_ERROR,
+                        LRE_CBINTERRUPTED,
+                        "Interrupted by LR_CB_ERROR from end callback");
+            return FALSE;
+        }
+    } else {
+        *download_targets = g_slist_concat(*download_targets, repo_download_targets);
+    }
+
+    return TRUE;
+}
+
+void
+lr_yum_propagate_records_errors(GSList *download_targets)
+{
+    // Propagate download target error to its metadata target
+    for (GSList *elem = download_targets; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *target = elem->data;
+        if (target->err) {
+            LrCallbackData *lrcbdata = target->cbdata;
+            LrSharedCallbackData *shared_cbdata = lrcbdata->sharedcbdata;
+            LrMetadataTarget *metadata_target = shared_cbdata->target;
+            metadata_target->err = g_list_append(metadata_target->err, g_strdup(target->err));
+        }
+    }
+}
+
+void
+lr_yum_free_records_cbdata(GSList *cbdata_list, GSList *shared_cbdata_list)
+{
+    for (GSList *elem = shared_cbdata_list; elem; elem = g_slist_next(elem)) {
+        LrSharedCallbackData *shared_cbdata = elem->data;
+        g_slist_free_full(shared_cbdata->singlecbdata, (GDestroyNotify)lr_free);
+    }
+    g_slist_free_full(shared_cbdata_list, (GDestroyNotify)lr_free);
+    g_slist_free_full(cbdata_list, (GDestroyNotify)cbdata_free);
+}
+
 gboolean
 lr_yum_download_repos(GSList *targets,
                       GError **err)
@@ -904,80 +1278,21 @@ lr_yum_download_repos(GSList *targets,
 
     for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
         LrMetadataTarget *repo_target = elem->data;
-        GSList *repo_download_targets = NULL;
 
         if (!repo_target->handle) {
             continue;
         }
 
-        prepare_repo_download_targets(repo_target->handle,
-                                      repo_target->repo,
-                                      repo_target->repomd,
-                                      repo_target,
-                                      &repo_download_targets,
-                                      &cbdata_list,
-                                      &download_error);
-
-
-        // Shared data for all targets from a single repository
-        LrSharedCallbackData *shared_cbdata = lr_malloc0(sizeof(*shared_cbdata));
-        shared_cbdata->cb           = repo_target->progresscb;
-        shared_cbdata->mfcb         = repo_target->mirrorfailurecb;
-        shared_cbdata->endcb        = repo_target->endcb;
-        shared_cbdata->singlecbdata = NULL;
-        shared_cbdata->target       = repo_target;
-        shared_cbdata_list = g_slist_append(shared_cbdata_list, shared_cbdata);
-
-        for (GSList *elem = repo_download_targets; elem; elem = g_slist_next(elem)) {
-            LrDownloadTarget *download_target = elem->data;
-            LrCallbackData *lrcbdata = lr_malloc0(sizeof(*lrcbdata));
-            lrcbdata->downloaded     = 0.0;
-            lrcbdata->total          = 0.0;
-            lrcbdata->userdata       = repo_target->cbdata;
-            lrcbdata->sharedcbdata   = shared_cbdata;
-
-            download_target->progresscb      = (repo_target->progresscb) ? lr_multi_progress_func : NULL;
-            download_target->mirrorfailurecb = (repo_target->mirrorfailurecb) ? lr_multi_mf_func : NULL;
-            download_target->endcb           = (repo_target->endcb) ? lr_metadata_target_end_func : NULL;
-            download_target->cbdata          = lrcbdata;
-
-            shared_cbdata->singlecbdata = g_slist_append(shared_cbdata->singlecbdata,
-                                                        lrcbdata);
-        }
-
-        if ((g_slist_length(repo_download_targets) == 0) && (repo_target->endcb)) {
-            LrTransferStatus status;
-            const char *msg;
-            if (g_list_length(repo_target->err) == 0) {
-                // If there is nothing to download for this repo_target and
-                // there were no erors it is finished.
-                // This can happen when downloading just metalink/repomd.xml
-                status = LR_TRANSFER_SUCCESSFUL;
-                msg = "Successfully downloaded";
-            } else {
-                // If there were errors (we failed to download/verify/parse repomd)
-                // for this repo_target it cannot continue and is finished.
-                status = LR_TRANSFER_ERROR;
-                const char * err_msg = join_glist_strings(repo_target->err, ",");
-                msg = err_msg ? err_msg : "Unknown error.";
-            }
-            int ret = repo_target->endcb(repo_target->cbdata, status, msg);
-            if (ret == LR_CB_ERROR) {
-                g_debug("%s: Downloading was aborted by LR_CB_ERROR from end callback", __func__);
-                g_set_error(err, LR_DOWNLOADER_ERROR,
-                            LRE_CBINTERRUPTED,
-                            "Interrupted by LR_CB_ERROR from end callback");
-                for (GSList *elem = shared_cbdata_list; elem; elem = g_slist_next(elem)) {
-                    LrSharedCallbackData *shared_cbdata = elem->data;
-                    g_slist_free_full(shared_cbdata->singlecbdata, (GDestroyNotify)lr_free);
-                }
-                g_slist_free_full(shared_cbdata_list, (GDestroyNotify)lr_free);
-                g_slist_free_full(cbdata_list, (GDestroyNotify)cbdata_free);
-                g_slist_free_full(download_targets, (GDestroyNotify)lr_downloadtarget_free);
-                return FALSE;
-            }
-        } else {
-            download_targets = g_slist_concat(download_targets, repo_download_targets);
+        if (!lr_yum_prepare_repo_records(repo_target,
+                                         &download_targets,
+                                         &cbdata_list,
+                                         &shared_cbdata_list,
+                                         &download_error,
+                                         err)) {
+            lr_yum_free_records_cbdata(cbdata_list, shared_cbdata_list);
+            g_slist_free_full(download_targets, (GDestroyNotify)lr_downloadtarget_free);
+            g_clear_error(&download_error);
+            return FALSE;
         }
     }
 
@@ -985,12 +1300,7 @@ lr_yum_download_repos(GSList *targets,
         if (download_error) {
             g_propagate_error(err, download_error);
         }
-        for (GSList *elem = shared_cbdata_list; elem; elem = g_slist_next(elem)) {
-            LrSharedCallbackData *shared_cbdata = elem->data;
-            g_slist_free_full(shared_cbdata->singlecbdata, (GDestroyNotify)lr_free);
-        }
-        g_slist_free_full(shared_cbdata_list, (GDestroyNotify)lr_free);
-        g_slist_free_full(cbdata_list, (GDestroyNotify)cbdata_free);
+        lr_yum_free_records_cbdata(cbdata_list, shared_cbdata_list);
         return TRUE;
     }
 
@@ -1002,59 +1312,68 @@ lr_yum_download_repos(GSList *targets,
         g_propagate_error(err, download_error);
     }
 
-    // Propagate download target error to its metadata target
-    for (GSList *elem = download_targets; elem; elem = g_slist_next(elem)) {
-        LrDownloadTarget *target = elem->data;
-        if (target->err) {
-            LrCallbackData *lrcbdata = target->cbdata;
-            LrSharedCallbackData *shared_cbdata = lrcbdata->sharedcbdata;
-            LrMetadataTarget *metadata_target = shared_cbdata->target;
-            metadata_target->err = g_list_append(metadata_target->err, g_strdup(target->err));
-        }
-    }
+    lr_yum_propagate_records_errors(download_targets);
 
-    for (GSList *elem = shared_cbdata_list; elem; elem = g_slist_next(elem)) {
-        LrSharedCallbackData *shared_cbdata = elem->data;
-        g_slist_free_full(shared_cbdata->singlecbdata, (GDestroyNotify)lr_free);
-    }
-    g_slist_free_full(shared_cbdata_list, (GDestroyNotify)lr_free);
-    g_slist_free_full(cbdata_list, (GDestroyNotify)cbdata_free);
+    lr_yum_free_records_cbdata(cbdata_list, shared_cbdata_list);
     g_slist_free_full(download_targets, (GDestroyNotify)lr_downloadtarget_free);
 
     return ret;
 }
 
-gboolean
-lr_yum_download_repo(LrHandle *handle,
-                     LrYumRepo *repo,
-                     LrYumRepoMd *repomd,
-                     GError **err)
+/** Download repomd records. If gpg_job is not NULL, the records are
+ * downloaded speculatively while the repomd.xml signature is being
+ * verified. When the verification fails, the download is aborted,
+ * the downloaded records are removed and the GPG error is returned.
+ */
+static gboolean
+lr_yum_download_repo_records(LrHandle *handle,
+                             LrYumRepo *repo,
+                             LrYumRepoMd *repomd,
+                             LrGpgCheckJob *gpg_job,
+                             GError **err)
 {
     gboolean ret = TRUE;
     GSList *targets = NULL;
     GSList *cbdata_list = NULL;
     GError *tmp_err = NULL;
+    GError *gpg_err = NULL;
 
     assert(!err || *err == NULL);
 
-    ret = prepare_repo_download_targets(handle, repo, repomd, NULL, &targets, &cbdata_list, err);
+    ret = prepare_repo_download_targets(handle, repo, repomd, NULL, &targets, &cbdata_list, &tmp_err);
+
     if (!ret) {
-        assert(!err || *err != NULL);
-        return ret;
+        // The list of targets is freed by prepare_repo_download_targets()
+        targets = NULL;
+    } else if (targets) {
+        ret = lr_download_single_cb_pipelined(targets,
+                                              FALSE,
+                                              (cbdata_list) ? progresscb : NULL,
+                                              (cbdata_list) ? hmfcb : NULL,
+                                              (gpg_job) ? lr_gpg_check_job_donecb : NULL,
+                                              gpg_job,
+                                              &tmp_err);
+        assert((ret && !tmp_err) || (!ret && tmp_err));
     }
-    assert(!err || *err == NULL);
 
-    if (!targets)
-        return TRUE;
-
-    ret = lr_download_single_cb(targets,
-                                FALSE,
-                                (cbdata_list) ? progresscb : NULL,
-                                (cbdata_list) ? hmfcb : NULL,
-                                &tmp_err);
-
-    assert((ret && !tmp_err) || (!ret && tmp_err));
-    ret = error_handling(targets, err, tmp_err);
+    if (gpg_job && !lr_gpg_check_job_finish(gpg_job, &gpg_err)) {
+        // The signature is not valid, the error of the verification
+        // takes precedence and nothing from the repo could be kept
+        for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+            LrDownloadTarget *target = elem->data;
+            if (target->fn && unlink(target->fn) != 0 && errno != ENOENT)
+                g_warning("Error while removing %s: %s",
+                          target->fn, g_strerror(errno));
+        }
+        g_clear_error(&tmp_err);
+        g_propagate_error(err, gpg_err);
+        ret = FALSE;
+    } else if (!targets) {
+        if (tmp_err)
+            g_propagate_error(err, tmp_err);
+    } else {
+        ret = error_handling(targets, err, tmp_err);
+    }
 
     g_slist_free_full(cbdata_list, (GDestroyNotify)cbdata_free);
     g_slist_free_full(targets, (GDestroyNotify)lr_downloadtarget_free);
@@ -1062,6 +1381,15 @@ lr_yum_download_repo(LrHandle *handle,
     return ret;
 }
 
+gboolean
+lr_yum_download_repo(LrHandle *handle,
+                     LrYumRepo *repo,
+                     LrYumRepoMd *repomd,
+                     GError **err)
+{
+    return lr_yum_download_repo_records(handle, repo, repomd, NULL, err);
+}
+
 static gboolean
 lr_yum_check_checksum_of_md_record(LrYumRepoMdRecord *rec,
                                    const char *path,
@@ -1369,6 +1697,57 @@ lr_yum_use_local(LrHandle *handle, LrResult *result, GError **err)
     return TRUE;
 }
 
+/** Remove the copy of repomd.xml kept for conditional requests
+ * (LRO_CONDITIONALGET) after the downloaded content was rejected,
+ * so a 304 response cannot hand it out again.
+ */
+static void
+lr_yum_drop_conditional_cache(const char *conditional_cache)
+{
+    if (!conditional_cache)
+        return;
+    g_debug("%s: Removing %s", __func__, conditional_cache);
+    if (unlink(conditional_cache) != 0 && errno != ENOENT)
+        g_warning("Cannot remove %s: %s", conditional_cache, g_strerror(errno));
+}
+
+/** Verify the GPG signature of repomd.xml reused after 304 Not Modified.
+ * Its copy in the cachedir is removed if the verification fails.
+ */
+static gboolean
+lr_yum_check_unchanged_repomd(LrHandle *handle,
+                              LrYumRepo *repo,
+                              const char *path,
+                              const char *conditional_cache,
+                              GError **err)
+{
+    char *signature;
+    GError *tmp_err = NULL;
+
+    if (!(handle->checks & LR_CHECK_GPG))
+        return TRUE;
+
+    if (!lr_download_repomd_xml_asc(handle, repo, &signature, err)) {
+        lr_yum_drop_conditional_cache(conditional_cache);
+        return FALSE;
+    }
+
+    gboolean ret = lr_gpg_check_signature(signature, path,
+                                          handle->gnupghomedir, &tmp_err);
+    g_free(signature);
+    if (!ret) {
+        g_debug("%s: GPG signature verification failed: %s",
+                __func__, tmp_err->message);
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "repomd.xml GPG signature verification error: ");
+        lr_yum_drop_conditional_cache(conditional_cache);
+        return FALSE;
+    }
+
+    g_debug("%s: GPG signature successfully verified", __func__);
+    return TRUE;
+}
+
 static gboolean
 lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
 {
@@ -1376,6 +1755,8 @@ lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
     int fd;
     LrYumRepo *repo;
     LrYumRepoMd *repomd;
+    LrGpgCheckJob *gpg_job = NULL;
+    _cleanup_free_ char *conditional_cache = NULL;
     GError *tmp_err = NULL;
 
     assert(!err || *err == NULL);
@@ -1401,17 +1782,48 @@ lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
             return FALSE;
 
         /* Download repomd.xml */
-        ret = lr_yum_download_repomd(handle, handle->metalink, fd, err);
+        ret = lr_yum_download_repomd(handle, handle->metalink, fd,
+                                     &result->repomd_unchanged,
+                                     &conditional_cache, err);
         if (!ret) {
             close(fd);
             lr_free(path);
             return FALSE;
         }
 
-        if (!lr_check_repomd_xml_asc_availability(handle, repo, fd, path, err)) {
+        if (result->repomd_unchanged) {
+            // Server says the repomd.xml is the same as the one from
+            // the previous download, caller reuses the previous repository
+            g_debug("%s: repomd.xml not modified", __func__);
             close(fd);
-            lr_free(path);
-            return FALSE;
+            if (!lr_yum_check_unchanged_repomd(handle, repo, path,
+                                               conditional_cache, err)) {
+                lr_free(path);
+                return FALSE;
+            }
+            result->destdir = g_strdup(handle->destdir);
+            repo->destdir = g_strdup(handle->destdir);
+            repo->repomd = path;
+            if (handle->used_mirror)
+                repo->url = g_strdup(handle->used_mirror);
+            else
+                repo->url = g_strdup(handle->urls[0]);
+            return TRUE;
+        }
+
+        if (handle->checks & LR_CHECK_GPG) {
+            char *signature;
+
+            if (!lr_download_repomd_xml_asc(handle, repo, &signature, err)) {
+                close(fd);
+                lr_free(path);
+                return FALSE;
+            }
+
+            // Verify the signature in the background, the records
+            // are downloaded meanwhile and discarded if it fails
+            gpg_job = lr_gpg_check_job_start(signature, path,
+                                             handle->gnupghomedir);
         }
 
         lseek(fd, 0, SEEK_SET);
@@ -1422,10 +1834,16 @@ lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
                                        "Repomd xml parser", &tmp_err);
         close(fd);
         if (!ret) {
+            lr_free(path);
+            lr_yum_drop_conditional_cache(conditional_cache);
+            if (gpg_job && !lr_gpg_check_job_finish(gpg_job, err)) {
+                // Bad signature is reported in favour of the parser error
+                g_clear_error(&tmp_err);
+                return FALSE;
+            }
             g_debug("%s: Parsing unsuccessful: %s", __func__, tmp_err->message);
             g_propagate_prefixed_error(err, tmp_err,
                                        "repomd.xml parser error: ");
-            lr_free(path);
             return FALSE;
         }
 
@@ -1442,10 +1860,16 @@ lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
     }
 
     /* Download rest of metadata files */
-    ret = lr_yum_download_repo(handle, repo, repomd, &tmp_err);
+    ret = lr_yum_download_repo_records(handle, repo, repomd, gpg_job, &tmp_err);
     assert((ret && !tmp_err) || (!ret && tmp_err));
 
     if (!ret) {
+        if (tmp_err->domain == LR_GPG_ERROR) {
+            // Failed verification of repomd.xml, not a download error
+            lr_yum_drop_conditional_cache(conditional_cache);
+            g_propagate_error(err, tmp_err);
+            return FALSE;
+        }
         g_debug("%s: Repository download error: %s", __func__, tmp_err->message);
         g_propagate_prefixed_error(err, tmp_err, "Yum repo downloading error: ");
         return FALSE;
@@ -26,6 +26,7 @@
 #include "rcodes.h"
 #include "result.h"
 #include "handle.h"
+#include "metadata_downloader.h"
 
 G_BEGIN_DECLS
 
@@ -33,7 +34,71 @@ gboolean
 lr_yum_perform(LrHandle *handle, LrResult *result, GError **err);
 gboolean
 lr_yum_download_url(LrHandle *lr_handle, const char *url, int fd,
-                    gboolean no_cache, gboolean is_zchunk, GError **err);
+                    gboolean no_cache, gboolean is_zchunk,
+                    gboolean conditional, GError **err);
+
+/** Prepare download targets of repomd records of the metadata target
+ * (its repomd must be already parsed). If there is nothing to download,
+ * the endcb of the metadata target is called right away.
+ * @param repo_target           Metadata target
+ * @param download_targets      New LrDownloadTargets are appended here
+ * @param cbdata_list           List of CbData to be freed
+ *                              by ::lr_yum_free_records_cbdata
+ * @param shared_cbdata_list    List of LrSharedCallbackData to be freed
+ *                              by ::lr_yum_free_records_cbdata
+ * @param prepare_err           Set when preparation of targets failed
+ * @param err                   Set when the endcb aborted the download
+ * @return                      FALSE if the download should be aborted
+ */
+gboolean
+lr_yum_prepare_repo_records(LrMetadataTarget *repo_target,
+                            GSList **download_targets,
+                            GSList **cbdata_list,
+                            GSList **shared_cbdata_list,
+                            GError **prepare_err,
+                            GError **err);
+
+/** Append errors of failed record targets prepared by
+ * ::lr_yum_prepare_repo_records to their metadata targets.
+ */
+void
+lr_yum_propagate_records_errors(GSList *download_targets);
+
+/** Copy the whole content of src_fd to dst_fd. The file is reflinked
+ * (FICLONE) or copied in kernel if possible (copy_file_range may reflink
+ * or copy on the server side). If the kernel
+ * copy fails, even in the middle, dst_fd is truncated and the content is
+ * copied again by read/write.
+ * @param src_fd    Source file descriptor
+ * @param dst_fd    Destination file descriptor (opened for writing)
+ * @return          TRUE on success
+ */
+gboolean
+lr_yum_copy_file_content(int src_fd, int dst_fd);
+
+/** Put a copy of the src file to dst. A hardlink is used if possible,
+ * otherwise the content is copied (in kernel if possible, which may
+ * reflink). An existing dst is replaced.
+ * @param src       Path of the source file
+ * @param dst       Destination path
+ * @return          TRUE on success
+ */
+gboolean
+lr_yum_link_or_copy(const char *src, const char *dst);
+
+/** Put a copy of the src file to dst, never a hardlink. The content is
+ * reflinked or copied in kernel if possible. An existing dst is unlinked
+ * first, so a file hardlinked to it is never modified.
+ * @param src       Path of the source file
+ * @param dst       Destination path
+ * @return          TRUE on success
+ */
+gboolean
+lr_yum_copy(const char *src, const char *dst);
+
+/** Free callback data created by ::lr_yum_prepare_repo_records */
+void
+lr_yum_free_records_cbdata(GSList *cbdata_list, GSList *shared_cbdata_list);
 
 G_END_DECLS
 
@@ -3,6 +3,7 @@ HARMCHECKSUM = "yum/harm_checksum/%s/"
 MISSINGFILE = "yum/not_found/%s/"
 BADURL = "yum/badurl/"
 BADGPG = "yum/badgpg/"
+ETAG = "yum/etag/"
 AUTHBASIC = "yum/auth_basic/"
 PARTIAL = "yum/partial/"
 RANGE_ONLY = "yum/range_only/"
@@ -1,4 +1,5 @@
 import base64
+import hashlib
 from http.server import BaseHTTPRequestHandler, HTTPServer
 import os
 import sys
@@ -171,6 +172,32 @@ def yum_mock_handler(port):
             self.end_headers()
             self.wfile.write(remaining)
 
+        def serve_etag(self):
+            """Serve file with an ETag (md5 of the content). If the ETag
+            matches the If-None-Match header, 304 is returned.
+            URL format: /yum/etag/<path>"""
+            path = self.parse_path('/yum/etag/')
+            if "static/" not in path:
+                return self.return_bad_request()
+            path = path[path.find("static/"):]
+            try:
+                with open(file_path(path), 'rb') as f:
+                    data = f.read()
+            except IOError:
+                return self.return_not_found()
+            etag = '"%s"' % hashlib.md5(data).hexdigest()
+            if self.headers.get('If-None-Match') == etag:
+                self.send_response(304)
+                self.send_header('ETag', etag)
+                self.end_headers()
+                return
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/octet-stream')
+            self.send_header('Content-Length', str(len(data)))
+            self.send_header('ETag', etag)
+            self.end_headers()
+            self.wfile.write(data)
+
         def serve_auth_basic(self):
             """Page secured with basic HTTP auth; User: admin Password: secret"""
             if not self.check_auth():
@@ -199,6 +226,8 @@ def yum_mock_handler(port):
                 return self.serve_partial()
             if self.path.startswith('/yum/range_only/'):
                 return self.serve_range_only()
+            if self.path.startswith('/yum/etag/'):
+                return self.serve_etag()
             if self.path.startswith('/yum/auth_basic/'):
                 return self.serve_auth_basic()
             return self.serve_static()
@@ -146,6 +146,108 @@ class TestCaseHandle(unittest.TestCase):
         h.setopt(librepo.LRO_LOWSPEEDLIMIT, None)
         self.assertEqual(h.getinfo(librepo.LRI_LOWSPEEDLIMIT), 1000)
 
+        self.assertEqual(h.getinfo(librepo.LRI_ZCKHEADERPREFETCH), 0)
+        h.setopt(librepo.LRO_ZCKHEADERPREFETCH, 65536)
+        self.assertEqual(h.getinfo(librepo.LRI_ZCKHEADERPREFETCH), 65536)
+        h.setopt(librepo.LRO_ZCKHEADERPREFETCH, None)
+        self.assertEqual(h.getinfo(librepo.LRI_ZCKHEADERPREFETCH), 0)
+
+        self.assertFalse(h.getinfo(librepo.LRI_CONDITIONALGET))
+        h.setopt(librepo.LRO_CONDITIONALGET, True)
+        self.assertTrue(h.getinfo(librepo.LRI_CONDITIONALGET))
+
+        self.assertEqual(h.getinfo(librepo.LRI_PREVIOUSDESTDIR), None)
+        h.setopt(librepo.LRO_PREVIOUSDESTDIR, "/tmp/previous")
+        self.assertEqual(h.getinfo(librepo.LRI_PREVIOUSDESTDIR), "/tmp/previous")
+
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORMAXPROBES), 64)
+        h.setopt(librepo.LRO_FASTESTMIRRORMAXPROBES, 8)
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORMAXPROBES), 8)
+        h.setopt(librepo.LRO_FASTESTMIRRORMAXPROBES, None)
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORMAXPROBES), 64)
+
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORPROBESIZE), 0)
+        h.setopt(librepo.LRO_FASTESTMIRRORPROBESIZE, 65536)
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORPROBESIZE), 65536)
+        h.setopt(librepo.LRO_FASTESTMIRRORPROBESIZE, None)
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORPROBESIZE), 0)
+
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORPROBEPATH), "repodata/repomd.xml")
+        h.setopt(librepo.LRO_FASTESTMIRRORPROBEPATH, "repodata/primary.xml.gz")
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORPROBEPATH), "repodata/primary.xml.gz")
+        h.setopt(librepo.LRO_FASTESTMIRRORPROBEPATH, None)
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORPROBEPATH), "repodata/repomd.xml")
+
+        self.assertFalse(h.getinfo(librepo.LRI_FASTESTMIRRORKEEPCONNS))
+        h.setopt(librepo.LRO_FASTESTMIRRORKEEPCONNS, True)
+        self.assertTrue(h.getinfo(librepo.LRI_FASTESTMIRRORKEEPCONNS))
+
+        self.assertFalse(h.getinfo(librepo.LRI_FASTESTMIRRORBINARYCACHE))
+        h.setopt(librepo.LRO_FASTESTMIRRORBINARYCACHE, True)
+        self.assertTrue(h.getinfo(librepo.LRI_FASTESTMIRRORBINARYCACHE))
+
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORBACKGROUND), 0)
+        h.setopt(librepo.LRO_FASTESTMIRRORBACKGROUND, 4)
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORBACKGROUND), 4)
+        h.setopt(librepo.LRO_FASTESTMIRRORBACKGROUND, None)
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORBACKGROUND), 0)
+
+        self.assertFalse(h.getinfo(librepo.LRI_MIRRORSTATS))
+        h.setopt(librepo.LRO_MIRRORSTATS, True)
+        self.assertTrue(h.getinfo(librepo.LRI_MIRRORSTATS))
+
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORSTATSFILE), None)
+        h.setopt(librepo.LRO_MIRRORSTATSFILE, "/tmp/mirrorstats")
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORSTATSFILE), "/tmp/mirrorstats")
+        h.setopt(librepo.LRO_MIRRORSTATSFILE, None)
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORSTATSFILE), None)
+
+        self.assertEqual(h.getinfo(librepo.LRI_MAXDOWNLOADSPERHOST), 0)
+        h.setopt(librepo.LRO_MAXDOWNLOADSPERHOST, 2)
+        self.assertEqual(h.getinfo(librepo.LRI_MAXDOWNLOADSPERHOST), 2)
+        h.setopt(librepo.LRO_MAXDOWNLOADSPERHOST, None)
+        self.assertEqual(h.getinfo(librepo.LRI_MAXDOWNLOADSPERHOST), 0)
+
+        self.assertFalse(h.getinfo(librepo.LRI_PRERESOLVE))
+        h.setopt(librepo.LRO_PRERESOLVE, True)
+        self.assertTrue(h.getinfo(librepo.LRI_PRERESOLVE))
+
+        self.assertEqual(h.getinfo(librepo.LRI_PRERESOLVECACHE), None)
+        h.setopt(librepo.LRO_PRERESOLVECACHE, "/tmp/resolvecache")
+        self.assertEqual(h.getinfo(librepo.LRI_PRERESOLVECACHE), "/tmp/resolvecache")
+        h.setopt(librepo.LRO_PRERESOLVECACHE, None)
+        self.assertEqual(h.getinfo(librepo.LRI_PRERESOLVECACHE), None)
+
+        self.assertEqual(h.getinfo(librepo.LRI_PRERESOLVECACHETTL), 300)
+        h.setopt(librepo.LRO_PRERESOLVECACHETTL, 60)
+        self.assertEqual(h.getinfo(librepo.LRI_PRERESOLVECACHETTL), 60)
+        h.setopt(librepo.LRO_PRERESOLVECACHETTL, None)
+        self.assertEqual(h.getinfo(librepo.LRI_PRERESOLVECACHETTL), 300)
+
+        self.assertFalse(h.getinfo(librepo.LRI_RANKMIRRORS))
+        h.setopt(librepo.LRO_RANKMIRRORS, True)
+        self.assertTrue(h.getinfo(librepo.LRI_RANKMIRRORS))
+
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORLOCATIONS), None)
+        h.setopt(librepo.LRO_MIRRORLOCATIONS, ["CZ", "SK"])
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORLOCATIONS), ["CZ", "SK"])
+        h.setopt(librepo.LRO_MIRRORLOCATIONS, None)
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORLOCATIONS), None)
+
+        self.assertFalse(h.getinfo(librepo.LRI_MIRRORHASHING))
+        h.setopt(librepo.LRO_MIRRORHASHING, True)
+        self.assertTrue(h.getinfo(librepo.LRI_MIRRORHASHING))
+
+        self.assertFalse(h.getinfo(librepo.LRI_LOCKTARGETS))
+        h.setopt(librepo.LRO_LOCKTARGETS, True)
+        self.assertTrue(h.getinfo(librepo.LRI_LOCKTARGETS))
+
+        self.assertEqual(h.getinfo(librepo.LRI_SCHEDULEPOLICY), librepo.SCHEDULE_FIFO)
+        h.setopt(librepo.LRO_SCHEDULEPOLICY, librepo.SCHEDULE_SHORTESTFIRST)
+        self.assertEqual(h.getinfo(librepo.LRI_SCHEDULEPOLICY), librepo.SCHEDULE_SHORTESTFIRST)
+        h.setopt(librepo.LRO_SCHEDULEPOLICY, None)
+        self.assertEqual(h.getinfo(librepo.LRI_SCHEDULEPOLICY), librepo.SCHEDULE_FIFO)
+
         self.assertFalse(h.getinfo(librepo.LRI_HMFCB))
         h.setopt(librepo.LRO_HMFCB, foo_hmfcb)
         self.assertEqual(h.getinfo(librepo.LRI_HMFCB), foo_hmfcb)
@@ -535,6 +637,8 @@ class TestCaseHandle(unittest.TestCase):
         h.progressdata = None
         h.setopt(librepo.LRO_MAXSPEED, None)        # None sets default value
         h.maxspeed = None
+        h.setopt(librepo.LRO_TOTALMAXSPEED, None)   # None sets default value
+        h.totalmaxspeed = None
         h.setopt(librepo.LRO_CONNECTTIMEOUT, None)  # None sets default value
         h.connecttimeout = None
         h.setopt(librepo.LRO_IGNOREMISSING, None)
@@ -7,6 +7,8 @@ import unittest
 import tempfile
 import xattr
 import errno
+import fcntl
+import threading
 
 import tests.servermock.yum_mock.config as config
 
@@ -479,6 +481,192 @@ class TestCaseYumPackagesDownloading(TestCaseWithServer):
         self.assertEqual(pkg.err, "Already downloaded")
         self.assertTrue(os.path.isfile(pkg.local_path))
 
+    def test_download_packages_mixed_with_already_downloaded(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.urls = [url]
+        h.repotype = librepo.LR_YUMREPO
+
+        dest_ok = os.path.join(self.tmpdir, "ok")
+        dest_bad = os.path.join(self.tmpdir, "bad")
+        os.mkdir(dest_ok)
+        os.mkdir(dest_bad)
+
+        pkgs = []
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=dest_ok))
+        librepo.download_packages(pkgs)
+        self.assertTrue(pkgs[0].err is None)
+
+        # A damaged copy of the same size can be neither kept nor resumed
+        with open(pkgs[0].local_path, "rb") as f:
+            size = len(f.read())
+        with open(os.path.join(dest_bad, config.PACKAGE_01_01), "wb") as f:
+            f.write(b"\0" * size)
+
+        statuses = {}
+        def endcb(cbdata, status, msg):
+            statuses[cbdata] = status
+
+        pkgs = []
+        for dest in (dest_ok, dest_bad):
+            pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                              handle=h,
+                                              dest=dest,
+                                              resume=True,
+                                              checksum_type=librepo.SHA256,
+                                              checksum=config.PACKAGE_01_01_SHA256,
+                                              expectedsize=size,
+                                              cbdata=dest,
+                                              endcb=endcb))
+
+        librepo.download_packages(pkgs, failfast=True)
+
+        self.assertEqual(pkgs[0].err, "Already downloaded")
+        self.assertEqual(statuses[dest_ok], librepo.TRANSFER_ALREADYEXISTS)
+        self.assertTrue(pkgs[1].err is None)
+        self.assertEqual(statuses[dest_bad], librepo.TRANSFER_SUCCESSFUL)
+        with open(pkgs[1].local_path, "rb") as f:
+            self.assertEqual(hashlib.sha256(f.read()).hexdigest(),
+                             config.PACKAGE_01_01_SHA256)
+
+    def test_download_packages_same_content_from_different_repos(self):
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+
+        pkgs = []
+        for name in ("base", "updates"):
+            h = librepo.Handle()
+            h.urls = [url]
+            h.repotype = librepo.LR_YUMREPO
+            dest = os.path.join(self.tmpdir, name)
+            os.mkdir(dest)
+            pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                              handle=h,
+                                              dest=dest,
+                                              checksum_type=librepo.SHA256,
+                                              checksum=config.PACKAGE_01_01_SHA256))
+
+        librepo.download_packages(pkgs)
+
+        for pkg in pkgs:
+            self.assertTrue(pkg.err is None)
+            self.assertTrue(pkg.usedmirror.startswith(self.MOCKURL))
+            with open(pkg.local_path, "rb") as f:
+                self.assertEqual(hashlib.sha256(f.read()).hexdigest(),
+                                 config.PACKAGE_01_01_SHA256)
+
+        # The content was downloaded once, the other path is its hardlink
+        self.assertEqual(os.stat(pkgs[0].local_path).st_ino,
+                         os.stat(pkgs[1].local_path).st_ino)
+
+    def test_download_packages_with_locktargets(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.urls = [url]
+        h.repotype = librepo.LR_YUMREPO
+
+        pkgs = []
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=self.tmpdir))
+        librepo.download_packages(pkgs)
+        with open(pkgs[0].local_path, "rb") as f:
+            content = f.read()
+
+        # Another "process" holds the lock and finishes the file later
+        h.locktargets = True
+        f = open(pkgs[0].local_path, "r+b")
+        fcntl.flock(f, fcntl.LOCK_EX)
+        f.truncate(0)
+
+        def finish():
+            f.write(content)
+            f.flush()
+            fcntl.flock(f, fcntl.LOCK_UN)
+            f.close()
+        timer = threading.Timer(1.0, finish)
+        timer.start()
+
+        statuses = []
+        def endcb(cbdata, status, msg):
+            statuses.append(status)
+
+        pkgs = []
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=self.tmpdir,
+                                          checksum_type=librepo.SHA256,
+                                          checksum=config.PACKAGE_01_01_SHA256,
+                                          endcb=endcb))
+        librepo.download_packages(pkgs)
+        timer.join()
+
+        pkg = pkgs[0]
+        self.assertTrue(pkg.err is None)
+        self.assertEqual(statuses, [librepo.TRANSFER_SUCCESSFUL])
+        with open(pkg.local_path, "rb") as f:
+            self.assertEqual(f.read(), content)
+
+    def test_download_packages_with_priority_schedule(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.urls = [url]
+        h.repotype = librepo.LR_YUMREPO
+        h.maxparalleldownloads = 1
+        h.schedulepolicy = librepo.SCHEDULE_PRIORITY
+
+        order = []
+        def endcb(cbdata, status, msg):
+            order.append(cbdata)
+
+        pkgs = []
+        for priority in (0, 5, 1):
+            dest = os.path.join(self.tmpdir, str(priority))
+            os.mkdir(dest)
+            pkg = librepo.PackageTarget(config.PACKAGE_01_01,
+                                        handle=h,
+                                        dest=dest,
+                                        cbdata=priority,
+                                        endcb=endcb)
+            pkg.priority = priority
+            pkgs.append(pkg)
+
+        librepo.download_packages(pkgs)
+
+        for pkg in pkgs:
+            self.assertTrue(pkg.err is None)
+        self.assertEqual(order, [5, 1, 0])
+
+    def test_download_packages_with_qos_classes(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.urls = [url]
+        h.repotype = librepo.LR_YUMREPO
+        h.totalmaxspeed = 1024 * 1024
+
+        pkgs = []
+        for qosclass in (librepo.QOS_BACKGROUND, librepo.QOS_NORMAL,
+                         librepo.QOS_INTERACTIVE):
+            dest = os.path.join(self.tmpdir, str(qosclass))
+            os.mkdir(dest)
+            pkg = librepo.PackageTarget(config.PACKAGE_01_01,
+                                        handle=h,
+                                        dest=dest)
+            pkg.qosclass = qosclass
+            self.assertEqual(pkg.qosclass, qosclass)
+            pkgs.append(pkg)
+
+        librepo.download_packages(pkgs)
+
+        for pkg in pkgs:
+            self.assertTrue(pkg.err is None)
+            self.assertTrue(os.path.isfile(pkg.local_path))
+
     def test_download_packages_with_callback(self):
         h = librepo.Handle()
 
@@ -555,6 +743,59 @@ class TestCaseYumPackagesDownloading(TestCaseWithServer):
         self.assertTrue(pkg.err is None)
         self.assertTrue(os.path.isfile(pkg.local_path))
 
+    def test_download_packages_with_maxdownloadsperhost(self):
+        """Both repos are served by the same host, the limit is shared
+        by the handles"""
+        h1 = librepo.Handle()
+        h2 = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h1.urls = [url]
+        h1.repotype = librepo.LR_YUMREPO
+        h1.maxdownloadsperhost = 1
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_03_PATH)
+        h2.urls = [url]
+        h2.repotype = librepo.LR_YUMREPO
+        h2.maxdownloadsperhost = 1
+
+        pkgs = []
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h1,
+                                          dest=self.tmpdir))
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_03_01,
+                                          handle=h2,
+                                          dest=self.tmpdir))
+
+        librepo.download_packages(pkgs)
+
+        for pkg in pkgs:
+            self.assertTrue(pkg.err is None)
+            self.assertTrue(os.path.isfile(pkg.local_path))
+
+    def test_download_packages_with_preresolve(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL.replace("127.0.0.1", "localhost"),
+                        config.REPO_YUM_01_PATH)
+        h.urls = [url]
+        h.repotype = librepo.LR_YUMREPO
+        h.ipresolve = librepo.IPRESOLVE_V4
+        h.preresolve = True
+        h.preresolvecache = os.path.join(self.tmpdir, "resolvecache")
+
+        pkgs = []
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=self.tmpdir))
+
+        librepo.download_packages(pkgs)
+
+        pkg = pkgs[0]
+        self.assertTrue(pkg.err is None)
+        self.assertTrue(os.path.isfile(pkg.local_path))
+        self.assertTrue(os.path.isfile(h.preresolvecache))
+
     def test_download_packages_with_expectedsize(self):
         h = librepo.Handle()
 
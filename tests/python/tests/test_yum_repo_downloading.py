@@ -755,6 +755,154 @@ class TestCaseYumRepoDownloading(TestCaseWithServer):
         self.assertTrue(yum_repomd)
         self.assertTrue("signature" not in yum_repo or yum_repo["signature"])
 
+    def test_download_repo_with_gpg_check_bad_signature_discards_records(self):
+        h = librepo.Handle()
+        r = librepo.Result()
+
+        url = "%s%s%s" % (self.MOCKURL, config.BADGPG, config.REPO_YUM_01_PATH)
+        h.urls = [url]
+        h.repotype = librepo.LR_YUMREPO
+        h.destdir = self.tmpdir
+        h.gpgcheck = True
+        self.assertRaises(librepo.LibrepoException, h.perform, (r))
+
+        # Records downloaded during the signature verification
+        # must not be kept
+        files = os.listdir(os.path.join(self.tmpdir, "repodata"))
+        self.assertEqual([f for f in files if not f.startswith("repomd.xml")], [])
+
+    def test_download_repo_01_conditionalget(self):
+        url = "%s%s%s" % (self.MOCKURL, config.ETAG, config.REPO_YUM_01_PATH)
+        cachedir = os.path.join(self.tmpdir, "cache")
+
+        def perform(destdir):
+            h = librepo.Handle()
+            r = librepo.Result()
+            h.urls = [url]
+            h.repotype = librepo.LR_YUMREPO
+            h.destdir = destdir
+            h.cachedir = cachedir
+            h.conditionalget = True
+            h.perform(r)
+            return r
+
+        destdir1 = os.path.join(self.tmpdir, "first")
+        os.mkdir(destdir1)
+        r = perform(destdir1)
+        self.assertFalse(r.getinfo(librepo.LRR_RPMMD_REPOMD_UNCHANGED))
+        self.assertTrue(r.getinfo(librepo.LRR_YUM_REPOMD))
+
+        # Server replies 304, the repomd.xml is taken from the cachedir
+        destdir2 = os.path.join(self.tmpdir, "second")
+        os.mkdir(destdir2)
+        r = perform(destdir2)
+        self.assertTrue(r.getinfo(librepo.LRR_RPMMD_REPOMD_UNCHANGED))
+        yum_repo = r.getinfo(librepo.LRR_YUM_REPO)
+        with open(os.path.join(destdir1, "repodata/repomd.xml"), "rb") as f1:
+            with open(yum_repo["repomd"], "rb") as f2:
+                self.assertEqual(f1.read(), f2.read())
+
+    def test_download_repo_01_reuse_previous_destdir(self):
+        destdir1 = os.path.join(self.tmpdir, "first")
+        destdir2 = os.path.join(self.tmpdir, "second")
+        os.mkdir(destdir1)
+        os.mkdir(destdir2)
+
+        h = librepo.Handle()
+        r = librepo.Result()
+        h.urls = ["%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)]
+        h.repotype = librepo.LR_YUMREPO
+        h.destdir = destdir1
+        h.perform(r)
+
+        # Records are not available on the server anymore, so they
+        # have to be taken from the previous destdir
+        h = librepo.Handle()
+        r = librepo.Result()
+        h.urls = ["%s%s%s" % (self.MOCKURL, config.MISSINGFILE % ".xml.gz",
+                              config.REPO_YUM_01_PATH)]
+        h.repotype = librepo.LR_YUMREPO
+        h.destdir = destdir2
+        h.previousdestdir = destdir1
+        h.perform(r)
+
+        yum_repo = r.getinfo(librepo.LRR_YUM_REPO)
+        self.assertTrue(yum_repo["primary"].startswith(destdir2))
+        self.assertTrue(os.path.isfile(yum_repo["primary"]))
+        self.assertTrue(os.path.isfile(yum_repo["filelists"]))
+
+        # The reused file is not a hardlink to the previous destdir,
+        # rewriting it leaves the previous one intact
+        prev_primary = os.path.join(destdir1,
+                                    os.path.relpath(yum_repo["primary"], destdir2))
+        self.assertNotEqual(os.stat(yum_repo["primary"]).st_ino,
+                            os.stat(prev_primary).st_ino)
+        with open(prev_primary, "rb") as f:
+            prev_content = f.read()
+        with open(yum_repo["primary"], "wb") as f:
+            f.write(b"rewritten")
+        with open(prev_primary, "rb") as f:
+            self.assertEqual(f.read(), prev_content)
+
+    def test_download_repo_01_fastestmirror_probe_download(self):
+        h = librepo.Handle()
+        r = librepo.Result()
+
+        cache = os.path.join(self.tmpdir, "fastestmirror.cache")
+        h.urls = ["%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH),
+                  "http://localhost:%d/%s" % (self.PORT, config.REPO_YUM_01_PATH)]
+        h.repotype = librepo.LR_YUMREPO
+        h.destdir = self.tmpdir
+        h.fastestmirror = True
+        h.fastestmirrorcache = cache
+        h.fastestmirrorprobesize = 1024
+        h.perform(r)
+
+        self.assertTrue(r.getinfo(librepo.LRR_YUM_REPOMD))
+        with open(cache) as f:
+            content = f.read()
+        self.assertIn("bandwidth=", content)
+        self.assertIn("ttfb=", content)
+
+    def test_download_repo_01_fastestmirror_keep_connections(self):
+        h = librepo.Handle()
+        r = librepo.Result()
+
+        h.urls = ["%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH),
+                  "http://localhost:%d/%s" % (self.PORT, config.REPO_YUM_01_PATH)]
+        h.repotype = librepo.LR_YUMREPO
+        h.destdir = self.tmpdir
+        h.fastestmirror = True
+        h.fastestmirrorkeepconns = True
+        h.perform(r)
+
+        self.assertTrue(r.getinfo(librepo.LRR_YUM_REPOMD))
+
+    def test_download_repo_01_fastestmirror_background(self):
+        h = librepo.Handle()
+        r = librepo.Result()
+
+        cache = os.path.join(self.tmpdir, "fastestmirror.cache")
+        destdir = os.path.join(self.tmpdir, "repo")
+        os.mkdir(destdir)
+        h.urls = ["%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH),
+                  "http://localhost:%d/%s" % (self.PORT, config.REPO_YUM_01_PATH)]
+        h.repotype = librepo.LR_YUMREPO
+        h.destdir = destdir
+        h.fastestmirror = True
+        h.fastestmirrorcache = cache
+        h.fastestmirrorbackground = 1
+        h.perform(r)
+
+        self.assertTrue(r.getinfo(librepo.LRR_YUM_REPOMD))
+
+        # Only one of the unknown mirrors was probed and the cache
+        # is written once the background probe finishes
+        del h
+        with open(cache) as f:
+            content = f.read()
+        self.assertEqual(content.count("connectime="), 1)
+
     def test_download_repo_01_with_missing_file(self):
         h = librepo.Handle()
         r = librepo.Result()
@@ -12,6 +12,7 @@
 
 #include "librepo/util.h"
 #include "librepo/checksum.h"
+#include "librepo/checksum_internal.h"
 #include "librepo/xattr_internal.h"
 
 #include "fixtures.h"
@@ -91,6 +92,33 @@ START_TEST(test_checksum_fd)
 }
 END_TEST
 
+START_TEST(test_checksum_ctx)
+{
+    LrChecksumCtx *ctx;
+    char *checksum;
+    GError *tmp_err = NULL;
+
+    // Data passed by parts
+    ctx = lr_checksum_ctx_new(LR_CHECKSUM_SHA256, &tmp_err);
+    ck_assert_ptr_nonnull(ctx);
+    ck_assert_ptr_null(tmp_err);
+    ck_assert(lr_checksum_ctx_update(ctx, "foo\n", 4, &tmp_err));
+    ck_assert(lr_checksum_ctx_update(ctx, "", 0, &tmp_err));
+    ck_assert(lr_checksum_ctx_update(ctx, "bar\n\n", 5, &tmp_err));
+    checksum = lr_checksum_ctx_final(ctx, &tmp_err);
+    ck_assert_ptr_null(tmp_err);
+    ck_assert_str_eq(checksum, CHKS_VAL_01_SHA256);
+    lr_free(checksum);
+    lr_checksum_ctx_free(ctx);
+
+    // Unknown checksum type
+    ctx = lr_checksum_ctx_new(LR_CHECKSUM_UNKNOWN, &tmp_err);
+    ck_assert_ptr_null(ctx);
+    ck_assert_ptr_nonnull(tmp_err);
+    g_error_free(tmp_err);
+}
+END_TEST
+
 START_TEST(test_cached_checksum_matches)
 {
     FILE *f;
@@ -300,6 +328,7 @@ checksum_suite(void)
     Suite *s = suite_create("checksum");
     TCase *tc = tcase_create("Main");
     tcase_add_test(tc, test_checksum_fd);
+    tcase_add_test(tc, test_checksum_ctx);
     tcase_add_test(tc, test_cached_checksum_matches);
     tcase_add_test(tc, test_cached_checksum_value);
     tcase_add_test(tc, test_cached_checksum_clear);
@@ -7,12 +7,15 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
 
 #include "librepo/librepo.h"
 #include "librepo/rcodes.h"
 #include "librepo/util.h"
 #include "librepo/downloader.h"
 #include "librepo/handle_internal.h"
+#include "librepo/downloader_internal.h"
 
 #include "fixtures.h"
 #include "testsys.h"
@@ -373,6 +376,796 @@ START_TEST(test_downloader_checksum)
 }
 END_TEST
 
+typedef struct {
+    LrHandle *handle;
+    int fd;
+    LrDownloadTarget *added;
+    int done_calls;
+} PipelinedTestData;
+
+static gboolean
+pipelined_done_cb(void *data,
+                  LrDownloadTarget *target,
+                  GSList **new_targets,
+                  G_GNUC_UNUSED GError **err)
+{
+    PipelinedTestData *test_data = data;
+    test_data->done_calls++;
+
+    ck_assert_int_eq(target->rcode, LRE_OK);
+
+    if (!test_data->added) {
+        // Add the dependent target to the running download
+        test_data->added = lr_downloadtarget_new(test_data->handle,
+                                                 "dev/null", NULL,
+                                                 test_data->fd, NULL, NULL,
+                                                 0, 0, NULL, NULL, NULL,
+                                                 NULL, NULL, 0, 0, NULL,
+                                                 FALSE, FALSE);
+        *new_targets = g_slist_append(*new_targets, test_data->added);
+    }
+
+    return TRUE;
+}
+
+START_TEST(test_downloader_pipelined)
+{
+    LrHandle *handle;
+    GSList *list = NULL;
+    GError *err = NULL;
+    int fd1, fd2;
+    char *tmpfn1, *tmpfn2;
+    LrDownloadTarget *t1;
+    GError *tmp_err = NULL;
+    PipelinedTestData test_data;
+
+    // Prepare handle
+
+    handle = lr_handle_init();
+    ck_assert_ptr_nonnull(handle);
+
+    char *urls[] = {"file:///", NULL};
+    ck_assert(lr_handle_setopt(handle, NULL, LRO_URLS, urls));
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &tmp_err);
+    ck_assert_ptr_null(tmp_err);
+
+    // Prepare list of download targets
+
+    tmpfn1 = lr_pathconcat(test_globals.tmpdir, "pipelined_1_XXXXXX", NULL);
+    tmpfn2 = lr_pathconcat(test_globals.tmpdir, "pipelined_2_XXXXXX", NULL);
+
+    fd1 = mkstemp(tmpfn1);
+    fd2 = mkstemp(tmpfn2);
+    g_free(tmpfn1);
+    g_free(tmpfn2);
+    ck_assert_int_ge(fd1, 0);
+    ck_assert_int_ge(fd2, 0);
+
+    t1 = lr_downloadtarget_new(handle, "dev/null", NULL, fd1, NULL, NULL,
+                               0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0, NULL,
+                               FALSE, FALSE);
+    ck_assert_ptr_nonnull(t1);
+
+    list = g_slist_append(list, t1);
+
+    test_data.handle = handle;
+    test_data.fd = fd2;
+    test_data.added = NULL;
+    test_data.done_calls = 0;
+
+    // Download
+
+    ck_assert(lr_download_pipelined(list, FALSE, 1, pipelined_done_cb,
+                                    &test_data, &err));
+    ck_assert_ptr_null(err);
+
+    lr_handle_free(handle);
+
+    // Check results
+
+    ck_assert_ptr_nonnull(test_data.added);
+    ck_assert_int_eq(test_data.done_calls, 2);
+    ck_assert_ptr_null(t1->err);
+    ck_assert_ptr_null(test_data.added->err);
+
+    lr_downloadtarget_free(test_data.added);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    close(fd1);
+    close(fd2);
+}
+END_TEST
+
+typedef struct {
+    LrHandle *handle;
+    int fd;
+    LrDownloadWorks works;
+    LrDownloadTarget *added;
+    int work_calls;
+    int done_calls;
+} WorksTestData;
+
+static gpointer
+works_test_thread(gpointer data)
+{
+    WorksTestData *test_data = data;
+    g_usleep(100000);
+    g_async_queue_push(test_data->works.results, test_data);
+    return NULL;
+}
+
+static void
+works_test_start(WorksTestData *test_data)
+{
+    test_data->works.pending++;
+    g_thread_unref(g_thread_new("works-test", works_test_thread, test_data));
+}
+
+static gboolean
+works_test_work_done_cb(void *data,
+                        void *result,
+                        GSList **new_targets,
+                        G_GNUC_UNUSED GError **err)
+{
+    WorksTestData *test_data = data;
+    ck_assert_ptr_eq(result, test_data);
+
+    if (test_data->work_calls++ == 0) {
+        // The first work brings the only target of the download
+        test_data->added = lr_downloadtarget_new(test_data->handle,
+                                                 "dev/null", NULL,
+                                                 test_data->fd, NULL, NULL,
+                                                 0, 0, NULL, NULL, NULL,
+                                                 NULL, NULL, 0, 0, NULL,
+                                                 FALSE, FALSE);
+        *new_targets = g_slist_append(*new_targets, test_data->added);
+    }
+
+    return TRUE;
+}
+
+static gboolean
+works_test_done_cb(void *data,
+                   LrDownloadTarget *target,
+                   G_GNUC_UNUSED GSList **new_targets,
+                   G_GNUC_UNUSED GError **err)
+{
+    WorksTestData *test_data = data;
+    test_data->done_calls++;
+
+    ck_assert_int_eq(target->rcode, LRE_OK);
+
+    // The download has to wait for this work although nothing
+    // is transferred anymore
+    works_test_start(test_data);
+    return TRUE;
+}
+
+START_TEST(test_downloader_pipelined_works)
+{
+    LrHandle *handle;
+    GError *err = NULL;
+    GError *tmp_err = NULL;
+    char *tmpfn;
+    WorksTestData test_data;
+
+    handle = lr_handle_init();
+    ck_assert_ptr_nonnull(handle);
+
+    char *urls[] = {"file:///", NULL};
+    ck_assert(lr_handle_setopt(handle, NULL, LRO_URLS, urls));
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &tmp_err);
+    ck_assert_ptr_null(tmp_err);
+
+    tmpfn = lr_pathconcat(test_globals.tmpdir, "pipelined_works_XXXXXX", NULL);
+    memset(&test_data, 0, sizeof(test_data));
+    test_data.handle = handle;
+    test_data.fd = mkstemp(tmpfn);
+    g_free(tmpfn);
+    ck_assert_int_ge(test_data.fd, 0);
+    test_data.works.results = g_async_queue_new();
+    test_data.works.donecb = works_test_work_done_cb;
+
+    // No targets yet, they are brought by the work
+    works_test_start(&test_data);
+
+    ck_assert(lr_download_pipelined_works(NULL, FALSE, 1, works_test_done_cb,
+                                          &test_data, &test_data.works,
+                                          &err));
+    ck_assert_ptr_null(err);
+
+    ck_assert_ptr_nonnull(test_data.added);
+    ck_assert_ptr_null(test_data.added->err);
+    ck_assert_int_eq(test_data.done_calls, 1);
+    ck_assert_int_eq(test_data.work_calls, 2);
+    ck_assert_int_eq(test_data.works.pending, 0);
+
+    lr_downloadtarget_free(test_data.added);
+    g_async_queue_unref(test_data.works.results);
+    lr_handle_free(handle);
+    close(test_data.fd);
+}
+END_TEST
+
+typedef struct {
+    GString *data;
+    int end_calls;
+    LrTransferStatus status;
+} DataCbTestData;
+
+static int
+datacb_test_cb(void *clientp, const char *buf, size_t len)
+{
+    DataCbTestData *test_data = clientp;
+    g_string_append_len(test_data->data, buf, len);
+    return LR_CB_OK;
+}
+
+static int
+datacb_test_end_cb(void *clientp,
+                   LrTransferStatus status,
+                   G_GNUC_UNUSED const char *msg)
+{
+    DataCbTestData *test_data = clientp;
+    test_data->end_calls++;
+    test_data->status = status;
+    return LR_CB_OK;
+}
+
+START_TEST(test_downloader_datacb)
+{
+    char *srcfn;
+    int srcfd;
+    char *sha256;
+    GString *content;
+
+    // Prepare the downloaded file
+
+    srcfn = lr_pathconcat(test_globals.tmpdir, "datacb_XXXXXX", NULL);
+    srcfd = mkstemp(srcfn);
+    ck_assert_int_ge(srcfd, 0);
+
+    content = g_string_new(NULL);
+    for (int x = 0; x < 10000; x++)
+        g_string_append_printf(content, "line %d\n", x);
+    ck_assert_int_eq(write(srcfd, content->str, content->len), content->len);
+
+    sha256 = lr_checksum_fd(LR_CHECKSUM_SHA256, srcfd, NULL);
+    ck_assert_ptr_nonnull(sha256);
+    close(srcfd);
+
+    for (int i = 0; i < 2; i++) {
+        LrHandle *handle;
+        GSList *list = NULL;
+        GSList *checksums = NULL;
+        GError *err = NULL;
+        GError *tmp_err = NULL;
+        LrDownloadTarget *t1;
+        DataCbTestData test_data = {g_string_new(NULL), 0, LR_TRANSFER_SUCCESSFUL};
+        const char *expected = i == 0 ? sha256 :
+            "0000000000000000000000000000000000000000000000000000000000000000";
+
+        // Prepare handle
+
+        handle = lr_handle_init();
+        ck_assert_ptr_nonnull(handle);
+
+        char *urls[] = {"file:///", NULL};
+        ck_assert(lr_handle_setopt(handle, NULL, LRO_URLS, urls));
+        lr_handle_prepare_internal_mirrorlist(handle, FALSE, &tmp_err);
+        ck_assert_ptr_null(tmp_err);
+
+        // Target without a file, data go only to the callback
+
+        checksums = g_slist_append(checksums,
+                        lr_downloadtargetchecksum_new(LR_CHECKSUM_SHA256, expected));
+        t1 = lr_downloadtarget_new(handle, srcfn + 1, NULL, -1, NULL, checksums,
+                                   0, 0, NULL, &test_data, datacb_test_end_cb,
+                                   NULL, NULL, 0, 0, NULL, FALSE, FALSE);
+        ck_assert_ptr_nonnull(t1);
+        t1->datacb = datacb_test_cb;
+
+        list = g_slist_append(list, t1);
+
+        // Download
+
+        ck_assert(lr_download(list, FALSE, &err));
+        ck_assert_ptr_null(err);
+
+        lr_handle_free(handle);
+
+        // Check results - the data are passed in both cases,
+        // the end callback tells if they are valid
+
+        ck_assert_int_eq(test_data.data->len, content->len);
+        ck_assert(memcmp(test_data.data->str, content->str, content->len) == 0);
+        ck_assert_int_eq(test_data.end_calls, 1);
+        if (i == 0) {
+            ck_assert_ptr_null(t1->err);
+            ck_assert_int_eq(test_data.status, LR_TRANSFER_SUCCESSFUL);
+        } else {
+            ck_assert_ptr_nonnull(t1->err);
+            ck_assert_int_eq(t1->rcode, LRE_BADCHECKSUM);
+            ck_assert_int_eq(test_data.status, LR_TRANSFER_ERROR);
+        }
+
+        g_string_free(test_data.data, TRUE);
+        g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    }
+
+    g_string_free(content, TRUE);
+    lr_free(sha256);
+    g_free(srcfn);
+}
+END_TEST
+
+typedef struct {
+    LrHandle *handle;
+    int fd;
+    int produced;
+    int released;
+    int failed;
+    int live;
+    int max_live;
+} LazyTestData;
+
+#define LAZY_TEST_TARGETS   50
+#define LAZY_TEST_LOOKAHEAD 4
+
+static gboolean
+lazy_test_producer(void *data,
+                   LrDownloadTarget **target,
+                   G_GNUC_UNUSED GError **err)
+{
+    LazyTestData *test_data = data;
+
+    *target = NULL;
+    if (test_data->produced == LAZY_TEST_TARGETS)
+        return TRUE;
+
+    *target = lr_downloadtarget_new(test_data->handle, "dev/null", NULL,
+                                    test_data->fd, NULL, NULL, 0, 0, NULL,
+                                    NULL, NULL, NULL, NULL, 0, 0, NULL,
+                                    FALSE, FALSE);
+    test_data->produced++;
+    test_data->live++;
+    test_data->max_live = MAX(test_data->max_live, test_data->live);
+    return TRUE;
+}
+
+static gboolean
+lazy_test_release(void *data,
+                  LrDownloadTarget *target,
+                  G_GNUC_UNUSED GError **err)
+{
+    LazyTestData *test_data = data;
+
+    test_data->released++;
+    test_data->live--;
+    if (target->err)
+        test_data->failed++;
+    lr_downloadtarget_free(target);
+    return TRUE;
+}
+
+START_TEST(test_downloader_lazy)
+{
+    LrHandle *handle;
+    GError *err = NULL;
+    GError *tmp_err = NULL;
+    char *tmpfn;
+    LazyTestData test_data = {NULL, -1, 0, 0, 0, 0, 0};
+
+    // Prepare handle
+
+    handle = lr_handle_init();
+    ck_assert_ptr_nonnull(handle);
+
+    char *urls[] = {"file:///", NULL};
+    ck_assert(lr_handle_setopt(handle, NULL, LRO_URLS, urls));
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &tmp_err);
+    ck_assert_ptr_null(tmp_err);
+
+    tmpfn = lr_pathconcat(test_globals.tmpdir, "lazy_XXXXXX", NULL);
+    test_data.fd = mkstemp(tmpfn);
+    g_free(tmpfn);
+    ck_assert_int_ge(test_data.fd, 0);
+    test_data.handle = handle;
+
+    // Download
+
+    ck_assert(lr_download_lazy(lazy_test_producer, lazy_test_release,
+                               &test_data, LAZY_TEST_LOOKAHEAD, FALSE, &err));
+    ck_assert_ptr_null(err);
+
+    lr_handle_free(handle);
+    close(test_data.fd);
+
+    // Check results - every target was released exactly once and
+    // no more than lookahead targets were alive at the same time
+
+    ck_assert_int_eq(test_data.produced, LAZY_TEST_TARGETS);
+    ck_assert_int_eq(test_data.released, LAZY_TEST_TARGETS);
+    ck_assert_int_eq(test_data.failed, 0);
+    ck_assert_int_eq(test_data.live, 0);
+    ck_assert_int_le(test_data.max_live, LAZY_TEST_LOOKAHEAD);
+}
+END_TEST
+
+typedef struct {
+    LrDownloadSession *session;
+    LrDownloadTarget *to_cancel;
+    LrDownloadTarget *to_add;
+    int end_calls;
+    int error_calls;
+} SessionTestData;
+
+static int
+session_test_end_cb(void *clientp,
+                    LrTransferStatus status,
+                    G_GNUC_UNUSED const char *msg)
+{
+    SessionTestData *test_data = clientp;
+
+    test_data->end_calls++;
+    if (status != LR_TRANSFER_SUCCESSFUL) {
+        test_data->error_calls++;
+        return LR_CB_OK;
+    }
+
+    // The first finished target changes the running download
+    if (test_data->to_cancel) {
+        lr_download_session_cancel_target(test_data->session,
+                                          test_data->to_cancel);
+        test_data->to_cancel = NULL;
+    }
+    if (test_data->to_add) {
+        lr_download_session_add_target(test_data->session, test_data->to_add);
+        test_data->to_add = NULL;
+    }
+    return LR_CB_OK;
+}
+
+START_TEST(test_downloader_session)
+{
+    LrHandle *handle;
+    GSList *list = NULL;
+    GError *err = NULL;
+    GError *tmp_err = NULL;
+    char *tmpfn;
+    int fd;
+    LrDownloadTarget *t1, *t2, *t3, *t4;
+    SessionTestData test_data = {NULL, NULL, NULL, 0, 0};
+
+    // Prepare handle, one transfer at a time
+
+    handle = lr_handle_init();
+    ck_assert_ptr_nonnull(handle);
+
+    char *urls[] = {"file:///", NULL};
+    ck_assert(lr_handle_setopt(handle, NULL, LRO_URLS, urls));
+    ck_assert(lr_handle_setopt(handle, NULL, LRO_MAXPARALLELDOWNLOADS, 1L));
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &tmp_err);
+    ck_assert_ptr_null(tmp_err);
+
+    tmpfn = lr_pathconcat(test_globals.tmpdir, "session_XXXXXX", NULL);
+    fd = mkstemp(tmpfn);
+    g_free(tmpfn);
+    ck_assert_int_ge(fd, 0);
+
+    // Prepare targets - t1 and t2 are passed to the download, t3 is added
+    // and t2 cancelled when t1 finishes, t4 is cancelled before the start
+
+    t1 = lr_downloadtarget_new(handle, "dev/null", NULL, fd, NULL, NULL,
+                               0, 0, NULL, &test_data, session_test_end_cb,
+                               NULL, NULL, 0, 0, NULL, FALSE, FALSE);
+    t2 = lr_downloadtarget_new(handle, "dev/null", NULL, fd, NULL, NULL,
+                               0, 0, NULL, &test_data, session_test_end_cb,
+                               NULL, NULL, 0, 0, NULL, FALSE, FALSE);
+    t3 = lr_downloadtarget_new(handle, "dev/null", NULL, fd, NULL, NULL,
+                               0, 0, NULL, &test_data, session_test_end_cb,
+                               NULL, NULL, 0, 0, NULL, FALSE, FALSE);
+    t4 = lr_downloadtarget_new(handle, "dev/null", NULL, fd, NULL, NULL,
+                               0, 0, NULL, &test_data, session_test_end_cb,
+                               NULL, NULL, 0, 0, NULL, FALSE, FALSE);
+    list = g_slist_append(list, t1);
+    list = g_slist_append(list, t2);
+
+    test_data.session = lr_download_session_new();
+    test_data.to_cancel = t2;
+    test_data.to_add = t3;
+
+    lr_download_session_add_target(test_data.session, t4);
+    lr_download_session_cancel_target(test_data.session, t4);
+
+    // Download
+
+    ck_assert(lr_download_session_run(test_data.session, list, FALSE, &err));
+    ck_assert_ptr_null(err);
+
+    lr_download_session_free(test_data.session);
+    lr_handle_free(handle);
+    close(fd);
+
+    // Check results
+
+    ck_assert_ptr_null(t1->err);
+    ck_assert_int_eq(t2->rcode, LRE_CANCELLED);
+    ck_assert_ptr_null(t3->err);
+    ck_assert_int_eq(t4->rcode, LRE_CANCELLED);
+    ck_assert_int_eq(test_data.end_calls, 3);
+    ck_assert_int_eq(test_data.error_calls, 1);
+
+    lr_downloadtarget_free(t3);
+    lr_downloadtarget_free(t4);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+}
+END_TEST
+
+START_TEST(test_downloader_session_cancel_held)
+{
+    LrHandle *handle;
+    GSList *list = NULL;
+    GError *err = NULL;
+    GError *tmp_err = NULL;
+    char *heldfn, *tmpfn;
+    int fd, held_fd;
+    LrDownloadTarget *t1, *t2;
+    SessionTestData test_data = {NULL, NULL, NULL, 0, 0};
+
+    // Prepare handle
+
+    handle = lr_handle_init();
+    ck_assert_ptr_nonnull(handle);
+
+    char *urls[] = {"file:///", NULL};
+    ck_assert(lr_handle_setopt(handle, NULL, LRO_URLS, urls));
+    ck_assert(lr_handle_setopt(handle, NULL, LRO_LOCKTARGETS, 1L));
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &tmp_err);
+    ck_assert_ptr_null(tmp_err);
+
+    tmpfn = lr_pathconcat(test_globals.tmpdir, "session_held_XXXXXX", NULL);
+    fd = mkstemp(tmpfn);
+    g_free(tmpfn);
+    ck_assert_int_ge(fd, 0);
+
+    // The file of t2 is locked as if another process downloaded it,
+    // t2 is held until t1 finishes and cancels it
+
+    heldfn = lr_pathconcat(test_globals.tmpdir, "session_held_target", NULL);
+    held_fd = open(heldfn, O_CREAT|O_RDWR, 0666);
+    ck_assert_int_ge(held_fd, 0);
+    ck_assert_int_eq(flock(held_fd, LOCK_EX), 0);
+
+    t2 = lr_downloadtarget_new(handle, "dev/null", NULL, -1, heldfn, NULL,
+                               0, 0, NULL, &test_data, session_test_end_cb,
+                               NULL, NULL, 0, 0, NULL, FALSE, FALSE);
+    t1 = lr_downloadtarget_new(handle, "dev/null", NULL, fd, NULL, NULL,
+                               0, 0, NULL, &test_data, session_test_end_cb,
+                               NULL, NULL, 0, 0, NULL, FALSE, FALSE);
+    list = g_slist_append(list, t2);
+    list = g_slist_append(list, t1);
+
+    test_data.session = lr_download_session_new();
+    test_data.to_cancel = t2;
+
+    // Download
+
+    ck_assert(lr_download_session_run(test_data.session, list, FALSE, &err));
+    ck_assert_ptr_null(err);
+
+    lr_download_session_free(test_data.session);
+    lr_handle_free(handle);
+    close(held_fd);
+    close(fd);
+    unlink(heldfn);
+    g_free(heldfn);
+
+    // Check results
+
+    ck_assert_ptr_null(t1->err);
+    ck_assert_int_eq(t2->rcode, LRE_CANCELLED);
+    ck_assert_int_eq(test_data.end_calls, 2);
+    ck_assert_int_eq(test_data.error_calls, 1);
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+}
+END_TEST
+
+START_TEST(test_downloader_session_step)
+{
+    LrHandle *handle;
+    LrDownloadSession *session;
+    GSList *list = NULL;
+    GError *err = NULL;
+    GError *tmp_err = NULL;
+    char *tmpfn;
+    int fd;
+    int steps = 0;
+
+    // Prepare handle
+
+    handle = lr_handle_init();
+    ck_assert_ptr_nonnull(handle);
+
+    char *urls[] = {"file:///", NULL};
+    ck_assert(lr_handle_setopt(handle, NULL, LRO_URLS, urls));
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &tmp_err);
+    ck_assert_ptr_null(tmp_err);
+
+    tmpfn = lr_pathconcat(test_globals.tmpdir, "session_step_XXXXXX", NULL);
+    fd = mkstemp(tmpfn);
+    g_free(tmpfn);
+    ck_assert_int_ge(fd, 0);
+
+    for (int x = 0; x < 5; x++) {
+        LrDownloadTarget *target;
+        target = lr_downloadtarget_new(handle, "dev/null", NULL, fd, NULL,
+                                       NULL, 0, 0, NULL, NULL, NULL, NULL,
+                                       NULL, 0, 0, NULL, FALSE, FALSE);
+        list = g_slist_append(list, target);
+    }
+
+    // Drive the download by a simple poll() loop
+
+    session = lr_download_session_new();
+    ck_assert(lr_download_session_start(session, list, FALSE, &err));
+    ck_assert_ptr_null(err);
+
+    while (!lr_download_session_is_finished(session)) {
+        LrDownloadSessionSocket *sockets;
+        long timeout;
+        guint count;
+
+        count = lr_download_session_get_sockets(session, &sockets, &timeout);
+        ck_assert(count > 0 || timeout >= 0);
+
+        struct pollfd *pfds = g_new0(struct pollfd, count + 1);
+        for (guint x = 0; x < count; x++) {
+            pfds[x].fd = sockets[x].fd;
+            if (sockets[x].events & LR_DOWNLOAD_SESSION_POLLIN)
+                pfds[x].events |= POLLIN;
+            if (sockets[x].events & LR_DOWNLOAD_SESSION_POLLOUT)
+                pfds[x].events |= POLLOUT;
+        }
+
+        int ready = poll(pfds, count, timeout < 0 ? 1000 : (int) timeout);
+        ck_assert_int_ge(ready, 0);
+
+        if (ready == 0) {
+            ck_assert(lr_download_session_step(session,
+                            LR_DOWNLOAD_SESSION_TIMEOUT, 0, &err));
+        }
+        for (guint x = 0; x < count && ready > 0; x++) {
+            int events = 0;
+            if (pfds[x].revents & POLLIN)
+                events |= LR_DOWNLOAD_SESSION_POLLIN;
+            if (pfds[x].revents & POLLOUT)
+                events |= LR_DOWNLOAD_SESSION_POLLOUT;
+            if (pfds[x].revents)
+                ck_assert(lr_download_session_step(session, pfds[x].fd,
+                                                   events, &err));
+        }
+        ck_assert_ptr_null(err);
+
+        g_free(pfds);
+        g_free(sockets);
+        ck_assert_int_lt(++steps, 1000);
+    }
+
+    lr_download_session_free(session);
+    lr_handle_free(handle);
+    close(fd);
+
+    // Check results
+
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *target = elem->data;
+        ck_assert_ptr_null(target->err);
+    }
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+}
+END_TEST
+
+static int
+rendezvous_winner(const char **mirrors, int n_mirrors, int skip, const char *path)
+{
+    int winner = -1;
+    guint64 best = 0;
+    for (int x = 0; x < n_mirrors; x++) {
+        if (x == skip)
+            continue;
+        guint64 score = lr_mirror_rendezvous_score(mirrors[x], path);
+        if (winner == -1 || score > best) {
+            winner = x;
+            best = score;
+        }
+    }
+    return winner;
+}
+
+START_TEST(test_downloader_rendezvous_score)
+{
+    const char *mirrors[] = {
+        "http://mirror1.example.com/fedora/",
+        "http://mirror2.example.com/fedora/",
+        "https://mirror3.example.com/pub/fedora/",
+        "ftp://mirror4.example.com/fedora/",
+    };
+    int counts[4] = {0};
+
+    ck_assert(lr_mirror_rendezvous_score(mirrors[0], "a.rpm")
+              == lr_mirror_rendezvous_score(mirrors[0], "a.rpm"));
+    ck_assert(lr_mirror_rendezvous_score("http://a/b", "c")
+              != lr_mirror_rendezvous_score("http://a/", "bc"));
+
+    for (int x = 0; x < 1000; x++) {
+        char path[64];
+        snprintf(path, sizeof(path), "Packages/p/package-%d.rpm", x);
+        int winner = rendezvous_winner(mirrors, 4, -1, path);
+        counts[winner]++;
+
+        // Without the mirror 1, only its paths move
+        int new_winner = rendezvous_winner(mirrors, 4, 1, path);
+        if (winner != 1)
+            ck_assert_int_eq(new_winner, winner);
+    }
+
+    // Paths are spread evenly (250 expected)
+    for (int x = 0; x < 4; x++)
+        ck_assert(counts[x] > 150 && counts[x] < 350);
+}
+END_TEST
+
+#define SPEED_EQ(speed, expected)   (ABS((speed) - (expected)) < 0.001)
+
+START_TEST(test_downloader_transfer_speeds)
+{
+    int repo_a, repo_b; // Only the addresses are used as repo keys
+
+    // Mixed classes of one repo: interactive (4), normal (2)
+    // and background (1) share its LRO_MAXSPEED 700
+    LrTransferSpeed mixed[] = {
+        { &repo_a, 700, 4.0, -1.0 },
+        { &repo_a, 700, 2.0, -1.0 },
+        { &repo_a, 700, 1.0, -1.0 },
+        { NULL,    0,   2.0, -1.0 },    // Unlimited, no handle
+    };
+    lr_transfer_speeds_compute(mixed, 4, 0);
+    ck_assert(SPEED_EQ(mixed[0].speed, 400.0));
+    ck_assert(SPEED_EQ(mixed[1].speed, 200.0));
+    ck_assert(SPEED_EQ(mixed[2].speed, 100.0));
+    ck_assert(SPEED_EQ(mixed[3].speed, 0.0));
+
+    // The same classes share LRO_TOTALMAXSPEED 1400
+    lr_transfer_speeds_compute(mixed, 4, 1400);
+    ck_assert(SPEED_EQ(mixed[0].speed, 400.0));
+    ck_assert(SPEED_EQ(mixed[1].speed, 200.0));
+    ck_assert(SPEED_EQ(mixed[2].speed, 100.0));
+    ck_assert(SPEED_EQ(mixed[3].speed, 700.0));
+
+    // Capped handle: the interactive transfer of the repo A cannot use
+    // more than its LRO_MAXSPEED 100 of its 4/7 share of 1000, the rest
+    // goes to the transfers of the repo B in proportion to their classes
+    LrTransferSpeed capped[] = {
+        { &repo_a, 100, 4.0, -1.0 },
+        { &repo_b, 0,   1.0, -1.0 },
+        { &repo_b, 0,   2.0, -1.0 },
+    };
+    lr_transfer_speeds_compute(capped, 3, 1000);
+    ck_assert(SPEED_EQ(capped[0].speed, 100.0));
+    ck_assert(SPEED_EQ(capped[1].speed, 300.0));
+    ck_assert(SPEED_EQ(capped[2].speed, 600.0));
+
+    // A repo limit higher than the share doesn't cap the transfer
+    capped[0].repo_maxspeed = 5000;
+    lr_transfer_speeds_compute(capped, 3, 700);
+    ck_assert(SPEED_EQ(capped[0].speed, 400.0));
+    ck_assert(SPEED_EQ(capped[1].speed, 100.0));
+    ck_assert(SPEED_EQ(capped[2].speed, 200.0));
+}
+END_TEST
+
 Suite *
 downloader_suite(void)
 {
@@ -384,6 +1177,15 @@ downloader_suite(void)
     tcase_add_test(tc, test_downloader_two_files);
     tcase_add_test(tc, test_downloader_three_files_with_error);
     tcase_add_test(tc, test_downloader_checksum);
+    tcase_add_test(tc, test_downloader_pipelined);
+    tcase_add_test(tc, test_downloader_pipelined_works);
+    tcase_add_test(tc, test_downloader_datacb);
+    tcase_add_test(tc, test_downloader_lazy);
+    tcase_add_test(tc, test_downloader_session);
+    tcase_add_test(tc, test_downloader_session_cancel_held);
+    tcase_add_test(tc, test_downloader_session_step);
+    tcase_add_test(tc, test_downloader_rendezvous_score);
+    tcase_add_test(tc, test_downloader_transfer_speeds);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "librepo/util.h"
+#include "librepo/handle.h"
+#include "librepo/fastestmirror.h"
+#include "librepo/fastestmirrorcache_internal.h"
+
+#include "fixtures.h"
+#include "testsys.h"
+#include "test_fastestmirrorcache.h"
+
+#define MAX_AGE     3600
+
+START_TEST(test_fastestmirrorcache_roundtrip)
+{
+    gboolean ret;
+    GError *tmp_err = NULL;
+    LrFastestMirrorBinCache *cache;
+    LrFastestMirrorCacheRecord record;
+    gint64 ts = g_get_real_time() / 1000000;
+    char *path = lr_pathconcat(test_globals.tmpdir, "fmcache_roundtrip", NULL);
+
+    // Nonexistent cache is empty
+    cache = lr_fastestmirror_bincache_new(path);
+    ret = lr_fastestmirror_bincache_load(cache, &tmp_err);
+    ck_assert(ret);
+    ck_assert_ptr_null(tmp_err);
+    ck_assert(!lr_fastestmirror_bincache_lookup(cache, "http://a", &record));
+
+    // Store a lot of records, so the hash table has to grow
+    for (int x = 0; x < 100; x++) {
+        char *url = g_strdup_printf("http://mirror%d.example.com/", x);
+        LrFastestMirrorCacheRecord new = { ts, x / 100.0, -1.0, 0.0 };
+        lr_fastestmirror_bincache_update(cache, url, &new);
+        g_free(url);
+    }
+    ret = lr_fastestmirror_bincache_write(cache, MAX_AGE, &tmp_err);
+    ck_assert(ret);
+    ck_assert_ptr_null(tmp_err);
+    lr_fastestmirror_bincache_free(cache);
+
+    // Load it again
+    cache = lr_fastestmirror_bincache_new(path);
+    ret = lr_fastestmirror_bincache_load(cache, &tmp_err);
+    ck_assert(ret);
+    ck_assert_ptr_null(tmp_err);
+    for (int x = 0; x < 100; x++) {
+        char *url = g_strdup_printf("http://mirror%d.example.com/", x);
+        ck_assert(lr_fastestmirror_bincache_lookup(cache, url, &record));
+        ck_assert(record.ts == ts);
+        ck_assert(record.connecttime == x / 100.0);
+        ck_assert(record.bandwidth == 0.0);
+        g_free(url);
+    }
+    ck_assert(!lr_fastestmirror_bincache_lookup(cache, "http://mirror100.example.com/", &record));
+    ck_assert(!lr_fastestmirror_bincache_lookup(cache, "http://mirror1.example.com", &record));
+    lr_fastestmirror_bincache_free(cache);
+
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_fastestmirrorcache_concurrent_writers)
+{
+    gboolean ret;
+    GError *tmp_err = NULL;
+    LrFastestMirrorCacheRecord record;
+    gint64 ts = g_get_real_time() / 1000000;
+    char *path = lr_pathconcat(test_globals.tmpdir, "fmcache_concurrent", NULL);
+
+    LrFastestMirrorBinCache *first = lr_fastestmirror_bincache_new(path);
+    LrFastestMirrorBinCache *second = lr_fastestmirror_bincache_new(path);
+    ck_assert(lr_fastestmirror_bincache_load(first, NULL));
+    ck_assert(lr_fastestmirror_bincache_load(second, NULL));
+
+    LrFastestMirrorCacheRecord a = { ts, 0.1, 0.2, 1000.0 };
+    LrFastestMirrorCacheRecord b_old = { ts - 10, 0.5, -1.0, 0.0 };
+    LrFastestMirrorCacheRecord b_new = { ts, 0.3, -1.0, 0.0 };
+    LrFastestMirrorCacheRecord c = { ts, 0.4, -1.0, 0.0 };
+    LrFastestMirrorCacheRecord too_old = { ts - 2 * MAX_AGE, 0.4, -1.0, 0.0 };
+
+    // Both processes loaded the same (empty) cache and measured something
+    lr_fastestmirror_bincache_update(first, "http://a/", &a);
+    lr_fastestmirror_bincache_update(first, "http://b/", &b_new);
+    lr_fastestmirror_bincache_update(second, "http://b/", &b_old);
+    lr_fastestmirror_bincache_update(second, "http://c/", &c);
+    lr_fastestmirror_bincache_update(second, "http://old/", &too_old);
+
+    ret = lr_fastestmirror_bincache_write(first, MAX_AGE, &tmp_err);
+    ck_assert(ret);
+    ck_assert_ptr_null(tmp_err);
+    ret = lr_fastestmirror_bincache_write(second, MAX_AGE, &tmp_err);
+    ck_assert(ret);
+    ck_assert_ptr_null(tmp_err);
+
+    lr_fastestmirror_bincache_free(first);
+    lr_fastestmirror_bincache_free(second);
+
+    // No update is lost and newer records win
+    LrFastestMirrorBinCache *cache = lr_fastestmirror_bincache_new(path);
+    ck_assert(lr_fastestmirror_bincache_load(cache, NULL));
+    ck_assert(lr_fastestmirror_bincache_lookup(cache, "http://a/", &record));
+    ck_assert(record.ttfb == 0.2);
+    ck_assert(record.bandwidth == 1000.0);
+    ck_assert(lr_fastestmirror_bincache_lookup(cache, "http://b/", &record));
+    ck_assert(record.connecttime == 0.3);
+    ck_assert(lr_fastestmirror_bincache_lookup(cache, "http://c/", &record));
+    ck_assert(record.connecttime == 0.4);
+    ck_assert(!lr_fastestmirror_bincache_lookup(cache, "http://old/", &record));
+    lr_fastestmirror_bincache_free(cache);
+
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_fastestmirrorcache_invalid_file)
+{
+    gboolean ret;
+    GError *tmp_err = NULL;
+    LrFastestMirrorCacheRecord record;
+    LrFastestMirrorCacheRecord new = { g_get_real_time() / 1000000, 0.1, -1.0, 0.0 };
+    char *path = lr_pathconcat(test_globals.tmpdir, "fmcache_invalid", NULL);
+
+    // Old text (keyfile) cache
+    ck_assert(g_file_set_contents(path, "[:_librepo_:]\nversion=1\n", -1, NULL));
+
+    LrFastestMirrorBinCache *cache = lr_fastestmirror_bincache_new(path);
+    ret = lr_fastestmirror_bincache_load(cache, &tmp_err);
+    ck_assert(!ret);
+    ck_assert_ptr_nonnull(tmp_err);
+    g_error_free(tmp_err);
+    tmp_err = NULL;
+
+    // The cache is still usable and the file gets replaced
+    ck_assert(!lr_fastestmirror_bincache_lookup(cache, "http://a/", &record));
+    lr_fastestmirror_bincache_update(cache, "http://a/", &new);
+    ret = lr_fastestmirror_bincache_write(cache, MAX_AGE, &tmp_err);
+    ck_assert(ret);
+    ck_assert_ptr_null(tmp_err);
+    ck_assert(lr_fastestmirror_bincache_load(cache, NULL));
+    ck_assert(lr_fastestmirror_bincache_lookup(cache, "http://a/", &record));
+    ck_assert(record.connecttime == 0.1);
+    lr_fastestmirror_bincache_free(cache);
+
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_fastestmirror_more_mirrors_than_probes)
+{
+    gboolean ret;
+    GError *tmp_err = NULL;
+    GSList *mirrors = NULL;
+    GSList *list = NULL;
+    char *urls[] = { "file:///", "http://mirror1.example.com/",
+                     "http://mirror2.example.com/", "http://mirror3.example.com/",
+                     NULL };
+    char *path = lr_pathconcat(test_globals.tmpdir, "fmcache_maxprobes", NULL);
+
+    // Only one probe at once and no time for the others
+    LrHandle *h = lr_handle_init();
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORCACHE, path));
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORMAXPROBES, 1L));
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORTIMEOUT, 0.0));
+
+    for (int x = 0; urls[x]; x++)
+        mirrors = g_slist_append(mirrors, urls[x]);
+
+    ret = lr_fastestmirror_detailed(h, mirrors, &list, &tmp_err);
+    ck_assert(ret);
+    ck_assert_ptr_null(tmp_err);
+    ck_assert_int_eq(g_slist_length(list), 4);
+
+    // Mirrors which never got a probe slot are unknown, not unreachable,
+    // and they are not stored to the cache
+    GKeyFile *keyfile = g_key_file_new();
+    ck_assert(g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, NULL));
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrFastestMirror *mirror = elem->data;
+        if (!g_strcmp0(mirror->url, urls[0]))
+            continue;
+        ck_assert_msg(mirror->unknown, "%s is not unknown", mirror->url);
+        ck_assert(!g_key_file_has_group(keyfile, mirror->url));
+    }
+    g_key_file_free(keyfile);
+
+    g_slist_free_full(list, (GDestroyNotify)lr_lrfastestmirror_free);
+    g_slist_free(mirrors);
+    lr_handle_free(h);
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_fastestmirror_background_record_without_bandwidth)
+{
+    gboolean ret;
+    GError *tmp_err = NULL;
+    GSList *mirrors = NULL;
+    GSList *list = NULL;
+    char *path = lr_pathconcat(test_globals.tmpdir, "fmcache_nobandwidth", NULL);
+    gint64 ts = g_get_real_time() / 1000000;
+
+    // The first mirror has only a (very good) connect time,
+    // the second one was measured by a probe download
+    gchar *content = g_strdup_printf(
+        "[:_librepo_:]\nversion=1\n"
+        "[http://a.example.com/]\nts=%"G_GINT64_FORMAT"\nconnectime=0.001\n"
+        "[http://b.example.com/]\nts=%"G_GINT64_FORMAT"\nconnectime=0.05\n"
+        "ttfb=0.1\nbandwidth=1000000\n", ts, ts);
+    ck_assert(g_file_set_contents(path, content, -1, NULL));
+    g_free(content);
+
+    LrHandle *h = lr_handle_init();
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORCACHE, path));
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORPROBESIZE, 1024L));
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORBACKGROUND, 1L));
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORTIMEOUT, 0.0));
+
+    mirrors = g_slist_append(mirrors, "http://a.example.com/");
+    mirrors = g_slist_append(mirrors, "http://b.example.com/");
+
+    ret = lr_fastestmirror_detailed(h, mirrors, &list, &tmp_err);
+    ck_assert(ret);
+    ck_assert_ptr_null(tmp_err);
+    ck_assert_int_eq(g_slist_length(list), 2);
+
+    // The connect time doesn't beat the measured mirror
+    LrFastestMirror *first = list->data;
+    LrFastestMirror *second = list->next->data;
+    ck_assert_str_eq(first->url, "http://b.example.com/");
+    ck_assert(!first->unknown);
+    ck_assert_str_eq(second->url, "http://a.example.com/");
+    ck_assert(second->unknown);
+
+    g_slist_free_full(list, (GDestroyNotify)lr_lrfastestmirror_free);
+    g_slist_free(mirrors);
+    lr_handle_free(h);  // Waits for the background probe
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+Suite *
+fastestmirrorcache_suite(void)
+{
+    Suite *s = suite_create("fastestmirrorcache");
+    TCase *tc = tcase_create("Main");
+    tcase_add_test(tc, test_fastestmirrorcache_roundtrip);
+    tcase_add_test(tc, test_fastestmirrorcache_concurrent_writers);
+    tcase_add_test(tc, test_fastestmirrorcache_invalid_file);
+    tcase_add_test(tc, test_fastestmirror_more_mirrors_than_probes);
+    tcase_add_test(tc, test_fastestmirror_background_record_without_bandwidth);
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,8 @@
+#ifndef LR_TEST_FASTESTMIRRORCACHE_H
+#define LR_TEST_FASTESTMIRRORCACHE_H
+
+#include <check.h>
+
+Suite *fastestmirrorcache_suite(void);
+
+#endif
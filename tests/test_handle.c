@@ -160,6 +160,150 @@ START_TEST(test_handle_getinfo)
     ck_assert(lr_handle_getinfo(h, NULL, LRI_PROXYAUTHMETHODS, &auth));
     ck_assert(auth == LR_AUTH_BASIC);
 
+    num = -1;
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_ZCKHEADERPREFETCH, &num));
+    ck_assert(num == LRO_ZCKHEADERPREFETCH_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_ZCKHEADERPREFETCH, 65536L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_ZCKHEADERPREFETCH, &num));
+    ck_assert(num == 65536);
+    ck_assert(!lr_handle_setopt(h, NULL, LRO_ZCKHEADERPREFETCH, -1L));
+
+    num = -1;
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_CONDITIONALGET, &num));
+    ck_assert(num == LRO_CONDITIONALGET_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_CONDITIONALGET, 1L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_CONDITIONALGET, &num));
+    ck_assert(num == 1);
+
+    str = NULL;
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_PREVIOUSDESTDIR, &str));
+    ck_assert_ptr_null(str);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_PREVIOUSDESTDIR, "/tmp/previous"));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_PREVIOUSDESTDIR, &str));
+    ck_assert(!strcmp(str, "/tmp/previous"));
+
+    num = -1;
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORMAXPROBES, &num));
+    ck_assert(num == LRO_FASTESTMIRRORMAXPROBES_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORMAXPROBES, 8L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORMAXPROBES, &num));
+    ck_assert(num == 8);
+    ck_assert(!lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORMAXPROBES, 0L));
+
+    num = -1;
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORPROBESIZE, &num));
+    ck_assert(num == LRO_FASTESTMIRRORPROBESIZE_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORPROBESIZE, 65536L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORPROBESIZE, &num));
+    ck_assert(num == 65536);
+    ck_assert(!lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORPROBESIZE, -1L));
+
+    str = NULL;
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORPROBEPATH, &str));
+    ck_assert(!strcmp(str, LRO_FASTESTMIRRORPROBEPATH_DEFAULT));
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORPROBEPATH, "repodata/primary.xml.gz"));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORPROBEPATH, &str));
+    ck_assert(!strcmp(str, "repodata/primary.xml.gz"));
+
+    num = -1;
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORKEEPCONNS, &num));
+    ck_assert(num == LRO_FASTESTMIRRORKEEPCONNS_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORKEEPCONNS, 1L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORKEEPCONNS, &num));
+    ck_assert(num == 1);
+
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORBINARYCACHE, &num));
+    ck_assert(num == LRO_FASTESTMIRRORBINARYCACHE_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORBINARYCACHE, 1L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORBINARYCACHE, &num));
+    ck_assert(num == 1);
+
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORBACKGROUND, &num));
+    ck_assert(num == LRO_FASTESTMIRRORBACKGROUND_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORBACKGROUND, 4L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORBACKGROUND, &num));
+    ck_assert(num == 4);
+    ck_assert(!lr_handle_setopt(h, NULL, LRO_FASTESTMIRRORBACKGROUND, -1L));
+
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_MIRRORSTATS, &num));
+    ck_assert(num == LRO_MIRRORSTATS_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_MIRRORSTATS, 1L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_MIRRORSTATS, &num));
+    ck_assert(num == 1);
+
+    str = NULL;
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_MIRRORSTATSFILE, &str));
+    ck_assert_ptr_null(str);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_MIRRORSTATSFILE, "/tmp/mirrorstats"));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_MIRRORSTATSFILE, &str));
+    ck_assert(!strcmp(str, "/tmp/mirrorstats"));
+
+    num = -1;
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_MAXDOWNLOADSPERHOST, &num));
+    ck_assert(num == LRO_MAXDOWNLOADSPERHOST_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_MAXDOWNLOADSPERHOST, 2L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_MAXDOWNLOADSPERHOST, &num));
+    ck_assert(num == 2);
+    ck_assert(!lr_handle_setopt(h, NULL, LRO_MAXDOWNLOADSPERHOST, -1L));
+
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_PRERESOLVE, &num));
+    ck_assert(num == LRO_PRERESOLVE_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_PRERESOLVE, 1L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_PRERESOLVE, &num));
+    ck_assert(num == 1);
+
+    str = NULL;
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_PRERESOLVECACHE, &str));
+    ck_assert_ptr_null(str);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_PRERESOLVECACHE, "/tmp/resolvecache"));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_PRERESOLVECACHE, &str));
+    ck_assert(!strcmp(str, "/tmp/resolvecache"));
+
+    num = -1;
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_PRERESOLVECACHETTL, &num));
+    ck_assert(num == LRO_PRERESOLVECACHETTL_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_PRERESOLVECACHETTL, 60L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_PRERESOLVECACHETTL, &num));
+    ck_assert(num == 60);
+    ck_assert(!lr_handle_setopt(h, NULL, LRO_PRERESOLVECACHETTL, -1L));
+
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_RANKMIRRORS, &num));
+    ck_assert(num == LRO_RANKMIRRORS_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_RANKMIRRORS, 1L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_RANKMIRRORS, &num));
+    ck_assert(num == 1);
+
+    char *locations[] = {"CZ", "SK", NULL};
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_MIRRORLOCATIONS, &strlist));
+    ck_assert_ptr_null(strlist);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_MIRRORLOCATIONS, locations));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_MIRRORLOCATIONS, &strlist));
+    ck_assert_str_eq(strlist[0], "CZ");
+    ck_assert_str_eq(strlist[1], "SK");
+    ck_assert_ptr_null(strlist[2]);
+    g_strfreev(strlist);
+
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_MIRRORHASHING, &num));
+    ck_assert(num == LRO_MIRRORHASHING_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_MIRRORHASHING, 1L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_MIRRORHASHING, &num));
+    ck_assert(num == 1);
+
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_LOCKTARGETS, &num));
+    ck_assert(num == LRO_LOCKTARGETS_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_LOCKTARGETS, 1L));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_LOCKTARGETS, &num));
+    ck_assert(num == 1);
+
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_SCHEDULEPOLICY, &num));
+    ck_assert(num == LRO_SCHEDULEPOLICY_DEFAULT);
+    ck_assert(lr_handle_setopt(h, NULL, LRO_SCHEDULEPOLICY, (long) LR_SCHEDULE_LONGESTFIRST));
+    ck_assert(lr_handle_getinfo(h, NULL, LRI_SCHEDULEPOLICY, &num));
+    ck_assert(num == LR_SCHEDULE_LONGESTFIRST);
+    ck_assert(!lr_handle_setopt(h, &tmp_err, LRO_SCHEDULEPOLICY, (long) LR_SCHEDULE_SENTINEL));
+    ck_assert(tmp_err);
+    g_clear_error(&tmp_err);
+
     lr_handle_free(h);
 }
 END_TEST
@@ -1,6 +1,9 @@
+#include <string.h>
+
 #include "testsys.h"
 #include "test_lrmirrorlist.h"
 #include "librepo/lrmirrorlist.h"
+#include "librepo/mirrorstats_internal.h"
 
 START_TEST(test_lrmirrorlist_append_url)
 {
@@ -143,11 +146,13 @@ START_TEST(test_lrmirrorlist_append_metalink)
     ck_assert_str_eq(mirror->url, "http://foo");
     ck_assert(mirror->preference == 100);
     ck_assert(mirror->protocol == LR_PROTOCOL_HTTP);
+    ck_assert_str_eq(mirror->location, "CZ");
 
     mirror = lr_lrmirrorlist_nth(iml, 1);
     ck_assert_str_eq(mirror->url, "ftp://bar");
     ck_assert(mirror->preference == 95);
     ck_assert(mirror->protocol == LR_PROTOCOL_FTP);
+    ck_assert_str_eq(mirror->location, "US");
 
     ck_assert(g_slist_length(iml) == 2);
 
@@ -236,6 +241,79 @@ START_TEST(test_lrmirrorlist_append_lrmirrorlist)
 }
 END_TEST
 
+static LrInternalMirrorlist *
+rank_test_mirrorlist(void)
+{
+    static LrMetalinkUrl urls[] = {
+        { .protocol = "http", .type = "http", .location = "CZ",
+          .preference = 100, .url = "http://a/" },
+        { .protocol = "http", .type = "http", .location = "US",
+          .preference = 100, .url = "http://b/" },
+        { .protocol = "http", .type = "http", .location = "DE",
+          .preference = 100, .url = "http://c/" },
+        { .protocol = "http", .type = "http", .location = "US",
+          .preference = 50, .url = "http://d/" },
+    };
+    LrMetalink ml = { .urls = NULL };
+
+    for (int x = G_N_ELEMENTS(urls) - 1; x >= 0; x--)
+        ml.urls = g_slist_prepend(ml.urls, &urls[x]);
+    LrInternalMirrorlist *iml = lr_lrmirrorlist_append_metalink(NULL, &ml, NULL, NULL);
+    g_slist_free(ml.urls);
+    return iml;
+}
+
+static gboolean
+mirrorlist_order_is(LrInternalMirrorlist *iml, const char *order)
+{
+    GString *str = g_string_new(NULL);
+    for (LrInternalMirrorlist *elem = iml; elem; elem = g_slist_next(elem)) {
+        LrInternalMirror *mirror = elem->data;
+        g_string_append_c(str, mirror->url[7]);
+    }
+    gboolean ret = !strcmp(str->str, order);
+    g_string_free(str, TRUE);
+    return ret;
+}
+
+START_TEST(test_lrmirrorlist_rank)
+{
+    LrInternalMirrorlist *iml;
+    char *locations[] = { "de", "US", NULL };
+
+    lr_mirrorstats_clear();
+
+    // Nothing known, the list keeps its order
+    iml = rank_test_mirrorlist();
+    iml = lr_lrmirrorlist_rank(iml, NULL);
+    ck_assert(mirrorlist_order_is(iml, "abcd"));
+    lr_lrmirrorlist_free(iml);
+
+    // Locations first, then the preference
+    iml = rank_test_mirrorlist();
+    iml = lr_lrmirrorlist_rank(iml, locations);
+    ck_assert(mirrorlist_order_is(iml, "cbda"));
+    lr_lrmirrorlist_free(iml);
+
+    // Measured RTT beats the preference, unknown mirrors are
+    // expected to be as fast as the median one
+    lr_mirrorstats_add("http://b/", 1, 0, 0, -1, 0.2);
+    lr_mirrorstats_add("http://d/", 1, 0, 0, -1, 0.05);
+
+    iml = rank_test_mirrorlist();
+    iml = lr_lrmirrorlist_rank(iml, locations);
+    ck_assert(mirrorlist_order_is(iml, "cdba"));
+    lr_lrmirrorlist_free(iml);
+
+    iml = rank_test_mirrorlist();
+    iml = lr_lrmirrorlist_rank(iml, NULL);
+    ck_assert(mirrorlist_order_is(iml, "dabc"));
+    lr_lrmirrorlist_free(iml);
+
+    lr_mirrorstats_clear();
+}
+END_TEST
+
 Suite *
 lrmirrorlist_suite(void)
 {
@@ -245,6 +323,7 @@ lrmirrorlist_suite(void)
     tcase_add_test(tc, test_lrmirrorlist_append_mirrorlist);
     tcase_add_test(tc, test_lrmirrorlist_append_metalink);
     tcase_add_test(tc, test_lrmirrorlist_append_lrmirrorlist);
+    tcase_add_test(tc, test_lrmirrorlist_rank);
     suite_add_tcase(s, tc);
     return s;
 }
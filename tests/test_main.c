@@ -12,11 +12,14 @@
 #include "fixtures.h"
 #include "test_checksum.h"
 #include "test_downloader.h"
+#include "test_fastestmirrorcache.h"
 #include "test_gpg.h"
 #include "test_handle.h"
 #include "test_lrmirrorlist.h"
 #include "test_metalink.h"
 #include "test_mirrorlist.h"
+#include "test_mirrorstats.h"
+#include "test_resolver.h"
 #include "test_package_downloader.h"
 #include "test_repoconf.h"
 #include "test_repomd.h"
@@ -107,11 +110,14 @@ main(int argc, char **argv)
     if (downloading) {
         srunner_add_suite(sr, downloader_suite());
     }
+    srunner_add_suite(sr, fastestmirrorcache_suite());
     srunner_add_suite(sr, gpg_suite());
     srunner_add_suite(sr, handle_suite());
     srunner_add_suite(sr, lrmirrorlist_suite());
     srunner_add_suite(sr, metalink_suite());
     srunner_add_suite(sr, mirrorlist_suite());
+    srunner_add_suite(sr, mirrorstats_suite());
+    srunner_add_suite(sr, resolver_suite());
     srunner_add_suite(sr, package_downloader_suite());
     srunner_add_suite(sr, repoconf_suite());
     srunner_add_suite(sr, repomd_suite());
@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "librepo/util.h"
+#include "librepo/mirrorstats_internal.h"
+
+#include "fixtures.h"
+#include "testsys.h"
+#include "test_mirrorstats.h"
+
+START_TEST(test_mirrorstats_add)
+{
+    LrMirrorStats stats;
+
+    lr_mirrorstats_clear();
+    ck_assert(!lr_mirrorstats_get("http://a/", &stats));
+
+    lr_mirrorstats_add("http://a/", 2, 1, 0, -1, -1.0);
+    lr_mirrorstats_add("http://a/", 1, 0, 2, 8, -1.0);
+    ck_assert(lr_mirrorstats_get("http://a/", &stats));
+    ck_assert(stats.successful_transfers > 2.99);
+    ck_assert(stats.failed_transfers > 0.99);
+    ck_assert_int_eq(stats.allowed_parallel_connections, 2);
+    ck_assert_int_eq(stats.max_ranges, 8);
+    ck_assert(stats.rtt < 0.0);
+    ck_assert(!lr_mirrorstats_get("http://b/", &stats));
+
+    // Round-trip time is smoothed
+    lr_mirrorstats_add("http://c/", 0, 0, 0, -1, 0.1);
+    ck_assert(lr_mirrorstats_get("http://c/", &stats));
+    ck_assert(stats.rtt > 0.099 && stats.rtt < 0.101);
+    lr_mirrorstats_add("http://c/", 0, 0, 0, -1, 0.5);
+    ck_assert(lr_mirrorstats_get("http://c/", &stats));
+    ck_assert(stats.rtt > 0.199 && stats.rtt < 0.201);
+
+    lr_mirrorstats_clear();
+    ck_assert(!lr_mirrorstats_get("http://a/", &stats));
+}
+END_TEST
+
+START_TEST(test_mirrorstats_save_load)
+{
+    GError *tmp_err = NULL;
+    LrMirrorStats stats;
+    char *path = lr_pathconcat(test_globals.tmpdir, "mirrorstats", NULL);
+
+    lr_mirrorstats_clear();
+    lr_mirrorstats_add("http://a/", 0, 3, 1, 0, 0.02);
+    ck_assert(lr_mirrorstats_save(path, &tmp_err));
+    ck_assert_ptr_null(tmp_err);
+
+    // Another process
+    lr_mirrorstats_clear();
+    ck_assert(lr_mirrorstats_load(path, &tmp_err));
+    ck_assert_ptr_null(tmp_err);
+    ck_assert(lr_mirrorstats_get("http://a/", &stats));
+    ck_assert(stats.successful_transfers < 0.01);
+    ck_assert(stats.failed_transfers > 2.99);
+    ck_assert_int_eq(stats.allowed_parallel_connections, 1);
+    ck_assert_int_eq(stats.max_ranges, 0);
+    ck_assert(stats.rtt > 0.019 && stats.rtt < 0.021);
+
+    // Every file is loaded only once
+    ck_assert(lr_mirrorstats_load(path, &tmp_err));
+    ck_assert(lr_mirrorstats_get("http://a/", &stats));
+    ck_assert(stats.failed_transfers < 3.01);
+
+    lr_mirrorstats_clear();
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_mirrorstats_decay)
+{
+    GError *tmp_err = NULL;
+    LrMirrorStats stats;
+    char *path = lr_pathconcat(test_globals.tmpdir, "mirrorstats_old", NULL);
+    gint64 now = g_get_real_time() / 1000000;
+
+    // Counters one half-life old, limits too old to be trusted
+    char *content = g_strdup_printf(
+            "[http://a/]\n"
+            "ts=%" G_GINT64_FORMAT "\n"
+            "successful_transfers=4\n"
+            "failed_transfers=2\n"
+            "limits_ts=%" G_GINT64_FORMAT "\n"
+            "allowed_parallel_connections=1\n"
+            "max_ranges=0\n"
+            "[http://b/]\n"
+            "ts=%" G_GINT64_FORMAT "\n"
+            "failed_transfers=5\n",
+            now - 3600, now - 5 * 3600, now - 100 * 3600);
+    ck_assert(g_file_set_contents(path, content, -1, NULL));
+    g_free(content);
+
+    lr_mirrorstats_clear();
+    ck_assert(lr_mirrorstats_load(path, &tmp_err));
+    ck_assert_ptr_null(tmp_err);
+    ck_assert(lr_mirrorstats_get("http://a/", &stats));
+    ck_assert(stats.successful_transfers > 1.9 && stats.successful_transfers < 2.1);
+    ck_assert(stats.failed_transfers > 0.9 && stats.failed_transfers < 1.1);
+    ck_assert_int_eq(stats.allowed_parallel_connections, 0);
+    ck_assert_int_eq(stats.max_ranges, -1);
+
+    // Forgotten completely
+    ck_assert(!lr_mirrorstats_get("http://b/", &stats));
+
+    lr_mirrorstats_clear();
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+Suite *
+mirrorstats_suite(void)
+{
+    Suite *s = suite_create("mirrorstats");
+    TCase *tc = tcase_create("Main");
+    tcase_add_test(tc, test_mirrorstats_add);
+    tcase_add_test(tc, test_mirrorstats_save_load);
+    tcase_add_test(tc, test_mirrorstats_decay);
+    suite_add_tcase(s, tc);
+    return s;
+}
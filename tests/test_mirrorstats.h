@@ -0,0 +1,8 @@
+#ifndef LR_TEST_MIRRORSTATS_H
+#define LR_TEST_MIRRORSTATS_H
+
+#include <check.h>
+
+Suite *mirrorstats_suite(void);
+
+#endif
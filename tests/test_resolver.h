@@ -0,0 +1,8 @@
+#ifndef LR_TEST_RESOLVER_H
+#define LR_TEST_RESOLVER_H
+
+#include <check.h>
+
+Suite *resolver_suite(void);
+
+#endif
@@ -9,6 +9,7 @@
 
 #include "librepo/rcodes.h"
 #include "librepo/util.h"
+#include "librepo/yum_internal.h"
 
 #include "fixtures.h"
 #include "testsys.h"
@@ -267,6 +268,51 @@ START_TEST(test_prepend_url_protocol)
 }
 END_TEST
 
+START_TEST(test_yum_copy_file_content_fallback)
+{
+    char *srcfn, *dstfn;
+    int src_fd, dst_fd;
+    GString *content;
+    gchar *copied = NULL;
+    gsize copied_len = 0;
+
+    srcfn = lr_pathconcat(test_globals.tmpdir, "copy_src_XXXXXX", NULL);
+    dstfn = lr_pathconcat(test_globals.tmpdir, "copy_dst_XXXXXX", NULL);
+    src_fd = mkstemp(srcfn);
+    ck_assert_int_ge(src_fd, 0);
+    dst_fd = mkstemp(dstfn);
+    ck_assert_int_ge(dst_fd, 0);
+    close(dst_fd);
+
+    content = g_string_new(NULL);
+    for (int x = 0; x < 10000; x++)
+        g_string_append_printf(content, "line %d\n", x);
+    ck_assert_int_eq(write(src_fd, content->str, content->len), content->len);
+
+    // The source offset is in the middle, the whole source has to be
+    // copied anyway. copy_file_range() refuses a destination opened with
+    // O_APPEND, so the read/write fallback is used.
+    ck_assert_int_eq(lseek(src_fd, content->len / 2, SEEK_SET), content->len / 2);
+    dst_fd = open(dstfn, O_WRONLY | O_APPEND);
+    ck_assert_int_ge(dst_fd, 0);
+
+    ck_assert(lr_yum_copy_file_content(src_fd, dst_fd));
+    close(src_fd);
+    close(dst_fd);
+
+    ck_assert(g_file_get_contents(dstfn, &copied, &copied_len, NULL));
+    ck_assert_int_eq(copied_len, content->len);
+    ck_assert(memcmp(copied, content->str, content->len) == 0);
+
+    g_free(copied);
+    g_string_free(content, TRUE);
+    unlink(srcfn);
+    unlink(dstfn);
+    g_free(srcfn);
+    g_free(dstfn);
+}
+END_TEST
+
 
 Suite *
 util_suite(void)
@@ -284,6 +330,7 @@ util_suite(void)
     tcase_add_test(tc, test_strv_dup);
     tcase_add_test(tc, test_is_local_path);
     tcase_add_test(tc, test_prepend_url_protocol);
+    tcase_add_test(tc, test_yum_copy_file_content_fallback);
     suite_add_tcase(s, tc);
     return s;
 }